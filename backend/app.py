@@ -112,6 +112,12 @@ def process_video():
         feature = data['feature']
         openmp_threads = int(data['openmp_threads'])
         pthread_threads = int(data['pthread_threads'])
+        # Higher runs first when jobs wait for cores
+        priority = int(data.get('priority', 0))
+        # 'throughput' runs the three versions at once on disjoint cores
+        mode = data.get('mode', 'benchmark')
+        if mode not in ('benchmark', 'throughput'):
+            return jsonify({'error': f'Invalid mode: {mode}'}), 400
         
         # Validate feature
         feature_ids = [f['id'] for f in FEATURES]
@@ -151,20 +157,27 @@ def process_video():
             input_video, 
             output_dir,
             pthread_threads,
-            openmp_threads
+            openmp_threads,
+            priority,
+            mode
         )
         
         print(f"[API] process_video() called successfully for job {job_id}")
         
         return jsonify({
             'job_id': job_id,
-            'status': 'processing',
-            'message': 'Video processing started'
+            'status': 'queued',
+            'message': 'Video processing queued'
         }), 200
     
     except Exception as e:
         return jsonify({'error': f'Processing failed: {str(e)}'}), 500
 
+@app.route('/api/scheduler', methods=['GET'])
+def get_scheduler():
+    """Core budget, running jobs with their CPUs and the queue"""
+    return jsonify(video_processor.scheduler.status())
+
 @app.route('/api/status/<job_id>', methods=['GET'])
 def get_status(job_id):
     """Get job status"""
@@ -185,7 +198,9 @@ def get_results(job_id):
         if status['status'] != 'completed':
             return jsonify({
                 'status': status['status'],
-                'message': status.get('message', 'Processing not complete')
+                'message': status.get('message', 'Processing not complete'),
+                'progress': status.get('progress', 0),
+                'live': status.get('live')
             }), 200
         
         # Get input video path
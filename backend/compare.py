@@ -0,0 +1,470 @@
+#!/usr/bin/env python3
+"""Output comparison across the sequential, pthread and OpenMP versions
+
+Decodes the outputs frame by frame against a reference and reports, per output, how
+many frames match exactly, the largest pixel difference, PSNR, SSIM and the first
+frame that differs. Each algorithm has a tolerance (TOLERANCES, exact unless listed);
+the exit code is 1 when any output is outside it, so the check can gate changes.
+
+Usage:
+    # build the three versions, run them at several thread counts and compare
+    python compare.py run gaussian_blur input_videos/sample.mp4 --threads 1,3,8
+
+    # compare existing outputs against the first one
+    python compare.py files ref.y4m other.y4m [more...] [--size WxH] [--feature NAME]
+
+    # run filter chains with operator fusion against the same chains without it
+    python compare.py fusion input_videos/sample.mp4 [--chain a,b,c ...] [--threads 4]
+
+'run' writes raw frames (--output-format raw), so nothing is lost to an encoder and
+the sequential output is the reference. Y4M files are read directly; other videos go
+through OpenCV, which is fine for PSNR/SSIM but not for exact matches after lossy
+encoding. Raw files need --size (their channel count follows from the file size).
+Scene detection writes a text report instead; its detected scene changes must match.
+'fusion' runs build/filter_chain with --fuse 1 (in frame and pipeline mode) and --fuse 0,
+both to raw frames, and requires identical frames: fused stages must reproduce the
+filters run one by one (src/13_filter_chain/chain_fusion.hpp).
+"""
+import argparse
+import json
+import math
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import numpy as np
+
+sys.path.append(os.path.dirname(__file__))
+
+from utils.parser import load_metrics_json
+from utils.video_processor import FEATURE_MAP
+
+try:
+    import cv2
+    OPENCV_AVAILABLE = True
+except ImportError:
+    OPENCV_AVAILABLE = False
+
+PROJECT_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), '..'))
+
+# Accepted differences from the reference per algorithm. 'luma' compares brightness
+# only (for outputs that differ in channel layout), 'max_diff' bounds the largest
+# per-sample difference, 'min_psnr' (dB) and 'min_ssim' bound every frame.
+DEFAULT_TOLERANCE = {'luma': False, 'max_diff': 0, 'min_psnr': None, 'min_ssim': None}
+TOLERANCES = {
+    # Sequential writes 3-channel gray from cvtColor, the parallel versions 1-channel
+    # gray from integer weights: compare brightness, allow rounding
+    'grayscale': {'luma': True, 'max_diff': 1},
+}
+
+# Chains for 'fusion': every kind of fused stage, and band kernels of both halo sizes
+FUSION_CHAINS = [
+    # two banded stages: blur (7 halo rows) then sharpen (2)
+    'gaussian_blur,frame_sharpening',
+    # prologue table with statistics, band kernel, epilogue table
+    'white_balance,brightness_contrast,frame_sharpening,contrast_enhancement',
+    # one composed table; the statistics of light-up and white balance come from it
+    'brightness_contrast,contrast_enhancement,lightup,white_balance',
+    # statistics filter after a band kernel starts a new stage
+    'lightup,gaussian_blur,brightness_contrast,white_balance',
+]
+
+def tolerance_for(feature):
+    tolerance = dict(DEFAULT_TOLERANCE)
+    tolerance.update(TOLERANCES.get(feature, {}))
+    return tolerance
+
+# ---------------------------------------------------------------------------
+# Frame readers. A frame is an HxW (gray) or HxWx3 (BGR) array, or a tuple of Y, U, V
+# planes for color Y4M.
+
+def read_y4m(path):
+    with open(path, 'rb') as f:
+        header = f.readline().decode('ascii').split()
+        if not header or header[0] != 'YUV4MPEG2':
+            raise ValueError(f"{path}: not a Y4M file")
+        params = {token[0]: token[1:] for token in header[1:]}
+        width, height = int(params['W']), int(params['H'])
+        chroma = params.get('C', '420')
+        if chroma.startswith('mono'):
+            plane_sizes = [(height, width)]
+        elif chroma.startswith('444'):
+            plane_sizes = [(height, width)] * 3
+        else:
+            plane_sizes = [(height, width)] + [((height + 1) // 2, (width + 1) // 2)] * 2
+        frame_bytes = sum(h * w for h, w in plane_sizes)
+        while True:
+            line = f.readline()
+            if not line:
+                return
+            if not line.startswith(b'FRAME'):
+                raise ValueError(f"{path}: bad frame header")
+            data = f.read(frame_bytes)
+            if len(data) < frame_bytes:
+                return
+            planes = []
+            offset = 0
+            for h, w in plane_sizes:
+                planes.append(np.frombuffer(data, np.uint8, h * w, offset).reshape(h, w))
+                offset += h * w
+            yield planes[0] if len(planes) == 1 else tuple(planes)
+
+def read_raw(path, width, height, frames=None):
+    size = os.path.getsize(path)
+    if frames:
+        channels = size // (width * height * frames)
+    else:
+        channels = 3 if size % (width * height * 3) == 0 else 1
+    if channels not in (1, 3):
+        raise ValueError(f"{path}: size does not match {width}x{height} frames")
+    frame_bytes = width * height * channels
+    with open(path, 'rb') as f:
+        while True:
+            data = f.read(frame_bytes)
+            if len(data) < frame_bytes:
+                return
+            frame = np.frombuffer(data, np.uint8)
+            yield frame.reshape(height, width) if channels == 1 else frame.reshape(height, width, 3)
+
+def read_video(path):
+    if not OPENCV_AVAILABLE:
+        raise RuntimeError("OpenCV is needed to decode " + path)
+    cap = cv2.VideoCapture(path)
+    if not cap.isOpened():
+        raise ValueError(f"Cannot open {path}")
+    try:
+        while True:
+            ok, frame = cap.read()
+            if not ok:
+                return
+            yield frame
+    finally:
+        cap.release()
+
+def read_frames(path, size=None, frames=None):
+    if path.endswith('.y4m'):
+        return read_y4m(path)
+    if path.endswith('.raw') or path.endswith('.rgb') or path.endswith('.yuv'):
+        if not size:
+            raise ValueError(f"{path}: raw frames need --size WxH")
+        return read_raw(path, size[0], size[1], frames)
+    return read_video(path)
+
+def video_size(path):
+    """Frame size of an input clip (Y4M header, else OpenCV)"""
+    if path.endswith('.y4m'):
+        with open(path, 'rb') as f:
+            params = {t[0]: t[1:] for t in f.readline().decode('ascii').split()[1:]}
+        return int(params['W']), int(params['H'])
+    cap = cv2.VideoCapture(path)
+    size = (int(cap.get(cv2.CAP_PROP_FRAME_WIDTH)), int(cap.get(cv2.CAP_PROP_FRAME_HEIGHT)))
+    cap.release()
+    return size
+
+# ---------------------------------------------------------------------------
+# Per-frame measures
+
+def luma(frame):
+    if isinstance(frame, tuple):
+        return frame[0]
+    if frame.ndim == 3:
+        # BT.601 weights, as COLOR_BGR2GRAY
+        bgr = frame.astype(np.int32)
+        return ((bgr[..., 2] * 299 + bgr[..., 1] * 587 + bgr[..., 0] * 114 + 500) // 1000).astype(np.uint8)
+    return frame
+
+def samples(frame):
+    if isinstance(frame, tuple):
+        return np.concatenate([plane.ravel() for plane in frame])
+    return frame.ravel()
+
+def same_layout(a, b):
+    if isinstance(a, tuple) != isinstance(b, tuple):
+        return False
+    if isinstance(a, tuple):
+        return all(x.shape == y.shape for x, y in zip(a, b))
+    return a.shape == b.shape
+
+def psnr(a, b):
+    mse = np.mean((a.astype(np.float64) - b.astype(np.float64)) ** 2)
+    return math.inf if mse == 0 else 10 * math.log10(255.0 * 255.0 / mse)
+
+def ssim(a, b):
+    """Mean SSIM of two gray images (11x11 Gaussian window, sigma 1.5)"""
+    if not OPENCV_AVAILABLE:
+        return None
+    c1, c2 = (0.01 * 255) ** 2, (0.03 * 255) ** 2
+    a = a.astype(np.float64)
+    b = b.astype(np.float64)
+    blur = lambda x: cv2.GaussianBlur(x, (11, 11), 1.5)
+    mu_a, mu_b = blur(a), blur(b)
+    var_a = blur(a * a) - mu_a * mu_a
+    var_b = blur(b * b) - mu_b * mu_b
+    cov = blur(a * b) - mu_a * mu_b
+    value = ((2 * mu_a * mu_b + c1) * (2 * cov + c2)) / ((mu_a ** 2 + mu_b ** 2 + c1) * (var_a + var_b + c2))
+    return float(value.mean())
+
+def compare_videos(reference, candidate, tolerance):
+    """Frame-by-frame comparison of two frame iterators"""
+    result = {
+        'frames': 0, 'reference_frames': 0, 'candidate_frames': 0, 'exact_frames': 0,
+        'max_diff': 0, 'min_psnr': math.inf, 'mean_psnr': None, 'min_ssim': None,
+        'first_divergent_frame': None, 'first_failing_frame': None, 'compared': None
+    }
+    psnr_sum = 0.0
+    finite = 0
+    ref_iter, cand_iter = iter(reference), iter(candidate)
+    while True:
+        ref = next(ref_iter, None)
+        cand = next(cand_iter, None)
+        if ref is not None:
+            result['reference_frames'] += 1
+        if cand is not None:
+            result['candidate_frames'] += 1
+        if ref is None or cand is None:
+            # Count what is left on the longer side
+            for _ in (ref_iter if ref is not None else cand_iter):
+                result['reference_frames' if ref is not None else 'candidate_frames'] += 1
+            break
+
+        index = result['frames']
+        result['frames'] += 1
+        if tolerance['luma'] or not same_layout(ref, cand):
+            a, b = luma(ref), luma(cand)
+            result['compared'] = 'luma'
+        else:
+            a, b = samples(ref), samples(cand)
+            result['compared'] = 'all'
+        if a.shape != b.shape:
+            raise ValueError(f"frame {index}: size {a.shape} vs {b.shape}")
+
+        diff = int(np.max(np.abs(a.astype(np.int16) - b.astype(np.int16)))) if a.size else 0
+        frame_psnr = psnr(a, b)
+        frame_ssim = ssim(luma(ref), luma(cand)) if diff else (1.0 if OPENCV_AVAILABLE else None)
+        if diff == 0:
+            result['exact_frames'] += 1
+        elif result['first_divergent_frame'] is None:
+            result['first_divergent_frame'] = index
+        result['max_diff'] = max(result['max_diff'], diff)
+        result['min_psnr'] = min(result['min_psnr'], frame_psnr)
+        if math.isfinite(frame_psnr):
+            psnr_sum += frame_psnr
+            finite += 1
+        if frame_ssim is not None:
+            result['min_ssim'] = frame_ssim if result['min_ssim'] is None else min(result['min_ssim'], frame_ssim)
+
+        # Within tolerance: small enough differences, or quality above the thresholds
+        # where the algorithm has them
+        passing = diff <= tolerance['max_diff']
+        if not passing and (tolerance['min_psnr'] is not None or tolerance['min_ssim'] is not None):
+            passing = ((tolerance['min_psnr'] is None or frame_psnr >= tolerance['min_psnr']) and
+                       (tolerance['min_ssim'] is None or (frame_ssim is not None and frame_ssim >= tolerance['min_ssim'])))
+        failing = not passing
+        if failing and result['first_failing_frame'] is None:
+            result['first_failing_frame'] = index
+
+    result['mean_psnr'] = round(psnr_sum / finite, 3) if finite else (math.inf if result['frames'] else None)
+    result['passed'] = (result['first_failing_frame'] is None and result['frames'] > 0
+                        and result['reference_frames'] == result['candidate_frames'])
+    return result
+
+def scene_changes(path):
+    """(frame, timestamp) of every detected scene change in a scene detection report"""
+    changes = []
+    in_table = False
+    with open(path, 'r') as f:
+        for line in f:
+            if line.startswith('-----'):
+                in_table = True
+            elif in_table and line.strip():
+                fields = line.split()
+                changes.append((int(fields[0]), fields[1]))
+    return changes
+
+def compare_reports(reference_path, candidate_path):
+    reference, candidate = scene_changes(reference_path), scene_changes(candidate_path)
+    first = next((i for i, (a, b) in enumerate(zip(reference, candidate)) if a != b), None)
+    if first is None and len(reference) != len(candidate):
+        first = min(len(reference), len(candidate))
+    return {
+        'reference_scene_changes': len(reference),
+        'candidate_scene_changes': len(candidate),
+        'first_divergent_change': first,
+        'passed': first is None
+    }
+
+# ---------------------------------------------------------------------------
+
+def format_value(value, digits=2):
+    if value is None:
+        return '-'
+    if isinstance(value, float):
+        return 'inf' if math.isinf(value) else f"{value:.{digits}f}"
+    return str(value)
+
+def print_result(name, result):
+    status = 'PASS' if result['passed'] else 'FAIL'
+    if 'reference_scene_changes' in result:
+        print(f"  {status} {name}: {result['candidate_scene_changes']}/{result['reference_scene_changes']} scene changes, "
+              f"first difference at change {format_value(result['first_divergent_change'])}")
+        return
+    print(f"  {status} {name}: {result['exact_frames']}/{result['frames']} frames exact ({result['compared']}), "
+          f"max diff {result['max_diff']}, PSNR min {format_value(result['min_psnr'])} mean {format_value(result['mean_psnr'])} dB, "
+          f"SSIM min {format_value(result['min_ssim'], 4)}, first divergent frame {format_value(result['first_divergent_frame'])}")
+    if result['reference_frames'] != result['candidate_frames']:
+        print(f"       frame count differs: {result['candidate_frames']} vs {result['reference_frames']} in the reference")
+
+def find_executable(build_dir, program):
+    for name in (f'{program}.exe', program):
+        path = os.path.join(build_dir, name)
+        if os.path.exists(path):
+            return path
+    return None
+
+def run_variants(args):
+    """Run every version into a scratch directory and compare against sequential"""
+    is_report = args.feature == 'scene_detection'
+    scratch = tempfile.mkdtemp(prefix='compare_')
+    outputs = []
+    try:
+        configs = [('sequential', None)]
+        for variant in args.variants.split(','):
+            for threads in args.threads.split(','):
+                configs.append((variant.strip(), int(threads)))
+        for variant, threads in configs:
+            exe = find_executable(args.build_dir, f'{args.feature}_{variant}')
+            if not exe:
+                print(f"Error: {args.feature}_{variant} not found in {args.build_dir} (build it with compile.ps1)")
+                return None, 1
+            name = variant if threads is None else f'{variant}_{threads}'
+            output = os.path.join(scratch, name + ('.txt' if is_report else '.raw'))
+            metrics_path = os.path.join(scratch, name + '.metrics.json')
+            command = [exe, args.video] + ([] if threads is None else [str(threads)]) + [output, '--metrics-json', metrics_path]
+            if not is_report:
+                command += ['--output-format', 'raw']
+            print(f"[Compare] Running {name}")
+            result = subprocess.run(command, cwd=PROJECT_ROOT, capture_output=True, text=True, timeout=args.timeout)
+            if result.returncode != 0:
+                print(f"Error: {name} failed: {(result.stderr or result.stdout)[-500:]}")
+                return None, 1
+            record = load_metrics_json(metrics_path) or {}
+            outputs.append((name, output, record.get('frames')))
+
+        results = {}
+        ref_name, ref_path, ref_frames = outputs[0]
+        size = None if is_report else video_size(args.video)
+        print(f"\nReference: {ref_name}")
+        for name, path, frames in outputs[1:]:
+            if is_report:
+                results[name] = compare_reports(ref_path, path)
+            else:
+                results[name] = compare_videos(read_raw(ref_path, size[0], size[1], ref_frames),
+                                               read_raw(path, size[0], size[1], frames), tolerance_for(args.feature))
+            print_result(name, results[name])
+        return results, 0
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+
+def run_fusion(args):
+    """Run each chain with --fuse 1 and --fuse 0 and compare the raw frames exactly"""
+    exe = find_executable(args.build_dir, 'filter_chain')
+    if not exe:
+        print(f"Error: filter_chain not found in {args.build_dir} (build it with compile.ps1)")
+        return None, 1
+    size = video_size(args.video)
+    scratch = tempfile.mkdtemp(prefix='fusion_')
+    results = {}
+    try:
+        for c, chain in enumerate(args.chain or FUSION_CHAINS):
+            outputs = []
+            for name, extra in (('unfused', ['--mode', 'frame', '--fuse', '0']),
+                                ('fused frame', ['--mode', 'frame', '--fuse', '1']),
+                                ('fused pipeline', ['--mode', 'pipeline', '--fuse', '1'])):
+                output = os.path.join(scratch, f'{c}_{name.replace(" ", "_")}.raw')
+                metrics_path = output + '.metrics.json'
+                command = [exe, args.video, str(args.threads), output, '--filters', chain,
+                           '--output-format', 'raw', '--metrics-json', metrics_path] + extra
+                print(f"[Compare] Running {chain} ({name})")
+                result = subprocess.run(command, cwd=PROJECT_ROOT, capture_output=True, text=True, timeout=args.timeout)
+                if result.returncode != 0:
+                    print(f"Error: {chain} ({name}) failed: {(result.stderr or result.stdout)[-500:]}")
+                    return None, 1
+                record = load_metrics_json(metrics_path) or {}
+                outputs.append((name, output, record.get('frames')))
+
+            ref_name, ref_path, ref_frames = outputs[0]
+            print(f"\n{chain}, reference: {ref_name}")
+            for name, path, frames in outputs[1:]:
+                key = f'{chain} ({name})'
+                results[key] = compare_videos(read_raw(ref_path, size[0], size[1], ref_frames),
+                                              read_raw(path, size[0], size[1], frames), tolerance_for(None))
+                print_result(key, results[key])
+        return results, 0
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+
+def compare_files(args):
+    size = tuple(int(v) for v in args.size.lower().split('x')) if args.size else None
+    reference = args.outputs[0]
+    results = {}
+    print(f"Reference: {reference}")
+    for path in args.outputs[1:]:
+        if reference.endswith('.txt'):
+            results[path] = compare_reports(reference, path)
+        else:
+            results[path] = compare_videos(read_frames(reference, size), read_frames(path, size), tolerance_for(args.feature))
+        print_result(path, results[path])
+    return results, 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare the outputs of the sequential, pthread and OpenMP versions')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    run = commands.add_parser('run', help='run every version and compare against sequential')
+    run.add_argument('feature', choices=sorted(FEATURE_MAP.keys()))
+    run.add_argument('video')
+    run.add_argument('--threads', default='1,3,8', help='thread counts of the parallel versions')
+    run.add_argument('--variants', default='pthread,openmp')
+    run.add_argument('--build-dir', default=os.path.join(PROJECT_ROOT, 'build'))
+    run.add_argument('--timeout', type=int, default=1800)
+    run.add_argument('--json', help='also write the results to this file')
+
+    files = commands.add_parser('files', help='compare existing outputs against the first one')
+    files.add_argument('outputs', nargs='+')
+    files.add_argument('--size', help='WxH of raw files')
+    files.add_argument('--feature', default=None, help='use this algorithm\'s tolerance')
+    files.add_argument('--json', help='also write the results to this file')
+
+    fusion = commands.add_parser('fusion', help='run filter chains with and without operator fusion and compare')
+    fusion.add_argument('video')
+    fusion.add_argument('--chain', action='append', help='comma-separated filters (repeatable, default: FUSION_CHAINS)')
+    fusion.add_argument('--threads', type=int, default=4)
+    fusion.add_argument('--build-dir', default=os.path.join(PROJECT_ROOT, 'build'))
+    fusion.add_argument('--timeout', type=int, default=1800)
+    fusion.add_argument('--json', help='also write the results to this file')
+
+    args = parser.parse_args()
+    if args.command == 'run':
+        results, code = run_variants(args)
+    elif args.command == 'fusion':
+        results, code = run_fusion(args)
+    else:
+        if len(args.outputs) < 2:
+            parser.error('need a reference and at least one output')
+        results, code = compare_files(args)
+    if results is None:
+        return code
+
+    if args.json:
+        # Identical frames have infinite PSNR, written as null
+        finite = lambda v: None if isinstance(v, float) and math.isinf(v) else v
+        with open(args.json, 'w') as f:
+            json.dump({name: {k: finite(v) for k, v in result.items()} for name, result in results.items()}, f, indent=2)
+    failed = [name for name, result in results.items() if not result['passed']]
+    print(f"\n{len(results) - len(failed)}/{len(results)} outputs within tolerance")
+    return 1 if failed else code
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,274 @@
+#!/usr/bin/env python3
+"""Thread-scaling sweep: run one algorithm's three versions over a range of thread counts
+
+For every configuration (sequential, then pthread and OpenMP at each thread count) the
+program is run a few times after some warm-up runs, and the median and p95 of the
+times it reports through --metrics-json are kept. From the medians come the speedup
+and efficiency against the sequential version, the Karp-Flatt serial fraction of every
+point, and a least-squares fit of the serial fraction per variant under Amdahl's law
+(fixed problem size, speedup limit 1/s) and Gustafson's law (for comparison).
+
+With --huge-pages MODE every configuration is run twice, on normal pages and with
+--huge-pages MODE (src/common/huge_pages.hpp), both with hardware counters, and the
+report compares their FPS and data TLB misses per frame.
+
+Usage:
+    python sweep.py gaussian_blur input_videos/sample.mp4 --threads 1,2,4,8,16 --runs 5
+    python sweep.py lightup clip.y4m --null-output --report results/lightup_sweep -- --decode-threads 2
+    python sweep.py gaussian_blur clip_4k.mp4 --threads 8 --huge-pages thp
+
+Writes <report>.csv (one row per configuration) and <report>.json (rows plus fits).
+The executables must have been built with compile.ps1 first.
+"""
+import argparse
+import csv
+import json
+import math
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.append(os.path.dirname(__file__))
+
+from utils.parser import parse_execution_output, calculate_speedup, calculate_efficiency
+from utils.video_processor import FEATURE_MAP
+
+PROJECT_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), '..'))
+
+def find_executable(build_dir, program):
+    """build/<program>.exe, or without the extension for non-Windows builds"""
+    for name in (f'{program}.exe', program):
+        path = os.path.join(build_dir, name)
+        if os.path.exists(path):
+            return path
+    return None
+
+def percentile(values, p):
+    """Linear-interpolated percentile of a non-empty list"""
+    ordered = sorted(values)
+    pos = (len(ordered) - 1) * p / 100.0
+    low = int(math.floor(pos))
+    high = min(low + 1, len(ordered) - 1)
+    return ordered[low] + (ordered[high] - ordered[low]) * (pos - low)
+
+def run_once(exe_path, args, metrics_path, timeout):
+    """Run the program once; returns its parsed metrics (time falls back to wall clock)"""
+    if os.path.exists(metrics_path):
+        os.remove(metrics_path)
+    start = time.perf_counter()
+    result = subprocess.run([exe_path] + args + ['--metrics-json', metrics_path],
+                            cwd=PROJECT_ROOT, capture_output=True, text=True, timeout=timeout)
+    wall = time.perf_counter() - start
+    if result.returncode != 0:
+        raise RuntimeError(f"{os.path.basename(exe_path)} failed ({result.returncode}): {(result.stderr or result.stdout)[-500:]}")
+    metrics = parse_execution_output(result.stdout + result.stderr, metrics_path)
+    if metrics['execution_time'] is None:
+        metrics['execution_time'] = wall
+    return metrics
+
+def run_config(exe_path, args, metrics_path, warmup, runs, timeout):
+    """Warm-up runs (discarded), then 'runs' timed runs summarized into one row"""
+    for _ in range(warmup):
+        run_once(exe_path, args, metrics_path, timeout)
+    times = []
+    tlb_misses = []
+    frames = None
+    for _ in range(runs):
+        metrics = run_once(exe_path, args, metrics_path, timeout)
+        times.append(metrics['execution_time'])
+        frames = metrics['frames_processed'] or frames
+        counters = metrics.get('counters') or {}
+        if counters.get('dtlb_misses_per_frame') is not None:
+            tlb_misses.append(counters['dtlb_misses_per_frame'])
+    median = percentile(times, 50)
+    return {
+        'dtlb_misses_per_frame': round(percentile(tlb_misses, 50)) if tlb_misses else None,
+        'runs': len(times),
+        'median_s': round(median, 6),
+        'p95_s': round(percentile(times, 95), 6),
+        'min_s': round(min(times), 6),
+        'max_s': round(max(times), 6),
+        'frames': frames,
+        'fps': round(frames / median, 2) if frames and median > 0 else None,
+        'times': [round(t, 6) for t in times]
+    }
+
+def karp_flatt(speedup, threads):
+    """Experimentally determined serial fraction of one point (None for 1 thread)"""
+    if not speedup or threads <= 1:
+        return None
+    return (1.0 / speedup - 1.0 / threads) / (1.0 - 1.0 / threads)
+
+def fit_amdahl(points):
+    """Least-squares serial fraction s of 1/S = s + (1 - s)/p over (threads, speedup)"""
+    num = den = 0.0
+    for p, speedup in points:
+        x = 1.0 - 1.0 / p
+        num += x * (1.0 / speedup - 1.0 / p)
+        den += x * x
+    if den == 0:
+        return None
+    s = min(max(num / den, 0.0), 1.0)
+    return {
+        'serial_fraction': round(s, 4),
+        'max_speedup': round(1.0 / s, 2) if s > 0 else None
+    }
+
+def fit_gustafson(points):
+    """Least-squares serial fraction s of S = p - s(p - 1) over (threads, speedup)"""
+    num = den = 0.0
+    for p, speedup in points:
+        x = p - 1.0
+        num += x * (p - speedup)
+        den += x * x
+    if den == 0:
+        return None
+    return {'serial_fraction': round(min(max(num / den, 0.0), 1.0), 4)}
+
+def main():
+    parser = argparse.ArgumentParser(description='Thread-scaling sweep of one algorithm')
+    parser.add_argument('feature', choices=sorted(FEATURE_MAP.keys()))
+    parser.add_argument('video', help='input clip (any format the programs read)')
+    parser.add_argument('--threads', default='1,2,4,8,16', help='comma-separated thread counts')
+    parser.add_argument('--variants', default='pthread,openmp', help='parallel variants to sweep')
+    parser.add_argument('--runs', type=int, default=5, help='timed runs per configuration')
+    parser.add_argument('--warmup', type=int, default=1, help='discarded runs before the timed ones')
+    parser.add_argument('--null-output', action='store_true', help='discard output frames (--output-format null), timing without the encoder')
+    parser.add_argument('--build-dir', default=os.path.join(PROJECT_ROOT, 'build'))
+    parser.add_argument('--report', default=None, help='report path without extension (default results/<feature>_sweep)')
+    parser.add_argument('--timeout', type=int, default=1800, help='seconds per run')
+    parser.add_argument('--huge-pages', default=None, metavar='MODE', choices=['thp', 'explicit', 'auto'],
+                        help='run every configuration also with --huge-pages MODE and compare FPS and dTLB misses')
+    # Everything after '--' is passed on to every run
+    argv = sys.argv[1:]
+    extra = argv[argv.index('--') + 1:] if '--' in argv else []
+    args = parser.parse_args(argv[:len(argv) - len(extra) - (1 if '--' in argv else 0)])
+
+    thread_counts = sorted({int(t) for t in args.threads.split(',') if t.strip()})
+    variants = [v.strip() for v in args.variants.split(',') if v.strip()]
+    report = args.report or os.path.join(PROJECT_ROOT, 'results', f'{args.feature}_sweep')
+    os.makedirs(os.path.dirname(os.path.abspath(report)), exist_ok=True)
+
+    scratch = tempfile.mkdtemp(prefix='sweep_')
+    file_ext = '.txt' if args.feature == 'scene_detection' else '.mp4'
+    output_path = os.path.join(scratch, f'output{file_ext}')
+    metrics_path = os.path.join(scratch, 'run.metrics.json')
+    output_args = [output_path]
+    if args.null_output and file_ext != '.txt':
+        output_args += ['--output-format', 'null']
+
+    # Normal pages only, or normal pages against huge pages (with counters for the TLB)
+    page_modes = ['off', args.huge_pages] if args.huge_pages else [None]
+
+    rows = []
+    try:
+        for pages in page_modes:
+            mode_args = ['--huge-pages', pages, '--perf-counters', '1'] if pages else []
+            label = f" (huge pages {pages})" if pages else ''
+            exe = find_executable(args.build_dir, f'{args.feature}_sequential')
+            if not exe:
+                print(f"Error: {args.feature}_sequential not found in {args.build_dir} (build it with compile.ps1)")
+                return 1
+            print(f"[Sweep] {args.feature}: sequential{label}")
+            baseline = run_config(exe, [args.video] + output_args + mode_args + extra, metrics_path,
+                                  args.warmup, args.runs, args.timeout)
+            rows.append(dict(variant='sequential', threads=1, huge_pages=pages, **baseline))
+
+            for variant in variants:
+                exe = find_executable(args.build_dir, f'{args.feature}_{variant}')
+                if not exe:
+                    print(f"[Sweep] Skipping {variant}: {args.feature}_{variant} not found in {args.build_dir}")
+                    continue
+                for threads in thread_counts:
+                    print(f"[Sweep] {args.feature}: {variant} x{threads}{label}")
+                    row = run_config(exe, [args.video, str(threads)] + output_args + mode_args + extra, metrics_path,
+                                     args.warmup, args.runs, args.timeout)
+                    rows.append(dict(variant=variant, threads=threads, huge_pages=pages, **row))
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+
+    # Speedups against the sequential run on the same pages
+    fits = {}
+    for pages in page_modes:
+        mode_rows = [r for r in rows if r['huge_pages'] == pages]
+        seq_time = mode_rows[0]['median_s']
+        for row in mode_rows:
+            row['speedup'] = calculate_speedup(seq_time, row['median_s'])
+            row['efficiency'] = calculate_efficiency(row['speedup'], row['threads'])
+            serial = karp_flatt(row['speedup'], row['threads'])
+            row['karp_flatt'] = round(serial, 4) if serial is not None else None
+        for variant in variants:
+            points = [(r['threads'], r['speedup']) for r in mode_rows if r['variant'] == variant and r['threads'] > 1 and r['speedup']]
+            if points:
+                key = variant if pages in (None, 'off') else f'{variant} (huge pages)'
+                fits[key] = {'amdahl': fit_amdahl(points), 'gustafson': fit_gustafson(points)}
+
+    # Normal against huge pages, per configuration
+    huge_pages = []
+    if args.huge_pages:
+        normal = {(r['variant'], r['threads']): r for r in rows if r['huge_pages'] == 'off'}
+        for row in rows:
+            base = normal.get((row['variant'], row['threads']))
+            if row['huge_pages'] != args.huge_pages or not base:
+                continue
+            fps_gain = (row['fps'] / base['fps'] - 1) * 100 if row['fps'] and base['fps'] else None
+            tlb_off, tlb_on = base['dtlb_misses_per_frame'], row['dtlb_misses_per_frame']
+            huge_pages.append({
+                'variant': row['variant'],
+                'threads': row['threads'],
+                'fps_normal': base['fps'],
+                'fps_huge': row['fps'],
+                'fps_gain_pct': round(fps_gain, 1) if fps_gain is not None else None,
+                'dtlb_misses_per_frame_normal': tlb_off,
+                'dtlb_misses_per_frame_huge': tlb_on,
+                'dtlb_reduction_pct': round((1 - tlb_on / tlb_off) * 100, 1) if tlb_off and tlb_on is not None else None
+            })
+
+    columns = ['variant', 'threads', 'runs', 'median_s', 'p95_s', 'min_s', 'max_s', 'frames', 'fps',
+               'speedup', 'efficiency', 'karp_flatt']
+    if args.huge_pages:
+        columns += ['huge_pages', 'dtlb_misses_per_frame']
+    with open(report + '.csv', 'w', newline='') as f:
+        writer = csv.DictWriter(f, fieldnames=columns, extrasaction='ignore')
+        writer.writeheader()
+        writer.writerows(rows)
+    with open(report + '.json', 'w') as f:
+        json.dump({
+            'feature': args.feature,
+            'video': args.video,
+            'runs': args.runs,
+            'warmup': args.warmup,
+            'null_output': args.null_output,
+            'cpu_count': os.cpu_count(),
+            'rows': rows,
+            'fits': fits,
+            'huge_pages': huge_pages if args.huge_pages else None
+        }, f, indent=2)
+
+    print(f"\n{'variant':<11}{'threads':>8}{'pages':>7}{'median s':>11}{'p95 s':>10}{'speedup':>9}{'eff %':>8}{'serial':>8}")
+    for row in rows:
+        serial = f"{row['karp_flatt']:.3f}" if row['karp_flatt'] is not None else '-'
+        print(f"{row['variant']:<11}{row['threads']:>8}{row['huge_pages'] or '-':>7}{row['median_s']:>11.3f}{row['p95_s']:>10.3f}"
+              f"{row['speedup'] or 0:>9.2f}{row['efficiency'] or 0:>8.1f}{serial:>8}")
+    if huge_pages:
+        print(f"\nHuge pages ({args.huge_pages}) against normal pages:")
+        print(f"{'variant':<11}{'threads':>8}{'fps':>9}{'fps huge':>10}{'gain %':>8}{'dTLB/frame':>12}{'huge':>12}{'fewer %':>9}")
+        def show(value, spec):
+            return format(value, spec) if value is not None else '-'
+        for c in huge_pages:
+            print(f"{c['variant']:<11}{c['threads']:>8}{show(c['fps_normal'], '.1f'):>9}{show(c['fps_huge'], '.1f'):>10}"
+                  f"{show(c['fps_gain_pct'], '.1f'):>8}{show(c['dtlb_misses_per_frame_normal'], 'd'):>12}"
+                  f"{show(c['dtlb_misses_per_frame_huge'], 'd'):>12}{show(c['dtlb_reduction_pct'], '.1f'):>9}")
+    for variant, fit in fits.items():
+        amdahl = fit['amdahl']
+        limit = f", max speedup {amdahl['max_speedup']}x" if amdahl and amdahl['max_speedup'] else ''
+        print(f"{variant}: Amdahl serial fraction {amdahl['serial_fraction'] if amdahl else '-'}{limit}, "
+              f"Gustafson serial fraction {fit['gustafson']['serial_fraction'] if fit['gustafson'] else '-'}")
+    print(f"\nReport: {report}.csv, {report}.json")
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
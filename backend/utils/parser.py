@@ -1,22 +1,68 @@
+import json
+import os
 import re
 
-def parse_execution_output(output_text):
+def load_metrics_json(metrics_path):
+    """Load the record a program wrote with --metrics-json (None if missing or invalid)"""
+    if not metrics_path or not os.path.exists(metrics_path):
+        return None
+    try:
+        with open(metrics_path, 'r') as f:
+            return json.load(f)
+    except (OSError, ValueError) as e:
+        print(f"[Parser] Cannot read metrics file {metrics_path}: {e}")
+        return None
+
+def parse_stages(stages):
+    """Per-stage times of a metrics record, with queue_wait_seconds (threads blocked on
+    the queues between them) and encoder_wait_seconds (the writer blocked on the encoder).
+    Records of older builds only had the encoder wait, under the name queue_wait_seconds."""
+    if not stages:
+        return stages
+    stages = dict(stages)
+    if 'encoder_wait_seconds' not in stages:
+        stages['encoder_wait_seconds'] = stages.pop('queue_wait_seconds', None)
+        stages['queue_wait_seconds'] = None
+    return stages
+
+def parse_execution_output(output_text, metrics_path=None):
     """
     Parse C++ program output to extract execution time and other metrics
     
-    Expected output format:
+    When the program wrote a --metrics-json record, the numbers come from there,
+    including the per-stage times. Otherwise they are scraped from the output:
     "Execution time: 2.345s"
-    "Processing 1000 frames"
+    "Processed frames: 1000"
     etc.
     """
     metrics = {
         'execution_time': None,
         'frames_processed': None,
         'fps': None,
+        'decode_fps': None,
+        'stages': None,
+        'peak_rss_bytes': None,
+        'allocations': None,
+        'build': None,
+        'counters': None,
         'success': False,
         'error': None
     }
     
+    record = load_metrics_json(metrics_path)
+    if record:
+        metrics['execution_time'] = record.get('total_seconds')
+        metrics['frames_processed'] = record.get('frames')
+        metrics['fps'] = round(record['fps'], 2) if record.get('fps') is not None else None
+        metrics['decode_fps'] = record.get('decode_fps')
+        metrics['stages'] = parse_stages(record.get('stages'))
+        metrics['peak_rss_bytes'] = record.get('peak_rss_bytes')
+        metrics['allocations'] = record.get('allocations')
+        metrics['build'] = record.get('build')
+        metrics['counters'] = record.get('counters')
+        metrics['success'] = metrics['execution_time'] is not None
+        return metrics
+    
     try:
         # Extract execution time (format: "Execution time: X.XXXs")
         time_match = re.search(r'Execution time:\s+([\d.]+)s', output_text)
@@ -29,10 +75,19 @@ def parse_execution_output(output_text):
         if frames_match:
             metrics['frames_processed'] = int(frames_match.group(1))
         
-        # Extract processed frames count (alternative format)
-        processed_match = re.search(r'Processed (\d+) frames', output_text)
-        if processed_match:
-            metrics['frames_processed'] = int(processed_match.group(1))
+        # Extract processed frames count: the final "Processed frames: N" line, else
+        # the last "\r" progress line ("Processed N frames...")
+        final_match = re.search(r'Processed frames:\s+(\d+)', output_text)
+        progress_matches = re.findall(r'Processed (\d+) frames', output_text)
+        if final_match:
+            metrics['frames_processed'] = int(final_match.group(1))
+        elif progress_matches:
+            metrics['frames_processed'] = int(progress_matches[-1])
+        
+        # Extract decoder throughput (format: "Decode FPS: X.XX")
+        decode_match = re.search(r'Decode FPS:\s+([\d.]+)', output_text)
+        if decode_match:
+            metrics['decode_fps'] = float(decode_match.group(1))
         
         # Calculate FPS if we have both time and frames
         if metrics['execution_time'] and metrics['frames_processed']:
@@ -74,14 +129,22 @@ def generate_performance_summary(sequential_metrics, pthread_metrics, openmp_met
         'sequential': {
             'time': seq_time,
             'fps': sequential_metrics.get('fps'),
+            'decode_fps': sequential_metrics.get('decode_fps'),
             'frames': sequential_metrics.get('frames_processed'),
+            'stages': sequential_metrics.get('stages'),
+            'peak_rss_bytes': sequential_metrics.get('peak_rss_bytes'),
+            'counters': sequential_metrics.get('counters'),
             'speedup': 1.0,
             'efficiency': 100.0
         },
         'pthread': {
             'time': pthread_time,
             'fps': pthread_metrics.get('fps'),
+            'decode_fps': pthread_metrics.get('decode_fps'),
             'frames': pthread_metrics.get('frames_processed'),
+            'stages': pthread_metrics.get('stages'),
+            'peak_rss_bytes': pthread_metrics.get('peak_rss_bytes'),
+            'counters': pthread_metrics.get('counters'),
             'threads': pthread_threads,
             'speedup': calculate_speedup(seq_time, pthread_time),
             'efficiency': calculate_efficiency(calculate_speedup(seq_time, pthread_time), pthread_threads)
@@ -89,7 +152,11 @@ def generate_performance_summary(sequential_metrics, pthread_metrics, openmp_met
         'openmp': {
             'time': openmp_time,
             'fps': openmp_metrics.get('fps'),
+            'decode_fps': openmp_metrics.get('decode_fps'),
             'frames': openmp_metrics.get('frames_processed'),
+            'stages': openmp_metrics.get('stages'),
+            'peak_rss_bytes': openmp_metrics.get('peak_rss_bytes'),
+            'counters': openmp_metrics.get('counters'),
             'threads': openmp_threads,
             'speedup': calculate_speedup(seq_time, openmp_time),
             'efficiency': calculate_efficiency(calculate_speedup(seq_time, openmp_time), openmp_threads)
@@ -0,0 +1,119 @@
+import json
+import os
+import queue
+import subprocess
+import threading
+import time
+
+from utils.scheduler import pin_process, popen_pinned
+
+class ProcessingServer:
+    """Client of build/processing_server.exe, which runs every program in one long-lived process
+
+    Jobs are sent one at a time over the server's stdin (one tab-separated line each)
+    and its replies are read as JSON lines from its stdout. The server is started on
+    first use and restarted if it dies or a job times out. Concurrent jobs each need
+    their own server.
+    """
+
+    def __init__(self, exe_path, cwd):
+        self.exe_path = exe_path
+        self.cwd = cwd
+        self.process = None
+        self.replies = None
+        self.programs = []
+        self.next_id = 0
+        self.lock = threading.RLock()
+
+    def available(self):
+        return os.path.exists(self.exe_path)
+
+    def _read_replies(self, process, replies):
+        for line in process.stdout:
+            line = line.strip()
+            if not line:
+                continue
+            try:
+                replies.put(json.loads(line))
+            except ValueError:
+                print(f"[Server] Unexpected output: {line[:200]}")
+        replies.put(None)  # server exited
+
+    def _start(self, timeout=60, cpus=None):
+        print(f"[Server] Starting {self.exe_path}")
+        self.process = popen_pinned(
+            [self.exe_path],
+            cpus,
+            cwd=self.cwd,
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            text=True,
+            bufsize=1
+        )
+        self.replies = queue.Queue()
+        reader = threading.Thread(target=self._read_replies, args=(self.process, self.replies))
+        reader.daemon = True
+        reader.start()
+
+        ready = self.replies.get(timeout=timeout)
+        if not ready or ready.get('event') != 'ready':
+            self.stop()
+            raise RuntimeError('Processing server did not start')
+        self.programs = ready.get('programs', [])
+        print(f"[Server] Ready with {len(self.programs)} programs")
+
+    def stop(self):
+        """Stop the server after the job it is running, if any"""
+        with self.lock:
+            if self.process and self.process.poll() is None:
+                try:
+                    self.process.stdin.write('quit\n')
+                    self.process.stdin.flush()
+                    self.process.wait(timeout=5)
+                except Exception:
+                    self.process.kill()
+            self.process = None
+
+    def run(self, program, args, timeout=600, on_progress=None, cpus=None):
+        """Run one job; returns (output, error, exit_code) like subprocess.run would
+
+        'on_progress' is called with each progress record of the job (frames, fps,
+        eta_s, queues, ... see src/common/progress.hpp); 'cpus' pins the server to
+        those CPUs for the job.
+        """
+        if any('\t' in arg or '\n' in arg for arg in args):
+            return None, 'Arguments must not contain tabs or newlines', 1
+
+        with self.lock:
+            try:
+                if not self.process or self.process.poll() is not None:
+                    self._start(cpus=cpus)
+                elif cpus:
+                    # Between jobs the server's threads are idle; each one gets the new mask
+                    pin_process(self.process, cpus)
+                self.next_id += 1
+                job_id = str(self.next_id)
+                self.process.stdin.write('\t'.join(['run', job_id, program] + list(args)) + '\n')
+                self.process.stdin.flush()
+
+                deadline = time.monotonic() + timeout
+                while True:
+                    reply = self.replies.get(timeout=max(0.0, deadline - time.monotonic()))
+                    if reply is None:
+                        self.process = None
+                        return None, 'Processing server exited during the job', 1
+                    if reply.get('id') != job_id:
+                        continue
+                    if reply['event'] == 'progress' and on_progress:
+                        on_progress({key: value for key, value in reply.items() if key not in ('event', 'id')})
+                    elif reply['event'] == 'done':
+                        return reply.get('output', ''), reply.get('error', ''), reply['exit_code']
+            except queue.Empty:
+                # A job that hangs takes the server with it
+                if self.process:
+                    self.process.kill()
+                self.process = None
+                return None, f"Execution timeout after {timeout} seconds", 1
+            except (OSError, RuntimeError) as e:
+                self.process = None
+                return None, str(e), 1
@@ -0,0 +1,103 @@
+import hashlib
+import json
+import os
+import shutil
+import threading
+import uuid
+
+def file_sha256(path, chunk_size=1 << 20):
+    digest = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(chunk_size), b''):
+            digest.update(chunk)
+    return digest.hexdigest()
+
+class ResultCache:
+    """Content-addressed store of program results (output file and parsed metrics)
+
+    An entry is keyed on the hash of the input video's contents, the algorithm, the
+    variant, its parameters and the id of the build that produced it, so the same clip
+    uploaded under another job id hits the same entry, and a rebuild misses. Entries
+    live in <root>/<key>/; the least recently used ones are evicted once the store
+    grows past 'budget_bytes'.
+    """
+
+    def __init__(self, root, budget_bytes):
+        self.root = root
+        self.budget_bytes = budget_bytes
+        self.input_hashes = {}  # (path, size, mtime) -> content hash
+        self.lock = threading.Lock()
+        os.makedirs(root, exist_ok=True)
+
+    def input_hash(self, path):
+        stat = os.stat(path)
+        memo = (os.path.abspath(path), stat.st_size, stat.st_mtime_ns)
+        if memo not in self.input_hashes:
+            self.input_hashes[memo] = file_sha256(path)
+        return self.input_hashes[memo]
+
+    def key(self, input_video, feature, variant, params, build_id):
+        description = json.dumps({
+            'input': self.input_hash(input_video),
+            'feature': feature,
+            'variant': variant,
+            'params': params,
+            'build': build_id
+        }, sort_keys=True)
+        return hashlib.sha256(description.encode()).hexdigest()
+
+    def get(self, key, output_path):
+        """The stored metrics with the stored output placed at 'output_path', or None"""
+        entry = os.path.join(self.root, key)
+        try:
+            with open(os.path.join(entry, 'metrics.json')) as f:
+                metrics = json.load(f)
+            stored = os.path.join(entry, 'output' + os.path.splitext(output_path)[1])
+            os.makedirs(os.path.dirname(output_path) or '.', exist_ok=True)
+            shutil.copyfile(stored, output_path)
+            os.utime(entry)  # most recently used
+        except (OSError, ValueError):
+            return None
+        metrics['cached'] = True
+        return metrics
+
+    def put(self, key, output_path, metrics):
+        """Store a successful run's output file and metrics"""
+        if not os.path.exists(output_path):
+            return
+        entry = os.path.join(self.root, key)
+        staging = os.path.join(self.root, f'.staging-{uuid.uuid4().hex}')
+        try:
+            os.makedirs(staging)
+            shutil.copyfile(output_path, os.path.join(staging, 'output' + os.path.splitext(output_path)[1]))
+            with open(os.path.join(staging, 'metrics.json'), 'w') as f:
+                json.dump(metrics, f, indent=2)
+            with self.lock:
+                if os.path.exists(entry):
+                    shutil.rmtree(entry, ignore_errors=True)
+                os.rename(staging, entry)
+                self.evict(keep=key)
+        except OSError as e:
+            print(f"[ResultCache] Could not store {key[:12]}: {e}")
+        finally:
+            shutil.rmtree(staging, ignore_errors=True)
+
+    def evict(self, keep=None):
+        """Remove least recently used entries until the store fits its budget"""
+        entries = []
+        total = 0
+        for name in os.listdir(self.root):
+            path = os.path.join(self.root, name)
+            if name.startswith('.') or not os.path.isdir(path):
+                continue
+            size = sum(os.path.getsize(os.path.join(path, f)) for f in os.listdir(path))
+            entries.append((os.path.getmtime(path), name, size))
+            total += size
+        for _, name, size in sorted(entries):
+            if total <= self.budget_bytes:
+                break
+            if name == keep:
+                continue
+            shutil.rmtree(os.path.join(self.root, name), ignore_errors=True)
+            total -= size
+            print(f"[ResultCache] Evicted {name[:12]} ({size} bytes)")
@@ -0,0 +1,141 @@
+import heapq
+import os
+import shutil
+import subprocess
+import threading
+
+def available_cpus():
+    """CPU ids this backend may use"""
+    if hasattr(os, 'sched_getaffinity'):
+        return sorted(os.sched_getaffinity(0))
+    return list(range(os.cpu_count() or 1))
+
+def pin_process(process, cpus):
+    """Restrict a running process (every thread of it) to 'cpus'; False where that is not supported"""
+    try:
+        if os.name == 'nt':
+            import ctypes
+            from ctypes import wintypes
+            kernel32 = ctypes.windll.kernel32
+            kernel32.SetProcessAffinityMask.argtypes = [wintypes.HANDLE, ctypes.c_size_t]
+            mask = sum(1 << cpu for cpu in cpus)
+            return bool(kernel32.SetProcessAffinityMask(int(process._handle), mask))
+        if hasattr(os, 'sched_setaffinity'):
+            # Threads already running keep their own mask on Linux, so set it on each
+            for tid in os.listdir(f'/proc/{process.pid}/task'):
+                os.sched_setaffinity(int(tid), cpus)
+            return True
+    except (OSError, AttributeError, ValueError):
+        pass
+    return False
+
+def popen_pinned(command, cpus, **kwargs):
+    """subprocess.Popen restricted to 'cpus' before the program runs: on Linux it is
+    started through taskset, which sets the mask and then execs it (no Python code runs
+    in the forked child, which is unsafe in this multithreaded backend), and on Windows
+    it starts suspended and is resumed once the mask is set. Elsewhere, or without
+    taskset, it is pinned after the start, like pin_process."""
+    if not cpus:
+        return subprocess.Popen(command, **kwargs)
+    cpus = list(cpus)
+    taskset = shutil.which('taskset') if hasattr(os, 'sched_setaffinity') else None
+    if taskset:
+        # taskset execs the program, so the process keeps its pid
+        return subprocess.Popen([taskset, '-c', ','.join(str(cpu) for cpu in cpus)] + list(command), **kwargs)
+    if os.name == 'nt':
+        import ctypes
+        from ctypes import wintypes
+        CREATE_SUSPENDED = 0x00000004
+        kwargs['creationflags'] = kwargs.get('creationflags', 0) | CREATE_SUSPENDED
+        process = subprocess.Popen(command, **kwargs)
+        pin_process(process, cpus)
+        ntdll = ctypes.windll.ntdll
+        ntdll.NtResumeProcess.argtypes = [wintypes.HANDLE]
+        if ntdll.NtResumeProcess(int(process._handle)) != 0:
+            process.kill()
+            process.wait()
+            raise OSError(f'Cannot resume {command[0]}')
+        return process
+    process = subprocess.Popen(command, **kwargs)
+    pin_process(process, cpus)
+    return process
+
+class JobScheduler:
+    """Runs jobs on a fixed budget of cores, each on its own set of CPUs
+
+    A job asks for a number of cores and waits in the queue until that many are free;
+    then it gets exactly those CPUs (pin its processes to them) until it finishes.
+    Jobs start in priority order (higher first, then first come), and a job never
+    starts ahead of an earlier one that is still waiting, so large jobs are not starved.
+    """
+
+    def __init__(self, budget=None, on_queued=None):
+        cpus = available_cpus()
+        if budget:
+            cpus = cpus[:budget]
+        self.cpus = cpus
+        self.free = set(cpus)
+        self.queue = []  # (-priority, sequence, job)
+        self.running = {}  # job id -> CPUs
+        self.sequence = 0
+        self.on_queued = on_queued  # called with (job_id, position, cores) while a job waits
+        self.cond = threading.Condition()
+        dispatcher = threading.Thread(target=self._dispatch)
+        dispatcher.daemon = True
+        dispatcher.start()
+
+    @property
+    def budget(self):
+        return len(self.cpus)
+
+    def submit(self, job_id, cores, run, priority=0):
+        """Queue run(cpus) to be started when 'cores' CPUs are free (capped at the budget)"""
+        job = {'id': job_id, 'cores': max(1, min(int(cores), self.budget)), 'run': run}
+        with self.cond:
+            self.sequence += 1
+            heapq.heappush(self.queue, (-priority, self.sequence, job))
+            self.cond.notify_all()
+        self._report_queue()
+
+    def status(self):
+        with self.cond:
+            return {
+                'budget': self.budget,
+                'free': len(self.free),
+                'running': {job_id: cpus for job_id, cpus in self.running.items()},
+                'queued': [job['id'] for _, _, job in sorted(self.queue, key=lambda entry: entry[:2])]
+            }
+
+    def _report_queue(self):
+        if not self.on_queued:
+            return
+        with self.cond:
+            waiting = [job for _, _, job in sorted(self.queue, key=lambda entry: entry[:2])]
+        for position, job in enumerate(waiting, 1):
+            self.on_queued(job['id'], position, job['cores'])
+
+    def _dispatch(self):
+        while True:
+            with self.cond:
+                while not self.queue or len(self.free) < self.queue[0][2]['cores']:
+                    self.cond.wait()
+                job = heapq.heappop(self.queue)[2]
+                cpus = sorted(self.free)[:job['cores']]
+                self.free.difference_update(cpus)
+                self.running[job['id']] = cpus
+            print(f"[Scheduler] Starting job {job['id']} on CPUs {cpus} ({len(self.free)} of {self.budget} free)")
+            worker = threading.Thread(target=self._run, args=(job, cpus))
+            worker.daemon = True
+            worker.start()
+            self._report_queue()
+
+    def _run(self, job, cpus):
+        try:
+            job['run'](cpus)
+        except Exception as e:
+            print(f"[Scheduler] Job {job['id']} raised: {e}")
+        finally:
+            with self.cond:
+                self.free.update(cpus)
+                self.running.pop(job['id'], None)
+                self.cond.notify_all()
@@ -1,7 +1,13 @@
 import subprocess
 import os
+import glob
+import json
 import threading
 from utils.parser import parse_execution_output
+from utils.processing_server import ProcessingServer
+from utils.scheduler import JobScheduler, popen_pinned
+from utils.result_cache import ResultCache
+from utils.file_manager import get_video_info
 
 # Try to import opencv for video conversion
 try:
@@ -11,6 +17,9 @@ except ImportError:
     OPENCV_AVAILABLE = False
     print("Warning: OpenCV not available for video conversion")
 
+# How often the programs report their live progress (--progress, src/common/progress.hpp)
+PROGRESS_INTERVAL_MS = 500
+
 # Map frontend feature names to backend directory names
 FEATURE_MAP = {
     'grayscale': '01_grayscale',
@@ -27,20 +36,144 @@ FEATURE_MAP = {
     'lightup': '12_lightup'
 }
 
+# Programs that process I420 frames with --yuv 1 (src/common/yuv_frame.hpp)
+YUV_FEATURES = {'grayscale', 'edge_detection', 'histogram_equalization', 'brightness_contrast'}
+
 class VideoProcessor:
     def __init__(self, project_root, socketio=None):
         self.project_root = project_root
         self.socketio = socketio
         self.jobs = {}  # Store job status
+        # Run the programs inside one long-lived processing server instead of one
+        # process per run (PROCESSING_SERVER=0 to disable)
+        self.use_server = os.environ.get('PROCESSING_SERVER', '1') != '0'
+        self.server_built = False
+        # CPU feature level the programs are built for (see compile.ps1 -Arch)
+        self.build_arch = self.resolve_build_arch(os.environ.get('BUILD_ARCH', 'native'))
+        # Idle processing servers: a running job takes one for itself. A rebuild bumps
+        # the generation, and servers of an older build are stopped instead of reused
+        self.servers = []
+        self.server_generation = 0
+        self.servers_lock = threading.Lock()
+        self.compile_lock = threading.Lock()
+        # Jobs wait until the cores they need are free and run pinned to them
+        # (CPU_BUDGET cores in all, default every CPU)
+        self.scheduler = JobScheduler(int(os.environ.get('CPU_BUDGET', '0')) or None, self.on_job_queued)
+        # Options passed to every run: thread placement (THREAD_PIN: compact, scatter
+        # or a CPU list, src/common/affinity.hpp) and huge page frame buffers
+        # (HUGE_PAGES: thp, explicit or auto, src/common/huge_pages.hpp)
+        self.run_options = []
+        if os.environ.get('THREAD_PIN'):
+            self.run_options += ['--pin', os.environ['THREAD_PIN']]
+        if os.environ.get('HUGE_PAGES'):
+            self.run_options += ['--huge-pages', os.environ['HUGE_PAGES']]
+        # I420 frames for the luminance kernels (YUV_FRAMES=1, see yuv_args)
+        self.yuv_frames = os.environ.get('YUV_FRAMES') == '1'
+        # Decoded-frame caches of the uploads share FRAME_CACHE_MB of disk (0 disables them)
+        self.frame_cache_budget = int(os.environ.get('FRAME_CACHE_MB', '8192')) << 20
+        self.frame_cache_lock = threading.Lock()
+        # Results of earlier runs, served again for the same input, variant, parameters
+        # and build (RESULT_CACHE=0 to disable, RESULT_CACHE_MB of disk)
+        self.result_cache = None
+        if os.environ.get('RESULT_CACHE', '1') != '0':
+            cache_dir = os.environ.get('RESULT_CACHE_DIR', os.path.join(project_root, 'backend', 'result_cache'))
+            self.result_cache = ResultCache(cache_dir, int(os.environ.get('RESULT_CACHE_MB', '4096')) << 20)
+    
+    def resolve_build_arch(self, arch):
+        """'auto' becomes the highest feature level the compiler sees on this CPU, as in compile.ps1"""
+        if arch != 'auto':
+            return arch
+        for gpp in (r'C:\msys64\ucrt64\bin\g++.exe', 'g++'):
+            try:
+                result = subprocess.run([gpp, '-march=native', '-dM', '-E', '-x', 'c++', '-'],
+                                        input='', capture_output=True, text=True, timeout=60)
+            except (OSError, subprocess.TimeoutExpired):
+                continue
+            if '__AVX512F__' in result.stdout:
+                return 'avx512'
+            if '__AVX2__' in result.stdout:
+                return 'avx2'
+            return 'baseline'
+        return 'native'
+    
+    def exe_path(self, program):
+        """build/<program>.exe, or build/<arch>/<program>.exe for a portable feature level"""
+        build_dir = os.path.join(self.project_root, 'build')
+        if self.build_arch != 'native':
+            build_dir = os.path.join(build_dir, self.build_arch)
+        return os.path.join(build_dir, f'{program}.exe')
+    
+    def compile_command(self, program):
+        return f".\\compile.ps1 -Program {program} -Arch {self.build_arch}"
+    
+    def build_id(self, exe_path):
+        """Id of the build that runs 'exe_path': the hash compile.ps1 keeps next to the binary"""
+        if self.use_server and self.server_built:
+            exe_path = self.exe_path('processing_server')
+        try:
+            with open(exe_path + '.hash') as f:
+                return f.read().strip()
+        except OSError:
+            pass
+        try:
+            stat = os.stat(exe_path)
+            return f'{stat.st_size}-{stat.st_mtime_ns}'
+        except OSError:
+            return None
+    
+    def cached_result(self, input_video, feature_key, variant, params, exe_path, output_path, placement=None):
+        """(key, metrics) from the result cache, metrics None on a miss; the stored output is copied to 'output_path'
+        
+        Throughput runs share the memory bandwidth with the other versions, so their
+        timings are kept apart from benchmark runs: the key holds the mode and CPU slice.
+        """
+        build = self.build_id(exe_path)
+        if not self.result_cache or not build:
+            return None, None
+        if placement and placement.get('mode') == 'throughput':
+            params = dict(params, mode='throughput', cpus=placement.get('cpus'))
+        if self.run_options:
+            params = dict(params, options=self.run_options)
+        if self.yuv_args(feature_key):
+            params = dict(params, yuv=True)
+        key = self.result_cache.key(input_video, feature_key, variant, params, build)
+        return key, self.result_cache.get(key, output_path)
+    
+    def acquire_server(self):
+        """An idle processing server of the current build, or a new one"""
+        with self.servers_lock:
+            while self.servers:
+                server = self.servers.pop()
+                if server.generation == self.server_generation:
+                    return server
+                server.stop()
+            server = ProcessingServer(self.exe_path('processing_server'), self.project_root)
+            server.generation = self.server_generation
+            return server
+    
+    def release_server(self, server):
+        with self.servers_lock:
+            if server.generation == self.server_generation:
+                self.servers.append(server)
+                return
+        server.stop()
     
-    def convert_avi_to_mp4(self, avi_path):
-        """Convert AVI to MP4 for browser compatibility using FFmpeg"""
+    def retire_servers(self):
+        """After a rebuild: idle servers stop now, busy ones when their job is done"""
+        with self.servers_lock:
+            self.server_generation += 1
+            idle, self.servers = self.servers, []
+        for server in idle:
+            server.stop()
+    
+    def convert_avi_to_mp4(self, avi_path, mp4_path=None):
+        """Convert AVI (or any video) to H.264 MP4 for browser compatibility using FFmpeg"""
         if not os.path.exists(avi_path):
             print(f"[Convert] AVI file not found: {avi_path}")
             return avi_path
         
         try:
-            mp4_path = avi_path.replace('.avi', '.mp4')
+            mp4_path = mp4_path or avi_path.replace('.avi', '.mp4')
             
             # Check if MP4 already exists and is valid
             if os.path.exists(mp4_path) and os.path.getsize(mp4_path) > 0:
@@ -126,28 +259,184 @@ class VideoProcessor:
             print(traceback.format_exc())
             return avi_path
     
-    def emit_progress(self, job_id, message, progress):
-        """Emit progress update via WebSocket"""
+    def video_codec(self, video_path):
+        """Codec of the first video stream ('h264', 'mpeg4', ...), None if it can't be told"""
+        try:
+            result = subprocess.run([
+                'ffprobe', '-v', 'error', '-select_streams', 'v:0',
+                '-show_entries', 'stream=codec_name', '-of', 'csv=p=0', video_path
+            ], capture_output=True, text=True, timeout=30)
+            if result.returncode == 0 and result.stdout.strip():
+                return result.stdout.strip().lower()
+        except (FileNotFoundError, subprocess.TimeoutExpired):
+            pass
+        
+        if not OPENCV_AVAILABLE:
+            return None
+        cap = cv2.VideoCapture(video_path)
+        fourcc = int(cap.get(cv2.CAP_PROP_FOURCC)) if cap.isOpened() else 0
+        cap.release()
+        if not fourcc:
+            return None
+        codec = ''.join(chr((fourcc >> (8 * i)) & 0xFF) for i in range(4)).strip().lower()
+        return 'h264' if codec in ('avc1', 'h264', 'x264') else codec
+    
+    def ensure_browser_playable(self, video_path):
+        """Re-encode an MP4 to H.264 if a program wrote another codec
+        
+        Programs built without FFmpeg write through cv::VideoWriter, which falls back
+        to MPEG-4 part 2 ('mp4v') when it has no H.264 encoder; browsers can't play that.
+        """
+        if not video_path.endswith('.mp4') or not os.path.exists(video_path):
+            return
+        codec = self.video_codec(video_path)
+        if codec is None or codec == 'h264':
+            return
+        
+        print(f"[Convert] {video_path} is {codec}, re-encoding to H.264")
+        source_path = video_path[:-len('.mp4')] + f'.{codec}.mp4'
+        os.replace(video_path, source_path)
+        if self.convert_avi_to_mp4(source_path, video_path) == video_path:
+            os.remove(source_path)
+        else:
+            os.replace(source_path, video_path)
+    
+    def frame_cache_path(self, input_video):
+        """Decoded-frame cache shared by every run on the same upload (removed with the upload)"""
+        return os.path.join(os.path.dirname(input_video), 'decoded_frames.cache')
+    
+    def yuv_args(self, feature_key):
+        """--yuv 1 for the programs that use it, when YUV_FRAMES=1"""
+        return ['--yuv', '1'] if self.yuv_frames and feature_key in YUV_FEATURES else []
+    
+    def frame_cache_args(self, input_video, feature_key):
+        """--frame-cache options for a run on 'input_video', within the disk budget of all caches
+        
+        Caches of other uploads are evicted, least recently used first, until this one fits
+        (its size estimated from the video's dimensions and frame count); the program is told
+        how much room is left and does not cache a video that would exceed it.
+        """
+        # The cache holds BGR frames, which would turn the I420 path off
+        if self.frame_cache_budget <= 0 or self.yuv_args(feature_key):
+            return []
+        path = self.frame_cache_path(input_video)
+        with self.frame_cache_lock:
+            if os.path.exists(path):
+                os.utime(path)  # most recently used
+                return ['--frame-cache', path]
+            
+            info = get_video_info(input_video)
+            needed = info['width'] * info['height'] * 3 * info['frame_count'] if info else self.frame_cache_budget // 2
+            if needed > self.frame_cache_budget:
+                return []
+            uploads = os.path.dirname(os.path.dirname(input_video))
+            others = sorted((p for p in glob.glob(os.path.join(uploads, '*', 'decoded_frames.cache')) if p != path),
+                            key=os.path.getmtime)
+            used = sum(os.path.getsize(p) for p in others)
+            for other in others:
+                if used + needed <= self.frame_cache_budget:
+                    break
+                try:
+                    size = os.path.getsize(other)
+                    os.remove(other)
+                    used -= size
+                    print(f"[FrameCache] Evicted {other}")
+                except OSError:
+                    pass  # in use by a running program (Windows)
+            room = self.frame_cache_budget - used
+            if room < needed:
+                return []
+            return ['--frame-cache', path, '--frame-cache-mb', str(room >> 20)]
+    
+    def metrics_path(self, output_path):
+        """Where a run writes its --metrics-json record, next to its output video"""
+        path = os.path.splitext(output_path)[0] + '.metrics.json'
+        if os.path.exists(path):
+            os.remove(path)
+        return path
+    
+    def emit_progress(self, job_id, message, progress, live=None):
+        """Emit progress update via WebSocket and keep it in the job status for polling;
+        'live' is the running program's last progress record"""
+        job = self.jobs.get(job_id)
+        if job and job.get('status') == 'processing':
+            # Versions running side by side report from different stages; never go back
+            progress = max(progress, job.get('progress', 0))
+            job.update(message=message, progress=progress, live=live)
         if self.socketio:
-            self.socketio.emit('progress', {
+            update = {
                 'job_id': job_id,
                 'message': message,
                 'progress': progress
-            })
+            }
+            if live:
+                update['live'] = live
+            self.socketio.emit('progress', update)
     
-    def run_executable(self, exe_path, args, timeout=600):
-        """Execute a program directly (not through PowerShell)"""
+    def emit_run_progress(self, job_id, label, start, end, live):
+        """Progress of a running program: frames, FPS and ETA in the message, the
+        overall percentage moved from 'start' towards 'end' by its share of frames done"""
+        message = f"{label} {live.get('frames', 0)}"
+        if live.get('total'):
+            message += f"/{live['total']}"
+        message += f" frames, {live.get('fps', 0):.1f} fps"
+        if live.get('eta_s') is not None:
+            message += f", ETA {live['eta_s']:.0f}s"
+        progress = start
+        if live.get('total'):
+            progress = start + (end - start) * min(1.0, live.get('frames', 0) / live['total'])
+        self.emit_progress(job_id, message, int(progress), live)
+    
+    def run_executable(self, exe_path, args, timeout=600, on_progress=None, placement=None):
+        """Execute a program directly (not through PowerShell); 'placement' ({'cpus': [...], 'server': ...})
+        pins it to those CPUs and runs it in that processing server"""
+        placement = placement or {}
+        cpus = placement.get('cpus')
+        args = args + self.run_options
+        if placement.get('server'):
+            program = os.path.splitext(os.path.basename(exe_path))[0]
+            return placement['server'].run(program, args, timeout, on_progress, cpus)
+        if on_progress:
+            args = args + ['--progress', str(PROGRESS_INTERVAL_MS)]
         try:
-            result = subprocess.run(
+            process = popen_pinned(
                 [exe_path] + args,
+                cpus,
                 cwd=self.project_root,
-                capture_output=True,
-                text=True,
-                timeout=timeout
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+                text=True
             )
-            return result.stdout, result.stderr, result.returncode
-        except subprocess.TimeoutExpired:
-            return None, f"Execution timeout after {timeout} seconds", 1
+            
+            # Both pipes are read as the program runs: '@progress' lines on stderr
+            # are passed on at once, everything else is kept
+            stdout_parts, stderr_lines = [], []
+            def read_stdout():
+                stdout_parts.append(process.stdout.read())
+            def read_stderr():
+                for line in process.stderr:
+                    if line.startswith('@progress '):
+                        try:
+                            record = json.loads(line[len('@progress '):])
+                        except ValueError:
+                            continue
+                        if on_progress:
+                            on_progress(record)
+                    else:
+                        stderr_lines.append(line)
+            readers = [threading.Thread(target=read_stdout), threading.Thread(target=read_stderr)]
+            for reader in readers:
+                reader.daemon = True
+                reader.start()
+            try:
+                process.wait(timeout=timeout)
+            except subprocess.TimeoutExpired:
+                process.kill()
+                process.wait()
+                return None, f"Execution timeout after {timeout} seconds", 1
+            for reader in readers:
+                reader.join()
+            return ''.join(stdout_parts), ''.join(stderr_lines), process.returncode
         except Exception as e:
             return None, str(e), 1
     
@@ -168,15 +457,35 @@ class VideoProcessor:
             return None, str(e), 1
     
     def compile_programs(self, job_id, feature):
-        """Compile all three versions of the program"""
+        """Compile all three versions of the program (one job at a time, they share the binaries)"""
+        with self.compile_lock:
+            self.compile_programs_locked(job_id, feature)
+    
+    def compile_programs_locked(self, job_id, feature):
         print(f"[Compile] Starting compilation for {feature}")
         self.emit_progress(job_id, 'Compiling sequential version...', 10)
         
         feature_key = feature.lower().replace(' ', '_')
         print(f"[Compile] Feature key: {feature_key}")
         
+        # The server contains every program. compile.ps1 only rebuilds it when a source
+        # or the flags changed, so asking on every job is cheap
+        if self.use_server:
+            self.emit_progress(job_id, 'Compiling processing server...', 10)
+            stdout, stderr, code = self.run_powershell_command(self.compile_command('processing_server'))
+            print(f"[Compile] Processing server - Exit code: {code}")
+            if code == 0:
+                if '[UP TO DATE]' not in (stdout or ''):
+                    self.retire_servers()  # restart on the new build
+                self.server_built = True
+                self.emit_progress(job_id, 'Compilation complete!', 35)
+                return
+            print(f"[Compile] Processing server FAILED, running the programs one by one - stderr: {stderr}")
+            self.use_server = False
+            self.server_built = False
+        
         # Compile sequential
-        cmd = f".\\compile.ps1 -Program {feature_key}_sequential"
+        cmd = self.compile_command(f'{feature_key}_sequential')
         print(f"[Compile] Running command: {cmd}")
         stdout, stderr, code = self.run_powershell_command(cmd)
         print(f"[Compile] Sequential - Exit code: {code}")
@@ -187,7 +496,7 @@ class VideoProcessor:
         self.emit_progress(job_id, 'Compiling pthread version...', 20)
         
         # Compile pthread
-        cmd = f".\\compile.ps1 -Program {feature_key}_pthread"
+        cmd = self.compile_command(f'{feature_key}_pthread')
         stdout, stderr, code = self.run_powershell_command(cmd)
         if code != 0:
             raise Exception(f"Pthread compilation failed: {stderr}")
@@ -195,25 +504,33 @@ class VideoProcessor:
         self.emit_progress(job_id, 'Compiling OpenMP version...', 30)
         
         # Compile OpenMP
-        cmd = f".\\compile.ps1 -Program {feature_key}_openmp"
+        cmd = self.compile_command(f'{feature_key}_openmp')
         stdout, stderr, code = self.run_powershell_command(cmd)
         if code != 0:
             raise Exception(f"OpenMP compilation failed: {stderr}")
         
         self.emit_progress(job_id, 'Compilation complete!', 35)
     
-    def run_sequential(self, job_id, feature, input_video, output_path):
+    def run_sequential(self, job_id, feature, input_video, output_path, placement=None):
         """Run sequential version"""
         self.emit_progress(job_id, 'Running sequential version...', 40)
         
         feature_key = feature.lower().replace(' ', '_')
-        exe_path = os.path.join(self.project_root, 'build', f'{feature_key}_sequential.exe')
+        exe_path = self.exe_path(f'{feature_key}_sequential')
         
         print(f"[Sequential] Executing: {exe_path}")
         print(f"[Sequential] Input: {input_video}")
         print(f"[Sequential] Output: {output_path}")
         
-        stdout, stderr, code = self.run_executable(exe_path, [input_video, output_path])
+        cache_key, cached = self.cached_result(input_video, feature_key, 'sequential', {}, exe_path, output_path, placement)
+        if cached:
+            print(f"[Sequential] Served from the result cache")
+            self.emit_progress(job_id, 'Sequential version complete (cached)!', 55)
+            return cached
+        
+        metrics_path = self.metrics_path(output_path)
+        stdout, stderr, code = self.run_executable(exe_path, [input_video, output_path, '--metrics-json', metrics_path] + self.frame_cache_args(input_video, feature_key) + self.yuv_args(feature_key),
+                                                   on_progress=lambda live: self.emit_run_progress(job_id, 'Running sequential version...', 40, 55, live), placement=placement)
         
         print(f"[Sequential] Exit code: {code}")
         print(f"[Sequential] STDOUT:\n{stdout}")
@@ -224,22 +541,33 @@ class VideoProcessor:
             raise Exception(f"Sequential execution failed: {stderr}")
         
         print(f"[Sequential] Success - parsing output...")
-        result = parse_execution_output(stdout + stderr)
+        self.ensure_browser_playable(output_path)
+        result = parse_execution_output(stdout + stderr, metrics_path)
         print(f"[Sequential] Parsed metrics: {result}")
+        if cache_key:
+            self.result_cache.put(cache_key, output_path, result)
         self.emit_progress(job_id, 'Sequential version complete!', 55)
         return result
     
-    def run_pthread(self, job_id, feature, input_video, output_path, num_threads):
+    def run_pthread(self, job_id, feature, input_video, output_path, num_threads, placement=None):
         """Run pthread version"""
         self.emit_progress(job_id, f'Running pthread version ({num_threads} threads)...', 60)
         
         feature_key = feature.lower().replace(' ', '_')
-        exe_path = os.path.join(self.project_root, 'build', f'{feature_key}_pthread.exe')
+        exe_path = self.exe_path(f'{feature_key}_pthread')
         
         print(f"[Pthread] Executing: {exe_path}")
         print(f"[Pthread] Threads: {num_threads}")
         
-        stdout, stderr, code = self.run_executable(exe_path, [input_video, str(num_threads), output_path])
+        cache_key, cached = self.cached_result(input_video, feature_key, 'pthread', {'threads': num_threads}, exe_path, output_path, placement)
+        if cached:
+            print(f"[Pthread] Served from the result cache")
+            self.emit_progress(job_id, 'Pthread version complete (cached)!', 75)
+            return cached
+        
+        metrics_path = self.metrics_path(output_path)
+        stdout, stderr, code = self.run_executable(exe_path, [input_video, str(num_threads), output_path, '--metrics-json', metrics_path] + self.frame_cache_args(input_video, feature_key) + self.yuv_args(feature_key),
+                                                   on_progress=lambda live: self.emit_run_progress(job_id, f'Running pthread version ({num_threads} threads)...', 60, 75, live), placement=placement)
         
         print(f"[Pthread] Exit code: {code}")
         print(f"[Pthread] STDOUT:\n{stdout}")
@@ -250,22 +578,33 @@ class VideoProcessor:
             raise Exception(f"Pthread execution failed: {stderr}")
         
         print(f"[Pthread] Success - parsing output...")
-        result = parse_execution_output(stdout + stderr)
+        self.ensure_browser_playable(output_path)
+        result = parse_execution_output(stdout + stderr, metrics_path)
         print(f"[Pthread] Parsed metrics: {result}")
+        if cache_key:
+            self.result_cache.put(cache_key, output_path, result)
         self.emit_progress(job_id, 'Pthread version complete!', 75)
         return result
     
-    def run_openmp(self, job_id, feature, input_video, output_path, num_threads):
+    def run_openmp(self, job_id, feature, input_video, output_path, num_threads, placement=None):
         """Run OpenMP version"""
         self.emit_progress(job_id, f'Running OpenMP version ({num_threads} threads)...', 80)
         
         feature_key = feature.lower().replace(' ', '_')
-        exe_path = os.path.join(self.project_root, 'build', f'{feature_key}_openmp.exe')
+        exe_path = self.exe_path(f'{feature_key}_openmp')
         
         print(f"[OpenMP] Executing: {exe_path}")
         print(f"[OpenMP] Threads: {num_threads}")
         
-        stdout, stderr, code = self.run_executable(exe_path, [input_video, str(num_threads), output_path])
+        cache_key, cached = self.cached_result(input_video, feature_key, 'openmp', {'threads': num_threads}, exe_path, output_path, placement)
+        if cached:
+            print(f"[OpenMP] Served from the result cache")
+            self.emit_progress(job_id, 'OpenMP version complete (cached)!', 95)
+            return cached
+        
+        metrics_path = self.metrics_path(output_path)
+        stdout, stderr, code = self.run_executable(exe_path, [input_video, str(num_threads), output_path, '--metrics-json', metrics_path] + self.frame_cache_args(input_video, feature_key) + self.yuv_args(feature_key),
+                                                   on_progress=lambda live: self.emit_run_progress(job_id, f'Running OpenMP version ({num_threads} threads)...', 80, 95, live), placement=placement)
         
         print(f"[OpenMP] Exit code: {code}")
         print(f"[OpenMP] STDOUT:\n{stdout}")
@@ -276,16 +615,54 @@ class VideoProcessor:
             raise Exception(f"OpenMP execution failed: {stderr}")
         
         print(f"[OpenMP] Success - parsing output...")
-        result = parse_execution_output(stdout + stderr)
+        self.ensure_browser_playable(output_path)
+        result = parse_execution_output(stdout + stderr, metrics_path)
         print(f"[OpenMP] Parsed metrics: {result}")
+        if cache_key:
+            self.result_cache.put(cache_key, output_path, result)
         self.emit_progress(job_id, 'OpenMP version complete!', 95)
         return result
     
-    def process_video_async(self, job_id, feature, input_video, output_dir, pthread_threads, openmp_threads):
-        """Process video with all three methods in background thread"""
+    def split_cpus(self, cpus, counts):
+        """Disjoint slices of 'cpus' with the given sizes, or None if they do not fit"""
+        if not cpus or sum(counts) > len(cpus):
+            return None
+        slices, start = [], 0
+        for count in counts:
+            slices.append(cpus[start:start + count])
+            start += count
+        return slices
+    
+    def run_variants_concurrently(self, job_id, feature, input_video, outputs, pthread_threads, openmp_threads, placements):
+        """Run the three versions at the same time, each with its own placement; returns their metrics"""
+        runs = [
+            ('sequential', lambda: self.run_sequential(job_id, feature, input_video, outputs[0], placements[0])),
+            ('pthread', lambda: self.run_pthread(job_id, feature, input_video, outputs[1], pthread_threads, placements[1])),
+            ('openmp', lambda: self.run_openmp(job_id, feature, input_video, outputs[2], openmp_threads, placements[2]))
+        ]
+        results = {}
+        def run(name, fn):
+            try:
+                results[name] = fn()
+            except Exception as e:
+                results[name] = e
+        threads = [threading.Thread(target=run, args=run_args) for run_args in runs]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for name, _ in runs:
+            if isinstance(results[name], Exception):
+                raise results[name]
+        return results['sequential'], results['pthread'], results['openmp']
+    
+    def process_video_async(self, job_id, feature, input_video, output_dir, pthread_threads, openmp_threads, cpus=None, mode='benchmark'):
+        """Process video with all three methods in background thread on 'cpus': one after the other
+        ('benchmark'), or all at once on disjoint slices of them ('throughput')"""
         print(f"[VideoProcessor] Starting async processing for job {job_id}")
         print(f"[VideoProcessor] Feature: {feature}, Input: {input_video}")
-        print(f"[VideoProcessor] Threads - Pthread: {pthread_threads}, OpenMP: {openmp_threads}")
+        print(f"[VideoProcessor] Threads - Pthread: {pthread_threads}, OpenMP: {openmp_threads}, CPUs: {cpus}, Mode: {mode}")
+        placements = []
         try:
             self.jobs[job_id] = {
                 'status': 'processing',
@@ -301,9 +678,11 @@ class VideoProcessor:
             # Define output paths
             feature_key = feature.lower().replace(' ', '_')
             
-            # Check if this is scene detection (outputs .txt instead of .avi)
+            # Check if this is scene detection (outputs .txt instead of video)
+            # Video programs encode the browser-ready MP4 themselves (re-encoded
+            # after the run if a build without FFmpeg wrote another codec)
             is_scene_detection = 'scene' in feature.lower()
-            file_ext = '.txt' if is_scene_detection else '.avi'
+            file_ext = '.txt' if is_scene_detection else '.mp4'
             
             seq_output = os.path.join(output_dir, f'{feature_key}_sequential{file_ext}')
             pthread_output = os.path.join(output_dir, f'{feature_key}_pthread{file_ext}')
@@ -316,34 +695,46 @@ class VideoProcessor:
             self.compile_programs(job_id, feature)
             print(f"[VideoProcessor] Compilation complete")
             
-            # Run sequential
-            print(f"[VideoProcessor] Running sequential...")
-            seq_metrics = self.run_sequential(job_id, feature, input_video, seq_output)
-            print(f"[VideoProcessor] Sequential complete: {seq_metrics}")
+            # Throughput mode: one CPU for sequential and as many as threads for the others
+            slices = None
+            if mode == 'throughput':
+                slices = self.split_cpus(cpus, [1, pthread_threads, openmp_threads])
+                if not slices:
+                    print(f"[VideoProcessor] {len(cpus or [])} CPUs are too few to run the versions side by side, running them one after another")
+            for slice_cpus in (slices or [cpus]):
+                placements.append({
+                    'cpus': slice_cpus,
+                    'mode': 'throughput' if slices else 'benchmark',
+                    'server': self.acquire_server() if self.use_server and self.server_built else None
+                })
             
-            # Run pthread
-            print(f"[VideoProcessor] Running pthread...")
-            pthread_metrics = self.run_pthread(job_id, feature, input_video, pthread_output, pthread_threads)
-            print(f"[VideoProcessor] Pthread complete: {pthread_metrics}")
-            
-            # Run OpenMP
-            print(f"[VideoProcessor] Running OpenMP...")
-            openmp_metrics = self.run_openmp(job_id, feature, input_video, openmp_output, openmp_threads)
-            print(f"[VideoProcessor] OpenMP complete: {openmp_metrics}")
-            
-            # Convert AVI files to MP4 for browser compatibility (skip for scene detection)
-            if is_scene_detection:
-                print(f"[VideoProcessor] Scene detection outputs text files, skipping video conversion")
-                seq_output_final = seq_output
-                pthread_output_final = pthread_output
-                openmp_output_final = openmp_output
+            if slices:
+                # All three at once on disjoint CPUs, sharing the decoded-frame cache
+                print(f"[VideoProcessor] Running all versions concurrently on {slices}...")
+                seq_metrics, pthread_metrics, openmp_metrics = self.run_variants_concurrently(
+                    job_id, feature, input_video, [seq_output, pthread_output, openmp_output],
+                    pthread_threads, openmp_threads, placements)
             else:
-                print(f"[VideoProcessor] Converting videos to MP4...")
-                self.emit_progress(job_id, 'Converting videos to MP4...', 96)
-                seq_output_final = self.convert_avi_to_mp4(seq_output)
-                pthread_output_final = self.convert_avi_to_mp4(pthread_output)
-                openmp_output_final = self.convert_avi_to_mp4(openmp_output)
-                print(f"[VideoProcessor] Conversion complete")
+                # Run sequential
+                print(f"[VideoProcessor] Running sequential...")
+                seq_metrics = self.run_sequential(job_id, feature, input_video, seq_output, placements[0])
+                print(f"[VideoProcessor] Sequential complete: {seq_metrics}")
+                
+                # Run pthread
+                print(f"[VideoProcessor] Running pthread...")
+                pthread_metrics = self.run_pthread(job_id, feature, input_video, pthread_output, pthread_threads, placements[0])
+                print(f"[VideoProcessor] Pthread complete: {pthread_metrics}")
+                
+                # Run OpenMP
+                print(f"[VideoProcessor] Running OpenMP...")
+                openmp_metrics = self.run_openmp(job_id, feature, input_video, openmp_output, openmp_threads, placements[0])
+                print(f"[VideoProcessor] OpenMP complete: {openmp_metrics}")
+            
+            # The programs write the final MP4 themselves (ensure_browser_playable
+            # re-encodes it only when it isn't H.264)
+            seq_output_final = seq_output
+            pthread_output_final = pthread_output
+            openmp_output_final = openmp_output
             
             # Update job status
             self.jobs[job_id] = {
@@ -364,7 +755,10 @@ class VideoProcessor:
                 },
                 'config': {
                     'pthread_threads': pthread_threads,
-                    'openmp_threads': openmp_threads
+                    'openmp_threads': openmp_threads,
+                    'cpus': cpus,
+                    'mode': 'throughput' if slices else 'benchmark',
+                    'variant_cpus': slices
                 }
             }
             
@@ -382,15 +776,43 @@ class VideoProcessor:
                 'error': str(e)
             }
             self.emit_progress(job_id, f'Error: {str(e)}', 0)
+        finally:
+            for placement in placements:
+                if placement['server']:
+                    self.release_server(placement['server'])
     
-    def process_video(self, job_id, feature, input_video, output_dir, pthread_threads, openmp_threads):
-        """Start video processing in background thread"""
-        thread = threading.Thread(
-            target=self.process_video_async,
-            args=(job_id, feature, input_video, output_dir, pthread_threads, openmp_threads)
+    def process_video(self, job_id, feature, input_video, output_dir, pthread_threads, openmp_threads, priority=0, mode='benchmark'):
+        """Queue video processing; it starts in a background thread once its cores are free.
+        A throughput job asks for the cores of all three versions at once"""
+        if mode == 'throughput':
+            cores = 1 + pthread_threads + openmp_threads
+        else:
+            cores = max(pthread_threads, openmp_threads)
+        self.jobs[job_id] = {
+            'status': 'queued',
+            'progress': 0,
+            'message': 'Queued...',
+            'error': None
+        }
+        self.scheduler.submit(
+            job_id,
+            cores,
+            lambda cpus: self.process_video_async(job_id, feature, input_video, output_dir, pthread_threads, openmp_threads, cpus, mode),
+            priority
         )
-        thread.daemon = True
-        thread.start()
+    
+    def on_job_queued(self, job_id, position, cores):
+        """Scheduler callback while a job waits for its cores"""
+        if self.jobs.get(job_id, {}).get('status') != 'queued':
+            return
+        message = f'Queued: waiting for {cores} cores (position {position})'
+        self.jobs[job_id] = {
+            'status': 'queued',
+            'progress': 0,
+            'message': message,
+            'error': None
+        }
+        self.emit_progress(job_id, message, 0)
     
     def get_job_status(self, job_id):
         """Get current job status"""
@@ -0,0 +1,358 @@
+// Microbenchmarks of the processing kernels on synthetic frames, without decoding or
+// encoding. The kernels are the programs' own (the <name>_kernels.hpp header of each
+// program directory), and every one runs at 480p, 1080p and 4K, in the three ways
+// the programs use it:
+//
+//   variant:0  sequential - the sequential program's kernel, the batch of frames one
+//                           after the other on one thread
+//   variant:1  pthread    - the pthread program's kernel on persistent worker
+//                           threads that take the frames of the batch one at a time
+//   variant:2  openmp     - the OpenMP program's kernel in a parallel for over the
+//                           batch
+//
+// Where the variants run different code (grayscale, light-up, temporal averaging),
+// each variant times its own. A batch holds one frame per thread (BENCH_THREADS
+// environment variable, default one per core), so all three variants do the same
+// work per iteration. Background subtraction is split into row bands instead, and
+// temporal averaging runs frame after frame (the pthread workers take turns under
+// one lock, the OpenMP version splits each frame's pixels), as in their programs.
+//
+// Results are reported as wall time per batch, pixels/s and bytes/s (frame bytes
+// read and written by the kernel). In-place kernels run on the same buffers every
+// iteration, so later iterations see already processed pixels; the work per pixel
+// does not depend on their values.
+//
+// Build: ./compile.ps1 -Program kernel_bench
+// Run:   build/kernel_bench.exe --benchmark_filter=GaussianBlur
+
+#include <benchmark/benchmark.h>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "../src/01_grayscale/grayscale_kernels.hpp"
+#include "../src/02_gaussian_blur/gaussian_blur_kernels.hpp"
+#include "../src/03_edge_detection/edge_detection_kernels.hpp"
+#include "../src/04_white_balance/white_balance_kernels.hpp"
+#include "../src/05_histogram_equalization/histogram_equalization_kernels.hpp"
+#include "../src/06_frame_sharpening/frame_sharpening_kernels.hpp"
+#include "../src/07_scene_detection/scene_detection_kernels.hpp"
+#include "../src/08_background_subtraction/foreground_roi.hpp"
+#include "../src/09_brightness_contrast/brightness_contrast_kernels.hpp"
+#include "../src/10_motion_blur_reduction/motion_blur_reduction_kernels.hpp"
+#include "../src/11_contrast_enhancement/contrast_enhancement_kernels.hpp"
+#include "../src/12_lightup/lightup_kernels.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define SEQUENTIAL 0
+#define PTHREAD 1
+#define OPENMP 2
+
+static const Size resolutions[] = {Size(640, 480), Size(1920, 1080), Size(3840, 2160)};
+static const char* const resolutionNames[] = {"480p", "1080p", "4K"};
+static const char* const variantNames[] = {"sequential", "pthread", "openmp"};
+
+int benchThreads() {
+	static int threads = 0;
+	if (!threads) {
+		const char* value = getenv("BENCH_THREADS");
+		threads = value ? atoi(value) : (int)thread::hardware_concurrency();
+		threads = max(1, threads);
+	}
+	return threads;
+}
+
+// Synthetic video: smooth gradients with noise, moving a little from frame to frame so
+// temporal kernels see real differences
+vector<Mat> makeFrames(Size size, int count) {
+	RNG rng(12345);
+	vector<Mat> frames(count);
+	for (int i = 0; i < count; ++i) {
+		frames[i].create(size, CV_8UC3);
+		for (int y = 0; y < size.height; ++y) {
+			Vec3b* row = frames[i].ptr<Vec3b>(y);
+			for (int x = 0; x < size.width; ++x) {
+				int sx = x + 2 * i, sy = y + i;
+				row[x] = Vec3b((uchar)(sx * 224 / size.width), (uchar)(sy * 224 / size.height), (uchar)((sx + sy) % 224));
+			}
+		}
+		Mat noise(size, CV_8UC3);
+		rng.fill(noise, RNG::UNIFORM, 0, 32);
+		frames[i] += noise;
+	}
+	return frames;
+}
+
+// Worker threads started once and fed every batch, like the pthread programs'
+// workers, so no thread is created inside the timing. Items are handed out one at a
+// time from a shared counter, as the workers pop frames off their queue.
+class WorkerPool {
+private:
+	vector<thread> workers;
+	mutex mtx;
+	condition_variable wake, finished;
+	function<void(int)> task;
+	int count = 0;
+	atomic<int> next;
+	int running = 0;
+	long long generation = 0;
+	bool stopping = false;
+
+	void workerLoop() {
+		long long seen = 0;
+		while (true) {
+			{
+				unique_lock<mutex> lock(mtx);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping) return;
+				seen = generation;
+			}
+			for (int i = next++; i < count; i = next++) task(i);
+
+			lock_guard<mutex> lock(mtx);
+			if (--running == 0) finished.notify_one();
+		}
+	}
+
+public:
+	explicit WorkerPool(int threads) : next(0) {
+		for (int t = 0; t < threads; ++t) workers.emplace_back(&WorkerPool::workerLoop, this);
+	}
+
+	~WorkerPool() {
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto &worker : workers) worker.join();
+	}
+
+	// Run fn(0) .. fn(items - 1) on the workers and wait for all of them
+	void run(int items, function<void(int)> fn) {
+		unique_lock<mutex> lock(mtx);
+		task = move(fn);
+		count = items;
+		next = 0;
+		running = (int)workers.size();
+		generation++;
+		wake.notify_all();
+		finished.wait(lock, [&] { return running == 0; });
+	}
+};
+
+WorkerPool &benchPool() {
+	static WorkerPool pool(benchThreads());
+	return pool;
+}
+
+// Run fn(0) .. fn(count - 1) the way 'variant' does
+template <typename Fn>
+void runBatch(benchmark::State &state, int variant, int count, Fn fn) {
+	if (variant == SEQUENTIAL) {
+		for (int i = 0; i < count; ++i) fn(i);
+	} else if (variant == PTHREAD) {
+		benchPool().run(count, fn);
+	} else {
+#ifdef _OPENMP
+		#pragma omp parallel for num_threads(benchThreads()) schedule(static)
+		for (int i = 0; i < count; ++i) fn(i);
+#else
+		state.SkipWithError("built without -fopenmp");
+#endif
+	}
+}
+
+void setCounters(benchmark::State &state, Size size, int framesPerIteration, double bytesPerPixel) {
+	double pixels = (double)size.area() * framesPerIteration * state.iterations();
+	state.counters["pixels/s"] = benchmark::Counter(pixels, benchmark::Counter::kIsRate);
+	state.SetBytesProcessed((int64_t)(pixels * bytesPerPixel));
+	state.SetLabel(string(resolutionNames[state.range(0)]) + " " + variantNames[state.range(1)]);
+}
+
+// A kernel with a separate output frame, one frame per batch slot; the kernel gets
+// the variant so it can run that variant's code
+template <typename Kernel>
+void benchFrameKernel(benchmark::State &state, double bytesPerPixel, Kernel kernel) {
+	Size size = resolutions[state.range(0)];
+	int variant = (int)state.range(1);
+	int batch = benchThreads();
+	vector<Mat> inputs = makeFrames(size, batch);
+	vector<Mat> outputs(batch);
+
+	for (auto _ : state) {
+		runBatch(state, variant, batch, [&](int i) { kernel(inputs[i], outputs[i], variant); });
+	}
+	setCounters(state, size, batch, bytesPerPixel);
+}
+
+void BM_Grayscale(benchmark::State &state) {
+	// Sequential: in place, 3 channels out; the others write a 1-channel frame
+	double bytesPerPixel = state.range(1) == SEQUENTIAL ? 6 : 4;
+	benchFrameKernel(state, bytesPerPixel, [](Mat &frame, Mat &output, int variant) {
+		if (variant == SEQUENTIAL) convertToGrayscale(frame);
+		else if (variant == PTHREAD) convertToGrayscaleOptimized(frame, output, false);
+		else convertToGrayscaleParallel(frame, output, false, benchThreads());
+	});
+}
+
+void BM_GaussianBlur(benchmark::State &state) {
+	benchFrameKernel(state, 6, [](Mat &frame, Mat &output, int variant) { applyGaussianBlur(frame, output); });
+}
+
+void BM_EdgeDetection(benchmark::State &state) {
+	benchFrameKernel(state, 4, [](Mat &frame, Mat &output, int variant) { applyEdgeDetection(frame, output); });
+}
+
+void BM_WhiteBalance(benchmark::State &state) {
+	// Two passes over the frame: channel sums, then the correction
+	benchFrameKernel(state, 9, [](Mat &frame, Mat &output, int variant) { whiteBalance(frame); });
+}
+
+void BM_HistogramEqualization(benchmark::State &state) {
+	benchFrameKernel(state, 6, [](Mat &frame, Mat &output, int variant) { applyHistogramEqualization(frame, output); });
+}
+
+void BM_Sharpen(benchmark::State &state) {
+	benchFrameKernel(state, 6, [](Mat &frame, Mat &output, int variant) { applySharpen(frame, output); });
+}
+
+void BM_BrightnessContrast(benchmark::State &state) {
+	benchFrameKernel(state, 6, [](Mat &frame, Mat &output, int variant) { applyBrightnessContrast(frame, output); });
+}
+
+void BM_ContrastEnhancement(benchmark::State &state) {
+	benchFrameKernel(state, 6, [](Mat &frame, Mat &output, int variant) { applyContrastEnhancement(frame, output); });
+}
+
+void BM_LightUp(benchmark::State &state) {
+	// Reads the blue channel twice (maximum, then scaling) and writes it once
+	benchFrameKernel(state, 7, [](Mat &frame, Mat &output, int variant) {
+		if (variant == OPENMP) lightUpParallel(frame, benchThreads());
+		else lightUp(frame);
+	});
+}
+
+// 07_scene_detection: compare each frame of the batch with the one before it
+void BM_SceneChange(benchmark::State &state) {
+	Size size = resolutions[state.range(0)];
+	int variant = (int)state.range(1);
+	int batch = benchThreads();
+	vector<Mat> frames = makeFrames(size, batch + 1);
+	vector<double> scores(batch);
+	vector<int> changes(batch);
+
+	for (auto _ : state) {
+		runBatch(state, variant, batch, [&](int i) { changes[i] = isSceneChange(frames[i], frames[i + 1], scores[i]); });
+	}
+	setCounters(state, size, batch, 6);
+}
+
+// 10_motion_blur_reduction: average of each frame with the TEMPORAL_WINDOW - 1 before
+// it. The pthread program's workers average under one lock (the window is shared), and
+// the OpenMP program goes frame by frame with each frame's pixels split over threads.
+void BM_TemporalAverage(benchmark::State &state) {
+	Size size = resolutions[state.range(0)];
+	int variant = (int)state.range(1);
+	int batch = benchThreads();
+	vector<Mat> frames = makeFrames(size, batch + TEMPORAL_WINDOW - 1);
+	vector<Mat> outputs(batch);
+	mutex windowMutex;
+
+	for (auto _ : state) {
+		if (variant == OPENMP) {
+			for (int i = 0; i < batch; ++i) {
+				deque<Mat> window(frames.begin() + i, frames.begin() + i + TEMPORAL_WINDOW);
+				reduceMotionBlurParallel(window, outputs[i], benchThreads());
+			}
+			continue;
+		}
+		runBatch(state, variant, batch, [&](int i) {
+			deque<Mat> window(frames.begin() + i, frames.begin() + i + TEMPORAL_WINDOW);
+			if (variant == SEQUENTIAL) {
+				reduceMotionBlur(window, outputs[i]);
+			} else {
+				lock_guard<mutex> lock(windowMutex);
+				reduceMotionBlurFloat(window, outputs[i]);
+			}
+		});
+	}
+	setCounters(state, size, batch, 3 * (TEMPORAL_WINDOW + 1));
+}
+
+// 08_background_subtraction: one model over the whole frame, each frame split into
+// row bands - one per pthread worker, 4 per thread for OpenMP's dynamic schedule
+void BM_BackgroundSubtraction(benchmark::State &state) {
+	Size size = resolutions[state.range(0)];
+	int variant = (int)state.range(1);
+	int bands = variant == SEQUENTIAL ? 1 : variant == PTHREAD ? benchThreads() : benchThreads() * 4;
+	vector<Mat> frames = makeFrames(size, 8);
+
+	GaussianMixtureBackground model;
+	RoiMask roi;
+	roi.init(size.height, size.width, "", "");
+	Mat mask(size, CV_8UC1);
+	vector<ForegroundStats> bandStats(bands);
+	int frameIndex = 0;
+	auto applyBand = [&](int b) {
+		applyBackgroundModel(model, frames[frameIndex % frames.size()], mask, frameIndex, 1, roi,
+		                     roi.bandRow(b, bands), roi.bandRow(b + 1, bands), bandStats[b]);
+	};
+	for (int b = 0; b < bands; ++b) applyBand(b);
+	frameIndex++;
+
+	for (auto _ : state) {
+		if (variant == OPENMP) {
+#ifdef _OPENMP
+			#pragma omp parallel for num_threads(benchThreads()) schedule(dynamic)
+			for (int b = 0; b < bands; ++b) applyBand(b);
+#else
+			state.SkipWithError("built without -fopenmp");
+#endif
+		} else {
+			runBatch(state, variant, bands, applyBand);
+		}
+		frameIndex++;
+	}
+	setCounters(state, size, 1, 4);
+}
+
+#define KERNEL_BENCHMARK(name) \
+	BENCHMARK(name)->ArgsProduct({{0, 1, 2}, {SEQUENTIAL, PTHREAD, OPENMP}})->ArgNames({"res", "variant"}) \
+	               ->Unit(benchmark::kMillisecond)->UseRealTime()
+
+KERNEL_BENCHMARK(BM_Grayscale);
+KERNEL_BENCHMARK(BM_GaussianBlur);
+KERNEL_BENCHMARK(BM_EdgeDetection);
+KERNEL_BENCHMARK(BM_WhiteBalance);
+KERNEL_BENCHMARK(BM_HistogramEqualization);
+KERNEL_BENCHMARK(BM_Sharpen);
+KERNEL_BENCHMARK(BM_SceneChange);
+KERNEL_BENCHMARK(BM_BackgroundSubtraction);
+KERNEL_BENCHMARK(BM_BrightnessContrast);
+KERNEL_BENCHMARK(BM_TemporalAverage);
+KERNEL_BENCHMARK(BM_ContrastEnhancement);
+KERNEL_BENCHMARK(BM_LightUp);
+
+int main(int argc, char** argv) {
+	// Keep OpenCV's own thread pool out of the comparison
+	setNumThreads(1);
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+	printf("Kernel benchmarks: %d threads per parallel variant\n", benchThreads());
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -2,7 +2,14 @@
 # Make sure you've installed: pacman -S mingw-w64-ucrt-x86_64-toolchain
 
 param(
-    [string]$Program = "grayscale_sequential"
+    [string]$Program = "grayscale_sequential",
+    # CPU feature level: native (this machine, into build\) or a portable level into
+    # build\<level>\: baseline (x86-64-v2), avx2 (x86-64-v3), avx512 (x86-64-v4).
+    # auto picks the highest level this CPU supports.
+    [ValidateSet("native", "auto", "baseline", "avx2", "avx512")]
+    [string]$Arch = "native",
+    # Rebuild even if the binary is up to date
+    [switch]$Force
 )
 
 Write-Host "`nCompiling $Program..." -ForegroundColor Cyan
@@ -30,6 +37,21 @@ if (-not (Test-Path $msys2Include)) {
     exit 1
 }
 
+# Resolve -Arch auto with the compiler's view of this CPU
+if ($Arch -eq "auto") {
+    $nativeDefines = "" | & $gppPath -march=native -dM -E -x c++ - 2>$null
+    if ($nativeDefines -match "__AVX512F__") { $Arch = "avx512" }
+    elseif ($nativeDefines -match "__AVX2__") { $Arch = "avx2" }
+    else { $Arch = "baseline" }
+    Write-Host "CPU feature level: $Arch" -ForegroundColor Green
+}
+$marchMap = @{
+    "native" = "native"
+    "baseline" = "x86-64-v2"
+    "avx2" = "x86-64-v3"
+    "avx512" = "x86-64-v4"
+}
+
 # Source files
 $sourceMap = @{
     # Grayscale
@@ -80,6 +102,12 @@ $sourceMap = @{
     "lightup_sequential" = "src\12_lightup\lightup_sequential.cpp"
     "lightup_openmp" = "src\12_lightup\lightup_openmp.cpp"
     "lightup_pthread" = "src\12_lightup\lightup_pthread.cpp"
+    # Filter Chain
+    "filter_chain" = "src\13_filter_chain\filter_chain.cpp"
+    # Processing server (all programs in one process)
+    "processing_server" = "src\14_processing_server\processing_server.cpp"
+    # Kernel microbenchmarks (Google Benchmark)
+    "kernel_bench" = "bench\kernel_bench.cpp"
 }
 
 if (-not $sourceMap.ContainsKey($Program)) {
@@ -88,11 +116,12 @@ if (-not $sourceMap.ContainsKey($Program)) {
 }
 
 $source = $sourceMap[$Program]
-$output = "build\$Program.exe"
+$buildDir = if ($Arch -eq "native") { "build" } else { "build\$Arch" }
+$output = "$buildDir\$Program.exe"
 
 # Create build directory
-if (-not (Test-Path "build")) {
-    New-Item -ItemType Directory -Path "build" | Out-Null
+if (-not (Test-Path $buildDir)) {
+    New-Item -ItemType Directory -Path $buildDir | Out-Null
 }
 
 Write-Host "Source: $source" -ForegroundColor Gray
@@ -142,19 +171,73 @@ $args = @(
     "-L$msys2Lib"
 )
 $args += $libs
-$args += @("-std=c++14")
+$args += @("-std=c++14", "-O3", "-march=$($marchMap[$Arch])")
+
+# Decode through libavcodec (frame/slice threaded) when FFmpeg is installed:
+# pacman -S mingw-w64-ucrt-x86_64-ffmpeg
+if (Test-Path "C:\msys64\ucrt64\include\libavcodec\avcodec.h") {
+    Write-Host "FFmpeg found: using the threaded libavcodec decoder" -ForegroundColor Green
+    $args += @("-DUSE_FFMPEG", "-lavformat", "-lavcodec", "-lswscale", "-lavutil")
+}
 
-# Add OpenMP for openmp version
-if ($Program -match "openmp") {
+# Add OpenMP for openmp version (the benchmarks and the server contain all variants)
+if ($Program -match "openmp|kernel_bench|processing_server") {
     $args += "-fopenmp"
 }
 
+# Google Benchmark: pacman -S mingw-w64-ucrt-x86_64-benchmark
+if ($Program -eq "kernel_bench") {
+    $args += @("-lbenchmark", "-lshlwapi")
+}
+
+# Build cache: the binary is rebuilt only when a source file it includes, the
+# compiler or the flags change. Their hash is kept next to the binary.
+function Get-IncludedSources($file) {
+    $seen = @{}
+    $pending = New-Object System.Collections.Queue
+    $pending.Enqueue((Resolve-Path $file).Path)
+    while ($pending.Count -gt 0) {
+        $current = $pending.Dequeue()
+        if ($seen.ContainsKey($current)) { continue }
+        $seen[$current] = $true
+        foreach ($match in Select-String -Path $current -Pattern '^\s*#include\s+"([^"]+)"') {
+            $included = Join-Path (Split-Path $current) $match.Matches[0].Groups[1].Value
+            if (Test-Path $included) { $pending.Enqueue((Resolve-Path $included).Path) }
+        }
+    }
+    return $seen.Keys | Sort-Object
+}
+
+$hashInput = "$(& $gppPath -dumpfullversion)`n$($args -join ' ')`n"
+foreach ($file in Get-IncludedSources $source) {
+    $hashInput += "$file $((Get-FileHash $file -Algorithm SHA256).Hash)`n"
+}
+$sha = [System.Security.Cryptography.SHA256]::Create()
+$buildHash = [System.BitConverter]::ToString($sha.ComputeHash([System.Text.Encoding]::UTF8.GetBytes($hashInput))) -replace "-", ""
+$hashFile = "$output.hash"
+
+if (-not $Force -and (Test-Path $output) -and (Test-Path $hashFile) -and ((Get-Content $hashFile -Raw).Trim() -eq $buildHash)) {
+    Write-Host "`n[UP TO DATE] $output (sources and flags unchanged)" -ForegroundColor Green
+    exit 0
+}
+if (Test-Path $hashFile) {
+    Remove-Item $hashFile
+}
+
+# A running binary (the processing server of another job) cannot be overwritten on
+# Windows, but it can be renamed out of the way
+if (Test-Path $output) {
+    Remove-Item "$output.old" -ErrorAction SilentlyContinue
+    Move-Item $output "$output.old" -Force -ErrorAction SilentlyContinue
+}
+
 Write-Host "`nCompiling..." -ForegroundColor Yellow
 
 # Compile
 $process = Start-Process -FilePath $gppPath -ArgumentList $args -NoNewWindow -Wait -PassThru
 
 if ($process.ExitCode -eq 0) {
+    Set-Content -Path $hashFile -Value $buildHash
     Write-Host "`n[SUCCESS] Compilation completed!" -ForegroundColor Green
     Write-Host "`nOutput: $output" -ForegroundColor Cyan
     
@@ -165,7 +248,16 @@ if ($process.ExitCode -eq 0) {
     }
     
     Write-Host "`nRun with:" -ForegroundColor Cyan
-    if ($Program -match "pthread|openmp") {
+    if ($Program -eq "processing_server") {
+        Write-Host "  Started by the backend; jobs are read from stdin, one per line:" -ForegroundColor White
+        Write-Host "  run<TAB>ID<TAB>PROGRAM<TAB>ARGS...  (e.g. run  1  gaussian_blur_openmp  input.mp4  4  out.mp4)" -ForegroundColor Gray
+    } elseif ($Program -eq "kernel_bench") {
+        Write-Host "  .\$output [--benchmark_filter=REGEX] [--benchmark_format=json]" -ForegroundColor White
+        Write-Host "  Example: .\$output --benchmark_filter=GaussianBlur" -ForegroundColor Gray
+    } elseif ($Program -match "filter_chain") {
+        Write-Host "  .\$output VIDEO_FILE NUM_THREADS [OUTPUT_FILE] --filters a,b,c [--mode frame|pipeline]" -ForegroundColor White
+        Write-Host "  Example: .\$output input_videos\sample.mp4 4 --filters white_balance,frame_sharpening" -ForegroundColor Gray
+    } elseif ($Program -match "pthread|openmp") {
         Write-Host "  .\$output VIDEO_FILE NUM_THREADS" -ForegroundColor White
         Write-Host "  Example: .\$output input_videos\sample.mp4 4" -ForegroundColor Gray
     } else {
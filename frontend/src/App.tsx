@@ -152,7 +152,7 @@ function App() {
           setProcessing(false);
           setShowProgress(false);
           setError(resultsData.error || 'Processing failed');
-        } else if (resultsData.status === 'processing') {
+        } else if (resultsData.status === 'processing' || resultsData.status === 'queued') {
           // Update progress
           setProgress(resultsData.progress || 0);
           setProgressMessage(resultsData.message || 'Processing...');
@@ -34,6 +34,8 @@ export interface ProcessRequest {
   feature: string;
   openmp_threads: number;
   pthread_threads: number;
+  priority?: number;  // higher starts first when jobs wait for cores
+  mode?: 'benchmark' | 'throughput';  // throughput runs the three versions at once
 }
 
 export interface Metrics {
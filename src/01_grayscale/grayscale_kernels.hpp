@@ -0,0 +1,91 @@
+#pragma once
+
+// Grayscale kernels of the three grayscale programs, also used by the filter chain
+// (13_filter_chain) and the kernel benchmarks (bench/kernel_bench.cpp).
+//
+// The sequential program converts in place with the floating-point luminosity
+// weights and keeps three channels; the pthread and OpenMP programs write a
+// single-channel image with integer weights, (29*R + 150*G + 77*B) / 256.
+
+#include <opencv2/opencv.hpp>
+#include "../common/yuv_frame.hpp"
+
+// Gray = 0.299*R + 0.587*G + 0.114*B, written to all three channels
+inline void convertToGrayscale(cv::Mat &frame) {
+	int rows = frame.rows;
+	int cols = frame.cols;
+
+	// Optimize for continuous memory
+	if (frame.isContinuous()) {
+		cols *= rows;
+		rows = 1;
+	}
+
+	for (int i = 0; i < rows; ++i) {
+		cv::Vec3b *p = frame.ptr<cv::Vec3b>(i);
+		for (int j = 0; j < cols; ++j) {
+			// OpenCV uses BGR format: p[j][0]=B, p[j][1]=G, p[j][2]=R
+			int gray = (int)(0.114 * p[j][0] +   // Blue
+			                 0.587 * p[j][1] +   // Green
+			                 0.299 * p[j][2]);   // Red
+
+			// Set all channels to gray value
+			p[j][0] = p[j][1] = p[j][2] = gray;
+		}
+	}
+}
+
+// Single-channel gray with integer weights; for I420 input (i420) the Y plane
+inline void convertToGrayscaleOptimized(const cv::Mat &frame, cv::Mat &output, bool i420) {
+	if (i420) {
+		lumaToGray(frame, output);
+		return;
+	}
+
+	int rows = frame.rows;
+	int cols = frame.cols;
+
+	output.create(rows, cols, CV_8UC1);
+
+	// Use pointer arithmetic for speed
+	const uchar* src = frame.data;
+	uchar* dst = output.data;
+	int total = rows * cols;
+
+	for (int i = 0; i < total; ++i) {
+		int b = src[i * 3];
+		int g = src[i * 3 + 1];
+		int r = src[i * 3 + 2];
+		// Use integer multiplication (faster than float)
+		// 0.114*B + 0.587*G + 0.299*R ≈ (29*R + 150*G + 77*B) / 256
+		dst[i] = (29 * r + 150 * g + 77 * b) >> 8;
+	}
+}
+
+// The same with the pixels split across 'threads' OpenMP threads (one thread when
+// called inside another parallel region, as the OpenMP program does)
+inline void convertToGrayscaleParallel(const cv::Mat &frame, cv::Mat &output, bool i420, int threads) {
+	if (i420) {
+		lumaToGray(frame, output);
+		return;
+	}
+
+	int rows = frame.rows;
+	int cols = frame.cols;
+
+	output.create(rows, cols, CV_8UC1);
+
+	const uchar* src = frame.data;
+	uchar* dst = output.data;
+	int total = rows * cols;
+
+	#pragma omp parallel for num_threads(threads) schedule(static)
+	for (int i = 0; i < total; ++i) {
+		int idx = i * 3;
+		int b = src[idx];
+		int g = src[idx + 1];
+		int r = src[idx + 2];
+		// Integer arithmetic: (29*R + 150*G + 77*B) / 256
+		dst[i] = (29 * r + 150 * g + 77 * b) >> 8;
+	}
+}
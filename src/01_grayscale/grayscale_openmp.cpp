@@ -2,6 +2,15 @@
 #include <cstdio>
 #include <vector>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "grayscale_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -9,33 +18,13 @@ using namespace cv;
 #define OUTPUT_VIDEO true
 #define BATCH_SIZE 30  // Process 20 frames at a time
 
-int threadNum;
-
-// Fast grayscale conversion using SIMD-friendly integer arithmetic
-inline void convertToGrayscaleOptimized(const Mat &frame, Mat &output) {
-	int rows = frame.rows;
-	int cols = frame.cols;
-	
-	output.create(rows, cols, CV_8UC1);
-	
-	const uchar* src = frame.data;
-	uchar* dst = output.data;
-	int total = rows * cols;
-	
-	// OpenMP parallel loop with optimizations
-	#pragma omp parallel for num_threads(threadNum) schedule(static)
-	for (int i = 0; i < total; ++i) {
-		int idx = i * 3;
-		int b = src[idx];
-		int g = src[idx + 1];
-		int r = src[idx + 2];
-		// Integer arithmetic: (29*R + 150*G + 77*B) / 256
-		dst[i] = (29 * r + 150 * g + 77 * b) >> 8;
-	}
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -47,14 +36,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/01_grayscale/grayscale_openmp.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -63,9 +52,10 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool yuvInput = captureVideo.enableYuv();  // frames arrive in I420 (--yuv 1, see yuv_frame.hpp)
 	
 	// Setup output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), false);
@@ -75,6 +65,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 	
 	double Total = omp_get_wtime();
@@ -100,7 +92,9 @@ int main(int argc, const char** argv) {
 		
 		#pragma omp parallel for num_threads(threadNum) schedule(static)
 		for (int i = 0; i < (int)batch.size(); ++i) {
-			convertToGrayscaleOptimized(batch[i], grayBatch[i]);
+			localizeFrame(batch[i]);
+			ComputeTimer computeTimer;
+			convertToGrayscaleParallel(batch[i], grayBatch[i], yuvInput, threadNum);
 		}
 		
 		// Write frames (sequential, but batched for efficiency)
@@ -119,6 +113,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 	
 	// Print results
@@ -130,9 +127,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -3,6 +3,15 @@
 #include <cmath>
 #include <algorithm>
 #include <ctime>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "grayscale_kernels.hpp"
 
 #define SHOW_INFO false
 #define OUTPUT_VIDEO true
@@ -10,7 +19,7 @@
 using namespace std;
 using namespace cv;
 
-VideoWriter setOutput(const VideoCapture &input, const string &outputPath) {
+bool setOutput(FrameSink &output, const FrameSource &input, const string &outputPath) {
 	// Get video properties
 	Size S = Size((int)input.get(CAP_PROP_FRAME_WIDTH),
 		          (int)input.get(CAP_PROP_FRAME_HEIGHT));
@@ -18,44 +27,18 @@ VideoWriter setOutput(const VideoCapture &input, const string &outputPath) {
 	double fps = input.get(CAP_PROP_FPS);
 	
 	// Create video writer
-	VideoWriter output;
-	output.open(outputPath, 
-	            VideoWriter::fourcc('M', 'J', 'P', 'G'),
-	            fps, S, false);  // false = grayscale output
-	
-	return output;
-}
-
-void convertToGrayscale(Mat &frame) {
-	// Manual grayscale conversion using standard luminosity method
-	// Gray = 0.299*R + 0.587*G + 0.114*B
-	
-	int rows = frame.rows;
-	int cols = frame.cols;
-	
-	// Optimize for continuous memory
-	if (frame.isContinuous()) {
-		cols *= rows;
-		rows = 1;
-	}
-	
-	// Convert BGR to grayscale
-	for (int i = 0; i < rows; ++i) {
-		Vec3b *p = frame.ptr<Vec3b>(i);
-		for (int j = 0; j < cols; ++j) {
-			// OpenCV uses BGR format: p[j][0]=B, p[j][1]=G, p[j][2]=R
-			int gray = (int)(0.114 * p[j][0] +   // Blue
-			                 0.587 * p[j][1] +   // Green
-			                 0.299 * p[j][2]);   // Red
-			
-			// Set all channels to gray value
-			p[j][0] = p[j][1] = p[j][2] = gray;
-		}
-	}
+	return output.open(outputPath, 
+	                   VideoWriter::fourcc('M', 'J', 'P', 'G'),
+	                   fps, S, false);  // false = grayscale output
 }
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -67,8 +50,9 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/01_grayscale/grayscale_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	captureVideo.requireWritableFrames();  // the kernel works on the frames in place
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -78,6 +62,7 @@ int main(int argc, const char** argv) {
 	int fps = (int)captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool yuvInput = captureVideo.enableYuv();  // frames arrive in I420 (--yuv 1, see yuv_frame.hpp)
 	
 	if (SHOW_INFO) {
 		printf("Video Information:\n");
@@ -88,10 +73,9 @@ int main(int argc, const char** argv) {
 	}
 	
 	// Setup video output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
-		outputVideo = setOutput(captureVideo, outputPath);
-		if (!outputVideo.isOpened()) {
+		if (!setOutput(outputVideo, captureVideo, outputPath)) {
 			printf("Error: Cannot create output video file\n");
 			return -1;
 		}
@@ -102,7 +86,9 @@ int main(int argc, const char** argv) {
 	double Total = getTickCount(), Last;
 	
 	int processedFrames = 0;
-	Mat frame;
+	Mat frame, grayFrame;
+	
+	pinMainThread();
 	
 	printf("Processing video (Sequential)...\n");
 	
@@ -116,7 +102,14 @@ int main(int argc, const char** argv) {
 		
 		// Time processing
 		Last = getTickCount();
-		convertToGrayscale(frame);
+		ComputeTimer computeTimer;
+		if (yuvInput) {
+			// I420 input: the gray image is the Y plane
+			lumaToGray(frame, grayFrame);
+		} else {
+			convertToGrayscale(frame);
+		}
+		computeTimer.stop();
 		Calculate += getTickCount() - Last;
 		
 		// Time output
@@ -124,8 +117,7 @@ int main(int argc, const char** argv) {
 			Last = getTickCount();
 			
 			// Convert to grayscale for output
-			Mat grayFrame;
-			cvtColor(frame, grayFrame, COLOR_BGR2GRAY);
+			if (!yuvInput) cvtColor(frame, grayFrame, COLOR_BGR2GRAY);
 			outputVideo << grayFrame;
 			
 			Output += getTickCount() - Last;
@@ -140,6 +132,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -150,9 +145,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	// Release resources
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
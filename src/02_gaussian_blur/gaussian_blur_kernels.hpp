@@ -0,0 +1,11 @@
+#pragma once
+
+// Gaussian blur kernel of the blur programs, also used by the filter chain
+// (13_filter_chain) and the kernel benchmarks (bench/kernel_bench.cpp).
+
+#include <opencv2/opencv.hpp>
+
+// 15x15 kernel with sigma 5.0 for a strong blur; it reaches 7 rows above and below
+inline void applyGaussianBlur(const cv::Mat &frame, cv::Mat &output) {
+	cv::GaussianBlur(frame, output, cv::Size(15, 15), 5.0, 5.0);
+}
@@ -2,6 +2,14 @@
 #include <cstdio>
 #include <vector>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "gaussian_blur_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -9,16 +17,13 @@ using namespace cv;
 #define OUTPUT_VIDEO true
 #define BATCH_SIZE 30  // Increased batch size
 
-int threadNum;
-
-// Apply Gaussian Blur
-inline void applyGaussianBlur(const Mat &frame, Mat &output) {
-	// Using 15x15 kernel with sigma 5.0 for strong blur effect
-	GaussianBlur(frame, output, Size(15, 15), 5.0, 5.0);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -30,14 +35,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/02_gaussian_blur/gaussian_blur_openmp.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -48,7 +53,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 	
 	// Setup output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);
@@ -58,6 +63,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 	
 	double Total = omp_get_wtime();
@@ -83,6 +90,8 @@ int main(int argc, const char** argv) {
 		
 		#pragma omp parallel for num_threads(threadNum) schedule(static)
 		for (int i = 0; i < (int)batch.size(); ++i) {
+			localizeFrame(batch[i]);
+			ComputeTimer computeTimer;
 			applyGaussianBlur(batch[i], blurredBatch[i]);
 		}
 		
@@ -102,6 +111,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 	
 	// Print results
@@ -113,9 +125,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
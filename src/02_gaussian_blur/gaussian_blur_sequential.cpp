@@ -1,20 +1,26 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "gaussian_blur_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
 
-// Apply Gaussian Blur using OpenCV's optimized function
-void applyGaussianBlur(const Mat &frame, Mat &output) {
-	// Kernel size (must be odd): larger = more blur
-	// Using 15x15 kernel with sigma 5.0 for strong blur effect
-	GaussianBlur(frame, output, Size(15, 15), 5.0, 5.0);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -26,8 +32,8 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/02_gaussian_blur/gaussian_blur_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -39,7 +45,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 	
 	// Setup video output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -50,6 +56,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinMainThread();
+	
 	printf("Processing video (Sequential)...\n");
 	
 	double Total = getTickCount();
@@ -62,7 +70,9 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 		
 		// Apply Gaussian blur
+		ComputeTimer computeTimer;
 		applyGaussianBlur(frame, blurred);
+		computeTimer.stop();
 		
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -78,6 +88,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -88,9 +101,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	// Release resources
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
@@ -0,0 +1,31 @@
+#pragma once
+
+// Edge detection kernel of the edge detection programs, also used by the filter
+// chain (13_filter_chain) and the kernel benchmarks (bench/kernel_bench.cpp).
+
+#include <opencv2/opencv.hpp>
+#include "../common/frame_arena.hpp"
+#include "../common/yuv_frame.hpp"
+
+// Canny 50/150 on the blurred luminance (single-channel output); for I420 input
+// (i420) the luminance is the Y plane
+inline void applyEdgeDetection(const cv::Mat &frame, cv::Mat &output, bool i420 = false) {
+	ArenaScope scratch;
+	cv::Mat gray = scratch.mat();
+	cv::Mat blurred = scratch.mat();
+
+	// Convert to grayscale if needed
+	if (i420) {
+		lumaToGray(frame, gray);
+	} else if (frame.channels() == 3) {
+		cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+	} else {
+		gray = frame;
+	}
+
+	// Apply Gaussian blur to reduce noise
+	cv::GaussianBlur(gray, blurred, cv::Size(5, 5), 1.5);
+
+	// Parameters: low threshold = 50, high threshold = 150
+	cv::Canny(blurred, output, 50, 150);
+}
@@ -2,6 +2,15 @@
 #include <cstdio>
 #include <vector>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "edge_detection_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -9,28 +18,13 @@ using namespace cv;
 #define OUTPUT_VIDEO true
 #define BATCH_SIZE 30
 
-int threadNum;
-
-// Apply Canny Edge Detection
-inline void applyEdgeDetection(const Mat &frame, Mat &output) {
-	Mat gray;
-	
-	// Convert to grayscale if needed
-	if (frame.channels() == 3) {
-		cvtColor(frame, gray, COLOR_BGR2GRAY);
-	} else {
-		gray = frame;
-	}
-	
-	// Apply Gaussian blur to reduce noise
-	GaussianBlur(gray, gray, Size(5, 5), 1.5);
-	
-	// Apply Canny edge detection
-	Canny(gray, output, 50, 150);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -42,14 +36,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/03_edge_detection/edge_detection_openmp.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -58,9 +52,10 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool yuvInput = captureVideo.enableYuv();  // frames arrive in I420 (--yuv 1, see yuv_frame.hpp)
 	
 	// Setup output (grayscale)
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), false);  // false = grayscale
@@ -70,6 +65,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 	
 	double Total = omp_get_wtime();
@@ -95,7 +92,9 @@ int main(int argc, const char** argv) {
 		
 		#pragma omp parallel for num_threads(threadNum) schedule(static)
 		for (int i = 0; i < (int)batch.size(); ++i) {
-			applyEdgeDetection(batch[i], edgeBatch[i]);
+			localizeFrame(batch[i]);
+			ComputeTimer computeTimer;
+			applyEdgeDetection(batch[i], edgeBatch[i], yuvInput);
 		}
 		
 		// Write frames
@@ -114,6 +113,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 	
 	// Print results
@@ -125,9 +127,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -1,32 +1,27 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "edge_detection_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
 
-// Apply Canny Edge Detection
-void applyEdgeDetection(const Mat &frame, Mat &output) {
-	Mat gray;
-	
-	// Convert to grayscale if needed
-	if (frame.channels() == 3) {
-		cvtColor(frame, gray, COLOR_BGR2GRAY);
-	} else {
-		gray = frame;
-	}
-	
-	// Apply Gaussian blur to reduce noise
-	GaussianBlur(gray, gray, Size(5, 5), 1.5);
-	
-	// Apply Canny edge detection
-	// Parameters: low threshold = 50, high threshold = 150
-	Canny(gray, output, 50, 150);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -38,8 +33,8 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/03_edge_detection/edge_detection_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -49,9 +44,10 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool yuvInput = captureVideo.enableYuv();  // frames arrive in I420 (--yuv 1, see yuv_frame.hpp)
 	
 	// Setup video output (grayscale output for edge detection)
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -62,6 +58,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinMainThread();
+	
 	printf("Processing video (Sequential Edge Detection)...\n");
 	
 	double Total = getTickCount();
@@ -74,7 +72,9 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 		
 		// Apply edge detection
-		applyEdgeDetection(frame, edges);
+		ComputeTimer computeTimer;
+		applyEdgeDetection(frame, edges, yuvInput);
+		computeTimer.stop();
 		
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -90,6 +90,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -100,9 +103,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
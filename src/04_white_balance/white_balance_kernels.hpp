@@ -0,0 +1,59 @@
+#pragma once
+
+// White balance kernel of the white balance programs, also used by the filter chain
+// (13_filter_chain) and the kernel benchmarks (bench/kernel_bench.cpp).
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+
+// Gray-world correction in place, with green as the base channel
+inline void whiteBalance(cv::Mat &img) {
+	if (img.empty()) return;
+
+	int rows = img.rows;
+	int cols = img.cols;
+	int picSz = rows * cols;
+
+	long long bSum = 0, gSum = 0, rSum = 0;  // int overflows from about 8M pixels
+	int avg[3], base;
+
+	if (img.isContinuous()) {
+		cols *= rows;
+		rows = 1;
+	}
+
+	// Calculate average for each channel
+	for (int i = 0; i < rows; ++i) {
+		cv::Vec3b *p = img.ptr<cv::Vec3b>(i);
+		for (int j = 0; j < cols; ++j) {
+			bSum += p[j][0];
+			gSum += p[j][1];
+			rSum += p[j][2];
+		}
+	}
+
+	avg[0] = (double)bSum / picSz;
+	avg[1] = (double)gSum / picSz;
+	avg[2] = (double)rSum / picSz;
+
+	// Use green channel as base (gray world assumption)
+	base = avg[1];
+
+	// Create lookup tables for color correction (a channel averaging 0 counts as 1)
+	int tableB[256], tableG[256], tableR[256];
+	for (int i = 0; i < 256; ++i) {
+		tableB[i] = std::min(255, (int)(base * i / std::max(1, avg[0])));
+		tableG[i] = std::min(255, (int)(base * i / std::max(1, avg[1])));
+		tableR[i] = std::min(255, (int)(base * i / std::max(1, avg[2])));
+	}
+
+	// Apply white balance correction
+	for (int i = 0; i < rows; ++i) {
+		cv::Vec3b *p = img.ptr<cv::Vec3b>(i);
+		for (int j = 0; j < cols; ++j) {
+			p[j][0] = tableB[p[j][0]];
+			p[j][1] = tableG[p[j][1]];
+			p[j][2] = tableR[p[j][2]];
+		}
+	}
+}
@@ -3,6 +3,14 @@
 #include <cmath>
 #include <vector>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "white_balance_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -10,61 +18,13 @@ using namespace cv;
 #define OUTPUT_VIDEO true
 #define BATCH_SIZE 30
 
-int threadNum;
-
-void whiteBalance(Mat &img) {
-	if (img.empty()) return;
-
-	int rows = img.rows;
-	int cols = img.cols;
-	int picSz = rows * cols;
-
-	int bSum = 0, gSum = 0, rSum = 0;
-	int avg[3], base;
-
-	if (img.isContinuous()) {
-		cols *= rows;
-		rows = 1;
-	}
-
-	// Calculate average for each channel
-	for (int i = 0; i < rows; ++i) {
-		Vec3b *p = img.ptr<Vec3b>(i);
-		for (int j = 0; j < cols; ++j) {
-			bSum += p[j][0];
-			gSum += p[j][1];
-			rSum += p[j][2];
-		}
-	}
-
-	avg[0] = (double)bSum / picSz;
-	avg[1] = (double)gSum / picSz;
-	avg[2] = (double)rSum / picSz;
-
-	// Use green channel as base (gray world assumption)
-	base = avg[1];
-
-	// Create lookup tables for color correction
-	int tableB[256], tableG[256], tableR[256];
-	for (int i = 0; i < 256; ++i) {
-		tableB[i] = min(255, (int)(base * i / avg[0]));
-		tableG[i] = min(255, (int)(base * i / avg[1]));
-		tableR[i] = min(255, (int)(base * i / avg[2]));
-	}
-
-	// Apply white balance correction
-	for (int i = 0; i < rows; ++i) {
-		Vec3b *p = img.ptr<Vec3b>(i);
-		for (int j = 0; j < cols; ++j) {
-			p[j][0] = tableB[p[j][0]];
-			p[j][1] = tableG[p[j][1]];
-			p[j][2] = tableR[p[j][2]];
-		}
-	}
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -76,14 +36,15 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/04_white_balance/white_balance_openmp.avi";
 
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	captureVideo.requireWritableFrames();  // the kernel works on the frames in place
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -94,7 +55,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 
 	// Setup output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);
@@ -104,6 +65,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 
 	double Total = omp_get_wtime();
@@ -127,6 +90,8 @@ int main(int argc, const char** argv) {
 		// Process batch in parallel
 		#pragma omp parallel for num_threads(threadNum) schedule(static)
 		for (int i = 0; i < (int)batch.size(); ++i) {
+			localizeFrame(batch[i]);
+			ComputeTimer computeTimer;
 			whiteBalance(batch[i]);
 		}
 
@@ -146,6 +111,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 
 	// Print results
@@ -157,9 +125,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -8,6 +8,15 @@
 #include <thread>
 #include <atomic>
 #include <map>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/trace.hpp"
+#include "white_balance_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -36,6 +45,7 @@ public:
 	}
 
 	bool pop(FrameBatch &batch) {
+		QueueWaitTimer waitTimer;
 		unique_lock<mutex> lock(mtx);
 		cv.wait(lock, [this] { return !q.empty() || finished; });
 		if (q.empty()) return false;
@@ -44,6 +54,11 @@ public:
 		return true;
 	}
 
+	size_t size() {
+		lock_guard<mutex> lock(mtx);
+		return q.size();
+	}
+	
 	void setFinished() {
 		lock_guard<mutex> lock(mtx);
 		finished = true;
@@ -56,79 +71,44 @@ public:
 	}
 };
 
-int threadNum;
-BatchQueue inputQueue, processedQueue;
-atomic<int> framesProcessed(0);
-
-void whiteBalance(Mat &img) {
-	if (img.empty()) return;
-
-	int rows = img.rows;
-	int cols = img.cols;
-	int picSz = rows * cols;
-
-	int bSum = 0, gSum = 0, rSum = 0;
-	int avg[3], base;
-
-	if (img.isContinuous()) {
-		cols *= rows;
-		rows = 1;
-	}
-
-	// Calculate average for each channel
-	for (int i = 0; i < rows; ++i) {
-		Vec3b *p = img.ptr<Vec3b>(i);
-		for (int j = 0; j < cols; ++j) {
-			bSum += p[j][0];
-			gSum += p[j][1];
-			rSum += p[j][2];
-		}
-	}
-
-	avg[0] = (double)bSum / picSz;
-	avg[1] = (double)gSum / picSz;
-	avg[2] = (double)rSum / picSz;
-
-	// Use green channel as base (gray world assumption)
-	base = avg[1];
-
-	// Create lookup tables for color correction
-	int tableB[256], tableG[256], tableR[256];
-	for (int i = 0; i < 256; ++i) {
-		tableB[i] = min(255, (int)(base * i / avg[0]));
-		tableG[i] = min(255, (int)(base * i / avg[1]));
-		tableR[i] = min(255, (int)(base * i / avg[2]));
-	}
-
-	// Apply white balance correction
-	for (int i = 0; i < rows; ++i) {
-		Vec3b *p = img.ptr<Vec3b>(i);
-		for (int j = 0; j < cols; ++j) {
-			p[j][0] = tableB[p[j][0]];
-			p[j][1] = tableG[p[j][1]];
-			p[j][2] = tableR[p[j][2]];
-		}
-	}
-}
+// What the threads of one run share; main() builds a new one for every run
+struct RunState {
+	int threadNum = 1;
+	BatchQueue inputQueue, processedQueue;
+	atomic<int> framesProcessed{0};
+	QueueWatchGuard unwatch;  // last: the queues are unwatched before they go
+};
 
 // Worker thread: processes batches of frames
-void processingWorker(int tid) {
+void processingWorker(RunState &state, int tid) {
+	traceThreadName("worker " + to_string(tid));
+	pinThread(ROLE_WORKER, tid);
 	FrameBatch batch;
 
-	while (inputQueue.pop(batch)) {
+	while (state.inputQueue.pop(batch)) {
+		localizeFrames(batch.frames);
 		// Process all frames in batch
 		for (auto &frame : batch.frames) {
+			ComputeTimer computeTimer;
 			whiteBalance(frame);
-			framesProcessed++;
+			state.framesProcessed++;
 		}
 
 		// Send to output queue
-		processedQueue.push(move(batch));
+		state.processedQueue.push(move(batch));
 	}
 }
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	RunState state;
+	watchQueue("input", [&state] { return state.inputQueue.size(); });
+	watchQueue("processed", [&state] { return state.processedQueue.size(); });
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -140,14 +120,15 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 
-	threadNum = atoi(argv[2]);
-	if (threadNum < 1) threadNum = 1;
+	state.threadNum = atoi(argv[2]);
+	if (state.threadNum < 1) state.threadNum = 1;
 
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/04_white_balance/white_balance_pthread.avi";
 
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	captureVideo.requireWritableFrames();  // the kernel works on the frames in place
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -158,7 +139,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 
 	// Setup output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);
@@ -168,18 +149,20 @@ int main(int argc, const char** argv) {
 		}
 	}
 
-	printf("Processing video (Pthread with %d threads)...\n", threadNum);
+	printf("Processing video (Pthread with %d threads)...\n", state.threadNum);
 
 	double Total = getTickCount();
 
 	// Start worker threads
-	vector<thread> workers;
-	for (int i = 0; i < threadNum; ++i) {
-		workers.emplace_back(processingWorker, i);
+	vector<PooledThread> workers;
+	for (int i = 0; i < state.threadNum; ++i) {
+		workers.emplace_back(processingWorker, ref(state), i);
 	}
 
 	// Reading thread
-	thread readerThread([&]() {
+	PooledThread readerThread([&]() {
+		traceThreadName("reader");
+		pinThread(ROLE_READER);
 		int batchIndex = 0;
 		while (true) {
 			FrameBatch batch;
@@ -190,26 +173,28 @@ int main(int argc, const char** argv) {
 				Mat frame;
 				captureVideo >> frame;
 				if (frame.empty()) break;
-				batch.frames.push_back(frame.clone());
+				batch.frames.push_back(frame);
 			}
 
 			if (batch.frames.empty()) break;
 
-			inputQueue.push(move(batch));
+			state.inputQueue.push(move(batch));
 			batchIndex++;
 		}
 
-		inputQueue.setFinished();
+		state.inputQueue.setFinished();
 	});
 
 	// Writing thread
-	thread writerThread([&]() {
+	PooledThread writerThread([&]() {
+		traceThreadName("writer");
+		pinThread(ROLE_WRITER);
 		int expectedBatch = 0;
 		map<int, FrameBatch> outOfOrderBatches;
 
-		while (!processedQueue.isFinished()) {
+		while (!state.processedQueue.isFinished()) {
 			FrameBatch batch;
-			if (!processedQueue.pop(batch)) continue;
+			if (!state.processedQueue.pop(batch)) continue;
 
 			int batchIndex = batch.startIndex / BATCH_SIZE;
 
@@ -235,7 +220,7 @@ int main(int argc, const char** argv) {
 			}
 
 			// Show progress
-			int processed = framesProcessed.load();
+			int processed = state.framesProcessed.load();
 			if (processed % 30 == 0) {
 				printf("  Processed %d frames...\r", processed);
 				fflush(stdout);
@@ -248,25 +233,32 @@ int main(int argc, const char** argv) {
 	for (auto &worker : workers) {
 		worker.join();
 	}
-	processedQueue.setFinished();
+	state.processedQueue.setFinished();
 	writerThread.join();
 
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 
-	int totalFrames = framesProcessed.load();
+	int totalFrames = state.framesProcessed.load();
 
 	// Print results
 	printf("\n\n");
 	printf("========================================\n");
 	printf("White Balance - Pthread\n");
 	printf("========================================\n");
-	printf("Threads used: %d\n", threadNum);
+	printf("Threads used: %d\n", state.threadNum);
 	printf("Processed frames: %d\n", totalFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", totalFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 
+	metrics.write(totalFrames, state.threadNum, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -1,65 +1,27 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
 #include <cmath>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "white_balance_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
 
-void whiteBalance(Mat &img) {
-	if (img.empty()) return;
-
-	int rows = img.rows;
-	int cols = img.cols;
-	int picSz = rows * cols;
-
-	int bSum = 0, gSum = 0, rSum = 0;
-	int avg[3], base;
-
-	if (img.isContinuous()) {
-		cols *= rows;
-		rows = 1;
-	}
-
-	// Calculate average for each channel
-	for (int i = 0; i < rows; ++i) {
-		Vec3b *p = img.ptr<Vec3b>(i);
-		for (int j = 0; j < cols; ++j) {
-			bSum += p[j][0];
-			gSum += p[j][1];
-			rSum += p[j][2];
-		}
-	}
-
-	avg[0] = (double)bSum / picSz;
-	avg[1] = (double)gSum / picSz;
-	avg[2] = (double)rSum / picSz;
-
-	// Use green channel as base (gray world assumption)
-	base = avg[1];
-
-	// Create lookup tables for color correction
-	int tableB[256], tableG[256], tableR[256];
-	for (int i = 0; i < 256; ++i) {
-		tableB[i] = min(255, (int)(base * i / avg[0]));
-		tableG[i] = min(255, (int)(base * i / avg[1]));
-		tableR[i] = min(255, (int)(base * i / avg[2]));
-	}
-
-	// Apply white balance correction
-	for (int i = 0; i < rows; ++i) {
-		Vec3b *p = img.ptr<Vec3b>(i);
-		for (int j = 0; j < cols; ++j) {
-			p[j][0] = tableB[p[j][0]];
-			p[j][1] = tableG[p[j][1]];
-			p[j][2] = tableR[p[j][2]];
-		}
-	}
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -71,8 +33,9 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/04_white_balance/white_balance_sequential.avi";
 
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	captureVideo.requireWritableFrames();  // the kernel works on the frames in place
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -84,7 +47,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 
 	// Setup video output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -95,6 +58,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	pinMainThread();
+	
 	printf("Processing video (Sequential White Balance)...\n");
 
 	double Total = getTickCount();
@@ -107,7 +72,9 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 
 		// Apply white balance
+		ComputeTimer computeTimer;
 		whiteBalance(frame);
+		computeTimer.stop();
 
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -123,6 +90,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 
 	// Print results
@@ -133,9 +103,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -0,0 +1,44 @@
+#pragma once
+
+// Histogram equalization kernel of the histogram equalization programs, also used
+// by the filter chain (13_filter_chain) and the kernel benchmarks
+// (bench/kernel_bench.cpp).
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "../common/frame_arena.hpp"
+#include "../common/yuv_frame.hpp"
+
+// Equalize the luminance: the Y channel in YCrCb, or for I420 input (i420) the Y
+// plane, keeping the chroma planes without any color conversion
+inline void applyHistogramEqualization(const cv::Mat &frame, cv::Mat &output, bool i420 = false) {
+	ArenaScope scratch;
+
+	if (i420) {
+		cv::Mat equalized = scratch.mat();
+		cv::equalizeHist(i420Luma(frame), equalized);
+		output.create(frame.size(), frame.type());
+		cv::Mat outputLuma = i420Luma(output), outputChroma = i420Chroma(output);
+		grayToLuma(equalized, outputLuma);
+		i420Chroma(frame).copyTo(outputChroma);
+		return;
+	}
+
+	cv::Mat ycrcb = scratch.mat();
+
+	// Convert BGR to YCrCb color space
+	cv::cvtColor(frame, ycrcb, cv::COLOR_BGR2YCrCb);
+
+	// Split into Y, Cr, Cb channels
+	std::vector<cv::Mat> channels = scratch.mats(3);
+	cv::split(ycrcb, channels);
+
+	// Apply histogram equalization to Y channel (luminance)
+	cv::equalizeHist(channels[0], channels[0]);
+
+	// Merge channels back
+	cv::merge(channels, ycrcb);
+
+	// Convert back to BGR
+	cv::cvtColor(ycrcb, output, cv::COLOR_YCrCb2BGR);
+}
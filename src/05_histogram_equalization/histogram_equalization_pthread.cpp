@@ -7,6 +7,16 @@
 #include <thread>
 #include <atomic>
 #include <map>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "histogram_equalization_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -35,6 +45,7 @@ public:
 	}
 	
 	bool pop(FrameBatch &batch) {
+		QueueWaitTimer waitTimer;
 		unique_lock<mutex> lock(mtx);
 		cv.wait(lock, [this] { return !q.empty() || finished; });
 		if (q.empty()) return false;
@@ -43,6 +54,11 @@ public:
 		return true;
 	}
 	
+	size_t size() {
+		lock_guard<mutex> lock(mtx);
+		return q.size();
+	}
+	
 	void setFinished() {
 		lock_guard<mutex> lock(mtx);
 		finished = true;
@@ -55,57 +71,53 @@ public:
 	}
 };
 
-int threadNum;
-BatchQueue inputQueue, processedQueue;
-atomic<int> framesProcessed(0);
-
-// Apply Histogram Equalization
-inline void applyHistogramEqualization(const Mat &frame, Mat &output) {
-	Mat ycrcb;
-	
-	// Convert BGR to YCrCb color space
-	cvtColor(frame, ycrcb, COLOR_BGR2YCrCb);
-	
-	// Split into Y, Cr, Cb channels
-	vector<Mat> channels;
-	split(ycrcb, channels);
-	
-	// Apply histogram equalization to Y channel (luminance)
-	equalizeHist(channels[0], channels[0]);
-	
-	// Merge channels back
-	merge(channels, ycrcb);
-	
-	// Convert back to BGR
-	cvtColor(ycrcb, output, COLOR_YCrCb2BGR);
-}
+// What the threads of one run share; main() builds a new one for every run
+struct RunState {
+	int threadNum = 1;
+	bool yuvInput = false;  // frames arrive in I420 (--yuv 1, see yuv_frame.hpp)
+	BatchQueue inputQueue, processedQueue;
+	atomic<int> framesProcessed{0};
+	QueueWatchGuard unwatch;  // last: the queues are unwatched before they go
+};
 
 // Worker thread: processes batches of frames
-void processingWorker(int tid) {
+void processingWorker(RunState &state, int tid) {
+	traceThreadName("worker " + to_string(tid));
+	pinThread(ROLE_WORKER, tid);
 	FrameBatch batch;
 	
-	while (inputQueue.pop(batch)) {
+	while (state.inputQueue.pop(batch)) {
+		localizeFrames(batch.frames);
 		vector<Mat> equalizedFrames;
 		equalizedFrames.reserve(batch.frames.size());
 		
 		// Process all frames in batch
 		for (auto &frame : batch.frames) {
+			ComputeTimer computeTimer;
 			Mat equalized;
-			applyHistogramEqualization(frame, equalized);
+			applyHistogramEqualization(frame, equalized, state.yuvInput);
 			equalizedFrames.push_back(equalized);
-			framesProcessed++;
+			state.framesProcessed++;
 		}
 		
 		// Send to output queue
 		FrameBatch processedBatch;
 		processedBatch.frames = move(equalizedFrames);
 		processedBatch.startIndex = batch.startIndex;
-		processedQueue.push(processedBatch);
+		state.processedQueue.push(processedBatch);
 	}
 }
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	RunState state;
+	watchQueue("input", [&state] { return state.inputQueue.size(); });
+	watchQueue("processed", [&state] { return state.processedQueue.size(); });
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -117,14 +129,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
-	if (threadNum < 1) threadNum = 1;
+	state.threadNum = atoi(argv[2]);
+	if (state.threadNum < 1) state.threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/05_histogram_equalization/histogram_equalization_pthread.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -133,9 +145,10 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	state.yuvInput = captureVideo.enableYuv();
 	
 	// Setup output (color)
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);  // true = color
@@ -145,18 +158,20 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
-	printf("Processing video (Pthread with %d threads)...\n", threadNum);
+	printf("Processing video (Pthread with %d threads)...\n", state.threadNum);
 	
 	double Total = getTickCount();
 	
 	// Start worker threads
-	vector<thread> workers;
-	for (int i = 0; i < threadNum; ++i) {
-		workers.emplace_back(processingWorker, i);
+	vector<PooledThread> workers;
+	for (int i = 0; i < state.threadNum; ++i) {
+		workers.emplace_back(processingWorker, ref(state), i);
 	}
 	
 	// Reading thread
-	thread readerThread([&]() {
+	PooledThread readerThread([&]() {
+		traceThreadName("reader");
+		pinThread(ROLE_READER);
 		int batchIndex = 0;
 		while (true) {
 			FrameBatch batch;
@@ -167,26 +182,28 @@ int main(int argc, const char** argv) {
 				Mat frame;
 				captureVideo >> frame;
 				if (frame.empty()) break;
-				batch.frames.push_back(frame.clone());
+				batch.frames.push_back(frame);
 			}
 			
 			if (batch.frames.empty()) break;
 			
-			inputQueue.push(move(batch));
+			state.inputQueue.push(move(batch));
 			batchIndex++;
 		}
 		
-		inputQueue.setFinished();
+		state.inputQueue.setFinished();
 	});
 	
 	// Writing thread
-	thread writerThread([&]() {
+	PooledThread writerThread([&]() {
+		traceThreadName("writer");
+		pinThread(ROLE_WRITER);
 		int expectedBatch = 0;
 		map<int, FrameBatch> outOfOrderBatches;
 		
-		while (!processedQueue.isFinished()) {
+		while (!state.processedQueue.isFinished()) {
 			FrameBatch batch;
-			if (!processedQueue.pop(batch)) continue;
+			if (!state.processedQueue.pop(batch)) continue;
 			
 			int batchIndex = batch.startIndex / BATCH_SIZE;
 			
@@ -212,7 +229,7 @@ int main(int argc, const char** argv) {
 			}
 			
 			// Show progress
-			int processed = framesProcessed.load();
+			int processed = state.framesProcessed.load();
 			if (processed % 30 == 0) {
 				printf("  Processed %d frames...\r", processed);
 				fflush(stdout);
@@ -225,25 +242,32 @@ int main(int argc, const char** argv) {
 	for (auto &worker : workers) {
 		worker.join();
 	}
-	processedQueue.setFinished();
+	state.processedQueue.setFinished();
 	writerThread.join();
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
-	int totalFrames = framesProcessed.load();
+	int totalFrames = state.framesProcessed.load();
 	
 	// Print results
 	printf("\n\n");
 	printf("========================================\n");
 	printf("Histogram Equalization - Pthread\n");
 	printf("========================================\n");
-	printf("Threads used: %d\n", threadNum);
+	printf("Threads used: %d\n", state.threadNum);
 	printf("Processed frames: %d\n", totalFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", totalFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(totalFrames, state.threadNum, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -1,34 +1,27 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "histogram_equalization_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
 
-// Apply Histogram Equalization
-void applyHistogramEqualization(const Mat &frame, Mat &output) {
-	Mat ycrcb;
-	
-	// Convert BGR to YCrCb color space
-	cvtColor(frame, ycrcb, COLOR_BGR2YCrCb);
-	
-	// Split into Y, Cr, Cb channels
-	vector<Mat> channels;
-	split(ycrcb, channels);
-	
-	// Apply histogram equalization to Y channel (luminance)
-	equalizeHist(channels[0], channels[0]);
-	
-	// Merge channels back
-	merge(channels, ycrcb);
-	
-	// Convert back to BGR
-	cvtColor(ycrcb, output, COLOR_YCrCb2BGR);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -40,8 +33,8 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/05_histogram_equalization/histogram_equalization_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -51,9 +44,10 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool yuvInput = captureVideo.enableYuv();  // frames arrive in I420 (--yuv 1, see yuv_frame.hpp)
 	
 	// Setup video output (color output)
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -64,6 +58,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinMainThread();
+	
 	printf("Processing video (Sequential Histogram Equalization)...\n");
 	
 	double Total = getTickCount();
@@ -76,7 +72,9 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 		
 		// Apply histogram equalization
-		applyHistogramEqualization(frame, equalized);
+		ComputeTimer computeTimer;
+		applyHistogramEqualization(frame, equalized, yuvInput);
+		computeTimer.stop();
 		
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -92,6 +90,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -102,9 +103,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
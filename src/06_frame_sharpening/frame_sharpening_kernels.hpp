@@ -0,0 +1,29 @@
+#pragma once
+
+// Sharpening kernel of the frame sharpening programs, also used by the filter chain
+// (13_filter_chain) and the kernel benchmarks (bench/kernel_bench.cpp).
+//
+// Unsharp mask: sharpened = original + amount * (original - blurred). The two halves
+// are separate so the chain can blur a band of rows with its halo and combine only
+// the band.
+
+#include <opencv2/opencv.hpp>
+#include "../common/frame_arena.hpp"
+
+// 5x5 blur with sigma 1.0; it reaches 2 rows above and below
+inline void sharpenBlur(const cv::Mat &frame, cv::Mat &blurred) {
+	cv::GaussianBlur(frame, blurred, cv::Size(5, 5), 1.0);
+}
+
+// amount controls the strength of sharpening (1.5 is a good value)
+inline void sharpenCombine(const cv::Mat &frame, const cv::Mat &blurred, cv::Mat &output) {
+	double amount = 1.5;
+	cv::addWeighted(frame, 1.0 + amount, blurred, -amount, 0, output);
+}
+
+inline void applySharpen(const cv::Mat &frame, cv::Mat &output) {
+	ArenaScope scratch;
+	cv::Mat blurred = scratch.mat();
+	sharpenBlur(frame, blurred);
+	sharpenCombine(frame, blurred, output);
+}
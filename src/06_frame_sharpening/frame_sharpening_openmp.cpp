@@ -2,6 +2,14 @@
 #include <cstdio>
 #include <vector>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "frame_sharpening_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -9,23 +17,13 @@ using namespace cv;
 #define OUTPUT_VIDEO true
 #define BATCH_SIZE 30
 
-int threadNum;
-
-// Apply Frame Sharpening using Unsharp Masking
-inline void applySharpen(const Mat &frame, Mat &output) {
-	Mat blurred;
-	
-	// Apply Gaussian blur
-	GaussianBlur(frame, blurred, Size(5, 5), 1.0);
-	
-	// Unsharp mask formula: sharpened = original + amount * (original - blurred)
-	// amount controls the strength of sharpening (1.5 is a good value)
-	double amount = 1.5;
-	addWeighted(frame, 1.0 + amount, blurred, -amount, 0, output);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -37,14 +35,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/06_frame_sharpening/frame_sharpening_openmp.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -55,7 +53,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 	
 	// Setup output (color)
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);  // true = color
@@ -65,6 +63,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 	
 	double Total = omp_get_wtime();
@@ -90,6 +90,8 @@ int main(int argc, const char** argv) {
 		
 		#pragma omp parallel for num_threads(threadNum) schedule(static)
 		for (int i = 0; i < (int)batch.size(); ++i) {
+			localizeFrame(batch[i]);
+			ComputeTimer computeTimer;
 			applySharpen(batch[i], sharpenedBatch[i]);
 		}
 		
@@ -109,6 +111,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 	
 	// Print results
@@ -120,9 +125,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
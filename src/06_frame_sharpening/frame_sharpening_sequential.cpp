@@ -1,26 +1,26 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "frame_sharpening_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
 
-// Apply Frame Sharpening using Unsharp Masking
-void applySharpen(const Mat &frame, Mat &output) {
-	Mat blurred;
-	
-	// Apply Gaussian blur
-	GaussianBlur(frame, blurred, Size(5, 5), 1.0);
-	
-	// Unsharp mask formula: sharpened = original + amount * (original - blurred)
-	// amount controls the strength of sharpening (1.5 is a good value)
-	double amount = 1.5;
-	addWeighted(frame, 1.0 + amount, blurred, -amount, 0, output);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -32,8 +32,8 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/06_frame_sharpening/frame_sharpening_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -45,7 +45,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 	
 	// Setup video output (color output)
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -56,6 +56,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinMainThread();
+	
 	printf("Processing video (Sequential Frame Sharpening)...\n");
 	
 	double Total = getTickCount();
@@ -68,7 +70,9 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 		
 		// Apply sharpening
+		ComputeTimer computeTimer;
 		applySharpen(frame, sharpened);
+		computeTimer.stop();
 		
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -84,6 +88,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -94,9 +101,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -0,0 +1,96 @@
+#pragma once
+
+// Scene change test of the scene detection programs, also used by the filter chain
+// (13_filter_chain/stateful_filters.hpp).
+//
+// Three metrics between consecutive frames (HSV histogram correlation, changed Canny
+// edge pixels, mean pixel difference); a scene changes when two of them agree or one
+// is very strong.
+
+#include <opencv2/opencv.hpp>
+#include "../common/frame_arena.hpp"
+
+// Multi-metric scene detection thresholds
+#define HIST_THRESHOLD 0.70      // Histogram correlation threshold (lower = more sensitive)
+#define EDGE_THRESHOLD 0.30      // Edge difference threshold (higher = more sensitive)
+#define PIXEL_THRESHOLD 25.0     // Mean pixel difference threshold
+#define MIN_SCENE_GAP 15         // Minimum frames between scene changes (avoid duplicates)
+
+// Calculate histogram correlation between two frames
+inline double calculateHistogramCorrelation(const cv::Mat &frame1, const cv::Mat &frame2) {
+	ArenaScope scratch;
+	cv::Mat hsv1 = scratch.mat(), hsv2 = scratch.mat();
+	cv::cvtColor(frame1, hsv1, cv::COLOR_BGR2HSV);
+	cv::cvtColor(frame2, hsv2, cv::COLOR_BGR2HSV);
+
+	int h_bins = 50, s_bins = 60;
+	int histSize[] = {h_bins, s_bins};
+	float h_ranges[] = {0, 180};
+	float s_ranges[] = {0, 256};
+	const float* ranges[] = {h_ranges, s_ranges};
+	int channels[] = {0, 1};
+
+	cv::Mat hist1 = scratch.mat(), hist2 = scratch.mat();
+	cv::calcHist(&hsv1, 1, channels, cv::Mat(), hist1, 2, histSize, ranges, true, false);
+	cv::calcHist(&hsv2, 1, channels, cv::Mat(), hist2, 2, histSize, ranges, true, false);
+
+	cv::normalize(hist1, hist1, 0, 1, cv::NORM_MINMAX);
+	cv::normalize(hist2, hist2, 0, 1, cv::NORM_MINMAX);
+
+	return cv::compareHist(hist1, hist2, cv::HISTCMP_CORREL);
+}
+
+// Calculate edge-based difference
+inline double calculateEdgeDifference(const cv::Mat &frame1, const cv::Mat &frame2) {
+	ArenaScope scratch;
+	cv::Mat gray1 = scratch.mat(), gray2 = scratch.mat();
+	cv::Mat edges1 = scratch.mat(), edges2 = scratch.mat();
+	cv::cvtColor(frame1, gray1, cv::COLOR_BGR2GRAY);
+	cv::cvtColor(frame2, gray2, cv::COLOR_BGR2GRAY);
+
+	// Apply Canny edge detection
+	cv::Canny(gray1, edges1, 50, 150);
+	cv::Canny(gray2, edges2, 50, 150);
+
+	// Calculate difference in edge pixels
+	cv::Mat diff = scratch.mat();
+	cv::absdiff(edges1, edges2, diff);
+
+	// Return percentage of changed edge pixels
+	return (double)cv::countNonZero(diff) / (frame1.rows * frame1.cols);
+}
+
+// Calculate mean pixel difference
+inline double calculatePixelDifference(const cv::Mat &frame1, const cv::Mat &frame2) {
+	ArenaScope scratch;
+	cv::Mat diff = scratch.mat();
+	cv::absdiff(frame1, frame2, diff);
+
+	cv::Scalar meanDiff = cv::mean(diff);
+	return (meanDiff[0] + meanDiff[1] + meanDiff[2]) / 3.0;
+}
+
+// Scene detection using multiple metrics; 'score' is 0-100, higher = more likely a
+// scene change
+inline bool isSceneChange(const cv::Mat &prevFrame, const cv::Mat &currFrame, double &score) {
+	// Calculate multiple metrics
+	double histCorr = calculateHistogramCorrelation(prevFrame, currFrame);
+	double edgeDiff = calculateEdgeDifference(prevFrame, currFrame);
+	double pixelDiff = calculatePixelDifference(prevFrame, currFrame);
+
+	// Combine metrics (weighted decision)
+	bool histChange = (histCorr < HIST_THRESHOLD);
+	bool edgeChange = (edgeDiff > EDGE_THRESHOLD);
+	bool pixelChange = (pixelDiff > PIXEL_THRESHOLD);
+
+	score = 0.0;
+	if (histChange) score += 40.0 * (1.0 - histCorr);
+	if (edgeChange) score += 30.0 * edgeDiff;
+	if (pixelChange) score += 30.0 * (pixelDiff / 100.0);
+
+	// Scene change if at least 2 metrics agree OR very strong signal on any metric
+	int agreementCount = (histChange ? 1 : 0) + (edgeChange ? 1 : 0) + (pixelChange ? 1 : 0);
+	bool strongSignal = (histCorr < 0.50) || (edgeDiff > 0.50) || (pixelDiff > 50.0);
+
+	return (agreementCount >= 2) || strongSignal;
+}
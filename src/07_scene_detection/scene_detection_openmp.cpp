@@ -3,89 +3,26 @@
 #include <vector>
 #include <omp.h>
 #include <algorithm>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "scene_detection_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
-// Multi-metric scene detection thresholds
-#define HIST_THRESHOLD 0.70      // Histogram correlation threshold
-#define EDGE_THRESHOLD 0.30      // Edge difference threshold
-#define PIXEL_THRESHOLD 25.0     // Mean pixel difference threshold
-#define MIN_SCENE_GAP 15         // Minimum frames between scene changes
 #define BATCH_SIZE 30
 
-int threadNum;
-
-// Calculate histogram correlation
-double calculateHistogramCorrelation(const Mat &frame1, const Mat &frame2) {
-	Mat hsv1, hsv2;
-	cvtColor(frame1, hsv1, COLOR_BGR2HSV);
-	cvtColor(frame2, hsv2, COLOR_BGR2HSV);
-	
-	int h_bins = 50, s_bins = 60;
-	int histSize[] = {h_bins, s_bins};
-	float h_ranges[] = {0, 180};
-	float s_ranges[] = {0, 256};
-	const float* ranges[] = {h_ranges, s_ranges};
-	int channels[] = {0, 1};
-	
-	Mat hist1, hist2;
-	calcHist(&hsv1, 1, channels, Mat(), hist1, 2, histSize, ranges, true, false);
-	calcHist(&hsv2, 1, channels, Mat(), hist2, 2, histSize, ranges, true, false);
-	
-	normalize(hist1, hist1, 0, 1, NORM_MINMAX);
-	normalize(hist2, hist2, 0, 1, NORM_MINMAX);
-	
-	return compareHist(hist1, hist2, HISTCMP_CORREL);
-}
-
-// Calculate edge-based difference
-double calculateEdgeDifference(const Mat &frame1, const Mat &frame2) {
-	Mat gray1, gray2, edges1, edges2;
-	cvtColor(frame1, gray1, COLOR_BGR2GRAY);
-	cvtColor(frame2, gray2, COLOR_BGR2GRAY);
-	
-	Canny(gray1, edges1, 50, 150);
-	Canny(gray2, edges2, 50, 150);
-	
-	Mat diff;
-	absdiff(edges1, edges2, diff);
-	
-	return (double)countNonZero(diff) / (frame1.rows * frame1.cols);
-}
-
-// Calculate mean pixel difference
-double calculatePixelDifference(const Mat &frame1, const Mat &frame2) {
-	Mat diff;
-	absdiff(frame1, frame2, diff);
-	
-	Scalar meanDiff = mean(diff);
-	return (meanDiff[0] + meanDiff[1] + meanDiff[2]) / 3.0;
-}
-
-// Improved scene detection using multiple metrics
-bool isSceneChange(const Mat &prevFrame, const Mat &currFrame, double &score) {
-	double histCorr = calculateHistogramCorrelation(prevFrame, currFrame);
-	double edgeDiff = calculateEdgeDifference(prevFrame, currFrame);
-	double pixelDiff = calculatePixelDifference(prevFrame, currFrame);
-	
-	bool histChange = (histCorr < HIST_THRESHOLD);
-	bool edgeChange = (edgeDiff > EDGE_THRESHOLD);
-	bool pixelChange = (pixelDiff > PIXEL_THRESHOLD);
-	
-	score = 0.0;
-	if (histChange) score += 40.0 * (1.0 - histCorr);
-	if (edgeChange) score += 30.0 * edgeDiff;
-	if (pixelChange) score += 30.0 * (pixelDiff / 100.0);
-	
-	int agreementCount = (histChange ? 1 : 0) + (edgeChange ? 1 : 0) + (pixelChange ? 1 : 0);
-	bool strongSignal = (histCorr < 0.50) || (edgeDiff > 0.50) || (pixelDiff > 50.0);
-	
-	return (agreementCount >= 2) || strongSignal;
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
 		return 0;
@@ -96,13 +33,13 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/07_scene_detection/scene_detection_openmp.txt";
 	
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -110,6 +47,8 @@ int main(int argc, const char** argv) {
 	int frameCount = (int)captureVideo.get(CAP_PROP_FRAME_COUNT);
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 	printf("Total frames: %d, FPS: %.2f\n", frameCount, fps);
 	
@@ -159,6 +98,9 @@ int main(int argc, const char** argv) {
 		
 		#pragma omp parallel for num_threads(threadNum) schedule(static)
 		for (int i = 0; i < (int)prevBatch.size(); ++i) {
+			localizeFrame(prevBatch[i]);
+			localizeFrame(currBatch[i]);
+			ComputeTimer computeTimer;
 			sceneFlags[i] = isSceneChange(prevBatch[i], currBatch[i], scores[i]);
 		}
 		
@@ -219,9 +161,13 @@ int main(int argc, const char** argv) {
 	printf("Detection: Multi-metric (Histogram + Edge + Pixel)\n");
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", frameNumber / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(frameNumber, threadNum, Total, captureVideo, nullptr);
+	trace.write();
+	
 	captureVideo.release();
 	
 	return 0;
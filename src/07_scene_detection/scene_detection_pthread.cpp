@@ -8,15 +8,18 @@
 #include <atomic>
 #include <map>
 #include <algorithm>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/trace.hpp"
+#include "scene_detection_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
-// Multi-metric scene detection thresholds
-#define HIST_THRESHOLD 0.70      // Histogram correlation threshold
-#define EDGE_THRESHOLD 0.30      // Edge difference threshold
-#define PIXEL_THRESHOLD 25.0     // Mean pixel difference threshold
-#define MIN_SCENE_GAP 15         // Minimum frames between scene changes
 #define BATCH_SIZE 10
 
 struct FramePair {
@@ -48,6 +51,7 @@ public:
 	}
 	
 	bool pop(T &item) {
+		QueueWaitTimer waitTimer;
 		unique_lock<mutex> lock(mtx);
 		cv.wait(lock, [this] { return !q.empty() || finished; });
 		if (q.empty()) return false;
@@ -56,6 +60,11 @@ public:
 		return true;
 	}
 	
+	size_t size() {
+		lock_guard<mutex> lock(mtx);
+		return q.size();
+	}
+	
 	void setFinished() {
 		lock_guard<mutex> lock(mtx);
 		finished = true;
@@ -68,99 +77,50 @@ public:
 	}
 };
 
-int threadNum;
-ThreadSafeQueue<vector<FramePair>> inputQueue;
-ThreadSafeQueue<vector<ComparisonResult>> resultQueue;
-atomic<int> framesProcessed(0);
-
-// Calculate histogram correlation
-double calculateHistogramCorrelation(const Mat &frame1, const Mat &frame2) {
-	Mat hsv1, hsv2;
-	cvtColor(frame1, hsv1, COLOR_BGR2HSV);
-	cvtColor(frame2, hsv2, COLOR_BGR2HSV);
-	
-	int h_bins = 50, s_bins = 60;
-	int histSize[] = {h_bins, s_bins};
-	float h_ranges[] = {0, 180};
-	float s_ranges[] = {0, 256};
-	const float* ranges[] = {h_ranges, s_ranges};
-	int channels[] = {0, 1};
-	
-	Mat hist1, hist2;
-	calcHist(&hsv1, 1, channels, Mat(), hist1, 2, histSize, ranges, true, false);
-	calcHist(&hsv2, 1, channels, Mat(), hist2, 2, histSize, ranges, true, false);
-	
-	normalize(hist1, hist1, 0, 1, NORM_MINMAX);
-	normalize(hist2, hist2, 0, 1, NORM_MINMAX);
-	
-	return compareHist(hist1, hist2, HISTCMP_CORREL);
-}
-
-// Calculate edge-based difference
-double calculateEdgeDifference(const Mat &frame1, const Mat &frame2) {
-	Mat gray1, gray2, edges1, edges2;
-	cvtColor(frame1, gray1, COLOR_BGR2GRAY);
-	cvtColor(frame2, gray2, COLOR_BGR2GRAY);
-	
-	Canny(gray1, edges1, 50, 150);
-	Canny(gray2, edges2, 50, 150);
-	
-	Mat diff;
-	absdiff(edges1, edges2, diff);
-	
-	return (double)countNonZero(diff) / (frame1.rows * frame1.cols);
-}
-
-// Calculate mean pixel difference
-double calculatePixelDifference(const Mat &frame1, const Mat &frame2) {
-	Mat diff;
-	absdiff(frame1, frame2, diff);
-	
-	Scalar meanDiff = mean(diff);
-	return (meanDiff[0] + meanDiff[1] + meanDiff[2]) / 3.0;
-}
-
-// Improved scene detection using multiple metrics
-bool isSceneChange(const Mat &prevFrame, const Mat &currFrame, double &score) {
-	double histCorr = calculateHistogramCorrelation(prevFrame, currFrame);
-	double edgeDiff = calculateEdgeDifference(prevFrame, currFrame);
-	double pixelDiff = calculatePixelDifference(prevFrame, currFrame);
-	
-	bool histChange = (histCorr < HIST_THRESHOLD);
-	bool edgeChange = (edgeDiff > EDGE_THRESHOLD);
-	bool pixelChange = (pixelDiff > PIXEL_THRESHOLD);
-	
-	score = 0.0;
-	if (histChange) score += 40.0 * (1.0 - histCorr);
-	if (edgeChange) score += 30.0 * edgeDiff;
-	if (pixelChange) score += 30.0 * (pixelDiff / 100.0);
-	
-	int agreementCount = (histChange ? 1 : 0) + (edgeChange ? 1 : 0) + (pixelChange ? 1 : 0);
-	bool strongSignal = (histCorr < 0.50) || (edgeDiff > 0.50) || (pixelDiff > 50.0);
-	
-	return (agreementCount >= 2) || strongSignal;
-}
+// What the threads of one run share; main() builds a new one for every run
+struct RunState {
+	int threadNum = 1;
+	ThreadSafeQueue<vector<FramePair>> inputQueue;
+	ThreadSafeQueue<vector<ComparisonResult>> resultQueue;
+	atomic<int> framesProcessed{0};
+	QueueWatchGuard unwatch;  // last: the queues are unwatched before they go
+};
 
 // Worker thread
-void processingWorker(int tid) {
+void processingWorker(RunState &state, int tid) {
+	traceThreadName("worker " + to_string(tid));
+	pinThread(ROLE_WORKER, tid);
 	vector<FramePair> batch;
 	
-	while (inputQueue.pop(batch)) {
+	while (state.inputQueue.pop(batch)) {
+		for (auto &pair : batch) {
+			localizeFrame(pair.frame1);
+			localizeFrame(pair.frame2);
+		}
 		vector<ComparisonResult> results;
 		
 		for (auto &pair : batch) {
+			ComputeTimer computeTimer;
 			double score = 0.0;
 			bool isChange = isSceneChange(pair.frame1, pair.frame2, score);
 			results.push_back({pair.frameNumber, score, isChange});
-			framesProcessed++;
+			state.framesProcessed++;
 		}
 		
-		resultQueue.push(move(results));
+		state.resultQueue.push(move(results));
 	}
 }
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	RunState state;
+	watchQueue("input", [&state] { return state.inputQueue.size(); });
+	watchQueue("results", [&state] { return state.resultQueue.size(); });
+	
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
 		return 0;
@@ -171,13 +131,13 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
-	if (threadNum < 1) threadNum = 1;
+	state.threadNum = atoi(argv[2]);
+	if (state.threadNum < 1) state.threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/07_scene_detection/scene_detection_pthread.txt";
 	
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -185,19 +145,21 @@ int main(int argc, const char** argv) {
 	int frameCount = (int)captureVideo.get(CAP_PROP_FRAME_COUNT);
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	
-	printf("Processing video (Pthread with %d threads)...\n", threadNum);
+	printf("Processing video (Pthread with %d threads)...\n", state.threadNum);
 	printf("Total frames: %d, FPS: %.2f\n", frameCount, fps);
 	
 	double Total = getTickCount();
 	
 	// Start worker threads
-	vector<thread> workers;
-	for (int i = 0; i < threadNum; ++i) {
-		workers.emplace_back(processingWorker, i);
+	vector<PooledThread> workers;
+	for (int i = 0; i < state.threadNum; ++i) {
+		workers.emplace_back(processingWorker, ref(state), i);
 	}
 	
 	// Reading thread
-	thread readerThread([&]() {
+	PooledThread readerThread([&]() {
+		traceThreadName("reader");
+		pinThread(ROLE_READER);
 		Mat prevFrame, currFrame;
 		int frameNumber = 0;
 		
@@ -221,7 +183,7 @@ int main(int argc, const char** argv) {
 			batch.push_back(pair);
 			
 			if (batch.size() >= BATCH_SIZE) {
-				inputQueue.push(move(batch));
+				state.inputQueue.push(move(batch));
 				batch.clear();
 				batch.reserve(BATCH_SIZE);
 			}
@@ -230,10 +192,10 @@ int main(int argc, const char** argv) {
 		}
 		
 		if (!batch.empty()) {
-			inputQueue.push(move(batch));
+			state.inputQueue.push(move(batch));
 		}
 		
-		inputQueue.setFinished();
+		state.inputQueue.setFinished();
 	});
 	
 	// Collector thread
@@ -242,10 +204,12 @@ int main(int argc, const char** argv) {
 	int lastSceneFrame = -MIN_SCENE_GAP;
 	mutex sceneMutex;
 	
-	thread collectorThread([&]() {
+	PooledThread collectorThread([&]() {
+		traceThreadName("collector");
+		pinThread(ROLE_WRITER);
 		vector<ComparisonResult> results;
 		
-		while (resultQueue.pop(results)) {
+		while (state.resultQueue.pop(results)) {
 			for (auto &res : results) {
 				if (res.isSceneChange) {
 					lock_guard<mutex> lock(sceneMutex);
@@ -259,7 +223,7 @@ int main(int argc, const char** argv) {
 					}
 				}
 				
-				int processed = framesProcessed.load();
+				int processed = state.framesProcessed.load();
 				if (processed % 30 == 0) {
 					printf("  Processed %d frames...\r", processed);
 					fflush(stdout);
@@ -273,12 +237,12 @@ int main(int argc, const char** argv) {
 	for (auto &worker : workers) {
 		worker.join();
 	}
-	resultQueue.setFinished();
+	state.resultQueue.setFinished();
 	collectorThread.join();
 	
 	Total = getTickCount() - Total;
 	
-	int totalFrames = framesProcessed.load();
+	int totalFrames = state.framesProcessed.load();
 	
 	// Sort scene changes by frame number
 	sort(sceneChanges.begin(), sceneChanges.end());
@@ -313,13 +277,17 @@ int main(int argc, const char** argv) {
 	printf("========================================\n");
 	printf("Processed frames: %d\n", totalFrames);
 	printf("Detected scene changes: %d\n", (int)sceneChanges.size());
-	printf("Threads used: %d\n", threadNum);
+	printf("Threads used: %d\n", state.threadNum);
 	printf("Detection: Multi-metric (Histogram + Edge + Pixel)\n");
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", totalFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(totalFrames, state.threadNum, Total / getTickFrequency(), captureVideo, nullptr);
+	trace.write();
+	
 	captureVideo.release();
 	
 	return 0;
@@ -2,17 +2,29 @@
 #include <cstdio>
 #include <vector>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "foreground_roi.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
-#define BATCH_SIZE 5  // Smaller batch for background subtraction (stateful operation)
-
-int threadNum;
+#define BATCH_SIZE 30
+#define BANDS_PER_THREAD 4  // Row bands per thread for load balancing
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -24,14 +36,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/08_background_subtraction/background_subtraction_openmp.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -40,10 +52,11 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool writeMask = OUTPUT_VIDEO && options.getBool("mask-video", true);
 	
 	// Setup output (grayscale)
-	VideoWriter outputVideo;
-	if (OUTPUT_VIDEO) {
+	FrameSink outputVideo(options);
+	if (writeMask) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), false);  // false = grayscale
 		if (!outputVideo.isOpened()) {
@@ -52,16 +65,35 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 	
-	// Create thread-local background subtractors
-	vector<Ptr<BackgroundSubtractorMOG2>> subtractors(threadNum);
-	#pragma omp parallel num_threads(threadNum)
-	{
-		int tid = omp_get_thread_num();
-		subtractors[tid] = createBackgroundSubtractorMOG2();
-		subtractors[tid]->setDetectShadows(true);
+	// Shared background model: each row band owns its slice of the model state
+	GmmParams gmmParams;
+	gmmParams.components = options.getInt("components", gmmParams.components);
+	gmmParams.learningRate = options.getDouble("learning-rate", gmmParams.learningRate);
+	gmmParams.history = options.getInt("history", gmmParams.history);
+	gmmParams.detectShadows = options.getBool("detect-shadows", gmmParams.detectShadows);
+	
+	GaussianMixtureBackground backgroundModel;
+	backgroundModel.init(height, width, gmmParams);
+	
+	// Optional region of interest, reduced-rate model updates and foreground sidecar
+	RoiMask roi;
+	if (!roi.init(height, width, options.getString("roi"), options.getString("roi-mask"))) {
+		printf("Error: Invalid ROI (use --roi \"x,y x,y x,y;...\" or --roi-mask <image>)\n");
+		return -1;
 	}
+	int updateStride = max(1, options.getInt("update-stride", 1));
+	
+	ForegroundSidecar sidecar;
+	if (options.has("sidecar") && !sidecar.open(options.getString("sidecar"))) {
+		printf("Error: Cannot create sidecar file: %s\n", options.getString("sidecar").c_str());
+		return -1;
+	}
+	
+	int bands = threadNum * BANDS_PER_THREAD;
 	
 	double Total = omp_get_wtime();
 	int processedFrames = 0;
@@ -81,17 +113,38 @@ int main(int argc, const char** argv) {
 		
 		if (batch.empty()) break;
 		
-		// Process batch in parallel (each thread processes different frames)
 		vector<Mat> fgMasks(batch.size());
+		for (auto &fgMask : fgMasks) {
+			fgMask.create(height, width, CV_8UC1);
+		}
+		vector<ForegroundStats> bandStats(bands * batch.size());
 		
-		#pragma omp parallel for num_threads(threadNum) schedule(static)
-		for (int i = 0; i < (int)batch.size(); ++i) {
-			int tid = omp_get_thread_num();
-			subtractors[tid]->apply(batch[i], fgMasks[i]);
+		// Process batch in parallel: each task walks one row band through every
+		// frame of the batch in order, so no synchronization is needed per frame
+		#pragma omp parallel for num_threads(threadNum) schedule(dynamic)
+		for (int b = 0; b < bands; ++b) {
+			ComputeTimer computeTimer;
+			int rowBegin = roi.bandRow(b, bands);
+			int rowEnd = roi.bandRow(b + 1, bands);
+			for (int i = 0; i < (int)batch.size(); ++i) {
+				applyBackgroundModel(backgroundModel, batch[i], fgMasks[i], processedFrames + i, updateStride, roi,
+				                     rowBegin, rowEnd, bandStats[b * batch.size() + i]);
+			}
+		}
+		
+		// Merge the per-band foreground summaries
+		if (sidecar.isOpened()) {
+			for (int i = 0; i < (int)batch.size(); ++i) {
+				ForegroundStats stats;
+				for (int b = 0; b < bands; ++b) {
+					stats.merge(bandStats[b * batch.size() + i]);
+				}
+				sidecar.write(processedFrames + i, stats);
+			}
 		}
 		
 		// Write frames
-		if (OUTPUT_VIDEO) {
+		if (writeMask) {
 			for (auto &fgMask : fgMasks) {
 				outputVideo << fgMask;
 			}
@@ -106,6 +159,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 	
 	// Print results
@@ -117,11 +173,21 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
-	printf("Output saved to: %s\n", outputPath.c_str());
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
+	if (writeMask) {
+		printf("Output saved to: %s\n", outputPath.c_str());
+	}
+	if (sidecar.isOpened()) {
+		printf("Sidecar saved to: %s\n", options.getString("sidecar").c_str());
+		sidecar.close();
+	}
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
-	if (OUTPUT_VIDEO) {
+	if (writeMask) {
 		outputVideo.release();
 	}
 	
@@ -7,6 +7,16 @@
 #include <thread>
 #include <atomic>
 #include <map>
+#include <memory>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/trace.hpp"
+#include "foreground_roi.hpp"
 
 using namespace std;
 using namespace cv;
@@ -16,7 +26,11 @@ using namespace cv;
 
 struct FrameBatch {
 	vector<Mat> frames;
+	vector<Mat> masks;
 	int startIndex;
+	shared_ptr<atomic<int>> pendingBands;  // Row bands still working on this batch
+	shared_ptr<vector<ForegroundStats>> stats;  // Per frame, merged across bands
+	shared_ptr<mutex> statsMutex;
 };
 
 // Thread-safe queue
@@ -35,6 +49,7 @@ public:
 	}
 	
 	bool pop(FrameBatch &batch) {
+		QueueWaitTimer waitTimer;
 		unique_lock<mutex> lock(mtx);
 		cv.wait(lock, [this] { return !q.empty() || finished; });
 		if (q.empty()) return false;
@@ -43,6 +58,11 @@ public:
 		return true;
 	}
 	
+	size_t size() {
+		lock_guard<mutex> lock(mtx);
+		return q.size();
+	}
+	
 	void setFinished() {
 		lock_guard<mutex> lock(mtx);
 		finished = true;
@@ -55,48 +75,70 @@ public:
 	}
 };
 
-int threadNum;
-BatchQueue inputQueue, processedQueue;
-atomic<int> framesProcessed(0);
+// What the threads of one run share; main() builds a new one for every run
+struct RunState {
+	int threadNum = 1;
+	vector<BatchQueue> bandQueues;  // One input queue per worker, every batch goes to all
+	BatchQueue processedQueue;
+	atomic<int> framesProcessed{0};
 
-// Thread-local background subtractors
-thread_local Ptr<BackgroundSubtractorMOG2> pBackSub;
-
-// Initialize background subtractor for this thread
-void initBackgroundSubtractor() {
-	pBackSub = createBackgroundSubtractorMOG2();
-	pBackSub->setDetectShadows(true);
-}
+	// Shared background model: each worker owns a fixed band of rows of the model state
+	GaussianMixtureBackground backgroundModel;
+	RoiMask roi;
+	int updateStride = 1;
+	QueueWatchGuard unwatch;  // last: the queues are unwatched before they go
+};
 
-// Worker thread: processes batches of frames
-void processingWorker(int tid) {
-	// Initialize background subtractor for this thread
-	initBackgroundSubtractor();
-	
+// Worker thread: runs its row band through every frame of each batch, in order
+void processingWorker(RunState &state, int tid) {
+	traceThreadName("worker " + to_string(tid));
+	pinThread(ROLE_WORKER, tid);
 	FrameBatch batch;
 	
-	while (inputQueue.pop(batch)) {
-		vector<Mat> fgMasks;
-		fgMasks.reserve(batch.frames.size());
-		
-		// Process all frames in batch
+	while (state.bandQueues[tid].pop(batch)) {
+		// Every worker reads its band of the same frames, so they are not copied
 		for (auto &frame : batch.frames) {
-			Mat fgMask;
-			pBackSub->apply(frame, fgMask);
-			fgMasks.push_back(fgMask);
-			framesProcessed++;
+			countFrameTraffic(frame, 1.0 / state.threadNum);
+		}
+		int rowBegin = state.roi.bandRow(tid, state.threadNum);
+		int rowEnd = state.roi.bandRow(tid + 1, state.threadNum);
+		
+		ComputeTimer computeTimer;
+		vector<ForegroundStats> bandStats(batch.frames.size());
+		for (int i = 0; i < (int)batch.frames.size(); ++i) {
+			applyBackgroundModel(state.backgroundModel, batch.frames[i], batch.masks[i], batch.startIndex + i,
+			                     state.updateStride, state.roi, rowBegin, rowEnd, bandStats[i]);
+		}
+		computeTimer.stop();
+		{
+			lock_guard<mutex> lock(*batch.statsMutex);
+			for (int i = 0; i < (int)bandStats.size(); ++i) {
+				(*batch.stats)[i].merge(bandStats[i]);
+			}
 		}
 		
-		// Send to output queue
-		FrameBatch processedBatch;
-		processedBatch.frames = move(fgMasks);
-		processedBatch.startIndex = batch.startIndex;
-		processedQueue.push(processedBatch);
+		// The last band to finish sends the masks to the output queue
+		if (--(*batch.pendingBands) == 0) {
+			state.framesProcessed += batch.frames.size();
+			
+			FrameBatch processedBatch;
+			processedBatch.frames = move(batch.masks);
+			processedBatch.startIndex = batch.startIndex;
+			processedBatch.stats = batch.stats;
+			state.processedQueue.push(processedBatch);
+		}
 	}
 }
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	RunState state;
+	watchQueue("processed", [&state] { return state.processedQueue.size(); });
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -108,14 +150,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
-	if (threadNum < 1) threadNum = 1;
+	state.threadNum = atoi(argv[2]);
+	if (state.threadNum < 1) state.threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/08_background_subtraction/background_subtraction_pthread.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -124,10 +166,11 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool writeMask = OUTPUT_VIDEO && options.getBool("mask-video", true);
 	
 	// Setup output (grayscale)
-	VideoWriter outputVideo;
-	if (OUTPUT_VIDEO) {
+	FrameSink outputVideo(options);
+	if (writeMask) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), false);  // false = grayscale
 		if (!outputVideo.isOpened()) {
@@ -136,18 +179,45 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
-	printf("Processing video (Pthread with %d threads)...\n", threadNum);
+	GmmParams gmmParams;
+	gmmParams.components = options.getInt("components", gmmParams.components);
+	gmmParams.learningRate = options.getDouble("learning-rate", gmmParams.learningRate);
+	gmmParams.history = options.getInt("history", gmmParams.history);
+	gmmParams.detectShadows = options.getBool("detect-shadows", gmmParams.detectShadows);
+	state.backgroundModel.init(height, width, gmmParams);
+	
+	// Optional region of interest, reduced-rate model updates and foreground sidecar
+	if (!state.roi.init(height, width, options.getString("roi"), options.getString("roi-mask"))) {
+		printf("Error: Invalid ROI (use --roi \"x,y x,y x,y;...\" or --roi-mask <image>)\n");
+		return -1;
+	}
+	state.updateStride = max(1, options.getInt("update-stride", 1));
+	
+	ForegroundSidecar sidecar;
+	if (options.has("sidecar") && !sidecar.open(options.getString("sidecar"))) {
+		printf("Error: Cannot create sidecar file: %s\n", options.getString("sidecar").c_str());
+		return -1;
+	}
+	
+	state.bandQueues = vector<BatchQueue>(state.threadNum);
+	for (int i = 0; i < state.threadNum; ++i) {
+		watchQueue("band " + to_string(i), [&state, i] { return state.bandQueues[i].size(); });
+	}
+	
+	printf("Processing video (Pthread with %d threads)...\n", state.threadNum);
 	
 	double Total = getTickCount();
 	
 	// Start worker threads
-	vector<thread> workers;
-	for (int i = 0; i < threadNum; ++i) {
-		workers.emplace_back(processingWorker, i);
+	vector<PooledThread> workers;
+	for (int i = 0; i < state.threadNum; ++i) {
+		workers.emplace_back(processingWorker, ref(state), i);
 	}
 	
 	// Reading thread
-	thread readerThread([&]() {
+	PooledThread readerThread([&]() {
+		traceThreadName("reader");
+		pinThread(ROLE_READER);
 		int batchIndex = 0;
 		while (true) {
 			FrameBatch batch;
@@ -158,26 +228,47 @@ int main(int argc, const char** argv) {
 				Mat frame;
 				captureVideo >> frame;
 				if (frame.empty()) break;
-				batch.frames.push_back(frame.clone());
+				batch.frames.push_back(frame);
+				batch.masks.push_back(Mat(frame.rows, frame.cols, CV_8UC1));
 			}
 			
 			if (batch.frames.empty()) break;
 			
-			inputQueue.push(move(batch));
+			// Every worker gets the batch (Mat headers share the pixel data)
+			batch.pendingBands = make_shared<atomic<int>>(state.threadNum);
+			batch.stats = make_shared<vector<ForegroundStats>>(batch.frames.size());
+			batch.statsMutex = make_shared<mutex>();
+			for (auto &queue : state.bandQueues) {
+				queue.push(batch);
+			}
 			batchIndex++;
 		}
 		
-		inputQueue.setFinished();
+		for (auto &queue : state.bandQueues) {
+			queue.setFinished();
+		}
 	});
 	
 	// Writing thread
-	thread writerThread([&]() {
+	PooledThread writerThread([&]() {
+		traceThreadName("writer");
+		pinThread(ROLE_WRITER);
 		int expectedBatch = 0;
 		map<int, FrameBatch> outOfOrderBatches;
 		
-		while (!processedQueue.isFinished()) {
+		// Write one batch of masks and its per-frame foreground summaries
+		auto writeBatch = [&](FrameBatch &maskBatch) {
+			for (int i = 0; i < (int)maskBatch.frames.size(); ++i) {
+				if (writeMask) {
+					outputVideo << maskBatch.frames[i];
+				}
+				sidecar.write(maskBatch.startIndex + i, (*maskBatch.stats)[i]);
+			}
+		};
+		
+		while (!state.processedQueue.isFinished()) {
 			FrameBatch batch;
-			if (!processedQueue.pop(batch)) continue;
+			if (!state.processedQueue.pop(batch)) continue;
 			
 			int batchIndex = batch.startIndex / BATCH_SIZE;
 			
@@ -187,23 +278,18 @@ int main(int argc, const char** argv) {
 			}
 			
 			// Write this batch
-			for (auto &frame : batch.frames) {
-				outputVideo << frame;
-			}
+			writeBatch(batch);
 			expectedBatch++;
 			
 			// Write queued batches
 			while (outOfOrderBatches.count(expectedBatch)) {
-				auto &nextBatch = outOfOrderBatches[expectedBatch];
-				for (auto &frame : nextBatch.frames) {
-					outputVideo << frame;
-				}
+				writeBatch(outOfOrderBatches[expectedBatch]);
 				outOfOrderBatches.erase(expectedBatch);
 				expectedBatch++;
 			}
 			
 			// Show progress
-			int processed = framesProcessed.load();
+			int processed = state.framesProcessed.load();
 			if (processed % 30 == 0) {
 				printf("  Processed %d frames...\r", processed);
 				fflush(stdout);
@@ -216,27 +302,40 @@ int main(int argc, const char** argv) {
 	for (auto &worker : workers) {
 		worker.join();
 	}
-	processedQueue.setFinished();
+	state.processedQueue.setFinished();
 	writerThread.join();
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
-	int totalFrames = framesProcessed.load();
+	int totalFrames = state.framesProcessed.load();
 	
 	// Print results
 	printf("\n\n");
 	printf("========================================\n");
 	printf("Background Subtraction - Pthread\n");
 	printf("========================================\n");
-	printf("Threads used: %d\n", threadNum);
+	printf("Threads used: %d\n", state.threadNum);
 	printf("Processed frames: %d\n", totalFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", totalFrames / (Total / getTickFrequency()));
-	printf("Output saved to: %s\n", outputPath.c_str());
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
+	if (writeMask) {
+		printf("Output saved to: %s\n", outputPath.c_str());
+	}
+	if (sidecar.isOpened()) {
+		printf("Sidecar saved to: %s\n", options.getString("sidecar").c_str());
+		sidecar.close();
+	}
 	printf("========================================\n");
 	
+	metrics.write(totalFrames, state.threadNum, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
-	if (OUTPUT_VIDEO) {
+	if (writeMask) {
 		outputVideo.release();
 	}
 	
@@ -1,5 +1,13 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "foreground_roi.hpp"
 
 using namespace std;
 using namespace cv;
@@ -8,6 +16,11 @@ using namespace cv;
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -19,8 +32,8 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/08_background_subtraction/background_subtraction_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -30,10 +43,11 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool writeMask = OUTPUT_VIDEO && options.getBool("mask-video", true);
 	
 	// Setup video output (grayscale for foreground mask)
-	VideoWriter outputVideo;
-	if (OUTPUT_VIDEO) {
+	FrameSink outputVideo(options);
+	if (writeMask) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), false);  // false = grayscale
@@ -43,9 +57,31 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
-	// Create background subtractor (MOG2 - Mixture of Gaussians)
-	Ptr<BackgroundSubtractorMOG2> pBackSub = createBackgroundSubtractorMOG2();
-	pBackSub->setDetectShadows(true);  // Detect and mark shadows
+	// Create background model (per-pixel Gaussian mixture, MOG2 compatible output)
+	GmmParams gmmParams;
+	gmmParams.components = options.getInt("components", gmmParams.components);
+	gmmParams.learningRate = options.getDouble("learning-rate", gmmParams.learningRate);
+	gmmParams.history = options.getInt("history", gmmParams.history);
+	gmmParams.detectShadows = options.getBool("detect-shadows", gmmParams.detectShadows);
+	
+	GaussianMixtureBackground backgroundModel;
+	backgroundModel.init(height, width, gmmParams);
+	
+	// Optional region of interest, reduced-rate model updates and foreground sidecar
+	RoiMask roi;
+	if (!roi.init(height, width, options.getString("roi"), options.getString("roi-mask"))) {
+		printf("Error: Invalid ROI (use --roi \"x,y x,y x,y;...\" or --roi-mask <image>)\n");
+		return -1;
+	}
+	int updateStride = max(1, options.getInt("update-stride", 1));
+	
+	ForegroundSidecar sidecar;
+	if (options.has("sidecar") && !sidecar.open(options.getString("sidecar"))) {
+		printf("Error: Cannot create sidecar file: %s\n", options.getString("sidecar").c_str());
+		return -1;
+	}
+	
+	pinMainThread();
 	
 	printf("Processing video (Sequential Background Subtraction)...\n");
 	
@@ -59,10 +95,15 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 		
 		// Apply background subtraction
-		pBackSub->apply(frame, fgMask);
+		ComputeTimer computeTimer;
+		ForegroundStats stats;
+		fgMask.create(frame.rows, frame.cols, CV_8UC1);
+		applyBackgroundModel(backgroundModel, frame, fgMask, processedFrames, updateStride, roi, 0, frame.rows, stats);
+		computeTimer.stop();
+		sidecar.write(processedFrames, stats);
 		
 		// Write output
-		if (OUTPUT_VIDEO) {
+		if (writeMask) {
 			outputVideo << fgMask;
 		}
 		
@@ -75,6 +116,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -85,11 +129,21 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
-	printf("Output saved to: %s\n", outputPath.c_str());
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
+	if (writeMask) {
+		printf("Output saved to: %s\n", outputPath.c_str());
+	}
+	if (sidecar.isOpened()) {
+		printf("Sidecar saved to: %s\n", options.getString("sidecar").c_str());
+		sidecar.close();
+	}
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
-	if (OUTPUT_VIDEO) {
+	if (writeMask) {
 		outputVideo.release();
 	}
 	
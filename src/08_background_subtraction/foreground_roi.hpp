@@ -0,0 +1,198 @@
+#pragma once
+
+// Region-of-interest, reduced-rate model updates and per-frame foreground summaries
+// for background subtraction.
+//
+// The ROI is stored as [x0, x1) spans per row, so pixels outside it are never read,
+// classified or learned. With an update stride of N the model only learns on every
+// Nth frame; the frames in between are classified against the current model.
+// Parallel variants split frames into row bands of equal ROI pixel counts (bandRow()),
+// so a band of rows mostly outside the ROI does not leave its thread idle.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "gaussian_mixture_background.hpp"
+
+// Foreground pixel count and bounding box of one mask (shadows are not counted)
+struct ForegroundStats {
+	long long pixels = 0;
+	int minX = INT_MAX, minY = INT_MAX, maxX = -1, maxY = -1;
+
+	void merge(const ForegroundStats &other) {
+		pixels += other.pixels;
+		minX = std::min(minX, other.minX);
+		minY = std::min(minY, other.minY);
+		maxX = std::max(maxX, other.maxX);
+		maxY = std::max(maxY, other.maxY);
+	}
+
+	cv::Rect box() const {
+		if (pixels == 0) return cv::Rect();
+		return cv::Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+	}
+};
+
+class RoiMask {
+private:
+	std::vector<std::vector<std::pair<int, int>>> rowSpans;
+	std::vector<long long> pixelsBefore;  // ROI pixels in the rows above each row
+	bool restricted = false;
+	long long coveredPixels = 0;
+	long long totalPixels = 0;
+
+public:
+	// Build the ROI from polygons ("x,y x,y x,y;x,y x,y x,y" - polygons separated by
+	// ';') and/or a mask image (non-zero = inside, rescaled to the frame size).
+	// With neither given, the ROI is the whole frame. Returns false on bad input.
+	bool init(int rows, int cols, const std::string &polygons, const std::string &maskPath) {
+		cv::Mat inside(rows, cols, CV_8UC1, cv::Scalar(0));
+		restricted = !polygons.empty() || !maskPath.empty();
+
+		if (!restricted) {
+			inside.setTo(cv::Scalar(255));
+		}
+
+		if (!polygons.empty()) {
+			std::vector<std::vector<cv::Point>> shapes;
+			std::stringstream polygonStream(polygons);
+			std::string polygon;
+			while (std::getline(polygonStream, polygon, ';')) {
+				std::vector<cv::Point> points;
+				std::stringstream pointStream(polygon);
+				std::string point;
+				while (pointStream >> point) {
+					int x, y;
+					if (sscanf(point.c_str(), "%d,%d", &x, &y) != 2) return false;
+					points.push_back(cv::Point(x, y));
+				}
+				if (points.size() < 3) return false;
+				shapes.push_back(points);
+			}
+			cv::fillPoly(inside, shapes, cv::Scalar(255));
+		}
+
+		if (!maskPath.empty()) {
+			cv::Mat image = cv::imread(maskPath, cv::IMREAD_GRAYSCALE);
+			if (image.empty()) return false;
+			if (image.rows != rows || image.cols != cols) {
+				cv::resize(image, image, cv::Size(cols, rows), 0, 0, cv::INTER_NEAREST);
+			}
+			for (int y = 0; y < rows; ++y) {
+				const uchar* m = image.ptr<uchar>(y);
+				uchar* p = inside.ptr<uchar>(y);
+				for (int x = 0; x < cols; ++x) {
+					if (m[x]) p[x] = 255;
+				}
+			}
+		}
+
+		// Convert the rasterized ROI into runs of inside pixels per row
+		rowSpans.assign(rows, std::vector<std::pair<int, int>>());
+		pixelsBefore.assign(rows + 1, 0);
+		coveredPixels = 0;
+		totalPixels = (long long)rows * cols;
+		for (int y = 0; y < rows; ++y) {
+			const uchar* p = inside.ptr<uchar>(y);
+			int x = 0;
+			while (x < cols) {
+				while (x < cols && !p[x]) ++x;
+				int start = x;
+				while (x < cols && p[x]) ++x;
+				if (x > start) {
+					rowSpans[y].push_back(std::make_pair(start, x));
+					coveredPixels += x - start;
+				}
+			}
+			pixelsBefore[y + 1] = coveredPixels;
+		}
+		return true;
+	}
+
+	bool isRestricted() const {
+		return restricted;
+	}
+
+	const std::vector<std::pair<int, int>> &spans(int y) const {
+		return rowSpans[y];
+	}
+
+	// First row of band 'band' of 'bands' (bandRow(bands) is the row count): the bands
+	// hold about the same number of ROI pixels each
+	int bandRow(int band, int bands) const {
+		int rows = (int)rowSpans.size();
+		if (band >= bands) return rows;
+		long long target = coveredPixels * band / bands;
+		return (int)(std::lower_bound(pixelsBefore.begin(), pixelsBefore.end() - 1, target) - pixelsBefore.begin());
+	}
+
+	// Fraction of the frame inside the ROI
+	double coverage() const {
+		return totalPixels ? (double)coveredPixels / totalPixels : 0.0;
+	}
+};
+
+// Run rows [rowBegin, rowEnd) of a frame through the model, restricted to the ROI.
+// The model learns only when frameIndex is a multiple of updateStride. Mask pixels
+// outside the ROI are set to 0; foreground inside it is added to 'stats'.
+inline void applyBackgroundModel(GaussianMixtureBackground &model, const cv::Mat &frame, cv::Mat &mask,
+                                 int frameIndex, int updateStride, const RoiMask &roi,
+                                 int rowBegin, int rowEnd, ForegroundStats &stats) {
+	bool update = frameIndex % updateStride == 0;
+	float alpha = model.learningRateFor(frameIndex / updateStride);
+
+	for (int y = rowBegin; y < rowEnd; ++y) {
+		uchar* dst = mask.ptr<uchar>(y);
+		if (roi.isRestricted()) {
+			memset(dst, 0, mask.cols);
+		}
+
+		for (const auto &span : roi.spans(y)) {
+			model.applySpan(frame, mask, y, span.first, span.second, alpha, update);
+
+			for (int x = span.first; x < span.second; ++x) {
+				if (dst[x] != 255) continue;
+				stats.pixels++;
+				stats.minX = std::min(stats.minX, x);
+				stats.maxX = std::max(stats.maxX, x);
+				stats.minY = std::min(stats.minY, y);
+				stats.maxY = std::max(stats.maxY, y);
+			}
+		}
+	}
+}
+
+// Compact per-frame foreground summary: one CSV line per frame
+class ForegroundSidecar {
+private:
+	FILE* file = nullptr;
+
+public:
+	bool open(const std::string &path) {
+		file = fopen(path.c_str(), "w");
+		if (!file) return false;
+		fprintf(file, "frame,foreground_pixels,x,y,width,height\n");
+		return true;
+	}
+
+	bool isOpened() const {
+		return file != nullptr;
+	}
+
+	void write(int frameIndex, const ForegroundStats &stats) {
+		if (!file) return;
+		cv::Rect box = stats.box();
+		fprintf(file, "%d,%lld,%d,%d,%d,%d\n", frameIndex, stats.pixels, box.x, box.y, box.width, box.height);
+	}
+
+	void close() {
+		if (file) fclose(file);
+		file = nullptr;
+	}
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+// Per-pixel Gaussian mixture background model (Zivkovic, as used by MOG2).
+//
+// The model is stored as structure-of-arrays: one plane per mixture component for
+// the weight, the variance and each of the three channel means. Planes hold 16-bit
+// fixed-point values (weights in 0.16, means and variances in 8.8), which halves
+// the memory traffic of a float model; each run of GMM_RUN pixels is widened to
+// float, updated with branch-free selects and narrowed again, so the inner loops
+// vectorize (compile with -O3). Pixels are independent of each other, which lets
+// any band of rows be updated by a different thread: the result is the same no
+// matter how a frame is tiled or how many threads are used.
+//
+// Mask values match createBackgroundSubtractorMOG2: 255 foreground, 127 shadow,
+// 0 background.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#define GMM_MAX_COMPONENTS 8
+#define GMM_WEIGHT_SCALE 65535.0f  // 0.16 fixed point
+#define GMM_VALUE_SCALE 256.0f     // 8.8 fixed point
+#define GMM_RUN 64  // Pixels widened to float and updated together
+
+struct GmmParams {
+	int components = 5;            // Mixture components per pixel (1..GMM_MAX_COMPONENTS)
+	double learningRate = -1.0;    // Negative = automatic, 1 / min(frameIndex + 1, history)
+	int history = 500;
+	float varThreshold = 16.0f;    // Squared Mahalanobis distance for the background test
+	float varThresholdGen = 9.0f;  // Squared Mahalanobis distance for matching a component
+	float backgroundRatio = 0.9f;  // Weight fraction of the mixture that models background
+	float varInit = 15.0f;
+	float varMin = 4.0f;
+	float varMax = 75.0f;
+	bool detectShadows = true;
+	float shadowThreshold = 0.5f;  // Darkest shadow accepted, as a fraction of background
+	unsigned char shadowValue = 127;
+};
+
+class GaussianMixtureBackground {
+private:
+	GmmParams params;
+	int rows = 0, cols = 0;
+	size_t planeSize = 0;
+	std::vector<uint16_t> weight, variance, meanB, meanG, meanR;  // components * planeSize
+
+	static uint16_t toFixed(float value, float scale) {
+		return (uint16_t)std::min(std::max(value * scale + 0.5f, 0.0f), 65535.0f);
+	}
+
+	// Classify and update n (<= GMM_RUN) consecutive pixels starting at plane offset 'offset'
+	// When 'update' is false the pixels are only classified and the model is left as is.
+	void processRun(const unsigned char* src, unsigned char* dst, size_t offset, int n, float alpha, bool update) {
+		const int K = params.components;
+		const float Tb = params.varThreshold;
+		const float Tg = params.varThresholdGen;
+		const float ratio = params.backgroundRatio;
+		const float wIn = 1.0f / GMM_WEIGHT_SCALE;
+		const float vIn = 1.0f / GMM_VALUE_SCALE;
+
+		float xb[GMM_RUN], xg[GMM_RUN], xr[GMM_RUN];
+		float w[GMM_MAX_COMPONENTS][GMM_RUN], v[GMM_MAX_COMPONENTS][GMM_RUN];
+		float mb[GMM_MAX_COMPONENTS][GMM_RUN], mg[GMM_MAX_COMPONENTS][GMM_RUN], mr[GMM_MAX_COMPONENTS][GMM_RUN];
+		float dist2[GMM_MAX_COMPONENTS][GMM_RUN];
+		float matchW[GMM_RUN], bgW[GMM_RUN], minW[GMM_RUN], heavier[GMM_RUN], total[GMM_RUN], rate[GMM_RUN];
+		int matchK[GMM_RUN], minK[GMM_RUN], fg[GMM_RUN], shadow[GMM_RUN];
+
+		for (int j = 0; j < n; ++j) {
+			xb[j] = src[j * 3];
+			xg[j] = src[j * 3 + 1];
+			xr[j] = src[j * 3 + 2];
+			matchW[j] = 0.0f;
+			bgW[j] = 0.0f;
+			minW[j] = FLT_MAX;
+			matchK[j] = -1;
+			minK[j] = 0;
+		}
+
+		// Pass 1: widen the planes, compute distances, find the heaviest matching
+		// component (Tg), the heaviest background candidate (Tb) and the lightest one
+		for (int k = 0; k < K; ++k) {
+			size_t base = k * planeSize + offset;
+			const uint16_t* pw = &weight[base];
+			const uint16_t* pv = &variance[base];
+			const uint16_t* pb = &meanB[base];
+			const uint16_t* pg = &meanG[base];
+			const uint16_t* pr = &meanR[base];
+
+			for (int j = 0; j < n; ++j) {
+				w[k][j] = pw[j] * wIn;
+				v[k][j] = pv[j] * vIn;
+				mb[k][j] = pb[j] * vIn;
+				mg[k][j] = pg[j] * vIn;
+				mr[k][j] = pr[j] * vIn;
+
+				float db = xb[j] - mb[k][j];
+				float dg = xg[j] - mg[k][j];
+				float dr = xr[j] - mr[k][j];
+				float dd = db * db + dg * dg + dr * dr;
+				dist2[k][j] = dd;
+
+				bool matched = dd < Tg * v[k][j] && w[k][j] > matchW[j];
+				matchW[j] = matched ? w[k][j] : matchW[j];
+				matchK[j] = matched ? k : matchK[j];
+
+				bool inBg = dd < Tb * v[k][j] && w[k][j] > bgW[j];
+				bgW[j] = inBg ? w[k][j] : bgW[j];
+
+				bool lighter = w[k][j] < minW[j];
+				minW[j] = lighter ? w[k][j] : minW[j];
+				minK[j] = lighter ? k : minK[j];
+			}
+		}
+
+		// Background test: the heaviest component within Tb belongs to the background
+		// set iff the components heavier than it hold less than 'ratio' of the weight
+		for (int j = 0; j < n; ++j) heavier[j] = 0.0f;
+		for (int k = 0; k < K; ++k) {
+			for (int j = 0; j < n; ++j) {
+				heavier[j] += w[k][j] > bgW[j] ? w[k][j] : 0.0f;
+			}
+		}
+		int anyForeground = 0;
+		for (int j = 0; j < n; ++j) {
+			fg[j] = !(bgW[j] > 0.0f && heavier[j] < ratio);
+			shadow[j] = 0;
+			anyForeground |= fg[j];
+		}
+
+		// Shadow test (as in MOG2): a foreground pixel that is a darker copy of a
+		// background component. Only runs that contain foreground pay for it.
+		if (params.detectShadows && anyForeground) {
+			const float tau = params.shadowThreshold;
+			for (int k = 0; k < K; ++k) {
+				for (int j = 0; j < n; ++j) heavier[j] = 0.0f;
+				for (int m = 0; m < K; ++m) {
+					for (int j = 0; j < n; ++j) {
+						heavier[j] += w[m][j] > w[k][j] ? w[m][j] : 0.0f;
+					}
+				}
+
+				for (int j = 0; j < n; ++j) {
+					float num = xb[j] * mb[k][j] + xg[j] * mg[k][j] + xr[j] * mr[k][j];
+					float den = mb[k][j] * mb[k][j] + mg[k][j] * mg[k][j] + mr[k][j] * mr[k][j];
+					float a = num / std::max(den, FLT_EPSILON);
+					float db = xb[j] - a * mb[k][j];
+					float dg = xg[j] - a * mg[k][j];
+					float dr = xr[j] - a * mr[k][j];
+					bool isShadow = w[k][j] > 0.0f && heavier[j] < ratio && den > 0.0f &&
+					                a >= tau && a <= 1.0f &&
+					                db * db + dg * dg + dr * dr < Tb * v[k][j] * a * a;
+					shadow[j] |= isShadow;
+				}
+			}
+		}
+
+		for (int j = 0; j < n; ++j) {
+			dst[j] = fg[j] ? (shadow[j] ? params.shadowValue : 255) : 0;
+		}
+
+		if (!update) return;
+
+		// Pass 2: update the matched component, or replace the lightest one when
+		// nothing matched, then renormalize the weights and narrow back to 16 bits
+		const float keep = 1.0f - alpha;
+		const float varInit = params.varInit;
+		const float varMin = params.varMin;
+		const float varMax = params.varMax;
+		for (int j = 0; j < n; ++j) {
+			total[j] = 0.0f;
+			rate[j] = alpha / std::max(matchW[j] * keep + alpha, FLT_EPSILON);
+		}
+		for (int k = 0; k < K; ++k) {
+			for (int j = 0; j < n; ++j) {
+				bool own = matchK[j] == k;
+				bool replace = matchK[j] < 0 && minK[j] == k;
+				float r = own ? rate[j] : 0.0f;
+
+				float wNew = w[k][j] * keep + (own ? alpha : 0.0f);
+				w[k][j] = replace ? alpha : wNew;
+
+				mb[k][j] = replace ? xb[j] : mb[k][j] + r * (xb[j] - mb[k][j]);
+				mg[k][j] = replace ? xg[j] : mg[k][j] + r * (xg[j] - mg[k][j]);
+				mr[k][j] = replace ? xr[j] : mr[k][j] + r * (xr[j] - mr[k][j]);
+
+				float vNew = std::min(std::max(v[k][j] + r * (dist2[k][j] - v[k][j]), varMin), varMax);
+				v[k][j] = replace ? varInit : vNew;
+
+				total[j] += w[k][j];
+			}
+		}
+
+		for (int j = 0; j < n; ++j) total[j] = GMM_WEIGHT_SCALE / std::max(total[j], FLT_EPSILON);
+		for (int k = 0; k < K; ++k) {
+			size_t base = k * planeSize + offset;
+			uint16_t* pw = &weight[base];
+			uint16_t* pv = &variance[base];
+			uint16_t* pb = &meanB[base];
+			uint16_t* pg = &meanG[base];
+			uint16_t* pr = &meanR[base];
+
+			for (int j = 0; j < n; ++j) {
+				pw[j] = toFixed(w[k][j], total[j]);
+				pv[j] = toFixed(v[k][j], GMM_VALUE_SCALE);
+				pb[j] = toFixed(mb[k][j], GMM_VALUE_SCALE);
+				pg[j] = toFixed(mg[k][j], GMM_VALUE_SCALE);
+				pr[j] = toFixed(mr[k][j], GMM_VALUE_SCALE);
+			}
+		}
+	}
+
+public:
+	void init(int frameRows, int frameCols, const GmmParams &p) {
+		params = p;
+		params.components = std::min(std::max(params.components, 1), GMM_MAX_COMPONENTS);
+		rows = frameRows;
+		cols = frameCols;
+		planeSize = (size_t)rows * cols;
+
+		size_t total = planeSize * params.components;
+		weight.assign(total, 0);
+		variance.assign(total, toFixed(params.varInit, GMM_VALUE_SCALE));
+		meanB.assign(total, 0);
+		meanG.assign(total, 0);
+		meanR.assign(total, 0);
+	}
+
+	bool isInitialized() const {
+		return planeSize > 0;
+	}
+
+	const GmmParams &getParams() const {
+		return params;
+	}
+
+	// Learning rate used for the given frame number (0-based)
+	float learningRateFor(int frameIndex) const {
+		if (params.learningRate >= 0) return (float)params.learningRate;
+		int n = std::min(frameIndex + 1, std::max(params.history, 1));
+		return 1.0f / n;
+	}
+
+	// Classify pixels [x0, x1) of row y into 'mask' and, if 'update' is set, update
+	// the model there. 'mask' must already be allocated as CV_8UC1. Disjoint rows or
+	// spans may be processed concurrently.
+	void applySpan(const cv::Mat &frame, cv::Mat &mask, int y, int x0, int x1, float alpha, bool update) {
+		const unsigned char* src = frame.ptr<unsigned char>(y);
+		unsigned char* dst = mask.ptr<unsigned char>(y);
+		size_t rowOffset = (size_t)y * cols;
+		for (int x = x0; x < x1; x += GMM_RUN) {
+			int n = std::min(GMM_RUN, x1 - x);
+			processRun(src + x * 3, dst + x, rowOffset + x, n, alpha, update);
+		}
+	}
+
+	// Update rows [rowBegin, rowEnd) of the model with a BGR frame and write the
+	// matching rows of 'mask'. Different row bands may be processed concurrently.
+	void apply(const cv::Mat &frame, cv::Mat &mask, int frameIndex, int rowBegin, int rowEnd) {
+		float alpha = learningRateFor(frameIndex);
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			applySpan(frame, mask, y, 0, cols, alpha, true);
+		}
+	}
+
+	// Whole-frame update, lazily sizing the model on the first frame
+	void apply(const cv::Mat &frame, cv::Mat &mask, int frameIndex) {
+		if (frame.rows != rows || frame.cols != cols) {
+			init(frame.rows, frame.cols, params);
+		}
+		mask.create(frame.rows, frame.cols, CV_8UC1);
+		apply(frame, mask, frameIndex, 0, frame.rows);
+	}
+
+	void setParams(const GmmParams &p) {
+		params = p;
+		if (isInitialized()) init(rows, cols, p);
+	}
+};
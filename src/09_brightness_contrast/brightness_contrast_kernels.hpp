@@ -0,0 +1,26 @@
+#pragma once
+
+// Brightness / contrast kernel of the brightness contrast programs, also used by
+// the filter chain (13_filter_chain) and the kernel benchmarks
+// (bench/kernel_bench.cpp).
+
+#include <opencv2/opencv.hpp>
+#include "../common/yuv_frame.hpp"
+
+// output = alpha * input + beta
+inline void applyBrightnessContrast(const cv::Mat &frame, cv::Mat &output, bool i420 = false) {
+	double alpha = 1.5;  // Contrast control (1.5 = 50% more contrast)
+	int beta = 50;       // Brightness control (+50 for noticeable brightness)
+
+	// I420 input: the same adjustment expressed on the planes, Y in video range
+	// (16-235) and the chroma scaled around 128 as the contrast scales BGR
+	if (i420) {
+		output.create(frame.size(), frame.type());
+		cv::Mat outputLuma = i420Luma(output), outputChroma = i420Chroma(output);
+		i420Luma(frame).convertTo(outputLuma, -1, alpha, 16 - 16 * alpha + beta * 219.0 / 255.0);
+		i420Chroma(frame).convertTo(outputChroma, -1, alpha, 128 - 128 * alpha);
+		return;
+	}
+
+	frame.convertTo(output, -1, alpha, beta);
+}
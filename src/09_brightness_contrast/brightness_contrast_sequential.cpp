@@ -1,25 +1,27 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "brightness_contrast_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
 
-// Apply Brightness and Contrast adjustment
-// Formula: new_pixel = alpha * original_pixel + beta
-// alpha > 1: increase contrast, alpha < 1: decrease contrast
-// beta > 0: increase brightness, beta < 0: decrease brightness
-void applyBrightnessContrast(const Mat &frame, Mat &output) {
-	double alpha = 1.5;  // Contrast control (1.5 = 50% more contrast)
-	int beta = 50;       // Brightness control (+50 for noticeable brightness)
-	
-	// Apply the formula: output = alpha * input + beta
-	frame.convertTo(output, -1, alpha, beta);
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -31,8 +33,8 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/09_brightness_contrast/brightness_contrast_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -42,9 +44,10 @@ int main(int argc, const char** argv) {
 	double fps = captureVideo.get(CAP_PROP_FPS);
 	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+	bool yuvInput = captureVideo.enableYuv();  // frames arrive in I420 (--yuv 1, see yuv_frame.hpp)
 	
 	// Setup video output (color output)
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -55,6 +58,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinMainThread();
+	
 	printf("Processing video (Sequential Brightness/Contrast)...\n");
 	
 	double Total = getTickCount();
@@ -67,7 +72,9 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 		
 		// Apply brightness and contrast adjustment
-		applyBrightnessContrast(frame, adjusted);
+		ComputeTimer computeTimer;
+		applyBrightnessContrast(frame, adjusted, yuvInput);
+		computeTimer.stop();
 		
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -83,6 +90,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -93,9 +103,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
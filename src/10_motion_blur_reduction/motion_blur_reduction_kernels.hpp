@@ -0,0 +1,65 @@
+#pragma once
+
+// Temporal averaging kernels of the motion blur reduction programs, also used by the
+// filter chain (13_filter_chain/stateful_filters.hpp).
+//
+// Each output frame is the average of the last TEMPORAL_WINDOW input frames. The
+// sequential program averages in 8-bit arithmetic; the pthread and OpenMP programs
+// accumulate in float, the OpenMP one with the pixels split across threads.
+
+#include <opencv2/opencv.hpp>
+#include <deque>
+
+#define TEMPORAL_WINDOW 3  // Number of frames to average
+
+inline void reduceMotionBlur(const std::deque<cv::Mat> &frameWindow, cv::Mat &output) {
+	if (frameWindow.empty()) return;
+
+	output = cv::Mat::zeros(frameWindow[0].rows, frameWindow[0].cols, frameWindow[0].type());
+
+	// Temporal averaging across frames
+	for (const auto &frame : frameWindow) {
+		output += frame / (double)frameWindow.size();
+	}
+}
+
+inline void reduceMotionBlurFloat(const std::deque<cv::Mat> &frameWindow, cv::Mat &output) {
+	if (frameWindow.empty()) return;
+
+	output = cv::Mat::zeros(frameWindow[0].rows, frameWindow[0].cols, CV_32FC3);
+	double weight = 1.0 / frameWindow.size();
+
+	for (const auto &frame : frameWindow) {
+		cv::Mat temp;
+		frame.convertTo(temp, CV_32FC3);
+		output += temp * weight;
+	}
+
+	// Convert back to 8-bit
+	output.convertTo(output, CV_8UC3);
+}
+
+inline void reduceMotionBlurParallel(const std::deque<cv::Mat> &frameWindow, cv::Mat &output, int threads) {
+	if (frameWindow.empty()) return;
+
+	int rows = frameWindow[0].rows;
+	int cols = frameWindow[0].cols;
+	cv::Mat sum = cv::Mat::zeros(rows, cols, CV_32FC3);
+	double weight = 1.0 / frameWindow.size();
+
+	// Sum all frames in temporal window
+	for (const auto &frame : frameWindow) {
+		cv::Mat floatFrame;
+		frame.convertTo(floatFrame, CV_32FC3);
+
+		#pragma omp parallel for num_threads(threads) collapse(2) schedule(static)
+		for (int i = 0; i < rows; ++i) {
+			for (int j = 0; j < cols; ++j) {
+				sum.at<cv::Vec3f>(i, j) += floatFrame.at<cv::Vec3f>(i, j) * weight;
+			}
+		}
+	}
+
+	// Convert back to 8-bit
+	sum.convertTo(output, CV_8UC3);
+}
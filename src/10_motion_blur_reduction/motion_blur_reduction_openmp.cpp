@@ -3,17 +3,27 @@
 #include <vector>
 #include <deque>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "motion_blur_reduction_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
-#define TEMPORAL_WINDOW 3
-
-int threadNum;
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -25,14 +35,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/10_motion_blur_reduction/motion_blur_reduction_openmp.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -43,7 +53,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 	
 	// Setup output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);
@@ -53,6 +63,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 	
 	double Total = omp_get_wtime();
@@ -70,6 +82,8 @@ int main(int argc, const char** argv) {
 		captureVideo >> frame;
 		if (frame.empty()) break;
 		
+		ComputeTimer computeTimer;
+		
 		// Add frame to temporal buffer
 		temporalBuffer.push_back(frame.clone());
 		
@@ -78,26 +92,10 @@ int main(int argc, const char** argv) {
 			temporalBuffer.pop_front();
 		}
 		
-		// Temporal averaging using efficient approach
-		Mat output = Mat::zeros(frame.rows, frame.cols, CV_32FC3);
-		double weight = 1.0 / temporalBuffer.size();
-		
-		// Sum all frames in temporal window (parallelize this)
-		for (const auto &tempFrame : temporalBuffer) {
-			Mat floatFrame;
-			tempFrame.convertTo(floatFrame, CV_32FC3);
-			
-			#pragma omp parallel for collapse(2) schedule(static)
-			for (int i = 0; i < frame.rows; ++i) {
-				for (int j = 0; j < frame.cols; ++j) {
-					output.at<Vec3f>(i, j) += floatFrame.at<Vec3f>(i, j) * weight;
-				}
-			}
-		}
-		
-		// Convert back to 8-bit
+		// Temporal averaging, the pixels of each frame summed in parallel
 		Mat finalOutput;
-		output.convertTo(finalOutput, CV_8UC3);
+		reduceMotionBlurParallel(temporalBuffer, finalOutput, threadNum);
+		computeTimer.stop();
 		
 		// Write frame
 		if (OUTPUT_VIDEO) {
@@ -113,6 +111,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 	
 	// Print results
@@ -124,9 +125,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
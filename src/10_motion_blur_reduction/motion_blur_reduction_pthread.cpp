@@ -8,12 +8,20 @@
 #include <thread>
 #include <atomic>
 #include <map>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/trace.hpp"
+#include "motion_blur_reduction_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
-#define TEMPORAL_WINDOW 3
 
 struct FrameData {
 	Mat frame;
@@ -37,6 +45,7 @@ public:
 	}
 	
 	bool pop(T &data) {
+		QueueWaitTimer waitTimer;
 		unique_lock<mutex> lock(mtx);
 		cv.wait(lock, [this] { return !q.empty() || finished; });
 		if (q.empty()) return false;
@@ -45,6 +54,11 @@ public:
 		return true;
 	}
 	
+	size_t size() {
+		lock_guard<mutex> lock(mtx);
+		return q.size();
+	}
+	
 	void setFinished() {
 		lock_guard<mutex> lock(mtx);
 		finished = true;
@@ -57,63 +71,69 @@ public:
 	}
 };
 
-int threadNum;
-ThreadSafeQueue<FrameData> inputQueue;
-ThreadSafeQueue<FrameData> outputQueue;
-atomic<int> framesProcessed(0);
+// What the threads of one run share; main() builds a new one for every run
+struct RunState {
+	int threadNum = 1;
+	ThreadSafeQueue<FrameData> inputQueue;
+	ThreadSafeQueue<FrameData> outputQueue;
+	atomic<int> framesProcessed{0};
 
-// Shared temporal buffer with frame mapping
-mutex temporalMutex;
-deque<Mat> temporalBuffer;
-int currentFrameIndex = 0;
-map<int, Mat> processedFrames;  // Store processed frames temporarily
+	// Shared temporal buffer with frame mapping
+	mutex temporalMutex;
+	deque<Mat> temporalBuffer;
+	int currentFrameIndex = 0;
+	map<int, Mat> processedFrames;  // Store processed frames temporarily
+	QueueWatchGuard unwatch;  // last: the queues are unwatched before they go
+};
 
 // Worker threads: Process pixel averaging in parallel
-void processingWorker(int tid) {
+void processingWorker(RunState &state, int tid) {
+	traceThreadName("worker " + to_string(tid));
+	pinThread(ROLE_WORKER, tid);
 	while (true) {
 		FrameData frameData;
-		if (!inputQueue.pop(frameData)) break;
+		if (!state.inputQueue.pop(frameData)) break;
+		countFrameTraffic(frameData.frame);  // the clone below is this thread's own
 		
 		Mat output;
 		
 		// Get frames to average (synchronized)
 		{
-			lock_guard<mutex> lock(temporalMutex);
+			lock_guard<mutex> lock(state.temporalMutex);
+			ComputeTimer computeTimer;
 			
 			// Add current frame to temporal buffer
-			temporalBuffer.push_back(frameData.frame.clone());
+			state.temporalBuffer.push_back(frameData.frame.clone());
 			
 			// Keep only TEMPORAL_WINDOW frames
-			if (temporalBuffer.size() > TEMPORAL_WINDOW) {
-				temporalBuffer.pop_front();
+			if (state.temporalBuffer.size() > TEMPORAL_WINDOW) {
+				state.temporalBuffer.pop_front();
 			}
 			
 			// Apply temporal averaging using efficient OpenCV operations
-			output = Mat::zeros(frameData.frame.rows, frameData.frame.cols, CV_32FC3);
-			double weight = 1.0 / temporalBuffer.size();
-			
-			for (const auto &frame : temporalBuffer) {
-				Mat temp;
-				frame.convertTo(temp, CV_32FC3);
-				output += temp * weight;
-			}
-			
-			// Convert back to 8-bit
-			output.convertTo(output, CV_8UC3);
+			reduceMotionBlurFloat(state.temporalBuffer, output);
 		}
 		
 		// Send processed frame to output
 		FrameData processedData;
 		processedData.frame = output;
 		processedData.index = frameData.index;
-		outputQueue.push(processedData);
+		state.outputQueue.push(processedData);
 		
-		framesProcessed++;
+		state.framesProcessed++;
 	}
 }
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	RunState state;
+	watchQueue("input", [&state] { return state.inputQueue.size(); });
+	watchQueue("output", [&state] { return state.outputQueue.size(); });
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -125,14 +145,14 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 	
-	threadNum = atoi(argv[2]);
-	if (threadNum < 1) threadNum = 1;
+	state.threadNum = atoi(argv[2]);
+	if (state.threadNum < 1) state.threadNum = 1;
 	
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/10_motion_blur_reduction/motion_blur_reduction_pthread.avi";
 	
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -143,7 +163,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 	
 	// Setup output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);
@@ -159,10 +179,12 @@ int main(int argc, const char** argv) {
 	double Total = (double)getTickCount();
 	
 	// Use only 1 worker for temporal processing (must be sequential)
-	thread worker(processingWorker, 0);
+	PooledThread worker(processingWorker, ref(state), 0);
 	
 	// Reading thread - reads frames and sends to queue
-	thread readerThread([&]() {
+	PooledThread readerThread([&]() {
+		traceThreadName("reader");
+		pinThread(ROLE_READER);
 		int frameIndex = 0;
 		while (true) {
 			Mat frame;
@@ -170,13 +192,13 @@ int main(int argc, const char** argv) {
 			if (frame.empty()) break;
 			
 			FrameData frameData;
-			frameData.frame = frame.clone();
+			frameData.frame = frame;
 			frameData.index = frameIndex++;
 			
-			inputQueue.push(frameData);
+			state.inputQueue.push(frameData);
 		}
 		
-		inputQueue.setFinished();
+		state.inputQueue.setFinished();
 	});
 	
 	// Writing thread - writes frames in correct order
@@ -184,11 +206,13 @@ int main(int argc, const char** argv) {
 	int nextFrameToWrite = 0;
 	mutex bufferMutex;
 	
-	thread writerThread([&]() {
+	PooledThread writerThread([&]() {
+		traceThreadName("writer");
+		pinThread(ROLE_WRITER);
 		while (true) {
 			FrameData frameData;
-			if (!outputQueue.pop(frameData)) {
-				if (outputQueue.isFinished()) break;
+			if (!state.outputQueue.pop(frameData)) {
+				if (state.outputQueue.isFinished()) break;
 				continue;
 			}
 			
@@ -218,25 +242,32 @@ int main(int argc, const char** argv) {
 	// Wait for all threads
 	readerThread.join();
 	worker.join();
-	outputQueue.setFinished();
+	state.outputQueue.setFinished();
 	writerThread.join();
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = ((double)getTickCount() - Total) / getTickFrequency();
 	
-	int totalFrames = framesProcessed.load();
+	int totalFrames = state.framesProcessed.load();
 	
 	// Print results
 	printf("\n\n");
 	printf("========================================\n");
 	printf("Motion Blur Reduction - Pthread\n");
 	printf("========================================\n");
-	printf("Threads used: %d\n", threadNum);
+	printf("Threads used: %d\n", state.threadNum);
 	printf("Processed frames: %d\n", totalFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", totalFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(totalFrames, state.threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
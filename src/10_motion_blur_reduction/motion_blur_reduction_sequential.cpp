@@ -1,30 +1,27 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
 #include <deque>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "motion_blur_reduction_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
-#define TEMPORAL_WINDOW 3  // Number of frames to average
-
-void reduceMotionBlur(const deque<Mat> &frameWindow, Mat &output) {
-	if (frameWindow.empty()) return;
-	
-	int rows = frameWindow[0].rows;
-	int cols = frameWindow[0].cols;
-	int channels = frameWindow[0].channels();
-	
-	output = Mat::zeros(rows, cols, frameWindow[0].type());
-	
-	// Temporal averaging across frames
-	for (const auto &frame : frameWindow) {
-		output += frame / (double)frameWindow.size();
-	}
-}
 
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -36,8 +33,8 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/10_motion_blur_reduction/motion_blur_reduction_sequential.avi";
 	
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -49,7 +46,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 	
 	// Setup video output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -60,6 +57,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	pinMainThread();
+	
 	printf("Processing video (Sequential Motion Blur Reduction)...\n");
 	
 	double Total = getTickCount();
@@ -72,6 +71,8 @@ int main(int argc, const char** argv) {
 		captureVideo >> frame;
 		if (frame.empty()) break;
 		
+		ComputeTimer computeTimer;
+		
 		// Add frame to temporal window
 		frameWindow.push_back(frame.clone());
 		if (frameWindow.size() > TEMPORAL_WINDOW) {
@@ -80,6 +81,7 @@ int main(int argc, const char** argv) {
 		
 		// Apply motion blur reduction (temporal averaging)
 		reduceMotionBlur(frameWindow, output);
+		computeTimer.stop();
 		
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -95,6 +97,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 	
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 	
 	// Print results
@@ -105,9 +110,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 	
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+	
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -0,0 +1,15 @@
+#pragma once
+
+// Contrast enhancement kernel of the contrast enhancement programs, also used by
+// the filter chain (13_filter_chain) and the kernel benchmarks
+// (bench/kernel_bench.cpp).
+
+#include <opencv2/opencv.hpp>
+
+// output = alpha * (input - 128) + 128
+inline void applyContrastEnhancement(const cv::Mat &frame, cv::Mat &output) {
+	double alpha = 1.8;  // Contrast factor (higher = more dramatic)
+
+	// convertTo with beta = (1-alpha)*128 achieves: alpha*(input-128)+128
+	frame.convertTo(output, -1, alpha, (1 - alpha) * 128);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// Light-up kernels of the light-up programs, also used by the filter chain
+// (13_filter_chain) and the kernel benchmarks (bench/kernel_bench.cpp).
+//
+// blue = 2 * blue + 5, normalized so the brightest pixel becomes 255. The sequential
+// and pthread programs run lightUp(); the OpenMP program splits each of its passes
+// across threads with lightUpParallel().
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+inline void lightUp(cv::Mat &frame) {
+	if (frame.empty()) return;
+
+	int rows = frame.rows;
+	int cols = frame.cols;
+
+	// Create matrix to store intermediate values
+	std::vector<std::vector<int>> mat(rows, std::vector<int>(cols));
+
+	// Extract blue channel and apply brightening
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			mat[i][j] = frame.at<cv::Vec3b>(i, j)[0] * 2 + 5;
+		}
+	}
+
+	// Find max value
+	int max_val = 0;
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			if (mat[i][j] > max_val) {
+				max_val = mat[i][j];
+			}
+		}
+	}
+
+	// Normalize to 255
+	if (max_val > 0) {
+		for (int i = 0; i < rows; ++i) {
+			for (int j = 0; j < cols; ++j) {
+				frame.at<cv::Vec3b>(i, j)[0] = (mat[i][j] * 255) / max_val;
+			}
+		}
+	}
+}
+
+inline void lightUpParallel(cv::Mat &frame, int threads) {
+	if (frame.empty()) return;
+
+	int rows = frame.rows;
+	int cols = frame.cols;
+
+	// Create matrix to store intermediate values
+	std::vector<std::vector<int>> mat(rows, std::vector<int>(cols));
+
+	// Extract blue channel and apply brightening - PARALLELIZED
+	#pragma omp parallel for num_threads(threads) schedule(static) collapse(2)
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			mat[i][j] = frame.at<cv::Vec3b>(i, j)[0] * 2 + 5;
+		}
+	}
+
+	// Find max value - PARALLELIZED with reduction
+	int max_val = 0;
+	#pragma omp parallel for num_threads(threads) schedule(static) reduction(max:max_val)
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			if (mat[i][j] > max_val) {
+				max_val = mat[i][j];
+			}
+		}
+	}
+
+	// Normalize to 255 - PARALLELIZED
+	if (max_val > 0) {
+		#pragma omp parallel for num_threads(threads) schedule(static) collapse(2)
+		for (int i = 0; i < rows; ++i) {
+			for (int j = 0; j < cols; ++j) {
+				frame.at<cv::Vec3b>(i, j)[0] = (mat[i][j] * 255) / max_val;
+			}
+		}
+	}
+}
@@ -3,6 +3,14 @@
 #include <algorithm>
 #include <vector>
 #include <omp.h>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "lightup_kernels.hpp"
 
 using namespace std;
 using namespace cv;
@@ -10,49 +18,13 @@ using namespace cv;
 #define OUTPUT_VIDEO true
 #define BATCH_SIZE 30  // Increased from 20 for better throughput
 
-int threadNum;
-
-void lightUp(Mat &frame) {
-	if (frame.empty()) return;
-
-	int rows = frame.rows;
-	int cols = frame.cols;
-
-	// Create matrix to store intermediate values
-	vector<vector<int>> mat(rows, vector<int>(cols));
-
-	// Extract blue channel and apply brightening - PARALLELIZED
-	#pragma omp parallel for num_threads(threadNum) schedule(static) collapse(2)
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			mat[i][j] = frame.at<Vec3b>(i, j)[0] * 2 + 5;
-		}
-	}
-
-	// Find max value - PARALLELIZED with reduction
-	int max_val = 0;
-	#pragma omp parallel for num_threads(threadNum) schedule(static) reduction(max:max_val)
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			if (mat[i][j] > max_val) {
-				max_val = mat[i][j];
-			}
-		}
-	}
-
-	// Normalize to 255 - PARALLELIZED
-	if (max_val > 0) {
-		#pragma omp parallel for num_threads(threadNum) schedule(static) collapse(2)
-		for (int i = 0; i < rows; ++i) {
-			for (int j = 0; j < cols; ++j) {
-				frame.at<Vec3b>(i, j)[0] = (mat[i][j] * 255) / max_val;
-			}
-		}
-	}
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> <num_threads> [output_file]\n", argv[0]);
@@ -64,14 +36,15 @@ int main(int argc, const char** argv) {
 		return 0;
 	}
 
-	threadNum = atoi(argv[2]);
+	int threadNum = atoi(argv[2]);
 	if (threadNum < 1) threadNum = 1;
 
 	string outputPath = (argc >= 4) ? argv[3] : "outputs/12_lightup/lightup_openmp.avi";
 
 	// Open video
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	captureVideo.requireWritableFrames();  // the kernel works on the frames in place
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -82,7 +55,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 
 	// Setup output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
 		                 fps, Size(width, height), true);
@@ -92,6 +65,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	pinOpenMPTeam(threadNum);
+	
 	printf("Processing video (OpenMP with %d threads)...\n", threadNum);
 
 	double Total = omp_get_wtime();
@@ -115,7 +90,9 @@ int main(int argc, const char** argv) {
 		// Process batch in parallel with static scheduling for better performance
 		#pragma omp parallel for num_threads(threadNum) schedule(static)
 		for (int i = 0; i < (int)batch.size(); ++i) {
-			lightUp(batch[i]);
+			localizeFrame(batch[i]);
+			ComputeTimer computeTimer;
+			lightUpParallel(batch[i], threadNum);
 		}
 
 		// Write frames
@@ -134,6 +111,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = omp_get_wtime() - Total;
 
 	// Print results
@@ -145,9 +125,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total);
 	printf("Average FPS: %.2f\n", processedFrames / Total);
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 
+	metrics.write(processedFrames, threadNum, Total, captureVideo, &outputVideo);
+	trace.write();
+
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -1,50 +1,27 @@
 #include <opencv2/opencv.hpp>
 #include <cstdio>
 #include <algorithm>
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/trace.hpp"
+#include "lightup_kernels.hpp"
 
 using namespace std;
 using namespace cv;
 
 #define OUTPUT_VIDEO true
 
-void lightUp(Mat &frame) {
-	if (frame.empty()) return;
-
-	int rows = frame.rows;
-	int cols = frame.cols;
-
-	// Create matrix to store intermediate values
-	vector<vector<int>> mat(rows, vector<int>(cols));
-
-	// Extract blue channel and apply brightening
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			mat[i][j] = frame.at<Vec3b>(i, j)[0] * 2 + 5;
-		}
-	}
-
-	// Find max value
-	int max_val = 0;
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			if (mat[i][j] > max_val) {
-				max_val = mat[i][j];
-			}
-		}
-	}
-
-	// Normalize to 255
-	if (max_val > 0) {
-		for (int i = 0; i < rows; ++i) {
-			for (int j = 0; j < cols; ++j) {
-				frame.at<Vec3b>(i, j)[0] = (mat[i][j] * 255) / max_val;
-			}
-		}
-	}
-}
-
 int main(int argc, const char** argv) {
 	
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	
 	// Check arguments
 	if (argc < 2) {
 		printf("Usage: %s <video_file> [output_file]\n", argv[0]);
@@ -56,8 +33,9 @@ int main(int argc, const char** argv) {
 	string outputPath = (argc >= 3) ? argv[2] : "outputs/12_lightup/lightup_sequential.avi";
 
 	// Open video file
-	VideoCapture captureVideo(argv[1]);
-	if (!captureVideo.isOpened()) {
+	FrameSource captureVideo(options);
+	captureVideo.requireWritableFrames();  // the kernel works on the frames in place
+	if (!captureVideo.open(argv[1])) {
 		printf("Error: Cannot open video file: %s\n", argv[1]);
 		return -1;
 	}
@@ -69,7 +47,7 @@ int main(int argc, const char** argv) {
 	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
 
 	// Setup video output
-	VideoWriter outputVideo;
+	FrameSink outputVideo(options);
 	if (OUTPUT_VIDEO) {
 		outputVideo.open(outputPath, 
 		                 VideoWriter::fourcc('M', 'J', 'P', 'G'),
@@ -80,6 +58,8 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	pinMainThread();
+	
 	printf("Processing video (Sequential Lightup)...\n");
 
 	double Total = getTickCount();
@@ -92,7 +72,9 @@ int main(int argc, const char** argv) {
 		if (frame.empty()) break;
 
 		// Apply lightup
+		ComputeTimer computeTimer;
 		lightUp(frame);
+		computeTimer.stop();
 
 		// Write output
 		if (OUTPUT_VIDEO) {
@@ -108,6 +90,9 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+	
 	Total = getTickCount() - Total;
 
 	// Print results
@@ -118,9 +103,13 @@ int main(int argc, const char** argv) {
 	printf("Processed frames: %d\n", processedFrames);
 	printf("Execution time: %.3fs\n", Total / getTickFrequency());
 	printf("Average FPS: %.2f\n", processedFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
 	printf("Output saved to: %s\n", outputPath.c_str());
 	printf("========================================\n");
 
+	metrics.write(processedFrames, 1, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+
 	captureVideo.release();
 	if (OUTPUT_VIDEO) {
 		outputVideo.release();
@@ -0,0 +1,220 @@
+#pragma once
+
+// Operator fusion for filter chains.
+//
+// The chain is split into stages. A fused stage is
+//
+//   [point filters] [neighbourhood filter] [point filters without statistics]
+//
+// where every part may be missing. All its point filters before the neighbourhood
+// filter collapse into one lookup table (prologue), those after it into another
+// (epilogue). Without a neighbourhood filter the stage is a single LUT pass over the
+// frame. With one, the frame is processed in bands of rows small enough to stay in
+// cache: the prologue table is applied to the band plus the rows the kernel reaches
+// into, the kernel runs on that, and the epilogue table is applied while writing the
+// result. A stage therefore reads and writes the frame once, however many filters it
+// holds.
+//
+// Point filters that depend on frame statistics (white balance, light-up) get them
+// from one histogram pass over the stage input; the statistics of the intermediate
+// frames follow from that histogram and the table built so far. Such filters cannot
+// follow a neighbourhood filter in the same stage and start a new one instead.
+//
+// Fused stages produce the same frames as running the filters one by one. Generic
+// filters (grayscale, edge detection, histogram equalization) and stateful filters
+// are stages of their own.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "filter_kernels.hpp"
+#include "../common/cli_options.hpp"
+
+#define FUSION_BAND_BYTES (256 << 10)  // Target size of one band of rows
+
+// Per-thread buffers, reused from frame to frame
+struct ChainWorkspace {
+	cv::Mat scratch;      // output frame of a stage
+	cv::Mat lut;          // prologue table built for the current frame
+	cv::Mat band;         // prologue output for one band (with its halo rows)
+	cv::Mat bandOutput;   // kernel output for one band, before the epilogue
+	cv::Mat work;         // kernel intermediate
+	FrameHistogram histogram;
+};
+
+inline cv::Mat identityLut() {
+	cv::Mat lut(1, 256, CV_8UC3);
+	cv::Vec3b *entry = lut.ptr<cv::Vec3b>(0);
+	for (int v = 0; v < 256; ++v) {
+		entry[v] = cv::Vec3b((uchar)v, (uchar)v, (uchar)v);
+	}
+	return lut;
+}
+
+class ChainStage {
+private:
+	std::vector<ChainFilter> prologue, epilogue;
+	ChainFilter neighbourhood = {};
+	bool hasNeighbourhood = false;
+	ChainFilter single = {};
+	std::shared_ptr<StatefulFilter> state;
+	bool fused = false;
+	bool prologueUsesStatistics = false;
+	cv::Mat prologueLut, epilogueLut;  // precomputed when they do not depend on the frame
+	std::string stageName;
+
+	void applyBands(cv::Mat &frame, const cv::Mat &lut, ChainWorkspace &ws) const {
+		int rows = frame.rows;
+		int radius = neighbourhood.radius;
+		size_t rowBytes = frame.cols * frame.elemSize();
+		int bandRows = std::max(8 * radius, (int)(FUSION_BAND_BYTES / std::max((size_t)1, rowBytes)));
+		bandRows = std::max(1, std::min(bandRows, rows));
+
+		ws.scratch.create(frame.size(), frame.type());
+		if (!prologue.empty()) {
+			ws.band.create(bandRows + 2 * radius, frame.cols, frame.type());
+		}
+
+		for (int y0 = 0; y0 < rows; y0 += bandRows) {
+			int y1 = std::min(rows, y0 + bandRows);
+			int a = std::max(0, y0 - radius);
+			int b = std::min(rows, y1 + radius);
+
+			// The kernel sees exactly rows [a, b): real neighbours inside the frame and
+			// its own border handling at the frame edges, as on the whole frame. The
+			// headers are built over the memory directly (not as ROIs), so OpenCV takes
+			// the same code path as for a whole frame.
+			cv::Mat input;
+			if (prologue.empty()) {
+				input = cv::Mat(b - a, frame.cols, frame.type(), frame.ptr(a), frame.step);
+			} else {
+				input = cv::Mat(b - a, frame.cols, frame.type(), ws.band.data, ws.band.step);
+				cv::LUT(frame.rowRange(a, b), lut, input);
+			}
+
+			cv::Mat output = ws.scratch.rowRange(y0, y1);
+			if (epilogue.empty()) {
+				neighbourhood.strip(input, y0 - a, y1 - a, output, ws.work);
+			} else {
+				neighbourhood.strip(input, y0 - a, y1 - a, ws.bandOutput, ws.work);
+				cv::LUT(ws.bandOutput, epilogueLut, output);
+			}
+		}
+
+		std::swap(frame, ws.scratch);
+	}
+
+public:
+	// A stage running one filter unchanged
+	ChainStage(const ChainFilter &filter, const CliOptions &options) : single(filter), stageName(filter.name) {
+		if (filter.kind == FILTER_STATEFUL) state.reset(filter.create(options));
+	}
+
+	// A fused stage; 'center' may be null
+	ChainStage(const std::vector<ChainFilter> &before, const ChainFilter* center, const std::vector<ChainFilter> &after)
+		: prologue(before), epilogue(after), fused(true) {
+		if (center) {
+			neighbourhood = *center;
+			hasNeighbourhood = true;
+		}
+		for (const ChainFilter &filter : prologue) {
+			if (filter.usesStatistics) prologueUsesStatistics = true;
+		}
+		if (!prologueUsesStatistics) {
+			prologueLut = identityLut();
+			for (const ChainFilter &filter : prologue) filter.lut(prologueLut, nullptr);
+		}
+		epilogueLut = identityLut();
+		for (const ChainFilter &filter : epilogue) filter.lut(epilogueLut, nullptr);
+
+		for (const ChainFilter &filter : prologue) stageName += std::string(stageName.empty() ? "" : "+") + filter.name;
+		if (hasNeighbourhood) stageName += std::string(stageName.empty() ? "" : "+") + neighbourhood.name;
+		for (const ChainFilter &filter : epilogue) stageName += "+" + std::string(filter.name);
+	}
+
+	const std::string &name() const {
+		return stageName;
+	}
+
+	bool isFused() const {
+		return fused;
+	}
+
+	// Stateful stages must see the frames in order on a single thread
+	bool isStateful() const {
+		return state != nullptr;
+	}
+
+	void report() const {
+		if (state) state->report();
+	}
+
+	void apply(cv::Mat &frame, ChainWorkspace &ws) const {
+		if (state) {
+			state->apply(frame, ws.scratch);
+			return;
+		}
+		if (!fused) {
+			single.apply(frame, ws.scratch);
+			return;
+		}
+
+		const cv::Mat* lut = &prologueLut;
+		if (prologueUsesStatistics) {
+			computeHistogram(frame, ws.histogram);
+			ws.lut = identityLut();
+			for (const ChainFilter &filter : prologue) filter.lut(ws.lut, &ws.histogram);
+			lut = &ws.lut;
+		}
+
+		if (!hasNeighbourhood) {
+			cv::LUT(frame, *lut, frame);
+		} else {
+			applyBands(frame, *lut, ws);
+		}
+	}
+};
+
+// Split a chain into stages; with fuse = false every filter is its own stage
+inline std::vector<ChainStage> planChain(const std::vector<ChainFilter> &chain, bool fuse, const CliOptions &options) {
+	std::vector<ChainStage> stages;
+	size_t i = 0;
+	while (i < chain.size()) {
+		if (!fuse || chain[i].kind == FILTER_GENERIC || chain[i].kind == FILTER_STATEFUL) {
+			stages.push_back(ChainStage(chain[i++], options));
+			continue;
+		}
+
+		size_t first = i;
+		std::vector<ChainFilter> before, after;
+		const ChainFilter* center = nullptr;
+		while (i < chain.size() && chain[i].kind == FILTER_POINT) {
+			before.push_back(chain[i++]);
+		}
+		if (i < chain.size() && chain[i].kind == FILTER_NEIGHBOURHOOD) {
+			center = &chain[i++];
+			while (i < chain.size() && chain[i].kind == FILTER_POINT && !chain[i].usesStatistics) {
+				after.push_back(chain[i++]);
+			}
+		}
+
+		// Nothing to fuse with: keep the filter's own implementation
+		if (i - first == 1) {
+			stages.push_back(ChainStage(chain[first], options));
+		} else {
+			stages.push_back(ChainStage(before, center, after));
+		}
+	}
+	return stages;
+}
+
+inline std::string describeStages(const std::vector<ChainStage> &stages) {
+	std::string description;
+	for (size_t i = 0; i < stages.size(); ++i) {
+		if (i) description += " -> ";
+		description += stages[i].isFused() ? "[" + stages[i].name() + "]" : stages[i].name();
+	}
+	return description;
+}
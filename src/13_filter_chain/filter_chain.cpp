@@ -0,0 +1,608 @@
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <vector>
+#include <queue>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <sstream>
+#include "filter_kernels.hpp"
+#include "chain_fusion.hpp"
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/progress.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/trace.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define OUTPUT_VIDEO true
+#define BATCH_SIZE 10
+#define STAGE_QUEUE_SIZE 8  // Frames buffered between pipeline stages
+#define BALANCE_FRAMES 30   // Frames measured before pipeline threads are assigned
+
+// Runs an ordered list of filters on every frame in a single decode/encode pass.
+//
+// --mode frame     : each worker runs the whole chain on its own batch of frames
+//                    (frame-level parallelism, intermediates stay in that core's cache)
+// --mode pipeline  : each stage has its own thread(s), connected by bounded queues
+//                    (stage-level parallelism). Stateless stages are replicated;
+//                    stateful ones (scene detection, background subtraction, motion
+//                    blur reduction) get one thread and see the frames in order.
+//                    <num_threads> is the budget for the stage threads, spread over
+//                    the stages from their measured time per frame after the first
+//                    BALANCE_FRAMES frames, or given per stage with --stage-threads.
+//
+// Adjacent point filters, and point filters around a blur or sharpen, are fused into
+// single passes (see chain_fusion.hpp); --fuse 0 runs every filter separately.
+
+struct FrameBatch {
+	vector<Mat> frames;
+	int startIndex;
+};
+
+// Thread-safe queue
+class BatchQueue {
+private:
+	queue<FrameBatch> q;
+	mutex mtx;
+	condition_variable cv;
+	bool finished = false;
+
+public:
+	void push(FrameBatch batch) {
+		lock_guard<mutex> lock(mtx);
+		q.push(move(batch));
+		cv.notify_one();
+	}
+
+	bool pop(FrameBatch &batch) {
+		QueueWaitTimer waitTimer;
+		unique_lock<mutex> lock(mtx);
+		cv.wait(lock, [this] { return !q.empty() || finished; });
+		if (q.empty()) return false;
+		batch = move(q.front());
+		q.pop();
+		return true;
+	}
+
+	size_t size() {
+		lock_guard<mutex> lock(mtx);
+		return q.size();
+	}
+
+	void setFinished() {
+		lock_guard<mutex> lock(mtx);
+		finished = true;
+		cv.notify_all();
+	}
+
+	bool isFinished() {
+		lock_guard<mutex> lock(mtx);
+		return finished && q.empty();
+	}
+};
+
+// Bounded queue between two pipeline stages. Frames come out in index order, so a
+// replicated stage may finish them in any order and the next stage still sees them
+// in sequence. The frame that is due next is accepted even when the queue is full;
+// otherwise frames that overtook it could block it forever.
+class StageQueue {
+private:
+	map<int, Mat> pending;
+	int nextIndex = 0;
+	mutex mtx;
+	condition_variable notEmpty, notFull;
+	bool finished = false;
+
+public:
+	void push(int index, Mat frame) {
+		QueueWaitTimer waitTimer;
+		unique_lock<mutex> lock(mtx);
+		notFull.wait(lock, [&] { return pending.size() < STAGE_QUEUE_SIZE || index == nextIndex; });
+		pending[index] = move(frame);
+		notEmpty.notify_all();
+	}
+
+	bool pop(int &index, Mat &frame) {
+		QueueWaitTimer waitTimer;
+		unique_lock<mutex> lock(mtx);
+		notEmpty.wait(lock, [this] { return pending.count(nextIndex) || finished; });
+		auto it = pending.find(nextIndex);
+		if (it == pending.end()) return false;
+		index = nextIndex++;
+		frame = move(it->second);
+		pending.erase(it);
+		notFull.notify_all();
+		return true;
+	}
+
+	size_t size() {
+		lock_guard<mutex> lock(mtx);
+		return pending.size();
+	}
+
+	void setFinished() {
+		lock_guard<mutex> lock(mtx);
+		finished = true;
+		notEmpty.notify_all();
+	}
+};
+
+// Worker threads of one pipeline stage
+struct StageWorkers {
+	mutex mtx;
+	vector<PooledThread> threads;
+	int active = 0;
+	bool done = false;
+	double busyTicks = 0;
+	int frames = 0;
+};
+
+// What the threads of one run share; main() builds a new one for every run
+struct RunState {
+	int threadNum = 1;
+	vector<ChainFilter> chain;
+	vector<ChainStage> stages;
+	BatchQueue inputQueue, processedQueue;
+	atomic<int> framesProcessed{0};
+
+	// Accumulated time per stage, across all threads
+	mutex stageTicksMutex;
+	vector<double> stageTicks;
+
+	// Pipeline mode
+	vector<unique_ptr<StageQueue>> stageQueues;
+	vector<unique_ptr<StageWorkers>> stageWorkers;
+	QueueWatchGuard unwatch;  // last: the queues are unwatched before they go
+};
+
+void addStageTicks(RunState &state, const vector<double> &ticks) {
+	lock_guard<mutex> lock(state.stageTicksMutex);
+	for (size_t i = 0; i < ticks.size(); ++i) {
+		state.stageTicks[i] += ticks[i];
+	}
+}
+
+// Frame mode worker: runs the whole chain on every frame of a batch
+void processingWorker(RunState &state, int tid) {
+	traceThreadName("worker " + to_string(tid));
+	pinThread(ROLE_WORKER, tid);
+	FrameBatch batch;
+	ChainWorkspace workspace;
+	vector<double> ticks(state.stages.size(), 0.0);
+
+	while (state.inputQueue.pop(batch)) {
+		localizeFrames(batch.frames);
+		for (auto &frame : batch.frames) {
+			ComputeTimer computeTimer;
+			for (size_t i = 0; i < state.stages.size(); ++i) {
+				TraceSpan span(state.stages[i].name().c_str());
+				double start = getTickCount();
+				state.stages[i].apply(frame, workspace);
+				ticks[i] += getTickCount() - start;
+			}
+			state.framesProcessed++;
+		}
+		state.processedQueue.push(move(batch));
+	}
+
+	addStageTicks(state, ticks);
+}
+
+void runFrameParallel(RunState &state, FrameSource &captureVideo, FrameSink &outputVideo) {
+	// Start worker threads
+	vector<PooledThread> workers;
+	for (int i = 0; i < state.threadNum; ++i) {
+		workers.emplace_back(processingWorker, ref(state), i);
+	}
+
+	// Reading thread
+	PooledThread readerThread([&]() {
+		traceThreadName("reader");
+		pinThread(ROLE_READER);
+		int batchIndex = 0;
+		while (true) {
+			FrameBatch batch;
+			batch.startIndex = batchIndex * BATCH_SIZE;
+			batch.frames.reserve(BATCH_SIZE);
+
+			for (int i = 0; i < BATCH_SIZE; ++i) {
+				Mat frame;
+				captureVideo >> frame;
+				if (frame.empty()) break;
+				batch.frames.push_back(frame);
+			}
+
+			if (batch.frames.empty()) break;
+
+			state.inputQueue.push(move(batch));
+			batchIndex++;
+		}
+
+		state.inputQueue.setFinished();
+	});
+
+	// Writing thread
+	PooledThread writerThread([&]() {
+		traceThreadName("writer");
+		pinThread(ROLE_WRITER);
+		int expectedBatch = 0;
+		map<int, FrameBatch> outOfOrderBatches;
+
+		while (!state.processedQueue.isFinished()) {
+			FrameBatch batch;
+			if (!state.processedQueue.pop(batch)) continue;
+
+			int batchIndex = batch.startIndex / BATCH_SIZE;
+
+			if (batchIndex != expectedBatch) {
+				outOfOrderBatches[batchIndex] = move(batch);
+				continue;
+			}
+
+			// Write this batch
+			if (OUTPUT_VIDEO) {
+				for (auto &frame : batch.frames) {
+					outputVideo << frame;
+				}
+			}
+			expectedBatch++;
+
+			// Write queued batches
+			while (outOfOrderBatches.count(expectedBatch)) {
+				auto &nextBatch = outOfOrderBatches[expectedBatch];
+				if (OUTPUT_VIDEO) {
+					for (auto &frame : nextBatch.frames) {
+						outputVideo << frame;
+					}
+				}
+				outOfOrderBatches.erase(expectedBatch);
+				expectedBatch++;
+			}
+
+			// Show progress
+			int processed = state.framesProcessed.load();
+			if (processed % 30 == 0) {
+				printf("  Processed %d frames...\r", processed);
+				fflush(stdout);
+			}
+		}
+	});
+
+	// Wait for all threads
+	readerThread.join();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+	state.processedQueue.setFinished();
+	writerThread.join();
+}
+
+void stageWorker(RunState &state, int s) {
+	traceThreadName("stage " + to_string(s));
+	pinThread(ROLE_WORKER);
+	StageWorkers &workers = *state.stageWorkers[s];
+	ChainWorkspace workspace;
+	int index;
+	Mat frame;
+
+	while (state.stageQueues[s]->pop(index, frame)) {
+		if (s == 0) localizeFrame(frame);
+		TraceSpan span(state.stages[s].name().c_str());
+		double start = getTickCount();
+		state.stages[s].apply(frame, workspace);
+		double elapsed = getTickCount() - start;
+		span.end();
+		computeTickCounter() += (long long)elapsed;
+		{
+			lock_guard<mutex> lock(workers.mtx);
+			workers.busyTicks += elapsed;
+			workers.frames++;
+		}
+		state.stageQueues[s + 1]->push(index, move(frame));
+	}
+
+	// The last worker out closes the next queue
+	lock_guard<mutex> lock(workers.mtx);
+	if (--workers.active == 0) {
+		workers.done = true;
+		state.stageQueues[s + 1]->setFinished();
+	}
+}
+
+// Start another worker for stage s; false once the stage has finished
+bool addStageWorker(RunState &state, int s) {
+	StageWorkers &workers = *state.stageWorkers[s];
+	lock_guard<mutex> lock(workers.mtx);
+	if (workers.done) return false;
+	workers.active++;
+	workers.threads.emplace_back(stageWorker, ref(state), s);
+	return true;
+}
+
+int stageThreadCount(RunState &state, int s) {
+	StageWorkers &workers = *state.stageWorkers[s];
+	lock_guard<mutex> lock(workers.mtx);
+	return (int)workers.threads.size();
+}
+
+// Thread counts per stage for a budget of 'budget' threads. Every stage gets one;
+// each further thread goes to the stateless stage with the highest time per frame
+// per thread, until no stateless stage is slower than the slowest stateful one
+// (which cannot be replicated and bounds the throughput anyway).
+vector<int> balanceStageThreads(const RunState &state, const vector<double> &msPerFrame, int budget) {
+	int stageCount = (int)state.stages.size();
+	vector<int> threads(stageCount, 1);
+
+	double statefulBound = 0;
+	for (int s = 0; s < stageCount; ++s) {
+		if (state.stages[s].isStateful()) statefulBound = max(statefulBound, msPerFrame[s]);
+	}
+
+	for (int spare = budget - stageCount; spare > 0; --spare) {
+		int slowest = -1;
+		double slowestLoad = statefulBound;
+		for (int s = 0; s < stageCount; ++s) {
+			if (state.stages[s].isStateful()) continue;
+			double load = msPerFrame[s] / threads[s];
+			if (load > slowestLoad) {
+				slowest = s;
+				slowestLoad = load;
+			}
+		}
+		if (slowest < 0) break;
+		threads[slowest]++;
+	}
+	return threads;
+}
+
+void runPipeline(RunState &state, FrameSource &captureVideo, FrameSink &outputVideo, const vector<int> &fixedThreads) {
+	int stageCount = (int)state.stages.size();
+	for (int i = 0; i <= stageCount; ++i) {
+		state.stageQueues.emplace_back(new StageQueue());
+	}
+	// Watchers only after the vector is complete: they read it from the sampling thread
+	for (int i = 0; i <= stageCount; ++i) {
+		watchQueue("stage " + to_string(i), [&state, i] { return state.stageQueues[i]->size(); });
+	}
+	for (int s = 0; s < stageCount; ++s) {
+		state.stageWorkers.emplace_back(new StageWorkers());
+	}
+
+	// One thread per stage to start with (or the fixed counts)
+	for (int s = 0; s < stageCount; ++s) {
+		int count = fixedThreads.empty() ? 1 : fixedThreads[s];
+		for (int t = 0; t < count; ++t) {
+			addStageWorker(state, s);
+		}
+	}
+
+	// Reading thread
+	PooledThread readerThread([&]() {
+		traceThreadName("reader");
+		pinThread(ROLE_READER);
+		int index = 0;
+		while (true) {
+			Mat frame;
+			captureVideo >> frame;
+			if (frame.empty()) break;
+			state.stageQueues[0]->push(index++, move(frame));
+		}
+		state.stageQueues[0]->setFinished();
+	});
+
+	// Writing happens on this thread
+	traceThreadName("writer");
+	pinThread(ROLE_WRITER);
+	int index;
+	Mat frame;
+	while (state.stageQueues[stageCount]->pop(index, frame)) {
+		if (OUTPUT_VIDEO) {
+			outputVideo << frame;
+		}
+		int processed = ++state.framesProcessed;
+
+		// Assign the thread budget once the stages have been measured
+		if (processed == BALANCE_FRAMES && fixedThreads.empty()) {
+			vector<double> msPerFrame(stageCount, 0.0);
+			for (int s = 0; s < stageCount; ++s) {
+				StageWorkers &workers = *state.stageWorkers[s];
+				lock_guard<mutex> lock(workers.mtx);
+				if (workers.frames) msPerFrame[s] = workers.busyTicks * 1000.0 / getTickFrequency() / workers.frames;
+			}
+			vector<int> target = balanceStageThreads(state, msPerFrame, state.threadNum);
+			for (int s = 0; s < stageCount; ++s) {
+				for (int t = stageThreadCount(state, s); t < target[s]; ++t) {
+					addStageWorker(state, s);
+				}
+			}
+		}
+
+		if (processed % 30 == 0) {
+			printf("  Processed %d frames...\r", processed);
+			fflush(stdout);
+		}
+	}
+
+	readerThread.join();
+	for (int s = 0; s < stageCount; ++s) {
+		// No worker can be added any more: every stage has finished
+		for (auto &worker : state.stageWorkers[s]->threads) {
+			worker.join();
+		}
+		state.stageTicks[s] = state.stageWorkers[s]->busyTicks;
+	}
+}
+
+int main(int argc, const char** argv) {
+
+	CliOptions options(argc, argv);
+	RunMetrics metrics(options, argv[0]);
+	TraceSession trace(options);
+	ProgressPublisher progress(options);
+	RunState state;
+	watchQueue("input", [&state] { return state.inputQueue.size(); });
+	watchQueue("processed", [&state] { return state.processedQueue.size(); });
+
+	// Check arguments
+	if (argc < 2) {
+		printf("Usage: %s <video_file> <num_threads> [output_file] --filters a,b,c [--mode frame|pipeline] [--fuse 0|1] [--stage-threads n,n,...]\n", argv[0]);
+		printf("Example: %s input_videos/sample_video.mp4 4 --filters white_balance,histogram_equalization,frame_sharpening\n", argv[0]);
+		printf("Filters:");
+		for (const ChainFilter &filter : chainFilters) {
+			printf(" %s", filter.name);
+		}
+		printf("\n");
+		return 0;
+	}
+
+	if (argc < 3) {
+		printf("Error: Please specify number of threads\n");
+		return 0;
+	}
+
+	state.threadNum = atoi(argv[2]);
+	if (state.threadNum < 1) state.threadNum = 1;
+
+	string outputPath = (argc >= 4) ? argv[3] : "outputs/13_filter_chain/filter_chain.avi";
+
+	string unknownFilter;
+	if (!parseFilterChain(options.getString("filters", ""), state.chain, unknownFilter)) {
+		if (!unknownFilter.empty()) {
+			printf("Error: Unknown filter: %s\n", unknownFilter.c_str());
+		} else {
+			printf("Error: Please specify the filters to run with --filters a,b,c\n");
+		}
+		return -1;
+	}
+	state.stages = planChain(state.chain, options.getBool("fuse", true), options);
+	state.stageTicks.assign(state.stages.size(), 0.0);
+
+	string mode = options.getString("mode", "frame");
+	if (mode != "frame" && mode != "pipeline") {
+		printf("Error: Unknown mode: %s (use frame or pipeline)\n", mode.c_str());
+		return -1;
+	}
+
+	bool stateful = false;
+	for (const ChainStage &stage : state.stages) {
+		if (stage.isStateful()) stateful = true;
+	}
+	if (mode == "frame" && stateful) {
+		printf("Note: stateful filters need the frames in order, using pipeline mode\n");
+		mode = "pipeline";
+	}
+
+	// Optional fixed thread counts per stage (stateful stages always get one)
+	vector<int> fixedThreads;
+	if (options.has("stage-threads")) {
+		stringstream counts(options.getString("stage-threads", ""));
+		string count;
+		while (getline(counts, count, ',')) {
+			fixedThreads.push_back(max(1, atoi(count.c_str())));
+		}
+		if (fixedThreads.size() != state.stages.size()) {
+			printf("Error: --stage-threads needs one count per stage (%d): %s\n", (int)state.stages.size(), describeStages(state.stages).c_str());
+			return -1;
+		}
+		for (size_t s = 0; s < state.stages.size(); ++s) {
+			if (state.stages[s].isStateful()) fixedThreads[s] = 1;
+		}
+	}
+
+	// Open video
+	FrameSource captureVideo(options);
+	captureVideo.requireWritableFrames();  // the kernel works on the frames in place
+	if (!captureVideo.open(argv[1])) {
+		printf("Error: Cannot open video file: %s\n", argv[1]);
+		return -1;
+	}
+
+	int frameCount = (int)captureVideo.get(CAP_PROP_FRAME_COUNT);
+	double fps = captureVideo.get(CAP_PROP_FPS);
+	int width = (int)captureVideo.get(CAP_PROP_FRAME_WIDTH);
+	int height = (int)captureVideo.get(CAP_PROP_FRAME_HEIGHT);
+
+	// Setup output (color)
+	FrameSink outputVideo(options);
+	if (OUTPUT_VIDEO) {
+		outputVideo.open(outputPath, VideoWriter::fourcc('M', 'J', 'P', 'G'),
+		                 fps, Size(width, height), true);  // true = color
+		if (!outputVideo.isOpened()) {
+			printf("Error: Cannot create output video file\n");
+			return -1;
+		}
+	}
+
+	if (mode == "frame") {
+		printf("Processing video (Filter chain, frame parallel with %d threads)...\n", state.threadNum);
+	} else {
+		printf("Processing video (Filter chain, pipeline with %d stages, %d threads)...\n", (int)state.stages.size(), state.threadNum);
+	}
+	printf("Stages: %s\n", describeStages(state.stages).c_str());
+
+	double Total = getTickCount();
+
+	if (mode == "frame") {
+		runFrameParallel(state, captureVideo, outputVideo);
+	} else {
+		runPipeline(state, captureVideo, outputVideo, fixedThreads);
+	}
+
+	// Let the encoder finish the queued frames so they count towards the timing
+	outputVideo.flush();
+
+	Total = getTickCount() - Total;
+
+	int totalFrames = state.framesProcessed.load();
+
+	// Print results
+	printf("\n\n");
+	printf("========================================\n");
+	printf("Filter Chain - %s\n", mode == "frame" ? "Frame Parallel" : "Pipeline");
+	printf("========================================\n");
+	printf("Filters: %s\n", describeFilterChain(state.chain).c_str());
+	printf("Stages: %s\n", describeStages(state.stages).c_str());
+	int threadsUsed = state.threadNum;
+	if (mode == "pipeline") {
+		threadsUsed = 0;
+		for (size_t i = 0; i < state.stages.size(); ++i) threadsUsed += stageThreadCount(state, (int)i);
+	}
+	printf("Threads used: %d\n", threadsUsed);
+	printf("Processed frames: %d\n", totalFrames);
+	printf("Execution time: %.3fs\n", Total / getTickFrequency());
+	printf("Average FPS: %.2f\n", totalFrames / (Total / getTickFrequency()));
+	printf("Decode FPS: %.2f\n", captureVideo.decodeFps());
+	for (size_t i = 0; i < state.stages.size(); ++i) {
+		double msPerFrame = totalFrames ? state.stageTicks[i] * 1000.0 / getTickFrequency() / totalFrames : 0.0;
+		if (mode == "pipeline") {
+			printf("  %-40s %.3f ms/frame, %d thread(s)\n", state.stages[i].name().c_str(), msPerFrame, stageThreadCount(state, (int)i));
+		} else {
+			printf("  %-40s %.3f ms/frame\n", state.stages[i].name().c_str(), msPerFrame);
+		}
+	}
+	for (const ChainStage &stage : state.stages) {
+		stage.report();
+	}
+	printf("Output saved to: %s\n", outputPath.c_str());
+	printf("========================================\n");
+
+	metrics.write(totalFrames, threadsUsed, Total / getTickFrequency(), captureVideo, &outputVideo);
+	trace.write();
+
+	captureVideo.release();
+	if (OUTPUT_VIDEO) {
+		outputVideo.release();
+	}
+
+	return 0;
+}
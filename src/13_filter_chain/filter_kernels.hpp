@@ -0,0 +1,217 @@
+#pragma once
+
+// Kernels available to the filter chain. They are the single-filter programs' own
+// (each program directory has a <name>_kernels.hpp that its three variants include),
+// run as the sequential program runs them, so a one-filter chain produces the same
+// frames as the corresponding program.
+//
+// Every chain step transforms 'frame' in place and keeps it 8-bit BGR, so any filter
+// can follow any other. Steps that produce a new image write it into 'scratch' and
+// swap it in, which keeps both buffers alive and reused from frame to frame.
+// Filters that keep state between frames are in stateful_filters.hpp.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../01_grayscale/grayscale_kernels.hpp"
+#include "../02_gaussian_blur/gaussian_blur_kernels.hpp"
+#include "../03_edge_detection/edge_detection_kernels.hpp"
+#include "../04_white_balance/white_balance_kernels.hpp"
+#include "../05_histogram_equalization/histogram_equalization_kernels.hpp"
+#include "../06_frame_sharpening/frame_sharpening_kernels.hpp"
+#include "../09_brightness_contrast/brightness_contrast_kernels.hpp"
+#include "../11_contrast_enhancement/contrast_enhancement_kernels.hpp"
+#include "../12_lightup/lightup_kernels.hpp"
+#include "stateful_filters.hpp"
+
+// Chain steps: transform 'frame' in place, 'scratch' is a reusable work buffer
+
+inline void grayscaleStep(cv::Mat &frame, cv::Mat &scratch) {
+	convertToGrayscale(frame);
+}
+
+inline void gaussianBlurStep(cv::Mat &frame, cv::Mat &scratch) {
+	applyGaussianBlur(frame, scratch);
+	std::swap(frame, scratch);
+}
+
+inline void edgeDetectionStep(cv::Mat &frame, cv::Mat &scratch) {
+	applyEdgeDetection(frame, scratch);
+	cv::cvtColor(scratch, frame, cv::COLOR_GRAY2BGR);
+}
+
+inline void whiteBalanceStep(cv::Mat &frame, cv::Mat &scratch) {
+	whiteBalance(frame);
+}
+
+inline void histogramEqualizationStep(cv::Mat &frame, cv::Mat &scratch) {
+	applyHistogramEqualization(frame, scratch);
+	std::swap(frame, scratch);
+}
+
+inline void sharpenStep(cv::Mat &frame, cv::Mat &scratch) {
+	applySharpen(frame, scratch);
+	std::swap(frame, scratch);
+}
+
+inline void brightnessContrastStep(cv::Mat &frame, cv::Mat &scratch) {
+	applyBrightnessContrast(frame, frame);
+}
+
+inline void contrastEnhancementStep(cv::Mat &frame, cv::Mat &scratch) {
+	applyContrastEnhancement(frame, frame);
+}
+
+inline void lightUpStep(cv::Mat &frame, cv::Mat &scratch) {
+	lightUp(frame);
+}
+
+// Point filters also have a lookup-table form so that runs of them can be fused
+// (see chain_fusion.hpp). A LUT step maps the current table (1x256, CV_8UC3) through
+// the filter; filters that depend on frame statistics get the per-channel histogram
+// of the frame the table is applied to.
+
+struct FrameHistogram {
+	int counts[3][256];
+	int pixels;
+};
+
+inline void computeHistogram(const cv::Mat &frame, FrameHistogram &histogram) {
+	memset(&histogram, 0, sizeof(histogram));
+	histogram.pixels = frame.rows * frame.cols;
+	for (int i = 0; i < frame.rows; ++i) {
+		const cv::Vec3b *p = frame.ptr<cv::Vec3b>(i);
+		for (int j = 0; j < frame.cols; ++j) {
+			histogram.counts[0][p[j][0]]++;
+			histogram.counts[1][p[j][1]]++;
+			histogram.counts[2][p[j][2]]++;
+		}
+	}
+}
+
+// Static point filters: run the kernel itself over the table, so the arithmetic is
+// exactly the kernel's
+inline void brightnessContrastLut(cv::Mat &lut, const FrameHistogram *histogram) {
+	applyBrightnessContrast(lut, lut);
+}
+
+inline void contrastEnhancementLut(cv::Mat &lut, const FrameHistogram *histogram) {
+	applyContrastEnhancement(lut, lut);
+}
+
+// White balance of the frame after 'lut': the channel sums follow from the histogram
+inline void whiteBalanceLut(cv::Mat &lut, const FrameHistogram *histogram) {
+	cv::Vec3b *entry = lut.ptr<cv::Vec3b>(0);
+	long long sums[3] = { 0, 0, 0 };
+	for (int c = 0; c < 3; ++c) {
+		for (int v = 0; v < 256; ++v) {
+			sums[c] += (long long)histogram->counts[c][v] * entry[v][c];
+		}
+	}
+
+	int avg[3];
+	for (int c = 0; c < 3; ++c) {
+		avg[c] = (double)sums[c] / histogram->pixels;
+	}
+	int base = avg[1];
+
+	for (int v = 0; v < 256; ++v) {
+		for (int c = 0; c < 3; ++c) {
+			entry[v][c] = std::min(255, (int)(base * entry[v][c] / std::max(1, avg[c])));
+		}
+	}
+}
+
+// Light-up of the frame after 'lut': the brightest blue value follows from the histogram
+inline void lightUpLut(cv::Mat &lut, const FrameHistogram *histogram) {
+	cv::Vec3b *entry = lut.ptr<cv::Vec3b>(0);
+	int max_val = 0;
+	for (int v = 0; v < 256; ++v) {
+		if (histogram->counts[0][v]) max_val = std::max(max_val, entry[v][0] * 2 + 5);
+	}
+	for (int v = 0; v < 256; ++v) {
+		entry[v][0] = ((entry[v][0] * 2 + 5) * 255) / max_val;
+	}
+}
+
+// Neighbourhood filters also have a strip form: 'input' holds a band of rows plus the
+// rows around it the kernel reaches into, and rows [begin, end) of the result are
+// written to 'output'
+inline void gaussianBlurStrip(const cv::Mat &input, int begin, int end, cv::Mat &output, cv::Mat &work) {
+	applyGaussianBlur(input, work);
+	work.rowRange(begin, end).copyTo(output);
+}
+
+inline void sharpenStrip(const cv::Mat &input, int begin, int end, cv::Mat &output, cv::Mat &work) {
+	sharpenBlur(input, work);
+	sharpenCombine(input.rowRange(begin, end), work.rowRange(begin, end), output);
+}
+
+enum ChainFilterKind { FILTER_GENERIC, FILTER_POINT, FILTER_NEIGHBOURHOOD, FILTER_STATEFUL };
+
+typedef void (*ChainStep)(cv::Mat &frame, cv::Mat &scratch);
+typedef void (*LutStep)(cv::Mat &lut, const FrameHistogram *histogram);
+typedef void (*StripStep)(const cv::Mat &input, int begin, int end, cv::Mat &output, cv::Mat &work);
+typedef StatefulFilter* (*StatefulFactory)(const CliOptions &options);
+
+struct ChainFilter {
+	const char* name;
+	ChainStep apply;
+	ChainFilterKind kind;
+	LutStep lut;            // FILTER_POINT
+	bool usesStatistics;    // FILTER_POINT: the table depends on the frame's histogram
+	StripStep strip;        // FILTER_NEIGHBOURHOOD
+	int radius;             // FILTER_NEIGHBOURHOOD: rows the kernel reaches above/below
+	StatefulFactory create; // FILTER_STATEFUL: 0 for the others
+};
+
+// Filter names match the program directories (and the backend's feature names)
+static const ChainFilter chainFilters[] = {
+	{ "grayscale", grayscaleStep, FILTER_GENERIC, nullptr, false, nullptr, 0, nullptr },
+	{ "gaussian_blur", gaussianBlurStep, FILTER_NEIGHBOURHOOD, nullptr, false, gaussianBlurStrip, 7, nullptr },
+	{ "edge_detection", edgeDetectionStep, FILTER_GENERIC, nullptr, false, nullptr, 0, nullptr },
+	{ "white_balance", whiteBalanceStep, FILTER_POINT, whiteBalanceLut, true, nullptr, 0, nullptr },
+	{ "histogram_equalization", histogramEqualizationStep, FILTER_GENERIC, nullptr, false, nullptr, 0, nullptr },
+	{ "frame_sharpening", sharpenStep, FILTER_NEIGHBOURHOOD, nullptr, false, sharpenStrip, 2, nullptr },
+	{ "brightness_contrast", brightnessContrastStep, FILTER_POINT, brightnessContrastLut, false, nullptr, 0, nullptr },
+	{ "contrast_enhancement", contrastEnhancementStep, FILTER_POINT, contrastEnhancementLut, false, nullptr, 0, nullptr },
+	{ "lightup", lightUpStep, FILTER_POINT, lightUpLut, true, nullptr, 0, nullptr },
+	{ "scene_detection", nullptr, FILTER_STATEFUL, nullptr, false, nullptr, 0, createSceneDetection },
+	{ "background_subtraction", nullptr, FILTER_STATEFUL, nullptr, false, nullptr, 0, createBackgroundSubtraction },
+	{ "motion_blur_reduction", nullptr, FILTER_STATEFUL, nullptr, false, nullptr, 0, createMotionBlurReduction },
+};
+
+// Parse a comma-separated list of filter names; false (with 'unknown' set) on a bad name
+inline bool parseFilterChain(const std::string &list, std::vector<ChainFilter> &chain, std::string &unknown) {
+	chain.clear();
+	std::stringstream stream(list);
+	std::string name;
+	while (std::getline(stream, name, ',')) {
+		if (name.empty()) continue;
+		bool found = false;
+		for (const ChainFilter &filter : chainFilters) {
+			if (name == filter.name) {
+				chain.push_back(filter);
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			unknown = name;
+			return false;
+		}
+	}
+	return !chain.empty();
+}
+
+inline std::string describeFilterChain(const std::vector<ChainFilter> &chain) {
+	std::string description;
+	for (size_t i = 0; i < chain.size(); ++i) {
+		if (i) description += " -> ";
+		description += chain[i].name;
+	}
+	return description;
+}
@@ -0,0 +1,133 @@
+# Master script to run a filter chain in both parallel modes
+# Compiles, runs frame-parallel and pipeline modes (and the chain without fusion),
+# and shows performance comparison
+
+param(
+    [Parameter(Mandatory=$true)]
+    [string]$VideoFile,
+
+    [int]$NumThreads = 4,
+
+    [string]$Filters = "white_balance,histogram_equalization,frame_sharpening"
+)
+
+Write-Host "`n================================================================" -ForegroundColor Cyan
+Write-Host "     FILTER CHAIN VIDEO PROCESSING - PERFORMANCE ANALYSIS" -ForegroundColor Cyan
+Write-Host "================================================================" -ForegroundColor Cyan
+
+# Check if video file exists
+if (-not (Test-Path $VideoFile)) {
+    Write-Host "`nERROR: Video file not found: $VideoFile" -ForegroundColor Red
+    exit 1
+}
+
+# Set paths
+$rootDir = Split-Path -Parent (Split-Path -Parent $PSScriptRoot)
+$outputDir = Join-Path $rootDir "outputs\13_filter_chain"
+$buildDir = Join-Path $rootDir "build"
+
+# Create output directory if it doesn't exist
+if (-not (Test-Path $outputDir)) {
+    New-Item -ItemType Directory -Path $outputDir -Force | Out-Null
+    Write-Host "`nCreated output directory: $outputDir" -ForegroundColor Yellow
+}
+
+# Add MSYS2 to PATH for DLLs
+$env:PATH = "C:\msys64\ucrt64\bin;$env:PATH"
+
+Write-Host "`nVideo: $VideoFile" -ForegroundColor White
+Write-Host "Filters: $Filters" -ForegroundColor White
+Write-Host "Threads for frame-parallel mode: $NumThreads" -ForegroundColor White
+Write-Host "Output directory: $outputDir`n" -ForegroundColor White
+
+# Build
+Write-Host "----------------------------------------------------------------" -ForegroundColor DarkGray
+Write-Host "STEP 1: Building filter_chain..." -ForegroundColor Yellow
+Write-Host "----------------------------------------------------------------" -ForegroundColor DarkGray
+
+Set-Location $rootDir
+
+& "$rootDir\compile.ps1" -Program filter_chain
+
+Write-Host "`nCompiled successfully!`n" -ForegroundColor Green
+
+# Run Frame-Parallel Mode
+Write-Host "----------------------------------------------------------------" -ForegroundColor DarkGray
+Write-Host "STEP 2: Running FRAME-PARALLEL mode ($NumThreads threads)..." -ForegroundColor Yellow
+Write-Host "----------------------------------------------------------------" -ForegroundColor DarkGray
+
+$frameOutput = & "$buildDir\filter_chain.exe" $VideoFile $NumThreads "$outputDir\filter_chain_frame.avi" --filters $Filters --mode frame 2>&1
+Write-Host $frameOutput
+
+# Extract execution time
+$frameTime = 0.0
+$frameOutputStr = $frameOutput -join "`n"
+if ($frameOutputStr -match "Execution time:\s+([\d.]+)s") {
+    $frameTime = [double]$matches[1]
+}
+
+# Run Pipeline Mode
+Write-Host "`n----------------------------------------------------------------" -ForegroundColor DarkGray
+Write-Host "STEP 3: Running PIPELINE mode..." -ForegroundColor Yellow
+Write-Host "----------------------------------------------------------------" -ForegroundColor DarkGray
+
+$pipelineOutput = & "$buildDir\filter_chain.exe" $VideoFile $NumThreads "$outputDir\filter_chain_pipeline.avi" --filters $Filters --mode pipeline 2>&1
+Write-Host $pipelineOutput
+
+# Extract execution time
+$pipelineTime = 0.0
+$pipelineOutputStr = $pipelineOutput -join "`n"
+if ($pipelineOutputStr -match "Execution time:\s+([\d.]+)s") {
+    $pipelineTime = [double]$matches[1]
+}
+
+# Run Frame-Parallel Mode Without Fusion
+Write-Host "`n----------------------------------------------------------------" -ForegroundColor DarkGray
+Write-Host "STEP 4: Running FRAME-PARALLEL mode without fusion ($NumThreads threads)..." -ForegroundColor Yellow
+Write-Host "----------------------------------------------------------------" -ForegroundColor DarkGray
+
+$unfusedOutput = & "$buildDir\filter_chain.exe" $VideoFile $NumThreads "$outputDir\filter_chain_unfused.avi" --filters $Filters --mode frame --fuse 0 2>&1
+Write-Host $unfusedOutput
+
+# Extract execution time
+$unfusedTime = 0.0
+$unfusedOutputStr = $unfusedOutput -join "`n"
+if ($unfusedOutputStr -match "Execution time:\s+([\d.]+)s") {
+    $unfusedTime = [double]$matches[1]
+}
+
+# Check Fused Output Against Unfused
+Write-Host "`n----------------------------------------------------------------" -ForegroundColor DarkGray
+Write-Host "STEP 5: Comparing fused and unfused output..." -ForegroundColor Yellow
+Write-Host "----------------------------------------------------------------" -ForegroundColor DarkGray
+
+python backend/compare.py fusion $VideoFile --threads $NumThreads --chain $Filters --build-dir $buildDir
+if ($LASTEXITCODE -ne 0) {
+    Write-Host "`nFused output differs from the unfused chain!" -ForegroundColor Red
+    exit 1
+}
+
+# Display Performance Summary
+Write-Host "`n================================================================" -ForegroundColor Cyan
+Write-Host "              PERFORMANCE COMPARISON SUMMARY" -ForegroundColor Cyan
+Write-Host "================================================================" -ForegroundColor Cyan
+
+Write-Host "`n----------------------------------------------------------------" -ForegroundColor White
+Write-Host " Mode             Time (s)" -ForegroundColor White
+Write-Host "----------------------------------------------------------------" -ForegroundColor White
+
+$frameLine = " Frame parallel   {0,-10:F3}" -f $frameTime
+$pipelineLine = " Pipeline         {0,-10:F3}" -f $pipelineTime
+$unfusedLine = " Unfused (frame)  {0,-10:F3}" -f $unfusedTime
+
+Write-Host $frameLine -ForegroundColor Green
+Write-Host $pipelineLine -ForegroundColor Green
+Write-Host $unfusedLine -ForegroundColor Gray
+Write-Host "----------------------------------------------------------------" -ForegroundColor White
+
+Write-Host "`nOutput files saved in: $outputDir" -ForegroundColor Cyan
+Write-Host "   - filter_chain_frame.avi" -ForegroundColor Gray
+Write-Host "   - filter_chain_pipeline.avi" -ForegroundColor Gray
+Write-Host "   - filter_chain_unfused.avi" -ForegroundColor Gray
+
+Write-Host "`nAll tests completed successfully!`n" -ForegroundColor Green
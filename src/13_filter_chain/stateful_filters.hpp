@@ -0,0 +1,131 @@
+#pragma once
+
+// Filters that carry state from one frame to the next, built on the kernels of the
+// single-filter programs (07 scene detection, 08 background subtraction, 10 motion
+// blur reduction). They must see the frames in order, one at a time, so the chain runs
+// each of them as a pipeline stage with a single thread.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../07_scene_detection/scene_detection_kernels.hpp"
+#include "../08_background_subtraction/gaussian_mixture_background.hpp"
+#include "../10_motion_blur_reduction/motion_blur_reduction_kernels.hpp"
+#include "../common/cli_options.hpp"
+
+class StatefulFilter {
+public:
+	virtual ~StatefulFilter() {}
+
+	// Transform 'frame' in place (8-bit BGR); 'scratch' is a reusable work buffer
+	virtual void apply(cv::Mat &frame, cv::Mat &scratch) = 0;
+
+	// Print filter-specific results at the end of the run
+	virtual void report() {}
+};
+
+// 08_background_subtraction: the foreground mask (255 / 127 shadow / 0), as BGR.
+// Reads the same --components, --learning-rate, --history and --detect-shadows
+// options as the program.
+class BackgroundSubtractionFilter : public StatefulFilter {
+private:
+	GaussianMixtureBackground model;
+	cv::Mat mask;
+	int frameIndex = 0;
+
+public:
+	explicit BackgroundSubtractionFilter(const CliOptions &options) {
+		GmmParams gmmParams;
+		gmmParams.components = options.getInt("components", gmmParams.components);
+		gmmParams.learningRate = options.getDouble("learning-rate", gmmParams.learningRate);
+		gmmParams.history = options.getInt("history", gmmParams.history);
+		gmmParams.detectShadows = options.getBool("detect-shadows", gmmParams.detectShadows);
+		model.setParams(gmmParams);
+	}
+
+	void apply(cv::Mat &frame, cv::Mat &scratch) override {
+		model.apply(frame, mask, frameIndex++);
+		cv::cvtColor(mask, frame, cv::COLOR_GRAY2BGR);
+	}
+};
+
+// 10_motion_blur_reduction: average of the last TEMPORAL_WINDOW frames
+class MotionBlurReductionFilter : public StatefulFilter {
+private:
+	std::deque<cv::Mat> frameWindow;
+
+public:
+	void apply(cv::Mat &frame, cv::Mat &scratch) override {
+		// Recycle the buffer of the frame that leaves the window
+		cv::Mat copy;
+		if (frameWindow.size() >= TEMPORAL_WINDOW) {
+			copy = frameWindow.front();
+			frameWindow.pop_front();
+		}
+		frame.copyTo(copy);
+		frameWindow.push_back(copy);
+
+		reduceMotionBlur(frameWindow, scratch);
+		std::swap(frame, scratch);
+	}
+};
+
+// 07_scene_detection: frames pass through unchanged; the detected scene changes are
+// reported at the end and, with --scene-output <file>, written as frame,score lines
+class SceneDetectionFilter : public StatefulFilter {
+private:
+	cv::Mat prevFrame;
+	int frameNumber = 0;
+	int lastSceneFrame = -MIN_SCENE_GAP;
+	std::vector<std::pair<int, double>> sceneChanges;  // frame number, score
+	std::string outputPath;
+
+public:
+	explicit SceneDetectionFilter(const CliOptions &options) {
+		outputPath = options.getString("scene-output", "");
+	}
+
+	void apply(cv::Mat &frame, cv::Mat &scratch) override {
+		frameNumber++;
+		double score = 0.0;
+		if (!prevFrame.empty() && isSceneChange(prevFrame, frame, score) &&
+		    frameNumber - lastSceneFrame >= MIN_SCENE_GAP) {
+			sceneChanges.push_back(std::make_pair(frameNumber, score));
+			lastSceneFrame = frameNumber;
+		}
+		frame.copyTo(prevFrame);
+	}
+
+	void report() override {
+		printf("Detected scene changes: %d\n", (int)sceneChanges.size());
+		if (outputPath.empty()) return;
+
+		FILE *outFile = fopen(outputPath.c_str(), "w");
+		if (!outFile) {
+			printf("Error: Cannot create scene output file: %s\n", outputPath.c_str());
+			return;
+		}
+		fprintf(outFile, "frame,confidence\n");
+		for (const auto &change : sceneChanges) {
+			fprintf(outFile, "%d,%.1f\n", change.first, std::min(change.second, 100.0));
+		}
+		fclose(outFile);
+		printf("Scene changes saved to: %s\n", outputPath.c_str());
+	}
+};
+
+inline StatefulFilter* createBackgroundSubtraction(const CliOptions &options) {
+	return new BackgroundSubtractionFilter(options);
+}
+
+inline StatefulFilter* createMotionBlurReduction(const CliOptions &options) {
+	return new MotionBlurReductionFilter();
+}
+
+inline StatefulFilter* createSceneDetection(const CliOptions &options) {
+	return new SceneDetectionFilter(options);
+}
@@ -0,0 +1,533 @@
+// Processing server: every program in one long-lived process.
+//
+// Running a program once per job pays process start-up, OpenCV and FFmpeg
+// initialization and the first-touch page faults of its frame buffers on every run;
+// on short clips that is a large part of the measured time. The server compiles all
+// the programs into one executable (each in its own namespace, with main renamed) and
+// runs them one job at a time from a pipe, so those costs are paid once. OpenMP keeps
+// its thread team between jobs, the reader, worker, writer and encoder threads come from
+// a pool that outlives the jobs (thread_pool.hpp), and the heap keeps the pages of
+// earlier frames.
+//
+// A run keeps no state in globals: everything a pthread program's threads share is in
+// a RunState that its main() builds, so nothing has to be reset between jobs.
+//
+// Protocol, one line per message:
+//   stdin   run<TAB>ID<TAB>PROGRAM<TAB>ARG<TAB>ARG...   run PROGRAM (grayscale_openmp,
+//                                                     filter_chain, ...) with the
+//                                                     arguments of its command line
+//           quit
+//   stdout  {"event": "ready", "programs": [...]}
+//           {"event": "started", "id": "ID"}
+//           {"event": "progress", "id": "ID", "frames": N, ...}   live progress, the
+//                                                     fields of progress.hpp
+//           {"event": "done", "id": "ID", "exit_code": N, "seconds": S, "output": "..."}
+//
+// "output" is what the program printed (its last OUTPUT_TAIL_BYTES); "done" carries an
+// "error" field instead of running when the program is unknown or threw. Programs
+// print to a capture file during a job, and the server's stdout is kept for the
+// protocol. Inputs and outputs must be files ("-" for stdin / stdout is not
+// supported).
+//
+// Build: ./compile.ps1 -Program processing_server
+
+// Everything the programs include comes first, at global scope, so their own includes
+// are no-ops inside their namespaces
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "../common/affinity.hpp"
+#include "../common/cli_options.hpp"
+#include "../common/frame_arena.hpp"
+#include "../common/frame_cache.hpp"
+#include "../common/frame_sink.hpp"
+#include "../common/frame_source.hpp"
+#include "../common/progress.hpp"
+#include "../common/raw_video.hpp"
+#include "../common/run_metrics.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/trace.hpp"
+#include "../common/yuv_frame.hpp"
+#include "../01_grayscale/grayscale_kernels.hpp"
+#include "../02_gaussian_blur/gaussian_blur_kernels.hpp"
+#include "../03_edge_detection/edge_detection_kernels.hpp"
+#include "../04_white_balance/white_balance_kernels.hpp"
+#include "../05_histogram_equalization/histogram_equalization_kernels.hpp"
+#include "../06_frame_sharpening/frame_sharpening_kernels.hpp"
+#include "../07_scene_detection/scene_detection_kernels.hpp"
+#include "../08_background_subtraction/foreground_roi.hpp"
+#include "../08_background_subtraction/gaussian_mixture_background.hpp"
+#include "../09_brightness_contrast/brightness_contrast_kernels.hpp"
+#include "../10_motion_blur_reduction/motion_blur_reduction_kernels.hpp"
+#include "../11_contrast_enhancement/contrast_enhancement_kernels.hpp"
+#include "../12_lightup/lightup_kernels.hpp"
+#include "../13_filter_chain/chain_fusion.hpp"
+#include "../13_filter_chain/filter_kernels.hpp"
+#include "../13_filter_chain/stateful_filters.hpp"
+
+#define PROGRESS_INTERVAL_MS 500
+#define OUTPUT_TAIL_BYTES (64 << 10)
+
+// The programs, each in its own namespace
+#define main programMain
+
+#undef BATCH_SIZE
+namespace grayscale_sequential {
+#include "../01_grayscale/grayscale_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace grayscale_pthread {
+#include "../01_grayscale/grayscale_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace grayscale_openmp {
+#include "../01_grayscale/grayscale_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace gaussian_blur_sequential {
+#include "../02_gaussian_blur/gaussian_blur_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace gaussian_blur_pthread {
+#include "../02_gaussian_blur/gaussian_blur_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace gaussian_blur_openmp {
+#include "../02_gaussian_blur/gaussian_blur_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace edge_detection_sequential {
+#include "../03_edge_detection/edge_detection_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace edge_detection_pthread {
+#include "../03_edge_detection/edge_detection_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace edge_detection_openmp {
+#include "../03_edge_detection/edge_detection_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace white_balance_sequential {
+#include "../04_white_balance/white_balance_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace white_balance_pthread {
+#include "../04_white_balance/white_balance_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace white_balance_openmp {
+#include "../04_white_balance/white_balance_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace histogram_equalization_sequential {
+#include "../05_histogram_equalization/histogram_equalization_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace histogram_equalization_pthread {
+#include "../05_histogram_equalization/histogram_equalization_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace histogram_equalization_openmp {
+#include "../05_histogram_equalization/histogram_equalization_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace frame_sharpening_sequential {
+#include "../06_frame_sharpening/frame_sharpening_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace frame_sharpening_pthread {
+#include "../06_frame_sharpening/frame_sharpening_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace frame_sharpening_openmp {
+#include "../06_frame_sharpening/frame_sharpening_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace scene_detection_sequential {
+#include "../07_scene_detection/scene_detection_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace scene_detection_pthread {
+#include "../07_scene_detection/scene_detection_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace scene_detection_openmp {
+#include "../07_scene_detection/scene_detection_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace background_subtraction_sequential {
+#include "../08_background_subtraction/background_subtraction_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace background_subtraction_pthread {
+#include "../08_background_subtraction/background_subtraction_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace background_subtraction_openmp {
+#include "../08_background_subtraction/background_subtraction_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace brightness_contrast_sequential {
+#include "../09_brightness_contrast/brightness_contrast_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace brightness_contrast_pthread {
+#include "../09_brightness_contrast/brightness_contrast_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace brightness_contrast_openmp {
+#include "../09_brightness_contrast/brightness_contrast_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace motion_blur_reduction_sequential {
+#include "../10_motion_blur_reduction/motion_blur_reduction_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace motion_blur_reduction_pthread {
+#include "../10_motion_blur_reduction/motion_blur_reduction_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace motion_blur_reduction_openmp {
+#include "../10_motion_blur_reduction/motion_blur_reduction_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace contrast_enhancement_sequential {
+#include "../11_contrast_enhancement/contrast_enhancement_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace contrast_enhancement_pthread {
+#include "../11_contrast_enhancement/contrast_enhancement_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace contrast_enhancement_openmp {
+#include "../11_contrast_enhancement/contrast_enhancement_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace lightup_sequential {
+#include "../12_lightup/lightup_sequential.cpp"
+}
+
+#undef BATCH_SIZE
+namespace lightup_pthread {
+#include "../12_lightup/lightup_pthread.cpp"
+}
+
+#undef BATCH_SIZE
+namespace lightup_openmp {
+#include "../12_lightup/lightup_openmp.cpp"
+}
+
+#undef BATCH_SIZE
+namespace filter_chain {
+#include "../13_filter_chain/filter_chain.cpp"
+}
+
+#undef main
+#undef BATCH_SIZE
+
+using namespace std;
+using namespace cv;
+
+struct ServerProgram {
+	const char* name;
+	int (*run)(int argc, const char** argv);
+};
+
+static const ServerProgram programs[] = {
+	{"grayscale_sequential", grayscale_sequential::programMain},
+	{"grayscale_pthread", grayscale_pthread::programMain},
+	{"grayscale_openmp", grayscale_openmp::programMain},
+	{"gaussian_blur_sequential", gaussian_blur_sequential::programMain},
+	{"gaussian_blur_pthread", gaussian_blur_pthread::programMain},
+	{"gaussian_blur_openmp", gaussian_blur_openmp::programMain},
+	{"edge_detection_sequential", edge_detection_sequential::programMain},
+	{"edge_detection_pthread", edge_detection_pthread::programMain},
+	{"edge_detection_openmp", edge_detection_openmp::programMain},
+	{"white_balance_sequential", white_balance_sequential::programMain},
+	{"white_balance_pthread", white_balance_pthread::programMain},
+	{"white_balance_openmp", white_balance_openmp::programMain},
+	{"histogram_equalization_sequential", histogram_equalization_sequential::programMain},
+	{"histogram_equalization_pthread", histogram_equalization_pthread::programMain},
+	{"histogram_equalization_openmp", histogram_equalization_openmp::programMain},
+	{"frame_sharpening_sequential", frame_sharpening_sequential::programMain},
+	{"frame_sharpening_pthread", frame_sharpening_pthread::programMain},
+	{"frame_sharpening_openmp", frame_sharpening_openmp::programMain},
+	{"scene_detection_sequential", scene_detection_sequential::programMain},
+	{"scene_detection_pthread", scene_detection_pthread::programMain},
+	{"scene_detection_openmp", scene_detection_openmp::programMain},
+	{"background_subtraction_sequential", background_subtraction_sequential::programMain},
+	{"background_subtraction_pthread", background_subtraction_pthread::programMain},
+	{"background_subtraction_openmp", background_subtraction_openmp::programMain},
+	{"brightness_contrast_sequential", brightness_contrast_sequential::programMain},
+	{"brightness_contrast_pthread", brightness_contrast_pthread::programMain},
+	{"brightness_contrast_openmp", brightness_contrast_openmp::programMain},
+	{"motion_blur_reduction_sequential", motion_blur_reduction_sequential::programMain},
+	{"motion_blur_reduction_pthread", motion_blur_reduction_pthread::programMain},
+	{"motion_blur_reduction_openmp", motion_blur_reduction_openmp::programMain},
+	{"contrast_enhancement_sequential", contrast_enhancement_sequential::programMain},
+	{"contrast_enhancement_pthread", contrast_enhancement_pthread::programMain},
+	{"contrast_enhancement_openmp", contrast_enhancement_openmp::programMain},
+	{"lightup_sequential", lightup_sequential::programMain},
+	{"lightup_pthread", lightup_pthread::programMain},
+	{"lightup_openmp", lightup_openmp::programMain},
+	{"filter_chain", filter_chain::programMain},
+};
+
+FILE* protocolOut = nullptr;
+mutex protocolMutex;
+
+string jsonString(const string &value) {
+	string out = "\"";
+	for (char c : value) {
+		switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if ((unsigned char)c < 0x20) {
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+					out += escaped;
+				} else {
+					out += c;
+				}
+		}
+	}
+	return out + "\"";
+}
+
+void sendMessage(const string &json) {
+	lock_guard<mutex> lock(protocolMutex);
+	fprintf(protocolOut, "%s\n", json.c_str());
+	fflush(protocolOut);
+}
+
+const ServerProgram* findProgram(const string &name) {
+	for (const ServerProgram &program : programs) {
+		if (name == program.name) return &program;
+	}
+	return nullptr;
+}
+
+vector<string> splitTabs(const string &line) {
+	vector<string> fields;
+	size_t start = 0;
+	while (true) {
+		size_t end = line.find('\t', start);
+		fields.push_back(line.substr(start, end == string::npos ? string::npos : end - start));
+		if (end == string::npos) break;
+		start = end + 1;
+	}
+	return fields;
+}
+
+// Last 'maxBytes' of a capture file
+string readTail(const string &path, size_t maxBytes) {
+	FILE* in = fopen(path.c_str(), "rb");
+	if (!in) return "";
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	long start = max(0L, size - (long)maxBytes);
+	fseek(in, start, SEEK_SET);
+	string text((size_t)(size - start), '\0');
+	size_t got = fread(&text[0], 1, text.size(), in);
+	fclose(in);
+	text.resize(got);
+	return text;
+}
+
+// Reports the job's progress every PROGRESS_INTERVAL_MS until stopped
+class ProgressReporter {
+private:
+	string id;
+	mutex mtx;
+	condition_variable cv;
+	bool stopping = false;
+	thread reporter;
+
+public:
+	explicit ProgressReporter(const string &jobId) : id(jobId) {
+		reporter = thread([this]() {
+			ProgressSampler sampler;
+			unique_lock<mutex> lock(mtx);
+			while (!cv.wait_for(lock, chrono::milliseconds(PROGRESS_INTERVAL_MS), [this] { return stopping; })) {
+				// Sent even when nothing moved: a stalled job shows as fps 0
+				sendMessage("{\"event\": \"progress\", \"id\": " + jsonString(id) + ", " + sampler.sample().substr(1));
+			}
+		});
+	}
+
+	~ProgressReporter() {
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		cv.notify_all();
+		reporter.join();
+	}
+};
+
+void runJob(const vector<string> &fields, const string &capturePath, int ompDefaultThreads) {
+	string id = fields.size() > 1 ? fields[1] : "";
+	string name = fields.size() > 2 ? fields[2] : "";
+	const ServerProgram* program = findProgram(name);
+	if (!program) {
+		sendMessage("{\"event\": \"done\", \"id\": " + jsonString(id) + ", \"exit_code\": -1, \"error\": " +
+		            jsonString("unknown program: " + name) + "}");
+		return;
+	}
+
+	// argv as on the command line, with the program's name in argv[0]
+	vector<string> args(fields.begin() + 2, fields.end());
+	vector<const char*> argv;
+	for (const string &arg : args) argv.push_back(arg.c_str());
+	argv.push_back(nullptr);
+
+#ifdef _OPENMP
+	omp_set_num_threads(ompDefaultThreads);
+#endif
+	framesReadCounter() = 0;
+	framesWrittenCounter() = 0;
+	framesTotalHint() = 0;
+	clearWatchedQueues();
+	sendMessage("{\"event\": \"started\", \"id\": " + jsonString(id) + "}");
+
+	// Program output goes to the capture file for the length of the job
+	fflush(stdout);
+	FILE* capture = fopen(capturePath.c_str(), "w");
+	if (capture) {
+		dup2(fileno(capture), fileno(stdout));
+		fclose(capture);
+	}
+
+	int exitCode = -1;
+	string error;
+	double start = (double)getTickCount();
+	{
+		ProgressReporter progress(id);
+		try {
+			exitCode = program->run((int)args.size(), argv.data());
+		} catch (const exception &e) {
+			error = e.what();
+		}
+	}
+	double seconds = ((double)getTickCount() - start) / getTickFrequency();
+
+	fflush(stdout);
+	dup2(fileno(stderr), fileno(stdout));
+
+	string message = "{\"event\": \"done\", \"id\": " + jsonString(id) + ", \"exit_code\": " + to_string(exitCode) +
+	                 ", \"seconds\": " + to_string(seconds) + ", \"output\": " + jsonString(readTail(capturePath, OUTPUT_TAIL_BYTES));
+	if (!error.empty()) message += ", \"error\": " + jsonString(error);
+	sendMessage(message + "}");
+}
+
+int main() {
+	// The protocol keeps the real stdout; between jobs anything printed goes to stderr
+	fflush(stdout);
+	protocolOut = fdopen(dup(fileno(stdout)), "w");
+	if (!protocolOut) {
+		fprintf(stderr, "Error: Cannot duplicate stdout\n");
+		return 1;
+	}
+	dup2(fileno(stderr), fileno(stdout));
+
+	const char* tempDir = getenv("TEMP");
+	if (!tempDir) tempDir = getenv("TMPDIR");
+	if (!tempDir) tempDir = "/tmp";
+	string capturePath = string(tempDir) + "/processing_server_" + to_string((long long)getpid()) + ".log";
+
+	int ompDefaultThreads = 1;
+#ifdef _OPENMP
+	ompDefaultThreads = omp_get_max_threads();
+#endif
+
+	string list;
+	for (const ServerProgram &program : programs) {
+		list += (list.empty() ? "" : ", ") + jsonString(program.name);
+	}
+	sendMessage("{\"event\": \"ready\", \"programs\": [" + list + "]}");
+
+	string line;
+	while (getline(cin, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty()) continue;
+		vector<string> fields = splitTabs(line);
+		if (fields[0] == "quit") break;
+		if (fields[0] == "run") {
+			runJob(fields, capturePath, ompDefaultThreads);
+		} else {
+			sendMessage("{\"event\": \"error\", \"message\": " + jsonString("unknown command: " + fields[0]) + "}");
+		}
+	}
+
+	remove(capturePath.c_str());
+	return 0;
+}
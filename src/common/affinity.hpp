@@ -0,0 +1,503 @@
+#pragma once
+
+// Thread placement: pins the reader, worker and writer threads (or the OpenMP team)
+// to CPUs, and keeps the frames a worker processes on its own NUMA node.
+//
+// --pin <policy> chooses the CPU of every thread, out of the CPUs the process may run
+// on (so it stays inside what the backend's scheduler gave the job):
+//
+//   compact    fill one node before the next, one thread per physical core before
+//              the SMT siblings; keeps a small run on one socket and its cache
+//   scatter    alternate between the nodes (physical cores first), for the memory
+//              bandwidth of every socket
+//   0,2,4,...  exactly these CPUs, in this order
+//
+// The threads take the CPUs in order: the reader (the main thread of the sequential
+// and OpenMP programs) the first, the writer the second, worker i the (i + 3)th, and
+// OpenMP thread t the (t + 1)th, wrapping around when there are more threads than
+// CPUs. Without --pin nothing is pinned.
+//
+// Frames are decoded into buffers the reader's thread touched first, so they live on
+// the reader's node. A pinned worker on another node calls localizeFrame() on every
+// frame it takes: the frame is copied once into a buffer of the worker's own (the
+// copy touches it first, which places it on the worker's node) and the kernel's many
+// passes read local memory. --first-touch 0 turns the copy off and only counts.
+// Buffers the workers allocate for their output are on their node already. In the
+// OpenMP programs that give each thread whole frames of the batch, every iteration of
+// the parallel for localizes its frame the same way.
+//
+// The report at the end of the run (and "placement" in --metrics-json) has the
+// threads per node and the frames that crossed nodes between the reader, the workers
+// and the writer. The traffic is derived from where the threads were pinned, not
+// measured by the memory controllers. OpenMP background subtraction (row bands of
+// every frame) and motion blur reduction (each frame's pixels split over the team)
+// have no per-thread frames, so their traffic is not counted.
+//
+// Windows: the CPUs of processor group 0 only (up to 64).
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cli_options.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define LOCAL_FRAME_POOL 16  // node-local frame buffers kept per worker thread
+
+enum ThreadRole {
+	ROLE_READER,
+	ROLE_WRITER,
+	ROLE_WORKER
+};
+
+struct PlacementCpu {
+	int id;
+	int node;
+	int core;  // physical core, the same for SMT siblings
+	int smt;   // 0 for the first logical CPU of its core, 1 for its sibling, ...
+};
+
+#ifdef _WIN32
+typedef DWORD_PTR PlacementMask;
+#else
+typedef cpu_set_t PlacementMask;
+#endif
+
+// Placement of the current run
+struct ThreadPlacement {
+	std::mutex mtx;
+	std::string policy;              // empty when nothing is pinned
+	std::vector<PlacementCpu> order;  // the CPUs in the order the threads take them
+	int nodeCount = 1;
+	bool firstTouch = true;
+	std::vector<int> threadsOnNode;
+	std::atomic<int> nextWorker;
+	std::atomic<long long> framesIn;    // reader -> worker on another node
+	std::atomic<long long> bytesIn;
+	std::atomic<long long> framesOut;   // worker -> writer on another node
+	std::atomic<long long> framesLocalized;
+
+	// The thread that started the run and its CPUs, restored when the run ends
+	std::thread::id startThread;
+	PlacementMask startMask;
+	bool startThreadPinned = false;
+	int teamPinned = 0;
+
+	ThreadPlacement() : nextWorker(0), framesIn(0), bytesIn(0), framesOut(0), framesLocalized(0) {}
+
+	bool active() const {
+		return !policy.empty();
+	}
+
+	int readerNode() const {
+		return order[0].node;
+	}
+
+	int writerNode() const {
+		return order[1 % order.size()].node;
+	}
+};
+
+inline ThreadPlacement &threadPlacement() {
+	static ThreadPlacement placement;
+	return placement;
+}
+
+// Node of the CPU the calling thread is pinned to, -1 when it is not pinned
+inline int &currentThreadNode() {
+	thread_local int node = -1;
+	return node;
+}
+
+inline bool currentThreadMask(PlacementMask &mask) {
+#ifdef _WIN32
+	// No getter for a thread's mask: set it to itself to read it back
+	DWORD_PTR processMask, systemMask;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) return false;
+	mask = SetThreadAffinityMask(GetCurrentThread(), processMask);
+	if (!mask) return false;
+	SetThreadAffinityMask(GetCurrentThread(), mask);
+	return true;
+#else
+	CPU_ZERO(&mask);
+	return sched_getaffinity(0, sizeof(mask), &mask) == 0;
+#endif
+}
+
+inline bool setCurrentThreadMask(const PlacementMask &mask) {
+#ifdef _WIN32
+	return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+	return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+#endif
+}
+
+inline bool maskHasCpu(const PlacementMask &mask, int cpu) {
+#ifdef _WIN32
+	return cpu < (int)(sizeof(DWORD_PTR) * 8) && ((mask >> cpu) & 1);
+#else
+	return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &mask);
+#endif
+}
+
+#ifndef _WIN32
+// "0-3,8,10-11" -> 0 1 2 3 8 10 11
+inline std::vector<int> parseCpuList(const std::string &list) {
+	std::vector<int> cpus;
+	std::stringstream ranges(list);
+	std::string range;
+	while (std::getline(ranges, range, ',')) {
+		if (range.empty()) continue;
+		size_t dash = range.find('-');
+		int first = atoi(range.c_str());
+		int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+		for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+inline int readSysInt(const std::string &path, int def) {
+	FILE* f = fopen(path.c_str(), "r");
+	if (!f) return def;
+	int value = def;
+	if (fscanf(f, "%d", &value) != 1) value = def;
+	fclose(f);
+	return value;
+}
+#endif
+
+// The CPUs in 'allowed' with their node and core, by CPU id
+inline std::vector<PlacementCpu> discoverCpus(const PlacementMask &allowed) {
+	std::vector<PlacementCpu> cpus;
+#ifdef _WIN32
+	int bits = (int)(sizeof(DWORD_PTR) * 8);
+	std::vector<int> node(bits, 0), core(bits, -1);
+	DWORD length = 0;
+	GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+	std::vector<char> buffer(length);
+	auto* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)buffer.data();
+	if (length && GetLogicalProcessorInformationEx(RelationAll, info, &length)) {
+		int coreIndex = 0;
+		for (DWORD offset = 0; offset < length; ) {
+			auto* entry = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer.data() + offset);
+			if (entry->Relationship == RelationNumaNode && entry->NumaNode.GroupMask.Group == 0) {
+				for (int cpu = 0; cpu < bits; ++cpu) {
+					if ((entry->NumaNode.GroupMask.Mask >> cpu) & 1) node[cpu] = (int)entry->NumaNode.NodeNumber;
+				}
+			} else if (entry->Relationship == RelationProcessorCore && entry->Processor.GroupMask[0].Group == 0) {
+				for (int cpu = 0; cpu < bits; ++cpu) {
+					if ((entry->Processor.GroupMask[0].Mask >> cpu) & 1) core[cpu] = coreIndex;
+				}
+				coreIndex++;
+			}
+			offset += entry->Size;
+		}
+	}
+	for (int cpu = 0; cpu < bits; ++cpu) {
+		if (maskHasCpu(allowed, cpu)) cpus.push_back({cpu, node[cpu], core[cpu] >= 0 ? core[cpu] : -1 - cpu, 0});
+	}
+#else
+	std::vector<int> node(CPU_SETSIZE, 0);
+	if (DIR* dir = opendir("/sys/devices/system/node")) {
+		while (dirent* entry = readdir(dir)) {
+			int n;
+			if (sscanf(entry->d_name, "node%d", &n) != 1) continue;
+			FILE* f = fopen(("/sys/devices/system/node/" + std::string(entry->d_name) + "/cpulist").c_str(), "r");
+			if (!f) continue;
+			char list[4096] = {};
+			if (fgets(list, sizeof(list), f)) {
+				for (int cpu : parseCpuList(list)) {
+					if (cpu >= 0 && cpu < CPU_SETSIZE) node[cpu] = n;
+				}
+			}
+			fclose(f);
+		}
+		closedir(dir);
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (!maskHasCpu(allowed, cpu)) continue;
+		std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+		int package = readSysInt(topology + "physical_package_id", 0);
+		int coreId = readSysInt(topology + "core_id", cpu);
+		cpus.push_back({cpu, node[cpu], package * 65536 + coreId, 0});
+	}
+#endif
+	// Rank the SMT siblings of each core
+	for (size_t i = 0; i < cpus.size(); ++i) {
+		for (size_t j = 0; j < i; ++j) {
+			if (cpus[j].core == cpus[i].core) cpus[i].smt++;
+		}
+	}
+	return cpus;
+}
+
+// The CPUs in the order of a --pin policy; empty for an unknown policy
+inline std::vector<PlacementCpu> placementOrder(std::vector<PlacementCpu> cpus, const std::string &policy) {
+	if (policy == "compact") {
+		std::stable_sort(cpus.begin(), cpus.end(), [](const PlacementCpu &a, const PlacementCpu &b) {
+			if (a.node != b.node) return a.node < b.node;
+			return a.smt < b.smt;
+		});
+		return cpus;
+	}
+	if (policy == "scatter") {
+		// Rank of each CPU among the CPUs of its node with the same SMT rank
+		std::vector<int> rank(cpus.size(), 0);
+		for (size_t i = 0; i < cpus.size(); ++i) {
+			for (size_t j = 0; j < i; ++j) {
+				if (cpus[j].node == cpus[i].node && cpus[j].smt == cpus[i].smt) rank[i]++;
+			}
+		}
+		std::vector<size_t> index(cpus.size());
+		for (size_t i = 0; i < index.size(); ++i) index[i] = i;
+		std::stable_sort(index.begin(), index.end(), [&](size_t a, size_t b) {
+			if (cpus[a].smt != cpus[b].smt) return cpus[a].smt < cpus[b].smt;
+			if (rank[a] != rank[b]) return rank[a] < rank[b];
+			return cpus[a].node < cpus[b].node;
+		});
+		std::vector<PlacementCpu> ordered;
+		for (size_t i : index) ordered.push_back(cpus[i]);
+		return ordered;
+	}
+
+	// Explicit list
+	std::vector<PlacementCpu> ordered;
+	std::stringstream ids(policy);
+	std::string id;
+	while (std::getline(ids, id, ',')) {
+		if (id.empty() || id.find_first_not_of("0123456789") != std::string::npos) return {};
+		int cpu = atoi(id.c_str());
+		auto found = std::find_if(cpus.begin(), cpus.end(), [cpu](const PlacementCpu &c) { return c.id == cpu; });
+		if (found == cpus.end()) {
+			printf("Warning: CPU %d is not available to this process, not pinning to it\n", cpu);
+			continue;
+		}
+		ordered.push_back(*found);
+	}
+	return ordered;
+}
+
+// Reset the placement for a run and read --pin / --first-touch (called by RunMetrics)
+inline void startThreadPlacement(const CliOptions &options) {
+	ThreadPlacement &placement = threadPlacement();
+	std::lock_guard<std::mutex> lock(placement.mtx);
+	placement.policy.clear();
+	placement.order.clear();
+	placement.threadsOnNode.clear();
+	placement.nextWorker = 0;
+	placement.framesIn = 0;
+	placement.bytesIn = 0;
+	placement.framesOut = 0;
+	placement.framesLocalized = 0;
+	placement.startThreadPinned = false;
+	placement.teamPinned = 0;
+	currentThreadNode() = -1;
+
+	std::string policy = options.getString("pin", "");
+	if (policy.empty()) return;
+	placement.startThread = std::this_thread::get_id();
+	if (!currentThreadMask(placement.startMask)) {
+		printf("Warning: cannot read the CPU affinity, not pinning threads\n");
+		return;
+	}
+	placement.order = placementOrder(discoverCpus(placement.startMask), policy);
+	if (placement.order.empty()) {
+		printf("Warning: unknown --pin policy '%s' (use compact, scatter or a CPU list), not pinning threads\n", policy.c_str());
+		return;
+	}
+	int maxNode = 0;
+	for (const PlacementCpu &cpu : placement.order) maxNode = std::max(maxNode, cpu.node);
+	placement.threadsOnNode.assign(maxNode + 1, 0);
+	placement.nodeCount = 0;
+	for (int node = 0; node <= maxNode; ++node) {
+		for (const PlacementCpu &cpu : placement.order) {
+			if (cpu.node == node) {
+				placement.nodeCount++;
+				break;
+			}
+		}
+	}
+	placement.firstTouch = options.getBool("first-touch", true);
+	placement.policy = policy;
+}
+
+// Pin the calling thread to the CPU of slot 'slot'
+inline void pinToSlot(int slot) {
+	ThreadPlacement &placement = threadPlacement();
+	if (!placement.active()) return;
+	const PlacementCpu &cpu = placement.order[slot % placement.order.size()];
+#ifdef _WIN32
+	PlacementMask mask = (DWORD_PTR)1 << cpu.id;
+#else
+	PlacementMask mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu.id, &mask);
+#endif
+	if (!setCurrentThreadMask(mask)) return;
+	currentThreadNode() = cpu.node;
+	std::lock_guard<std::mutex> lock(placement.mtx);
+	placement.threadsOnNode[cpu.node]++;
+	if (std::this_thread::get_id() == placement.startThread) placement.startThreadPinned = true;
+}
+
+// Pin the calling thread for its role; workers pass their index (or -1 to take the
+// next free worker slot). Call at the start of the thread, after traceThreadName().
+inline void pinThread(ThreadRole role, int index = -1) {
+	if (!threadPlacement().active()) return;
+	if (role == ROLE_READER) {
+		pinToSlot(0);
+	} else if (role == ROLE_WRITER) {
+		pinToSlot(1);
+	} else {
+		pinToSlot(2 + (index >= 0 ? index : threadPlacement().nextWorker++));
+	}
+}
+
+// Pin the main thread of a sequential program, which reads, processes and writes.
+// Call after opening the input and output: on Linux, threads the decoder and encoder
+// start later would inherit its single CPU.
+inline void pinMainThread() {
+	pinThread(ROLE_READER);
+}
+
+// Pin every thread of an OpenMP team of 'threads' (the main thread as the reader).
+// Call after opening the input and output, like pinMainThread().
+inline void pinOpenMPTeam(int threads) {
+#ifdef _OPENMP
+	ThreadPlacement &placement = threadPlacement();
+	if (!placement.active()) return;
+	#pragma omp parallel num_threads(threads)
+	{
+		pinToSlot(omp_get_thread_num());
+	}
+	placement.teamPinned = std::max(placement.teamPinned, threads);
+#else
+	(void)threads;
+	pinMainThread();
+#endif
+}
+
+// Undo the pinning of the threads that outlive the run (the main thread and the
+// OpenMP team of the processing server); called by RunMetrics at the end of the run
+inline void endThreadPlacement() {
+	ThreadPlacement &placement = threadPlacement();
+	if (!placement.active()) return;
+#ifdef _OPENMP
+	if (placement.teamPinned > 0) {
+		#pragma omp parallel num_threads(placement.teamPinned)
+		{
+			setCurrentThreadMask(placement.startMask);
+			currentThreadNode() = -1;
+		}
+	}
+#endif
+	if (placement.startThreadPinned && std::this_thread::get_id() == placement.startThread) {
+		setCurrentThreadMask(placement.startMask);
+	}
+	currentThreadNode() = -1;
+}
+
+// Count a frame a worker takes from the reader, and the frame it hands on to the
+// writer, when they cross nodes. 'share' is the part of the frame the worker reads.
+inline bool countFrameTraffic(const cv::Mat &frame, double share = 1.0) {
+	ThreadPlacement &placement = threadPlacement();
+	int node = currentThreadNode();
+	if (node < 0 || placement.nodeCount < 2) return false;
+	if (node != placement.writerNode()) placement.framesOut++;
+	if (node == placement.readerNode()) return false;
+	placement.framesIn++;
+	placement.bytesIn += (long long)(frame.total() * frame.elemSize() * share);
+	return true;
+}
+
+// Move a frame from the reader's node to the calling worker's node (see above)
+inline void localizeFrame(cv::Mat &frame) {
+	if (!countFrameTraffic(frame) || !threadPlacement().firstTouch || frame.empty()) return;
+
+	// A buffer of this thread's pool that nothing else refers to any more
+	thread_local std::vector<cv::Mat> pool;
+	cv::Mat local;
+	for (cv::Mat &buffer : pool) {
+		if (buffer.u && buffer.u->refcount == 1 && buffer.size() == frame.size() && buffer.type() == frame.type()) {
+			local = buffer;
+			break;
+		}
+	}
+	if (local.empty()) {
+		local.create(frame.size(), frame.type());
+		if (pool.size() < LOCAL_FRAME_POOL) pool.push_back(local);
+	}
+	frame.copyTo(local);
+	frame = local;
+	threadPlacement().framesLocalized++;
+}
+
+inline void localizeFrames(std::vector<cv::Mat> &frames) {
+	for (cv::Mat &frame : frames) localizeFrame(frame);
+}
+
+inline void printPlacement() {
+	ThreadPlacement &placement = threadPlacement();
+	if (!placement.active()) return;
+	std::lock_guard<std::mutex> lock(placement.mtx);
+	printf("Thread placement: %s over %d CPUs on %d node(s), threads per node:", placement.policy.c_str(),
+	       (int)placement.order.size(), placement.nodeCount);
+	for (size_t node = 0; node < placement.threadsOnNode.size(); ++node) {
+		if (placement.threadsOnNode[node]) printf(" %d:%d", (int)node, placement.threadsOnNode[node]);
+	}
+	printf("\n");
+	if (placement.nodeCount > 1) {
+		printf("Cross-node traffic: %lld frames to workers (%.1f MB, %lld copied to the worker's node), %lld frames to the writer\n",
+		       placement.framesIn.load(), placement.bytesIn.load() / (1024.0 * 1024.0), placement.framesLocalized.load(),
+		       placement.framesOut.load());
+	}
+}
+
+inline void writePlacement(FILE* out) {
+	ThreadPlacement &placement = threadPlacement();
+	if (!placement.active()) {
+		fprintf(out, "  \"placement\": null,\n");
+		return;
+	}
+	std::lock_guard<std::mutex> lock(placement.mtx);
+	fprintf(out, "  \"placement\": {\n");
+	fprintf(out, "    \"policy\": \"");
+	for (char c : placement.policy) {
+		if (c != '"' && c != '\\' && (unsigned char)c >= 0x20) fputc(c, out);
+	}
+	fprintf(out, "\",\n");
+	fprintf(out, "    \"cpus\": %d,\n", (int)placement.order.size());
+	fprintf(out, "    \"nodes\": %d,\n", placement.nodeCount);
+	fprintf(out, "    \"threads_per_node\": [");
+	for (size_t node = 0; node < placement.threadsOnNode.size(); ++node) {
+		fprintf(out, "%s%d", node ? ", " : "", placement.threadsOnNode[node]);
+	}
+	fprintf(out, "],\n");
+	fprintf(out, "    \"cross_node_frames_in\": %lld,\n", placement.framesIn.load());
+	fprintf(out, "    \"cross_node_bytes_in\": %lld,\n", placement.bytesIn.load());
+	fprintf(out, "    \"localized_frames\": %lld,\n", placement.framesLocalized.load());
+	fprintf(out, "    \"cross_node_frames_out\": %lld\n", placement.framesOut.load());
+	fprintf(out, "  },\n");
+}
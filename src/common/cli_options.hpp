@@ -0,0 +1,64 @@
+#pragma once
+
+// Command-line options shared by the processing programs.
+//
+// Options are given as "--name value" pairs anywhere on the command line. They are
+// removed from argv on construction, so the positional arguments every program
+// already expects (<video_file> [num_threads] [output_file]) keep their indices.
+
+#include <cstdlib>
+#include <map>
+#include <string>
+
+class CliOptions {
+private:
+	std::map<std::string, std::string> values;
+
+public:
+	CliOptions(int &argc, const char** argv) {
+		int positional = 1;
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-') {
+				std::string name = arg.substr(2);
+				size_t eq = name.find('=');
+				if (eq != std::string::npos) {
+					values[name.substr(0, eq)] = name.substr(eq + 1);
+				} else if (i + 1 < argc) {
+					values[name] = argv[++i];
+				} else {
+					values[name] = "1";
+				}
+			} else {
+				argv[positional++] = argv[i];
+			}
+		}
+		argc = positional;
+	}
+
+	bool has(const std::string &name) const {
+		return values.count(name) > 0;
+	}
+
+	std::string getString(const std::string &name, const std::string &def = "") const {
+		auto it = values.find(name);
+		return it != values.end() ? it->second : def;
+	}
+
+	int getInt(const std::string &name, int def) const {
+		auto it = values.find(name);
+		return it != values.end() ? atoi(it->second.c_str()) : def;
+	}
+
+	double getDouble(const std::string &name, double def) const {
+		auto it = values.find(name);
+		return it != values.end() ? atof(it->second.c_str()) : def;
+	}
+
+	bool getBool(const std::string &name, bool def) const {
+		auto it = values.find(name);
+		if (it == values.end()) return def;
+		const std::string &v = it->second;
+		return !(v == "0" || v == "false" || v == "off" || v == "no");
+	}
+};
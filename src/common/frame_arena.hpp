@@ -0,0 +1,198 @@
+#pragma once
+
+// Per-thread arena for the temporaries of the multi-step kernels.
+//
+// Kernels like histogram equalization (YCrCb copy, three channel planes) or edge
+// detection (gray, blurred) allocate several full-frame Mats on every call and free
+// them at its end, so every frame goes through malloc and free (and, for large
+// blocks, mmap and fresh page faults) a few times per thread. Instead the kernel
+// opens an ArenaScope and takes its temporaries from it:
+//
+//   ArenaScope scratch;
+//   Mat ycrcb = scratch.mat();                  // buffer from this thread's arena
+//   vector<Mat> channels = scratch.mats(3);
+//
+// The buffers are carved out of one block per thread by bumping an offset, and the
+// offset goes back when the scope ends, so every call reuses the same memory, which
+// is still in cache from the last frame. A call that needs more than the block holds
+// gets the rest from the default allocator, and the block grows to the largest
+// amount needed once nothing in it is in use, so after the first frame everything
+// comes from the arena.
+//
+// Only Mats that do not outlive the scope may come from it, and they must be released
+// on the thread that allocated them. --arena 0 turns it off (for comparisons).
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <new>
+#include <vector>
+#include "cli_options.hpp"
+
+#define ARENA_ALIGN 64  // every buffer starts on a cache line
+
+// Process-wide switch and totals
+struct FrameArenaTotals {
+	std::atomic<bool> enabled;
+	std::atomic<long long> allocations;  // buffers served from an arena
+	std::atomic<long long> fallbacks;    // buffers that did not fit and went to the default allocator
+	std::atomic<long long> blockBytes;   // arena blocks allocated or grown, in all threads
+
+	FrameArenaTotals() : enabled(true), allocations(0), fallbacks(0), blockBytes(0) {}
+};
+
+inline FrameArenaTotals &frameArenaTotals() {
+	static FrameArenaTotals totals;
+	return totals;
+}
+
+class FrameArena : public cv::MatAllocator {
+private:
+	cv::Mat block;                        // the memory handed out (from the default allocator)
+	mutable size_t offset = 0;            // bytes of the block in use
+	mutable size_t needed = 0;            // bytes asked for since the arena was empty, fallbacks included
+	mutable size_t highWater = 0;         // most bytes needed at once
+	mutable int live = 0;                 // buffers from the block not released yet
+	mutable std::vector<cv::UMatData*> spare;  // released headers, to be used again
+
+	static size_t aligned(size_t bytes) {
+		return (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	}
+
+public:
+	struct Mark {
+		size_t offset;
+		size_t needed;
+		int live;
+	};
+
+	FrameArena() {}
+	FrameArena(const FrameArena&) = delete;
+	FrameArena &operator=(const FrameArena&) = delete;
+
+	~FrameArena() {
+		for (cv::UMatData* u : spare) delete u;
+	}
+
+	Mark mark() const {
+		return {offset, needed, live};
+	}
+
+	// Give back everything allocated since 'm', if all of it has been released; when
+	// the arena is empty again the block is grown to the most it had to provide
+	void rewind(const Mark &m) {
+		if (live != m.live) return;  // a buffer outlived its scope: keep it
+		offset = m.offset;
+		needed = m.needed;
+		if (live == 0 && highWater > (size_t)block.cols) {
+			block.release();
+			block.create(1, (int)highWater, CV_8U);
+			frameArenaTotals().blockBytes += block.cols;
+		}
+	}
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+	                       cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+		cv::MatAllocator* fallback = cv::Mat::getDefaultAllocator();
+		if (data) return fallback->allocate(dims, sizes, type, data, step, flags, usageFlags);
+
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--) {
+			if (step) step[i] = total;
+			total *= sizes[i];
+		}
+		size_t bytes = aligned(total);
+		needed += bytes;
+		highWater = std::max(highWater, needed);
+		if (offset + bytes > (size_t)block.cols) {
+			frameArenaTotals().fallbacks++;
+			return fallback->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+
+		cv::UMatData* u;
+		if (spare.empty()) {
+			u = new cv::UMatData(this);
+		} else {
+			u = spare.back();
+			spare.pop_back();
+			u->~UMatData();
+			new (u) cv::UMatData(this);
+		}
+		u->data = u->origdata = block.data + offset;
+		u->size = total;
+		offset += bytes;
+		live++;
+		frameArenaTotals().allocations++;
+		return u;
+	}
+
+	bool allocate(cv::UMatData* data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override {
+		(void)data; (void)accessflags; (void)usageFlags;
+		return false;
+	}
+
+	void deallocate(cv::UMatData* u) const override {
+		if (!u) return;
+		live--;
+		spare.push_back(u);
+	}
+};
+
+// The calling thread's arena
+inline FrameArena &frameArena() {
+	thread_local FrameArena arena;
+	return arena;
+}
+
+// The temporaries of one kernel call. Declare it before the Mats it provides, so they
+// are released before it rewinds the arena.
+class ArenaScope {
+private:
+	FrameArena* arena;
+	FrameArena::Mark start;
+
+public:
+	ArenaScope() : arena(frameArenaTotals().enabled.load(std::memory_order_relaxed) ? &frameArena() : nullptr) {
+		if (arena) start = arena->mark();
+	}
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope &operator=(const ArenaScope&) = delete;
+
+	~ArenaScope() {
+		if (arena) arena->rewind(start);
+	}
+
+	// An empty Mat whose buffer comes from the arena when it is created
+	cv::Mat mat() const {
+		cv::Mat m;
+		m.allocator = arena;
+		return m;
+	}
+
+	std::vector<cv::Mat> mats(int count) const {
+		return std::vector<cv::Mat>(count, mat());
+	}
+};
+
+// Read --arena for a run and reset the totals (called by RunMetrics)
+inline void configureFrameArena(const CliOptions &options) {
+	FrameArenaTotals &totals = frameArenaTotals();
+	totals.enabled = options.getBool("arena", true);
+	totals.allocations = 0;
+	totals.fallbacks = 0;
+	totals.blockBytes = 0;
+}
+
+inline void writeFrameArena(FILE* out) {
+	FrameArenaTotals &totals = frameArenaTotals();
+	if (!totals.enabled) {
+		fprintf(out, "  \"arena\": null,\n");
+		return;
+	}
+	fprintf(out, "  \"arena\": {\n");
+	fprintf(out, "    \"allocations\": %lld,\n", totals.allocations.load());
+	fprintf(out, "    \"fallbacks\": %lld,\n", totals.fallbacks.load());
+	fprintf(out, "    \"block_bytes\": %lld\n", totals.blockBytes.load());
+	fprintf(out, "  },\n");
+}
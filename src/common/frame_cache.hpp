@@ -0,0 +1,317 @@
+#pragma once
+
+// Decoded-frame cache for repeated runs on the same input (--frame-cache <file>).
+//
+// When the cache is missing, FrameSource::open() decodes the whole video into it
+// before the program starts timing, so every run - the first one included - reads
+// its frames from the cache. The file holds a small header, the frames at
+// page-aligned offsets, and a frame index at the end. The header is only completed
+// (and the temporary file renamed into place) once the whole video has been read, so
+// an interrupted run never leaves a partial cache behind. Runs that start at the
+// same time wait on a lock file (<file>.lock) while one of them builds the cache.
+// --frame-cache-mb N caps the file; a video that does not fit is not cached.
+//
+// Runs map the file copy-on-write and return Mats pointing straight into the
+// mapping. Programs whose kernels write into their input frames ask FrameSource for
+// copies instead (requireWritableFrames()), so the copy-on-write faults do not land
+// in the timed kernels. The cache is tied to the source file's size and
+// modification time and is rebuilt when either changes.
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define FRAME_CACHE_VERSION 1
+#define FRAME_CACHE_ALIGN 4096
+
+struct FrameCacheHeader {
+	char magic[8];
+	uint32_t version;
+	int32_t width, height, type;
+	double fps;
+	int64_t sourceSize, sourceTime;
+	int64_t frameCount;    // 0 until the cache is complete
+	uint64_t frameBytes;
+	uint64_t indexOffset;  // frameCount int64 offsets, one per frame
+};
+
+// Size and modification time identify the source the cache was built from
+inline bool frameCacheSourceId(const std::string &path, int64_t &size, int64_t &time) {
+#ifdef _WIN32
+	struct __stat64 info;
+	if (_stat64(path.c_str(), &info) != 0) return false;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) return false;
+#endif
+	size = (int64_t)info.st_size;
+	time = (int64_t)info.st_mtime;
+	return true;
+}
+
+// Exclusive lock on <cache>.lock, held while a cache is built; released on destruction
+class FrameCacheLock {
+private:
+#ifdef _WIN32
+	HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+	int fd = -1;
+#endif
+
+public:
+	explicit FrameCacheLock(const std::string &cachePath) {
+		std::string lockPath = cachePath + ".lock";
+#ifdef _WIN32
+		handle = CreateFileA(lockPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		                     nullptr, OPEN_ALWAYS, 0, nullptr);
+		OVERLAPPED overlapped = {};
+		if (handle != INVALID_HANDLE_VALUE) LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+#else
+		fd = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd >= 0) flock(fd, LOCK_EX);
+#endif
+	}
+	FrameCacheLock(const FrameCacheLock&) = delete;
+	FrameCacheLock &operator=(const FrameCacheLock&) = delete;
+
+	~FrameCacheLock() {
+#ifdef _WIN32
+		if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+#else
+		if (fd >= 0) ::close(fd);
+#endif
+	}
+};
+
+class FrameCacheReader {
+private:
+	uchar* base = nullptr;
+	size_t mappedBytes = 0;
+	const FrameCacheHeader* header = nullptr;
+	const int64_t* index = nullptr;
+	int nextFrame = 0;
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+	bool map(const std::string &cachePath) {
+#ifdef _WIN32
+		fileHandle = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart < (LONGLONG)sizeof(FrameCacheHeader)) return false;
+		mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (!mapping) return false;
+		base = (uchar*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		mappedBytes = (size_t)size.QuadPart;
+		return base != nullptr;
+#else
+		int fd = ::open(cachePath.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(FrameCacheHeader)) {
+			::close(fd);
+			return false;
+		}
+		mappedBytes = (size_t)info.st_size;
+		void* address = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (address == MAP_FAILED) return false;
+		base = (uchar*)address;
+		madvise(base, mappedBytes, MADV_SEQUENTIAL);
+		return true;
+#endif
+	}
+
+public:
+	~FrameCacheReader() {
+		close();
+	}
+
+	// Map a complete cache built from 'sourcePath'; false if missing or stale
+	bool open(const std::string &cachePath, const std::string &sourcePath) {
+		close();
+		int64_t sourceSize, sourceTime;
+		if (!frameCacheSourceId(sourcePath, sourceSize, sourceTime) || !map(cachePath)) {
+			close();
+			return false;
+		}
+
+		header = (const FrameCacheHeader*)base;
+		bool valid = memcmp(header->magic, "PVFCACHE", 8) == 0 &&
+		             header->version == FRAME_CACHE_VERSION &&
+		             header->frameCount > 0 &&
+		             header->sourceSize == sourceSize && header->sourceTime == sourceTime &&
+		             header->indexOffset + header->frameCount * sizeof(int64_t) <= mappedBytes;
+		if (!valid) {
+			close();
+			return false;
+		}
+		index = (const int64_t*)(base + header->indexOffset);
+		nextFrame = 0;
+		return true;
+	}
+
+	bool isOpened() const {
+		return header != nullptr;
+	}
+
+	const FrameCacheHeader &getHeader() const {
+		return *header;
+	}
+
+	// Point 'frame' at the next cached frame (no copy); empty at the end
+	bool read(cv::Mat &frame) {
+		if (!header || nextFrame >= header->frameCount) {
+			frame.release();
+			return false;
+		}
+		frame = cv::Mat(header->height, header->width, header->type, base + index[nextFrame++]);
+		return true;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (base) UnmapViewOfFile(base);
+		if (mapping) CloseHandle(mapping);
+		if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+		mapping = nullptr;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (base) munmap(base, mappedBytes);
+#endif
+		base = nullptr;
+		header = nullptr;
+		index = nullptr;
+		mappedBytes = 0;
+	}
+};
+
+class FrameCacheWriter {
+private:
+	FILE* file = nullptr;
+	std::string cachePath, tempPath;
+	FrameCacheHeader header;
+	std::vector<int64_t> index;
+	int64_t offset = 0;
+	int64_t maxBytes = 0;  // 0 = no limit
+
+	void pad() {
+		static const char zeros[FRAME_CACHE_ALIGN] = {};
+		int64_t aligned = (offset + FRAME_CACHE_ALIGN - 1) / FRAME_CACHE_ALIGN * FRAME_CACHE_ALIGN;
+		fwrite(zeros, 1, (size_t)(aligned - offset), file);
+		offset = aligned;
+	}
+
+public:
+	~FrameCacheWriter() {
+		abandon();
+	}
+
+	// 'limitBytes' > 0 abandons the cache once it would grow beyond that size
+	bool open(const std::string &path, const std::string &sourcePath, double fps, int64_t limitBytes = 0) {
+		abandon();
+		maxBytes = limitBytes;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "PVFCACHE", 8);
+		header.version = FRAME_CACHE_VERSION;
+		header.fps = fps;
+		if (!frameCacheSourceId(sourcePath, header.sourceSize, header.sourceTime)) return false;
+
+		// Per-process temporary name, so concurrent first runs do not collide
+#ifdef _WIN32
+		unsigned long processId = GetCurrentProcessId();
+#else
+		unsigned long processId = (unsigned long)getpid();
+#endif
+		cachePath = path;
+		tempPath = path + ".tmp" + std::to_string(processId);
+		file = fopen(tempPath.c_str(), "wb");
+		if (!file) return false;
+		setvbuf(file, nullptr, _IOFBF, 8 << 20);
+
+		// Placeholder header; the real one is written by finish()
+		fwrite(&header, sizeof(header), 1, file);
+		offset = sizeof(header);
+		index.clear();
+		return true;
+	}
+
+	bool isOpened() const {
+		return file != nullptr;
+	}
+
+	void write(const cv::Mat &frame) {
+		if (!file) return;
+		if (index.empty()) {
+			header.width = frame.cols;
+			header.height = frame.rows;
+			header.type = frame.type();
+			header.frameBytes = frame.total() * frame.elemSize();
+		} else if (frame.cols != header.width || frame.rows != header.height || frame.type() != header.type) {
+			abandon();  // frame size changed mid-stream; not cacheable
+			return;
+		}
+
+		pad();
+		if (maxBytes > 0 && offset + (int64_t)header.frameBytes + (int64_t)(index.size() + 1) * (int64_t)sizeof(int64_t) > maxBytes) {
+			abandon();  // over the size budget
+			return;
+		}
+		index.push_back(offset);
+		size_t rowBytes = frame.cols * frame.elemSize();
+		for (int y = 0; y < frame.rows; ++y) {
+			fwrite(frame.ptr(y), 1, rowBytes, file);
+		}
+		offset += (int64_t)header.frameBytes;
+	}
+
+	// Write the index and the completed header, then move the cache into place
+	bool finish() {
+		if (!file) return false;
+		pad();
+		header.indexOffset = (uint64_t)offset;
+		header.frameCount = (int64_t)index.size();
+		fwrite(index.data(), sizeof(int64_t), index.size(), file);
+		fseek(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, file);
+		bool ok = fclose(file) == 0 && header.frameCount > 0;
+		file = nullptr;
+
+		if (ok) {
+			remove(cachePath.c_str());
+			ok = rename(tempPath.c_str(), cachePath.c_str()) == 0;
+		}
+		if (!ok) remove(tempPath.c_str());
+		return ok;
+	}
+
+	// Drop an incomplete cache
+	void abandon() {
+		if (!file) return;
+		fclose(file);
+		file = nullptr;
+		remove(tempPath.c_str());
+	}
+};
@@ -0,0 +1,402 @@
+#pragma once
+
+// Video output shared by the processing programs.
+//
+// FrameSink is used like cv::VideoWriter (open / isOpened / << / release), but the
+// encoding runs on its own thread (a pooled one, see thread_pool.hpp) behind a bounded
+// queue, so the caller only pays for one frame copy. Frame buffers are recycled
+// between the caller and the encoder thread.
+//
+// For .mp4 outputs built with -DUSE_FFMPEG, frames are encoded in-process to H.264
+// (libx264, frame- and slice-threaded) and muxed straight into the MP4, so no
+// separate transcode pass is needed. Otherwise cv::VideoWriter is used: the given
+// fourcc for .avi, H.264 ('avc1', falling back to 'mp4v') for .mp4.
+//
+// --output-format y4m|raw writes uncompressed frames instead (see raw_video.hpp;
+// outputs ending in .y4m are recognized without the option), and --output-format null
+// discards them, so timings contain no encoder at all.
+//
+// I420 frames (see yuv_frame.hpp) are accepted as well: the MP4 encoder and Y4M take
+// their planes as they are, cv::VideoWriter gets them converted to BGR (or gray).
+//
+// Encoded videos are 4:2:0, which needs even dimensions, so frames of an odd width or
+// height lose their last column / row there (raw and Y4M outputs keep every pixel).
+//
+// Options: --encode-threads N (0 = auto), --crf N (default 23), --preset NAME
+// (default "fast"), --encode-queue N (frames buffered ahead of the encoder, default 16).
+//
+// Encoding time and the time callers wait for the encoder are kept for the run
+// metrics (see run_metrics.hpp). framesWrittenCounter() counts the frames written by
+// every FrameSink of the process and encoderQueueDepth() the frames waiting for the
+// encoder, for the live progress (progress.hpp).
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cli_options.hpp"
+#include "raw_video.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include "yuv_frame.hpp"
+
+#ifdef USE_FFMPEG
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+inline std::atomic<long long> &framesWrittenCounter() {
+	static std::atomic<long long> frames(0);
+	return frames;
+}
+
+inline std::atomic<long long> &encoderQueueDepth() {
+	static std::atomic<long long> frames(0);
+	return frames;
+}
+
+class FrameSink {
+private:
+	int encodeThreads = 0;
+	int crf = 23;
+	std::string preset = "fast";
+	size_t queueLimit = 16;
+	std::string outputFormat;
+
+	bool opened = false;
+	bool discard = false;
+	bool color = true;
+	cv::Size frameSize;
+	cv::Size encodeSize;  // frameSize cropped to even dimensions for the video encoders
+	cv::Mat converted;  // I420 frames converted for cv::VideoWriter (encoder thread only)
+	cv::VideoWriter writer;
+	RawVideoWriter rawWriter;
+
+	// Encoder thread and the queue feeding it
+	PooledThread encoderThread;
+	std::mutex mtx;
+	std::condition_variable queueChanged;
+	std::deque<cv::Mat> pending;
+	std::vector<cv::Mat> spare;
+	bool encoding = false;
+	bool closing = false;
+	int framesEncoded = 0;
+	double encodeTicks = 0;
+	double waitTicks = 0;  // time callers spent blocked on a full queue or in flush()
+
+#ifdef USE_FFMPEG
+	bool useLibav = false;
+	AVFormatContext* format = nullptr;
+	AVCodecContext* codec = nullptr;
+	AVStream* stream = nullptr;
+	AVFrame* picture = nullptr;
+	AVPacket* packet = nullptr;
+	SwsContext* scaler = nullptr;
+	int64_t nextPts = 0;
+
+	bool openEncoder(const std::string &path, double fps, cv::Size size) {
+		if (avformat_alloc_output_context2(&format, nullptr, nullptr, path.c_str()) < 0 || !format) return false;
+
+		const AVCodec* encoder = avcodec_find_encoder_by_name("libx264");
+		if (!encoder) encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+		if (!encoder) return false;
+
+		stream = avformat_new_stream(format, nullptr);
+		codec = avcodec_alloc_context3(encoder);
+		codec->width = size.width;
+		codec->height = size.height;
+		codec->pix_fmt = AV_PIX_FMT_YUV420P;
+		codec->time_base = av_inv_q(av_d2q(fps > 0 ? fps : 30.0, 100000));
+		codec->framerate = av_inv_q(codec->time_base);
+		codec->thread_count = encodeThreads;
+		codec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+		if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+			codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		}
+		av_opt_set(codec->priv_data, "preset", preset.c_str(), 0);
+		av_opt_set(codec->priv_data, "crf", std::to_string(crf).c_str(), 0);
+
+		if (avcodec_open2(codec, encoder, nullptr) < 0) return false;
+		avcodec_parameters_from_context(stream->codecpar, codec);
+		stream->time_base = codec->time_base;
+
+		if (!(format->oformat->flags & AVFMT_NOFILE) && avio_open(&format->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) return false;
+		if (avformat_write_header(format, nullptr) < 0) return false;
+
+		picture = av_frame_alloc();
+		picture->format = codec->pix_fmt;
+		picture->width = codec->width;
+		picture->height = codec->height;
+		if (av_frame_get_buffer(picture, 0) < 0) return false;
+		packet = av_packet_alloc();
+		nextPts = 0;
+		return true;
+	}
+
+	// Send one frame (or nullptr to flush) and mux every packet that comes out
+	void encodePicture(const cv::Mat* frame) {
+		if (frame) {
+			av_frame_make_writable(picture);
+			bool i420 = isI420Frame(*frame, frameSize);
+			AVPixelFormat srcFormat = i420 ? AV_PIX_FMT_YUV420P : frame->channels() == 1 ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_BGR24;
+			// Odd sizes are cropped by giving the scaler only the even part of the frame
+			int srcWidth = i420 ? frame->cols : codec->width;
+			int srcHeight = i420 ? frameSize.height : codec->height;
+			scaler = sws_getCachedContext(scaler, srcWidth, srcHeight, srcFormat,
+			                              codec->width, codec->height, codec->pix_fmt,
+			                              SWS_BILINEAR, nullptr, nullptr, nullptr);
+			uint8_t* src[3] = { frame->data, nullptr, nullptr };
+			int srcStride[3] = { (int)frame->step, 0, 0 };
+			if (i420) i420Planes(*frame, src, srcStride);
+			sws_scale(scaler, src, srcStride, 0, srcHeight, picture->data, picture->linesize);
+			picture->pts = nextPts++;
+		}
+
+		avcodec_send_frame(codec, frame ? picture : nullptr);
+		while (avcodec_receive_packet(codec, packet) == 0) {
+			av_packet_rescale_ts(packet, codec->time_base, stream->time_base);
+			packet->stream_index = stream->index;
+			av_interleaved_write_frame(format, packet);
+		}
+	}
+
+	void closeEncoder() {
+		if (codec && picture && packet && format && format->pb) {
+			encodePicture(nullptr);
+			av_write_trailer(format);
+		}
+		if (scaler) sws_freeContext(scaler);
+		if (picture) av_frame_free(&picture);
+		if (packet) av_packet_free(&packet);
+		if (codec) avcodec_free_context(&codec);
+		if (format) {
+			if (!(format->oformat->flags & AVFMT_NOFILE) && format->pb) avio_closep(&format->pb);
+			avformat_free_context(format);
+		}
+		scaler = nullptr;
+		format = nullptr;
+		stream = nullptr;
+	}
+#endif
+
+	// The even-sized part of a frame (shares its data)
+	cv::Mat cropToEncodeSize(const cv::Mat &image) const {
+		return image.size() == encodeSize ? image : image(cv::Rect(0, 0, encodeSize.width, encodeSize.height));
+	}
+
+	// cv::VideoWriter only takes BGR and gray frames
+	void writeFrame(const cv::Mat &frame) {
+		if (!isI420Frame(frame, frameSize)) {
+			writer.write(cropToEncodeSize(frame));
+		} else if (color) {
+			cv::cvtColor(frame, converted, cv::COLOR_YUV2BGR_I420);
+			writer.write(cropToEncodeSize(converted));
+		} else {
+			lumaToGray(frame, converted);
+			writer.write(cropToEncodeSize(converted));
+		}
+	}
+
+	void encoderLoop() {
+		traceThreadName("encoder");
+		while (true) {
+			cv::Mat frame;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				queueChanged.wait(lock, [this] { return !pending.empty() || closing; });
+				if (pending.empty()) return;
+				frame = pending.front();
+				pending.pop_front();
+				encoderQueueDepth() = (long long)pending.size();
+				encoding = true;
+			}
+
+			TraceSpan span("encode");
+			double start = (double)cv::getTickCount();
+			if (rawWriter.isOpened()) {
+				rawWriter.write(frame);
+			} else {
+#ifdef USE_FFMPEG
+				if (useLibav) encodePicture(&frame);
+				else writeFrame(frame);
+#else
+				writeFrame(frame);
+#endif
+			}
+			double elapsed = (double)cv::getTickCount() - start;
+			span.end();
+
+			std::lock_guard<std::mutex> lock(mtx);
+			encodeTicks += elapsed;
+			framesEncoded++;
+			encoding = false;
+			spare.push_back(frame);
+			queueChanged.notify_all();
+		}
+	}
+
+	bool openWriter(const std::string &path, bool mp4, int fourcc, double fps, cv::Size size, bool isColor) {
+		if (mp4) {
+			writer.open(path, cv::VideoWriter::fourcc('a', 'v', 'c', '1'), fps, size, isColor);
+			if (!writer.isOpened()) writer.open(path, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, size, isColor);
+		} else {
+			writer.open(path, fourcc, fps, size, isColor);
+		}
+		return writer.isOpened();
+	}
+
+public:
+	FrameSink() {}
+
+	explicit FrameSink(const CliOptions &options) {
+		encodeThreads = options.getInt("encode-threads", 0);
+		crf = options.getInt("crf", 23);
+		preset = options.getString("preset", "fast");
+		queueLimit = (size_t)std::max(1, options.getInt("encode-queue", 16));
+		outputFormat = options.getString("output-format", "");
+	}
+
+	FrameSink(const FrameSink&) = delete;
+	FrameSink &operator=(const FrameSink&) = delete;
+
+	~FrameSink() {
+		release();
+	}
+
+	bool open(const std::string &path, int fourcc, double fps, cv::Size size, bool isColor = true) {
+		release();
+		color = isColor;
+		frameSize = size;
+		encodeSize = cv::Size(size.width & ~1, size.height & ~1);
+
+		std::string sinkFormat = outputFormat;
+		if (sinkFormat.empty()) sinkFormat = hasFileExtension(path, ".y4m") ? "y4m" : "video";
+		if (sinkFormat == "null") {
+			discard = true;
+			opened = true;
+			return true;
+		}
+
+		if (sinkFormat == "y4m" || sinkFormat == "raw") {
+			if (!rawWriter.open(path, sinkFormat == "y4m", size.width, size.height, fps, isColor)) return false;
+		} else if (sinkFormat == "video") {
+			bool mp4 = hasFileExtension(path, ".mp4");
+#ifdef USE_FFMPEG
+			useLibav = mp4;
+			if (useLibav && !openEncoder(path, fps, encodeSize)) {
+				closeEncoder();
+				return false;
+			}
+			if (!useLibav && !openWriter(path, mp4, fourcc, fps, encodeSize, isColor)) return false;
+#else
+			if (!openWriter(path, mp4, fourcc, fps, encodeSize, isColor)) return false;
+#endif
+		} else {
+			return false;
+		}
+
+		closing = false;
+		framesEncoded = 0;
+		encodeTicks = 0;
+		waitTicks = 0;
+		encoderThread = PooledThread(&FrameSink::encoderLoop, this);
+		opened = true;
+		return true;
+	}
+
+	bool isOpened() const {
+		return opened;
+	}
+
+	// Queue a copy of 'frame' for encoding; blocks while the queue is full
+	void write(const cv::Mat &frame) {
+		if (!opened) return;
+		framesWrittenCounter()++;
+		if (discard) return;
+		TraceSpan span("write");
+		std::unique_lock<std::mutex> lock(mtx);
+		if (pending.size() >= queueLimit) {
+			TraceSpan waitSpan("queue wait");
+			double start = (double)cv::getTickCount();
+			queueChanged.wait(lock, [this] { return pending.size() < queueLimit; });
+			waitTicks += (double)cv::getTickCount() - start;
+		}
+
+		cv::Mat buffer;
+		if (!spare.empty()) {
+			buffer = spare.back();
+			spare.pop_back();
+		}
+		lock.unlock();
+		frame.copyTo(buffer);
+		lock.lock();
+
+		pending.push_back(buffer);
+		encoderQueueDepth() = (long long)pending.size();
+		queueChanged.notify_all();
+	}
+
+	FrameSink &operator<<(const cv::Mat &frame) {
+		write(frame);
+		return *this;
+	}
+
+	// Wait until every queued frame has been encoded
+	void flush() {
+		if (!opened || discard) return;
+		TraceSpan span("flush");
+		double start = (double)cv::getTickCount();
+		std::unique_lock<std::mutex> lock(mtx);
+		queueChanged.wait(lock, [this] { return pending.empty() && !encoding; });
+		waitTicks += (double)cv::getTickCount() - start;
+	}
+
+	void release() {
+		if (opened && !discard) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				closing = true;
+				queueChanged.notify_all();
+			}
+			encoderThread.join();
+		}
+		opened = false;
+		discard = false;
+		rawWriter.close();
+#ifdef USE_FFMPEG
+		closeEncoder();
+		useLibav = false;
+#endif
+		writer.release();
+		pending.clear();
+		spare.clear();
+		encoderQueueDepth() = 0;
+	}
+
+	// Frames per second the encoder managed, counting only time spent encoding.
+	// Valid once the queue has been flushed or released.
+	double encodeFps() const {
+		double seconds = encodeSeconds();
+		return seconds > 0 ? framesEncoded / seconds : 0.0;
+	}
+
+	// Time spent encoding, on the encoder thread
+	double encodeSeconds() const {
+		return encodeTicks / cv::getTickFrequency();
+	}
+
+	// Time the writing side spent waiting for the encoder: blocked on a full queue
+	// in write() and in flush()
+	double encoderWaitSeconds() const {
+		return waitTicks / cv::getTickFrequency();
+	}
+};
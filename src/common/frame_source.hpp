@@ -0,0 +1,403 @@
+#pragma once
+
+// Video input shared by the processing programs.
+//
+// FrameSource is used exactly like cv::VideoCapture (open / isOpened / get / >> /
+// release). Built with -DUSE_FFMPEG it decodes through libavcodec directly, with
+// frame- and slice-threading enabled, and converts each picture straight into the
+// caller's Mat - no intermediate copy, and a Mat that already has the right size is
+// reused. Without USE_FFMPEG it falls back to cv::VideoCapture and passes the thread
+// count on to OpenCV's own FFmpeg backend.
+//
+// --frame-cache <file> keeps the decoded frames of a video in a memory-mapped cache
+// (see frame_cache.hpp): open() fills it when it is missing, before the program's
+// timed part, and every run reads from it instead of decoding.
+//
+// --input-format y4m|raw bypasses the decoder entirely (see raw_video.hpp); inputs
+// ending in .y4m are recognized without the option.
+//
+// Programs whose kernel works on luminance call enableYuv() after open(): with
+// --yuv 1 frames are then delivered in I420 instead of BGR (see yuv_frame.hpp),
+// when the input allows it - FFmpeg decoding or 4:2:0 Y4M/raw input, no frame cache.
+//
+// Time spent inside the decoder is accumulated separately so programs can report
+// decode FPS next to their processing FPS.
+//
+// framesReadCounter() counts the frames delivered by every FrameSource of the
+// process, and framesTotalHint() holds the frame count of the input opened last
+// (0 when unknown); progress.hpp reports both while the program runs.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "cli_options.hpp"
+#include "frame_cache.hpp"
+#include "raw_video.hpp"
+#include "trace.hpp"
+#include "yuv_frame.hpp"
+
+#ifdef USE_FFMPEG
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+inline std::atomic<long long> &framesReadCounter() {
+	static std::atomic<long long> frames(0);
+	return frames;
+}
+
+inline std::atomic<long long> &framesTotalHint() {
+	static std::atomic<long long> frames(0);
+	return frames;
+}
+
+class FrameSource {
+private:
+#ifdef USE_FFMPEG
+	AVFormatContext* format = nullptr;
+	AVCodecContext* codec = nullptr;
+	AVPacket* packet = nullptr;
+	AVFrame* decoded = nullptr;
+	SwsContext* scaler = nullptr;
+	int streamIndex = -1;
+	bool draining = false;
+	int width = 0, height = 0, frameCount = 0;
+	double frameRate = 0;
+
+	// Pull the next decoded picture into 'decoded'; false at end of stream
+	bool decodeNext() {
+		while (true) {
+			int ret = avcodec_receive_frame(codec, decoded);
+			if (ret == 0) return true;
+			if (ret != AVERROR(EAGAIN) || draining) return false;
+
+			// Decoder wants more input
+			if (av_read_frame(format, packet) < 0) {
+				avcodec_send_packet(codec, nullptr);
+				draining = true;
+				continue;
+			}
+			if (packet->stream_index == streamIndex) {
+				avcodec_send_packet(codec, packet);
+			}
+			av_packet_unref(packet);
+		}
+	}
+#else
+	cv::VideoCapture capture;
+#endif
+	std::string inputFormat;
+	RawVideoInfo rawInfo;
+	RawVideoReader rawReader;
+	bool useRaw = false;
+	std::string cachePath;
+	FrameCacheReader cacheReader;
+	int64_t cacheLimitBytes = 0;
+	bool useCache = false;
+	bool writableFrames = false;
+	cv::Mat mapped;  // cached frame before it is copied for writableFrames
+	bool wantYuv = false;
+	bool yuv = false;
+	int threads = 0;
+	int decodedFrames = 0;
+	double decodeTicks = 0;
+
+	bool decodeFrame(cv::Mat &frame) {
+#ifdef USE_FFMPEG
+		if (!codec || !decodeNext()) {
+			frame.release();
+			return false;
+		}
+		// I420 output is a plain plane copy for yuv420p streams
+		frame.create(yuv ? decoded->height * 3 / 2 : decoded->height, decoded->width, yuv ? CV_8UC1 : CV_8UC3);
+		scaler = sws_getCachedContext(scaler, decoded->width, decoded->height, (AVPixelFormat)decoded->format,
+		                              decoded->width, decoded->height, yuv ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_BGR24,
+		                              SWS_BILINEAR, nullptr, nullptr, nullptr);
+		uint8_t* dst[3] = { frame.data, nullptr, nullptr };
+		int dstStride[3] = { (int)frame.step, 0, 0 };
+		if (yuv) i420Planes(frame, dst, dstStride);
+		sws_scale(scaler, decoded->data, decoded->linesize, 0, decoded->height, dst, dstStride);
+		av_frame_unref(decoded);
+		return true;
+#else
+		return capture.read(frame);
+#endif
+	}
+
+public:
+	FrameSource() {}
+
+	// Reads --decode-threads, --input-format, --yuv and the raw layout (--raw-size WxH,
+	// --raw-fps N, --raw-pix bgr24|gray|i420)
+	explicit FrameSource(const CliOptions &options) {
+		threads = options.getInt("decode-threads", 0);
+		wantYuv = options.getBool("yuv", false);
+		cachePath = options.getString("frame-cache", "");
+		cacheLimitBytes = (int64_t)options.getInt("frame-cache-mb", 0) << 20;
+		inputFormat = options.getString("input-format", "");
+		sscanf(options.getString("raw-size", "0x0").c_str(), "%dx%d", &rawInfo.width, &rawInfo.height);
+		rawInfo.fps = options.getDouble("raw-fps", 30.0);
+		if (!parseRawPixelFormat(options.getString("raw-pix", "bgr24"), rawInfo.pixel)) {
+			inputFormat = "invalid";
+		}
+	}
+	FrameSource(const FrameSource&) = delete;
+	FrameSource &operator=(const FrameSource&) = delete;
+
+	~FrameSource() {
+		release();
+	}
+
+	bool open(const std::string &path) {
+		return open(path, threads);
+	}
+
+	// threadCount = 0 lets the decoder pick one thread per core
+	bool open(const std::string &path, int threadCount) {
+		release();
+		threads = threadCount;
+		decodedFrames = 0;
+		decodeTicks = 0;
+
+		std::string sourceFormat = inputFormat;
+		if (sourceFormat.empty()) sourceFormat = hasFileExtension(path, ".y4m") ? "y4m" : "video";
+		if (sourceFormat == "y4m" || sourceFormat == "raw") {
+			useRaw = true;
+			if (!rawReader.open(path, sourceFormat == "y4m", rawInfo)) return false;
+			return publishFrameCount();
+		}
+		if (sourceFormat != "video") return false;
+
+		if (!cachePath.empty() && openCache(path, threadCount)) {
+			useCache = true;
+			return publishFrameCount();
+		}
+		if (!isOpened() && !openDecoder(path, threadCount)) return false;
+		return publishFrameCount();
+	}
+
+	// Map the cache of 'path', decoding the whole video into it first when it is
+	// missing or stale. False if it can't be used; the decoder may then be open already.
+	bool openCache(const std::string &path, int threadCount) {
+		if (cacheReader.open(cachePath, path)) return true;
+		FrameCacheLock lock(cachePath);
+		if (cacheReader.open(cachePath, path)) return true;  // built by a run that held the lock
+		if (!openDecoder(path, threadCount)) return false;
+
+		double estimate = get(cv::CAP_PROP_FRAME_WIDTH) * get(cv::CAP_PROP_FRAME_HEIGHT) * 3 * get(cv::CAP_PROP_FRAME_COUNT);
+		if (cacheLimitBytes > 0 && estimate > (double)cacheLimitBytes) return false;  // over the budget: just decode
+
+		FrameCacheWriter writer;
+		if (!writer.open(cachePath, path, get(cv::CAP_PROP_FPS), cacheLimitBytes)) return false;
+		cv::Mat frame;
+		while (writer.isOpened() && decodeFrame(frame)) {
+			writer.write(frame);
+		}
+		bool built = writer.isOpened() && writer.finish();
+		closeDecoder();
+		return built && cacheReader.open(cachePath, path);
+	}
+
+	// Kernels that write into the frames they read call this: cached frames are then
+	// copied out of the mapping inside read() (decode time) instead of being handed
+	// out copy-on-write, which would fault pages in inside the kernel
+	void requireWritableFrames() {
+		writableFrames = true;
+	}
+
+	// Deliver the following frames in I420 when --yuv 1 was given and the input allows
+	// it; returns whether it does. Call after open().
+	bool enableYuv() {
+		yuv = false;
+		if (!wantYuv) return false;
+		if (useRaw) {
+			yuv = rawReader.getInfo().pixel == RAW_I420;
+		} else if (!useCache) {
+#ifdef USE_FFMPEG
+			yuv = codec && width % 2 == 0 && height % 2 == 0;
+#endif
+		}
+		return yuv;
+	}
+
+	bool yuvFrames() const {
+		return yuv;
+	}
+
+	bool publishFrameCount() {
+		framesTotalHint() = std::max(0LL, (long long)get(cv::CAP_PROP_FRAME_COUNT));
+		return true;
+	}
+
+	bool openDecoder(const std::string &path, int threadCount) {
+
+#ifdef USE_FFMPEG
+		if (avformat_open_input(&format, path.c_str(), nullptr, nullptr) < 0) return false;
+		if (avformat_find_stream_info(format, nullptr) < 0) {
+			release();
+			return false;
+		}
+
+		const AVCodec* decoder = nullptr;
+		streamIndex = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+		if (streamIndex < 0 || !decoder) {
+			release();
+			return false;
+		}
+		AVStream* stream = format->streams[streamIndex];
+
+		codec = avcodec_alloc_context3(decoder);
+		avcodec_parameters_to_context(codec, stream->codecpar);
+		codec->thread_count = threadCount;
+		codec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+		if (avcodec_open2(codec, decoder, nullptr) < 0) {
+			release();
+			return false;
+		}
+		threads = codec->thread_count;
+
+		packet = av_packet_alloc();
+		decoded = av_frame_alloc();
+		draining = false;
+
+		width = codec->width;
+		height = codec->height;
+		frameRate = av_q2d(av_guess_frame_rate(format, stream, nullptr));
+		frameCount = (int)stream->nb_frames;
+		if (frameCount <= 0 && format->duration > 0) {
+			frameCount = (int)(format->duration * frameRate / AV_TIME_BASE + 0.5);
+		}
+		return true;
+#else
+		if (threadCount > 0) {
+			capture.open(path, cv::CAP_ANY, {cv::CAP_PROP_N_THREADS, threadCount});
+		} else {
+			capture.open(path);
+		}
+		return capture.isOpened();
+#endif
+	}
+
+	bool isOpened() const {
+		if (useRaw) return rawReader.isOpened();
+		if (useCache) return cacheReader.isOpened();
+#ifdef USE_FFMPEG
+		return codec != nullptr;
+#else
+		return capture.isOpened();
+#endif
+	}
+
+	// Supports the properties the programs use: frame count, FPS, width and height
+	double get(int property) const {
+		if (useRaw) {
+			const RawVideoInfo &info = rawReader.getInfo();
+			switch (property) {
+				case cv::CAP_PROP_FRAME_COUNT: return rawReader.getFrameCount();
+				case cv::CAP_PROP_FPS: return info.fps;
+				case cv::CAP_PROP_FRAME_WIDTH: return info.width;
+				case cv::CAP_PROP_FRAME_HEIGHT: return info.height;
+				default: return 0;
+			}
+		}
+		if (useCache) {
+			const FrameCacheHeader &header = cacheReader.getHeader();
+			switch (property) {
+				case cv::CAP_PROP_FRAME_COUNT: return (double)header.frameCount;
+				case cv::CAP_PROP_FPS: return header.fps;
+				case cv::CAP_PROP_FRAME_WIDTH: return header.width;
+				case cv::CAP_PROP_FRAME_HEIGHT: return header.height;
+				default: return 0;
+			}
+		}
+#ifdef USE_FFMPEG
+		switch (property) {
+			case cv::CAP_PROP_FRAME_COUNT: return frameCount;
+			case cv::CAP_PROP_FPS: return frameRate;
+			case cv::CAP_PROP_FRAME_WIDTH: return width;
+			case cv::CAP_PROP_FRAME_HEIGHT: return height;
+			default: return 0;
+		}
+#else
+		return capture.get(property);
+#endif
+	}
+
+	// Decode the next frame as 8-bit BGR (I420 after enableYuv()) into 'frame'. At end
+	// of stream 'frame' is left empty and false is returned, as with cv::VideoCapture.
+	bool read(cv::Mat &frame) {
+		TraceSpan span("decode");
+		double start = (double)cv::getTickCount();
+		bool ok;
+		if (useRaw) {
+			ok = rawReader.read(frame, yuv);
+		} else if (useCache && writableFrames) {
+			ok = cacheReader.read(mapped);
+			if (ok) mapped.copyTo(frame);
+			else frame.release();
+		} else if (useCache) {
+			ok = cacheReader.read(frame);
+		} else {
+			ok = decodeFrame(frame);
+		}
+
+		decodeTicks += (double)cv::getTickCount() - start;
+		if (ok) {
+			decodedFrames++;
+			framesReadCounter()++;
+		}
+		return ok;
+	}
+
+	FrameSource &operator>>(cv::Mat &frame) {
+		read(frame);
+		return *this;
+	}
+
+	// Frames of a cached input point into the mapping, so they must not be used after
+	// release()
+	void release() {
+		rawReader.close();
+		useRaw = false;
+		mapped.release();
+		cacheReader.close();
+		useCache = false;
+		yuv = false;
+		closeDecoder();
+	}
+
+	void closeDecoder() {
+#ifdef USE_FFMPEG
+		if (scaler) sws_freeContext(scaler);
+		if (decoded) av_frame_free(&decoded);
+		if (packet) av_packet_free(&packet);
+		if (codec) avcodec_free_context(&codec);
+		if (format) avformat_close_input(&format);
+		scaler = nullptr;
+		streamIndex = -1;
+#else
+		capture.release();
+#endif
+	}
+
+	// Decoder threads in use (0 = chosen by the backend)
+	int decodeThreads() const {
+		return threads;
+	}
+
+	double decodeSeconds() const {
+		return decodeTicks / cv::getTickFrequency();
+	}
+
+	// Frames per second the decoder delivered, counting only time spent decoding
+	double decodeFps() const {
+		double seconds = decodeSeconds();
+		return seconds > 0 ? decodedFrames / seconds : 0.0;
+	}
+};
+
@@ -0,0 +1,308 @@
+#pragma once
+
+// Huge-page backed cv::Mat buffers.
+//
+// A 4K BGR frame is ~24 MB, about 6000 pages of 4 KB. Kernels that walk a frame down
+// its columns (the vertical pass of a Gaussian blur, Canny's neighbourhoods) touch a
+// new page on every row and miss the TLB most of the time. With --huge-pages every
+// Mat of at least HUGE_PAGE_MIN_BYTES (frames and full-frame intermediates) is backed
+// by 2 MB pages instead, so a 4K frame needs 12 TLB entries:
+//
+//   explicit  pages from the reserved huge page pool (Linux MAP_HUGETLB, needs
+//             vm.nr_hugepages; Windows large pages, needs the "Lock pages in memory"
+//             user right)
+//   thp       2 MB aligned memory marked MADV_HUGEPAGE for transparent huge pages
+//             (Linux, /sys/kernel/mm/transparent_hugepage/enabled at madvise or always)
+//   auto      explicit, else thp
+//   off       normal pages (the default)
+//
+// What cannot be had falls back to the next kind and in the end to the standard
+// allocator, so the option never makes a run fail; the run prints how many buffers
+// got each kind. Smaller Mats always come from the standard allocator.
+//
+// Mapping and faulting in fresh huge pages for every frame would cost more than the
+// TLB misses it saves, so freed buffers are kept (up to HUGE_PAGE_CACHE_BYTES) and
+// handed out again for the same size, only on the NUMA node they were first touched
+// on (see affinity.hpp).
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "affinity.hpp"
+#include "cli_options.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_BYTES (2 << 20)
+#define HUGE_PAGE_MIN_BYTES (1 << 20)     // smaller Mats keep normal pages
+#define HUGE_PAGE_CACHE_BYTES (512 << 20)  // freed huge page buffers kept for reuse
+
+enum HugePageKind {
+	PAGES_NORMAL,
+	PAGES_EXPLICIT,
+	PAGES_TRANSPARENT,
+	PAGE_KIND_COUNT
+};
+
+// Bits of HugePageMatAllocator::mode
+#define HUGE_PAGES_EXPLICIT 1
+#define HUGE_PAGES_TRANSPARENT 2
+
+static const char* const hugePageKindNames[PAGE_KIND_COUNT] = {"normal", "explicit", "transparent"};
+
+struct HugePageBlock {
+	void* data;
+	size_t bytes;
+	int kind;
+	int node;  // NUMA node of the thread that first touched it, -1 if unknown
+};
+
+class HugePageMatAllocator : public cv::MatAllocator {
+private:
+	cv::MatAllocator* base;
+	mutable std::mutex mtx;
+	mutable std::vector<HugePageBlock> freeBlocks;
+	mutable size_t freeBytes = 0;
+
+	static size_t pageBytes() {
+#ifdef _WIN32
+		static size_t bytes = GetLargePageMinimum() ? GetLargePageMinimum() : HUGE_PAGE_BYTES;
+		return bytes;
+#else
+		return HUGE_PAGE_BYTES;
+#endif
+	}
+
+	static size_t roundUp(size_t bytes) {
+		return (bytes + pageBytes() - 1) / pageBytes() * pageBytes();
+	}
+
+#ifdef _WIN32
+	// Large pages need SeLockMemoryPrivilege enabled in the process token
+	static bool enableLockMemory() {
+		static int enabled = -1;
+		if (enabled >= 0) return enabled == 1;
+		enabled = 0;
+		HANDLE token;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+		TOKEN_PRIVILEGES privileges;
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		if (LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+		    AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+		    GetLastError() == ERROR_SUCCESS) {
+			enabled = 1;
+		}
+		CloseHandle(token);
+		return enabled == 1;
+	}
+#else
+	static bool transparentAvailable() {
+		static int available = -1;
+		if (available >= 0) return available == 1;
+		available = 0;
+		FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+		if (f) {
+			char line[128] = {};
+			if (fgets(line, sizeof(line), f) && !strstr(line, "[never]")) available = 1;
+			fclose(f);
+		}
+		return available == 1;
+	}
+#endif
+
+	// New memory of 'bytes' (a multiple of the page size) of one kind
+	static void* mapBlock(size_t bytes, int kind) {
+#ifdef _WIN32
+		if (kind != PAGES_EXPLICIT || !enableLockMemory()) return nullptr;
+		return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+#else
+		if (kind == PAGES_EXPLICIT) {
+			void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			return data == MAP_FAILED ? nullptr : data;
+		}
+		if (kind != PAGES_TRANSPARENT || !transparentAvailable()) return nullptr;
+
+		// Over-allocate by a page to place the block on a 2 MB boundary
+		size_t mapped = bytes + HUGE_PAGE_BYTES;
+		void* region = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) return nullptr;
+		uintptr_t start = (uintptr_t)region;
+		uintptr_t aligned = (start + HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(HUGE_PAGE_BYTES - 1);
+		if (aligned > start) munmap(region, aligned - start);
+		if (aligned + bytes < start + mapped) munmap((void*)(aligned + bytes), start + mapped - aligned - bytes);
+		if (madvise((void*)aligned, bytes, MADV_HUGEPAGE) != 0) {
+			munmap((void*)aligned, bytes);
+			return nullptr;
+		}
+		return (void*)aligned;
+#endif
+	}
+
+	static void unmapBlock(const HugePageBlock &block) {
+#ifdef _WIN32
+		VirtualFree(block.data, 0, MEM_RELEASE);
+#else
+		munmap(block.data, block.bytes);
+#endif
+	}
+
+	// A free block of this size on this node, or a new one
+	bool takeBlock(size_t bytes, HugePageBlock &block) const {
+		int node = currentThreadNode();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			for (size_t i = freeBlocks.size(); i-- > 0; ) {
+				if (freeBlocks[i].bytes == bytes && freeBlocks[i].node == node) {
+					block = freeBlocks[i];
+					freeBlocks.erase(freeBlocks.begin() + i);
+					freeBytes -= bytes;
+					reused++;
+					return true;
+				}
+			}
+		}
+		for (int kind : {PAGES_EXPLICIT, PAGES_TRANSPARENT}) {
+			if (!(mode.load() & (kind == PAGES_EXPLICIT ? HUGE_PAGES_EXPLICIT : HUGE_PAGES_TRANSPARENT))) continue;
+			if (void* data = mapBlock(bytes, kind)) {
+				block = {data, bytes, kind, node};
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	std::atomic<int> mode;  // HUGE_PAGES_* bits, 0 when off
+	mutable std::atomic<long long> buffers[PAGE_KIND_COUNT];
+	mutable std::atomic<long long> reused;
+
+	explicit HugePageMatAllocator(cv::MatAllocator* allocator) : base(allocator), mode(0), reused(0) {
+		for (auto &count : buffers) count = 0;
+	}
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+	                       cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--) total *= sizes[i];
+		if (data || total < HUGE_PAGE_MIN_BYTES || !mode.load()) {
+			return base->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+
+		HugePageBlock block;
+		if (!takeBlock(roundUp(total), block)) {
+			buffers[PAGES_NORMAL]++;
+			return base->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+		buffers[block.kind]++;
+
+		// Continuous layout, as the standard allocator does it
+		size_t stepBytes = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--) {
+			if (step) step[i] = stepBytes;
+			stepBytes *= sizes[i];
+		}
+		cv::UMatData* u = new cv::UMatData(this);
+		u->data = u->origdata = (uchar*)block.data;
+		u->size = total;
+		u->allocatorFlags_ = block.kind | ((block.node + 1) << 4);
+		return u;
+	}
+
+	bool allocate(cv::UMatData* data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override {
+		(void)data; (void)accessflags; (void)usageFlags;
+		return false;
+	}
+
+	void deallocate(cv::UMatData* u) const override {
+		if (!u) return;
+		HugePageBlock block = {u->origdata, roundUp(u->size), u->allocatorFlags_ & 15, (u->allocatorFlags_ >> 4) - 1};
+		delete u;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (mode.load() && freeBytes + block.bytes <= HUGE_PAGE_CACHE_BYTES) {
+				freeBlocks.push_back(block);
+				freeBytes += block.bytes;
+				return;
+			}
+		}
+		unmapBlock(block);
+	}
+
+	// Give the kept buffers back to the system
+	void trim() {
+		std::vector<HugePageBlock> blocks;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			blocks.swap(freeBlocks);
+			freeBytes = 0;
+		}
+		for (const HugePageBlock &block : blocks) unmapBlock(block);
+	}
+};
+
+// The huge page allocator, created when first needed and never deleted (Mats that
+// outlive a run may still be released through it)
+inline HugePageMatAllocator* hugePageMatAllocator() {
+	static HugePageMatAllocator* allocator = new HugePageMatAllocator(cv::Mat::getStdAllocator());
+	return allocator;
+}
+
+// Read --huge-pages for a run and return the allocator its Mats should come from
+// (called by RunMetrics)
+inline cv::MatAllocator* configureHugePages(const CliOptions &options) {
+	std::string value = options.getString("huge-pages", "off");
+	int mode = 0;
+	if (value == "explicit") mode = HUGE_PAGES_EXPLICIT;
+	else if (value == "thp") mode = HUGE_PAGES_TRANSPARENT;
+	else if (value == "auto" || value == "1" || value == "on") mode = HUGE_PAGES_EXPLICIT | HUGE_PAGES_TRANSPARENT;
+	else if (value != "off" && value != "0") printf("Warning: unknown --huge-pages mode '%s' (use off, thp, explicit or auto)\n", value.c_str());
+
+	HugePageMatAllocator* allocator = hugePageMatAllocator();
+	allocator->mode = mode;
+	for (auto &count : allocator->buffers) count = 0;
+	allocator->reused = 0;
+	if (!mode) {
+		allocator->trim();
+		return cv::Mat::getStdAllocator();
+	}
+	return allocator;
+}
+
+inline void printHugePages() {
+	HugePageMatAllocator* allocator = hugePageMatAllocator();
+	if (!allocator->mode.load()) return;
+	printf("Huge pages: %lld buffers explicit, %lld transparent, %lld on normal pages (fallback), %lld reused\n",
+	       allocator->buffers[PAGES_EXPLICIT].load(), allocator->buffers[PAGES_TRANSPARENT].load(),
+	       allocator->buffers[PAGES_NORMAL].load(), allocator->reused.load());
+}
+
+inline void writeHugePages(FILE* out) {
+	HugePageMatAllocator* allocator = hugePageMatAllocator();
+	int mode = allocator->mode.load();
+	if (!mode) {
+		fprintf(out, "  \"huge_pages\": null,\n");
+		return;
+	}
+	fprintf(out, "  \"huge_pages\": {\n");
+	fprintf(out, "    \"mode\": \"%s\",\n", mode == HUGE_PAGES_EXPLICIT ? "explicit" : mode == HUGE_PAGES_TRANSPARENT ? "thp" : "auto");
+	for (int kind = 0; kind < PAGE_KIND_COUNT; ++kind) {
+		fprintf(out, "    \"%s\": %lld,\n", hugePageKindNames[kind], allocator->buffers[kind].load());
+	}
+	fprintf(out, "    \"reused\": %lld\n", allocator->reused.load());
+	fprintf(out, "  },\n");
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+// Hardware performance counters around the processing kernels (Linux only).
+//
+// With --perf-counters 1 every thread that runs a kernel opens its own group of
+// counters through perf_event_open (user-space events of this thread only): cycles,
+// instructions, last-level cache misses, branch misses and data TLB read misses. ComputeTimer
+// (run_metrics.hpp) reads the group when a kernel starts and ends and adds the
+// difference to process-wide totals, so decode and encode threads are not counted.
+// The totals go into the --metrics-json record with the derived IPC, per-pixel
+// figures and the memory traffic implied by the cache misses (one cache line each).
+// Lines the hardware prefetchers bring in ahead of a load do not miss, so they are not
+// in that figure: it, and the bandwidth derived from it, are lower bounds.
+//
+// Counters the machine or the perf_event_paranoid setting do not allow are reported
+// as missing; elsewhere (Windows) the option is accepted and ignored.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define PERF_COUNTER_COUNT 5
+#define PERF_CACHE_LINE_BYTES 64  // memory traffic per last-level cache miss
+
+enum PerfCounterId {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_DTLB_MISSES
+};
+
+static const char* const perfCounterNames[PERF_COUNTER_COUNT] = {
+	"cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses"
+};
+
+// Counter values of one thread at one point in time
+struct PerfSample {
+	uint64_t value[PERF_COUNTER_COUNT] = {};
+	bool valid = false;
+};
+
+// Totals over all kernel calls of the process
+struct PerfTotals {
+	std::atomic<bool> enabled;
+	std::atomic<int> available;  // bit per counter that could be opened (on any thread)
+	std::atomic<uint64_t> value[PERF_COUNTER_COUNT];
+
+	PerfTotals() : enabled(false), available(0) {
+		for (auto &v : value) v = 0;
+	}
+};
+
+inline PerfTotals &perfTotals() {
+	static PerfTotals totals;
+	return totals;
+}
+
+#ifdef __linux__
+// The counter group of one thread, opened on first use and closed when the thread
+// exits
+class PerfCounterGroup {
+private:
+	int fds[PERF_COUNTER_COUNT];
+	int order[PERF_COUNTER_COUNT];  // counter of each value in a group read
+	int opened = 0;
+	bool tried = false;
+
+	static int openCounter(uint32_t type, uint64_t config, int groupFd) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = groupFd < 0 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+	}
+
+	void open() {
+		tried = true;
+		static const uint32_t types[PERF_COUNTER_COUNT] = {
+			PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+		};
+		static const uint64_t configs[PERF_COUNTER_COUNT] = {
+			PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+			PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+		};
+		for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+			int fd = openCounter(types[i], configs[i], opened ? fds[0] : -1);
+			if (fd < 0) {
+				if (i == PERF_CYCLES) return;  // no group without its leader
+				continue;
+			}
+			fds[opened] = fd;
+			order[opened] = i;
+			opened++;
+			perfTotals().available |= 1 << i;
+		}
+		ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+public:
+	PerfCounterGroup() {}
+	PerfCounterGroup(const PerfCounterGroup&) = delete;
+	PerfCounterGroup &operator=(const PerfCounterGroup&) = delete;
+
+	~PerfCounterGroup() {
+		for (int i = 0; i < opened; ++i) close(fds[i]);
+	}
+
+	bool read(PerfSample &sample) {
+		if (!tried) open();
+		if (!opened) return false;
+
+		uint64_t data[3 + PERF_COUNTER_COUNT];
+		if (::read(fds[0], data, sizeof(data)) < (ssize_t)((3 + opened) * sizeof(uint64_t))) return false;
+
+		// Scale up if the kernel had to multiplex the counters
+		double scale = data[2] > 0 ? (double)data[1] / data[2] : 1.0;
+		for (int i = 0; i < opened; ++i) {
+			sample.value[order[i]] = (uint64_t)(data[3 + i] * scale);
+		}
+		sample.valid = true;
+		return true;
+	}
+};
+#endif
+
+// Read the calling thread's counters (false when disabled or unavailable)
+inline bool perfSample(PerfSample &sample) {
+	if (!perfTotals().enabled.load(std::memory_order_relaxed)) return false;
+#ifdef __linux__
+	static thread_local PerfCounterGroup group;
+	return group.read(sample);
+#else
+	return false;
+#endif
+}
+
+// Add what the calling thread counted since 'start' to the totals
+inline void perfAccumulate(const PerfSample &start) {
+	PerfSample end;
+	if (!start.valid || !perfSample(end)) return;
+	PerfTotals &totals = perfTotals();
+	for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		if (end.value[i] > start.value[i]) totals.value[i] += end.value[i] - start.value[i];
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+// Live progress of a run, for the backend.
+//
+// With --progress <ms> a program prints one line to stderr every <ms> milliseconds
+// while it runs (and a last one when it ends):
+//
+//   @progress {"frames": 120, "total": 300, "fps": 41.7, "elapsed_s": 3.1, "eta_s": 4.6,
+//              "queues": {"input": 4, "processed": 0, "encoder": 2}}
+//
+// "frames" counts the frames written out (frames read, for programs that write no
+// video), "fps" is the rate over the last interval and "eta_s" the time left at the
+// average rate so far; "total" and "eta_s" are left out when the input's frame count
+// is unknown. "queues" has the depth of every queue the program registered with
+// watchQueue() and of the encoder's queue. A queue that keeps growing, or fps at zero
+// with the queues full, shows where a pipeline is stuck while it still runs.
+//
+// The processing server sends the same fields in its "progress" events.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cli_options.hpp"
+#include "frame_sink.hpp"
+#include "frame_source.hpp"
+
+struct WatchedQueue {
+	std::string name;
+	std::function<size_t()> depth;
+};
+
+struct WatchedQueues {
+	std::mutex mtx;
+	std::vector<WatchedQueue> queues;
+};
+
+inline WatchedQueues &watchedQueues() {
+	static WatchedQueues watched;
+	return watched;
+}
+
+// Report the depth of a queue in the progress lines; 'depth' is called from the
+// progress thread, so it must lock whatever the queue locks
+inline void watchQueue(const std::string &name, std::function<size_t()> depth) {
+	WatchedQueues &watched = watchedQueues();
+	std::lock_guard<std::mutex> lock(watched.mtx);
+	watched.queues.push_back({name, depth});
+}
+
+inline void clearWatchedQueues() {
+	WatchedQueues &watched = watchedQueues();
+	std::lock_guard<std::mutex> lock(watched.mtx);
+	watched.queues.clear();
+}
+
+// Stops watching every queue when destroyed. Make it the last member of the object that
+// owns the watched queues, so the progress thread stops reading them before they go.
+struct QueueWatchGuard {
+	QueueWatchGuard() = default;
+	QueueWatchGuard(const QueueWatchGuard&) = delete;
+	QueueWatchGuard &operator=(const QueueWatchGuard&) = delete;
+
+	~QueueWatchGuard() {
+		clearWatchedQueues();
+	}
+};
+
+// Turns the frame counters into one progress record per call
+class ProgressSampler {
+private:
+	double startTicks;
+	double lastTicks;
+	long long lastFrames = 0;
+
+public:
+	ProgressSampler() : startTicks((double)cv::getTickCount()), lastTicks(startTicks) {}
+
+	// The fields above as a JSON object
+	std::string sample() {
+		long long written = framesWrittenCounter().load();
+		long long frames = written > 0 ? written : framesReadCounter().load();
+		long long total = framesTotalHint().load();
+		double now = (double)cv::getTickCount();
+		double interval = (now - lastTicks) / cv::getTickFrequency();
+		double elapsed = (now - startTicks) / cv::getTickFrequency();
+		double fps = interval > 0 ? (frames - lastFrames) / interval : 0;
+		lastTicks = now;
+		lastFrames = frames;
+
+		char buffer[160];
+		snprintf(buffer, sizeof(buffer), "{\"frames\": %lld, \"fps\": %.1f, \"elapsed_s\": %.1f", frames, fps, elapsed);
+		std::string json = buffer;
+		if (total > 0) {
+			snprintf(buffer, sizeof(buffer), ", \"total\": %lld", total);
+			json += buffer;
+			if (frames > 0) {
+				snprintf(buffer, sizeof(buffer), ", \"eta_s\": %.1f", std::max(0LL, total - frames) * elapsed / frames);
+				json += buffer;
+			}
+		}
+
+		json += ", \"queues\": {";
+		{
+			WatchedQueues &watched = watchedQueues();
+			std::lock_guard<std::mutex> lock(watched.mtx);
+			for (const WatchedQueue &queue : watched.queues) {
+				json += "\"" + queue.name + "\": " + std::to_string(queue.depth()) + ", ";
+			}
+		}
+		return json + "\"encoder\": " + std::to_string(encoderQueueDepth().load()) + "}}";
+	}
+};
+
+// Prints the "@progress" lines of a run from its own thread. Declare it in main()
+// after CliOptions, and watch the queues right after it.
+class ProgressPublisher {
+private:
+	int intervalMs;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping = false;
+	std::thread publisher;
+
+public:
+	explicit ProgressPublisher(const CliOptions &options) : intervalMs(options.getInt("progress", 0)) {
+		if (intervalMs <= 0) return;
+		clearWatchedQueues();
+		framesReadCounter() = 0;
+		framesWrittenCounter() = 0;
+		framesTotalHint() = 0;
+		publisher = std::thread([this]() {
+			ProgressSampler sampler;
+			std::unique_lock<std::mutex> lock(mtx);
+			while (true) {
+				bool last = cv.wait_for(lock, std::chrono::milliseconds(intervalMs), [this] { return stopping; });
+				fprintf(stderr, "@progress %s\n", sampler.sample().c_str());
+				fflush(stderr);
+				if (last) break;
+			}
+		});
+	}
+	ProgressPublisher(const ProgressPublisher&) = delete;
+	ProgressPublisher &operator=(const ProgressPublisher&) = delete;
+
+	~ProgressPublisher() {
+		if (!publisher.joinable()) return;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		cv.notify_all();
+		publisher.join();
+		clearWatchedQueues();
+	}
+};
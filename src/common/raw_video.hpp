@@ -0,0 +1,329 @@
+#pragma once
+
+// Uncompressed video I/O: YUV4MPEG2 (.y4m) and headerless raw frames.
+//
+// Used by FrameSource / FrameSink for --input-format y4m|raw and
+// --output-format y4m|raw, so benchmarks can measure the kernels without any codec
+// in the loop and stream frames to and from external tools through pipes ("-" is
+// stdin / stdout). Whole frames are moved with single large fread/fwrite calls on
+// a file with a big stdio buffer.
+//
+// Raw input has no header, so its layout comes from --raw-size WxH, --raw-fps N and
+// --raw-pix bgr24|gray|i420. Raw output is written in the frame's own layout: bgr24
+// for color frames, gray for single-channel ones, i420 for I420 frames (see
+// yuv_frame.hpp).
+
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "yuv_frame.hpp"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define RAW_IO_BUFFER (8 << 20)
+
+enum RawPixelFormat { RAW_BGR24, RAW_GRAY, RAW_I420, RAW_YUV444 };
+
+struct RawVideoInfo {
+	int width = 0;
+	int height = 0;
+	double fps = 30.0;
+	RawPixelFormat pixel = RAW_BGR24;
+
+	size_t frameBytes() const {
+		size_t plane = (size_t)width * height;
+		switch (pixel) {
+			case RAW_BGR24: return plane * 3;
+			case RAW_GRAY: return plane;
+			case RAW_I420: return plane * 3 / 2;
+			case RAW_YUV444: return plane * 3;
+		}
+		return 0;
+	}
+};
+
+inline bool parseRawPixelFormat(const std::string &name, RawPixelFormat &pixel) {
+	if (name == "bgr24" || name == "bgr") pixel = RAW_BGR24;
+	else if (name == "gray" || name == "gray8") pixel = RAW_GRAY;
+	else if (name == "i420" || name == "yuv420p") pixel = RAW_I420;
+	else return false;
+	return true;
+}
+
+inline bool hasFileExtension(const std::string &path, const std::string &ext) {
+	return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+class RawVideoReader {
+private:
+	FILE* file = nullptr;
+	bool y4m = false;
+	RawVideoInfo info;
+	int frameCount = 0;
+	cv::Mat staging;
+
+	// Read a header line (without the '\n'); false on EOF or an absurdly long line
+	bool readLine(std::string &line) {
+		line.clear();
+		int c;
+		while ((c = fgetc(file)) != EOF && c != '\n') {
+			line.push_back((char)c);
+			if (line.size() > 4096) return false;
+		}
+		return c == '\n';
+	}
+
+	bool parseY4mHeader(const std::string &header) {
+		if (header.compare(0, 10, "YUV4MPEG2 ") != 0) return false;
+		info.pixel = RAW_I420;
+
+		size_t pos = 10;
+		while (pos < header.size()) {
+			size_t end = header.find(' ', pos);
+			if (end == std::string::npos) end = header.size();
+			std::string token = header.substr(pos, end - pos);
+			pos = end + 1;
+			if (token.empty()) continue;
+
+			std::string value = token.substr(1);
+			switch (token[0]) {
+				case 'W': info.width = atoi(value.c_str()); break;
+				case 'H': info.height = atoi(value.c_str()); break;
+				case 'F': {
+					int num = 0, den = 1;
+					if (sscanf(value.c_str(), "%d:%d", &num, &den) == 2 && den > 0) info.fps = (double)num / den;
+					break;
+				}
+				case 'C':
+					if (value == "420" || value == "420jpeg" || value == "420mpeg2" || value == "420paldv") info.pixel = RAW_I420;
+					else if (value == "444") info.pixel = RAW_YUV444;
+					else if (value == "mono") info.pixel = RAW_GRAY;
+					else return false;  // 4:2:2, high bit depth etc. are not supported
+					break;
+				default: break;  // interlacing, aspect and X-tags do not matter here
+			}
+		}
+		if (info.width <= 0 || info.height <= 0) return false;
+		if (info.pixel == RAW_I420 && (info.width % 2 || info.height % 2)) return false;
+		return true;
+	}
+
+public:
+	~RawVideoReader() {
+		close();
+	}
+
+	// For raw input 'rawInfo' describes the frames; for Y4M it is read from the header
+	bool open(const std::string &path, bool isY4m, const RawVideoInfo &rawInfo) {
+		close();
+		y4m = isY4m;
+		info = rawInfo;
+
+		if (path == "-") {
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+			file = stdin;
+		} else {
+			file = fopen(path.c_str(), "rb");
+		}
+		if (!file) return false;
+		setvbuf(file, nullptr, _IOFBF, RAW_IO_BUFFER);
+
+		size_t headerBytes = 0, frameHeaderBytes = 0;
+		if (y4m) {
+			std::string header;
+			if (!readLine(header) || !parseY4mHeader(header)) {
+				close();
+				return false;
+			}
+			headerBytes = header.size() + 1;
+			frameHeaderBytes = 6;  // "FRAME\n"
+		} else if (info.width <= 0 || info.height <= 0 || (info.pixel == RAW_I420 && (info.width % 2 || info.height % 2))) {
+			close();
+			return false;
+		}
+
+		// Frame count from the file size (unknown when reading a pipe)
+		frameCount = 0;
+		if (file != stdin) {
+			std::ifstream sizeProbe(path, std::ios::binary | std::ios::ate);
+			long long bytes = (long long)sizeProbe.tellg() - (long long)headerBytes;
+			if (bytes > 0) frameCount = (int)(bytes / (long long)(info.frameBytes() + frameHeaderBytes));
+		}
+		return true;
+	}
+
+	bool isOpened() const {
+		return file != nullptr;
+	}
+
+	const RawVideoInfo &getInfo() const {
+		return info;
+	}
+
+	int getFrameCount() const {
+		return frameCount;
+	}
+
+	// Read the next frame as 8-bit BGR into 'frame', or as it is stored when 'i420' is
+	// set and the input is 4:2:0; leaves it empty at end of stream
+	bool read(cv::Mat &frame, bool i420 = false) {
+		if (!file) {
+			frame.release();
+			return false;
+		}
+
+		if (y4m) {
+			std::string frameHeader;
+			if (!readLine(frameHeader) || frameHeader.compare(0, 5, "FRAME") != 0) {
+				frame.release();
+				return false;
+			}
+		}
+
+		// Packed BGR (and I420 kept as such) is read straight into the frame, everything
+		// else via one staging read
+		bool ok;
+		if (info.pixel == RAW_BGR24 || (i420 && info.pixel == RAW_I420)) {
+			if (info.pixel == RAW_I420) frame.create(info.height * 3 / 2, info.width, CV_8UC1);
+			else frame.create(info.height, info.width, CV_8UC3);
+			ok = fread(frame.data, 1, info.frameBytes(), file) == info.frameBytes();
+		} else {
+			int stagingRows = info.pixel == RAW_GRAY ? info.height : info.pixel == RAW_I420 ? info.height * 3 / 2 : info.height * 3;
+			staging.create(stagingRows, info.width, CV_8UC1);
+			ok = fread(staging.data, 1, info.frameBytes(), file) == info.frameBytes();
+			if (ok) {
+				if (info.pixel == RAW_GRAY) {
+					cv::cvtColor(staging, frame, cv::COLOR_GRAY2BGR);
+				} else if (info.pixel == RAW_I420) {
+					cv::cvtColor(staging, frame, cv::COLOR_YUV2BGR_I420);
+				} else {
+					std::vector<cv::Mat> planes = {
+						staging.rowRange(0, info.height),
+						staging.rowRange(info.height, info.height * 2),
+						staging.rowRange(info.height * 2, info.height * 3)
+					};
+					cv::Mat yuv;
+					cv::merge(planes, yuv);
+					cv::cvtColor(yuv, frame, cv::COLOR_YUV2BGR);
+				}
+			}
+		}
+
+		if (!ok) frame.release();
+		return ok;
+	}
+
+	void close() {
+		if (file && file != stdin) fclose(file);
+		file = nullptr;
+	}
+};
+
+class RawVideoWriter {
+private:
+	FILE* file = nullptr;
+	bool y4m = false;
+	bool color = true;
+	cv::Size frameSize;
+	cv::Mat staging, converted;
+
+	void writeMat(const cv::Mat &mat) {
+		if (mat.isContinuous()) {
+			fwrite(mat.data, 1, mat.total() * mat.elemSize(), file);
+		} else {
+			for (int y = 0; y < mat.rows; ++y) {
+				fwrite(mat.ptr(y), 1, mat.cols * mat.elemSize(), file);
+			}
+		}
+	}
+
+public:
+	~RawVideoWriter() {
+		close();
+	}
+
+	// "-" streams to stdout. The program's own messages are then moved to stderr so
+	// they cannot end up inside the video stream.
+	bool open(const std::string &path, bool isY4m, int width, int height, double fps, bool isColor) {
+		close();
+		y4m = isY4m;
+		color = isColor;
+		frameSize = cv::Size(width, height);
+		if (y4m && isColor && (width % 2 || height % 2)) return false;
+
+		if (path == "-") {
+			fflush(stdout);
+			int videoFd = dup(fileno(stdout));
+			dup2(fileno(stderr), fileno(stdout));
+#ifdef _WIN32
+			_setmode(videoFd, _O_BINARY);
+#endif
+			file = fdopen(videoFd, "wb");
+		} else {
+			file = fopen(path.c_str(), "wb");
+		}
+		if (!file) return false;
+		setvbuf(file, nullptr, _IOFBF, RAW_IO_BUFFER);
+
+		if (y4m) {
+			int fpsNum = (int)(fps * 1000 + 0.5), fpsDen = 1000;
+			if (fpsNum <= 0) fpsNum = 30000;
+			fprintf(file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 %s\n", width, height, fpsNum, fpsDen,
+			        isColor ? "C420jpeg" : "Cmono");
+		}
+		return true;
+	}
+
+	bool isOpened() const {
+		return file != nullptr;
+	}
+
+	void write(const cv::Mat &frame) {
+		if (!file) return;
+		if (!y4m) {
+			writeMat(frame);
+			return;
+		}
+
+		// Y4M frames must match the header: 4:2:0 for color, a single plane for mono
+		fwrite("FRAME\n", 1, 6, file);
+		bool i420 = isI420Frame(frame, frameSize);
+		if (i420 && color) {
+			writeMat(frame);
+			return;
+		}
+		const cv::Mat* source = &frame;
+		if (i420) {
+			lumaToGray(frame, converted);
+			source = &converted;
+		} else if (color && frame.channels() == 1) {
+			cv::cvtColor(frame, converted, cv::COLOR_GRAY2BGR);
+			source = &converted;
+		} else if (!color && frame.channels() == 3) {
+			cv::cvtColor(frame, converted, cv::COLOR_BGR2GRAY);
+			source = &converted;
+		}
+
+		if (color) {
+			cv::cvtColor(*source, staging, cv::COLOR_BGR2YUV_I420);
+			writeMat(staging);
+		} else {
+			writeMat(*source);
+		}
+	}
+
+	void close() {
+		if (file) fclose(file);
+		file = nullptr;
+	}
+};
@@ -0,0 +1,443 @@
+#pragma once
+
+// Machine-readable run metrics shared by the processing programs.
+//
+// With --metrics-json <file> a program writes one JSON record at the end of the run:
+// total time, frames, FPS, threads, the time spent in each stage (decode, compute,
+// encode, queue wait and the time the writer was blocked on the encoder), peak resident
+// memory, the number and size of cv::Mat allocations, and the build configuration.
+//
+// Stage times are busy times, not shares of the wall clock: decode and encode are
+// measured inside FrameSource / FrameSink, compute is the sum over all threads of the
+// time spent in the processing kernels (so it can exceed the total time), queue wait
+// is the time threads were blocked on the queues between them (also summed over
+// threads; the "queue wait" spans of --trace), and encoder wait is how long writes and
+// the final flush waited for the encoder.
+//
+// Without the option no file is written and Mats are not counted.
+//
+// --perf-counters 1 adds hardware counters of the compute stage (see perf_counters.hpp).
+// --pin pins the threads and reports where they ran (see affinity.hpp).
+// --huge-pages backs frame-sized Mats with 2 MB pages (see huge_pages.hpp).
+// Kernel temporaries come from per-thread arenas unless --arena 0 (see frame_arena.hpp).
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include "affinity.hpp"
+#include "cli_options.hpp"
+#include "frame_arena.hpp"
+#include "frame_source.hpp"
+#include "frame_sink.hpp"
+#include "huge_pages.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2  // GetProcessMemoryInfo from kernel32, no -lpsapi needed
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Counts the Mat buffers OpenCV allocates, then hands them to the allocator of the run
+// (which also frees them, as it becomes their owner)
+class CountingMatAllocator : public cv::MatAllocator {
+private:
+	std::atomic<cv::MatAllocator*> base;
+
+public:
+	mutable std::atomic<long long> allocations;
+	mutable std::atomic<long long> allocatedBytes;
+
+	explicit CountingMatAllocator(cv::MatAllocator* allocator) : base(allocator), allocations(0), allocatedBytes(0) {}
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+	                       cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+		cv::UMatData* u = base.load()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		if (u && !data) {
+			allocations++;
+			allocatedBytes += (long long)u->size;
+		}
+		return u;
+	}
+
+	bool allocate(cv::UMatData* data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override {
+		return base.load()->allocate(data, accessflags, usageFlags);
+	}
+
+	void deallocate(cv::UMatData* data) const override {
+		base.load()->deallocate(data);
+	}
+
+	// Where new buffers come from (buffers allocated before keep their owner)
+	void setBase(cv::MatAllocator* allocator) {
+		base = allocator;
+	}
+};
+
+// The counting allocator, created when first needed. It stays installed for the rest
+// of the process (Mats that outlive main may still be released through it), so it is
+// never deleted.
+inline CountingMatAllocator* countingMatAllocator() {
+	static CountingMatAllocator* allocator = new CountingMatAllocator(cv::Mat::getStdAllocator());
+	return allocator;
+}
+
+// Peak resident set size of the process in bytes (0 if unknown)
+inline long long peakResidentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (long long)counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;
+#else
+	return (long long)usage.ru_maxrss * 1024;  // kilobytes on Linux
+#endif
+#endif
+}
+
+// Kernel time of the whole process in cv::getTickCount ticks, summed over threads
+inline std::atomic<long long> &computeTickCounter() {
+	static std::atomic<long long> ticks(0);
+	return ticks;
+}
+
+// Adds the time from construction to stop() (or the end of the scope) to the compute
+// stage, traces it as a "kernel" span and counts it with --perf-counters. The counter
+// group is read outside the timed interval, so its two read() calls per kernel call are
+// not compute time (they still add to the wall clock, noticeably for very short calls).
+// Wall-clock time during which at least one thread was running a kernel (overlapping
+// kernel calls count once), in cv::getTickCount ticks
+class ComputeBusyClock {
+private:
+	std::mutex mtx;
+	int active = 0;
+	int64_t since = 0;
+	long long ticks = 0;
+
+public:
+	void enter(int64_t now) {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (active++ == 0) since = now;
+	}
+
+	void leave(int64_t now) {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (--active == 0) ticks += now - since;
+	}
+
+	void reset() {
+		std::lock_guard<std::mutex> lock(mtx);
+		ticks = 0;
+	}
+
+	double seconds() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return ticks / cv::getTickFrequency();
+	}
+};
+
+inline ComputeBusyClock &computeBusyClock() {
+	static ComputeBusyClock clock;
+	return clock;
+}
+
+// Time threads spent blocked on the queues between them, in cv::getTickCount ticks,
+// summed over threads
+inline std::atomic<long long> &queueWaitTickCounter() {
+	static std::atomic<long long> ticks(0);
+	return ticks;
+}
+
+// Adds the time from construction to the end of the scope to the queue wait stage and
+// traces it as a "queue wait" span; one at the top of a queue's blocking push or pop
+class QueueWaitTimer {
+private:
+	TraceSpan span;
+	double start;
+
+public:
+	QueueWaitTimer() : span("queue wait"), start((double)cv::getTickCount()) {}
+
+	~QueueWaitTimer() {
+		queueWaitTickCounter() += (long long)((double)cv::getTickCount() - start);
+	}
+
+	QueueWaitTimer(const QueueWaitTimer&) = delete;
+	QueueWaitTimer &operator=(const QueueWaitTimer&) = delete;
+};
+
+class ComputeTimer {
+private:
+	TraceSpan span;
+	double start;
+	PerfSample counters;
+	bool running = true;
+
+public:
+	ComputeTimer() : span("kernel") {
+		perfSample(counters);
+		int64_t now = cv::getTickCount();
+		computeBusyClock().enter(now);
+		start = (double)now;
+	}
+
+	~ComputeTimer() {
+		stop();
+	}
+
+	void stop() {
+		if (!running) return;
+		int64_t now = cv::getTickCount();
+		computeTickCounter() += (long long)((double)now - start);
+		computeBusyClock().leave(now);
+		perfAccumulate(counters);
+		span.end();
+		running = false;
+	}
+};
+
+class RunMetrics {
+private:
+	std::string path;
+	std::string program;
+	CountingMatAllocator* counter = nullptr;
+
+	static void writeString(FILE* out, const std::string &value) {
+		fputc('"', out);
+		for (char c : value) {
+			if (c == '"' || c == '\\') fputc('\\', out);
+			if ((unsigned char)c < 0x20) fputc(' ', out);
+			else fputc(c, out);
+		}
+		fputc('"', out);
+	}
+
+	static bool counterAvailable(int id) {
+		return (perfTotals().available.load() >> id) & 1;
+	}
+
+	static double counterValue(int id) {
+		return (double)perfTotals().value[id].load();
+	}
+
+	// Memory traffic implied by the last-level cache misses
+	static double missBytes() {
+		return counterValue(PERF_LLC_MISSES) * PERF_CACHE_LINE_BYTES;
+	}
+
+	static void printCounters(int frames, double pixels) {
+		if (!perfTotals().enabled) return;
+		if (!counterAvailable(PERF_CYCLES)) {
+			printf("Performance counters: unavailable (check perf_event_paranoid)\n");
+			return;
+		}
+		if (counterAvailable(PERF_INSTRUCTIONS)) {
+			printf("Compute IPC: %.2f\n", counterValue(PERF_INSTRUCTIONS) / std::max(1.0, counterValue(PERF_CYCLES)));
+		}
+		if (counterAvailable(PERF_LLC_MISSES) && pixels > 0) {
+			printf("Compute memory traffic: %.2f bytes/pixel\n", missBytes() / pixels);
+		}
+		if (counterAvailable(PERF_DTLB_MISSES) && frames > 0) {
+			printf("Compute dTLB misses: %.0f per frame\n", counterValue(PERF_DTLB_MISSES) / frames);
+		}
+	}
+
+	// The misses of all threads over the wall-clock time in kernels ('busySeconds') give
+	// the bandwidth the machine sustained; over the kernel time summed over threads
+	// ('kernelSeconds'), the average of one kernel thread
+	static void writeCounters(FILE* out, int frames, double pixels, double busySeconds, double kernelSeconds) {
+		if (!perfTotals().enabled || !counterAvailable(PERF_CYCLES)) {
+			fprintf(out, "  \"counters\": null,\n");
+			return;
+		}
+
+		fprintf(out, "  \"counters\": {\n");
+		for (int id = 0; id < PERF_COUNTER_COUNT; ++id) {
+			if (counterAvailable(id)) fprintf(out, "    \"%s\": %.0f,\n", perfCounterNames[id], counterValue(id));
+			else fprintf(out, "    \"%s\": null,\n", perfCounterNames[id]);
+		}
+		double cycles = std::max(1.0, counterValue(PERF_CYCLES));
+		fprintf(out, "    \"cycles_per_frame\": %.0f,\n", frames > 0 ? cycles / frames : 0.0);
+		fprintf(out, "    \"cycles_per_pixel\": %.3f,\n", pixels > 0 ? cycles / pixels : 0.0);
+		if (counterAvailable(PERF_INSTRUCTIONS)) {
+			fprintf(out, "    \"ipc\": %.3f,\n", counterValue(PERF_INSTRUCTIONS) / cycles);
+		} else {
+			fprintf(out, "    \"ipc\": null,\n");
+		}
+		if (counterAvailable(PERF_DTLB_MISSES)) {
+			fprintf(out, "    \"dtlb_misses_per_frame\": %.0f,\n", frames > 0 ? counterValue(PERF_DTLB_MISSES) / frames : 0.0);
+		} else {
+			fprintf(out, "    \"dtlb_misses_per_frame\": null,\n");
+		}
+		if (counterAvailable(PERF_LLC_MISSES)) {
+			fprintf(out, "    \"memory_bytes\": %.0f,\n", missBytes());
+			fprintf(out, "    \"bytes_per_pixel\": %.3f,\n", pixels > 0 ? missBytes() / pixels : 0.0);
+			fprintf(out, "    \"bandwidth_gb_per_s\": %.3f,\n", busySeconds > 0 ? missBytes() / busySeconds / 1e9 : 0.0);
+			fprintf(out, "    \"bandwidth_gb_per_s_per_thread\": %.3f\n", kernelSeconds > 0 ? missBytes() / kernelSeconds / 1e9 : 0.0);
+		} else {
+			fprintf(out, "    \"memory_bytes\": null,\n");
+			fprintf(out, "    \"bytes_per_pixel\": null,\n");
+			fprintf(out, "    \"bandwidth_gb_per_s\": null,\n");
+			fprintf(out, "    \"bandwidth_gb_per_s_per_thread\": null\n");
+		}
+		fprintf(out, "  },\n");
+	}
+
+public:
+	// 'programPath' is argv[0]; the record names the program after its file name
+	RunMetrics(const CliOptions &options, const std::string &programPath) {
+		path = options.getString("metrics-json", "");
+		program = programPath.substr(programPath.find_last_of("/\\") + 1);
+		if (hasFileExtension(program, ".exe")) program.resize(program.size() - 4);
+
+		// Every run starts from zero (the processing server runs many in one process)
+		computeTickCounter() = 0;
+		computeBusyClock().reset();
+		queueWaitTickCounter() = 0;
+		PerfTotals &totals = perfTotals();
+		for (auto &v : totals.value) v = 0;
+		totals.enabled = options.getBool("perf-counters", false);
+		startThreadPlacement(options);
+		configureFrameArena(options);
+
+		cv::MatAllocator* allocator = configureHugePages(options);
+		if (enabled()) {
+			counter = countingMatAllocator();
+			counter->allocations = 0;
+			counter->allocatedBytes = 0;
+			counter->setBase(allocator);
+			allocator = counter;
+		}
+		cv::Mat::setDefaultAllocator(allocator);
+	}
+
+	~RunMetrics() {
+		endThreadPlacement();
+	}
+
+	RunMetrics(const RunMetrics&) = delete;
+	RunMetrics &operator=(const RunMetrics&) = delete;
+
+	bool enabled() const {
+		return !path.empty();
+	}
+
+	double computeSeconds() const {
+		return computeTickCounter().load() / cv::getTickFrequency();
+	}
+
+	// Wall-clock time during which any thread was in a kernel
+	double computeWallSeconds() const {
+		return computeBusyClock().seconds();
+	}
+
+	double queueWaitSeconds() const {
+		return queueWaitTickCounter().load() / cv::getTickFrequency();
+	}
+
+	// Write the record; 'sink' is null for programs without video output. Call after
+	// the sink has been flushed. Returns false if the file cannot be written.
+	bool write(int frames, int threads, double totalSeconds, const FrameSource &source, const FrameSink* sink) const {
+		double pixels = (double)frames * source.get(cv::CAP_PROP_FRAME_WIDTH) * source.get(cv::CAP_PROP_FRAME_HEIGHT);
+		printCounters(frames, pixels);
+		printPlacement();
+		printHugePages();
+		if (!enabled()) return true;
+
+		FILE* out = fopen(path.c_str(), "w");
+		if (!out) {
+			printf("Error: Cannot create metrics file: %s\n", path.c_str());
+			return false;
+		}
+
+		fprintf(out, "{\n");
+		fprintf(out, "  \"program\": ");
+		writeString(out, program);
+		fprintf(out, ",\n");
+		fprintf(out, "  \"frames\": %d,\n", frames);
+		fprintf(out, "  \"threads\": %d,\n", threads);
+		fprintf(out, "  \"frame_format\": \"%s\",\n", source.yuvFrames() ? "i420" : "bgr");
+		fprintf(out, "  \"total_seconds\": %.6f,\n", totalSeconds);
+		fprintf(out, "  \"fps\": %.3f,\n", totalSeconds > 0 ? frames / totalSeconds : 0.0);
+		fprintf(out, "  \"stages\": {\n");
+		fprintf(out, "    \"decode_seconds\": %.6f,\n", source.decodeSeconds());
+		fprintf(out, "    \"compute_seconds\": %.6f,\n", computeSeconds());
+		fprintf(out, "    \"compute_wall_seconds\": %.6f,\n", computeWallSeconds());
+		fprintf(out, "    \"encode_seconds\": %.6f,\n", sink ? sink->encodeSeconds() : 0.0);
+		fprintf(out, "    \"queue_wait_seconds\": %.6f,\n", queueWaitSeconds());
+		fprintf(out, "    \"encoder_wait_seconds\": %.6f\n", sink ? sink->encoderWaitSeconds() : 0.0);
+		fprintf(out, "  },\n");
+		fprintf(out, "  \"decode_fps\": %.3f,\n", source.decodeFps());
+		fprintf(out, "  \"encode_fps\": %.3f,\n", sink ? sink->encodeFps() : 0.0);
+		fprintf(out, "  \"peak_rss_bytes\": %lld,\n", peakResidentBytes());
+		fprintf(out, "  \"allocations\": {\n");
+		fprintf(out, "    \"count\": %lld,\n", counter ? counter->allocations.load() : 0LL);
+		fprintf(out, "    \"bytes\": %lld\n", counter ? counter->allocatedBytes.load() : 0LL);
+		fprintf(out, "  },\n");
+		writeCounters(out, frames, pixels, computeWallSeconds(), computeSeconds());
+
+		writePlacement(out);
+		writeHugePages(out);
+		writeFrameArena(out);
+		fprintf(out, "  \"build\": {\n");
+#ifdef __VERSION__
+		fprintf(out, "    \"compiler\": ");
+		writeString(out, __VERSION__);
+		fprintf(out, ",\n");
+#endif
+		fprintf(out, "    \"opencv\": ");
+		writeString(out, CV_VERSION);
+		fprintf(out, ",\n");
+#ifdef _OPENMP
+		fprintf(out, "    \"openmp\": %d,\n", _OPENMP);
+#else
+		fprintf(out, "    \"openmp\": null,\n");
+#endif
+#ifdef USE_FFMPEG
+		fprintf(out, "    \"ffmpeg\": true,\n");
+#else
+		fprintf(out, "    \"ffmpeg\": false,\n");
+#endif
+#ifdef __OPTIMIZE__
+		fprintf(out, "    \"optimized\": true,\n");
+#else
+		fprintf(out, "    \"optimized\": false,\n");
+#endif
+#ifdef __AVX2__
+		fprintf(out, "    \"avx2\": true,\n");
+#else
+		fprintf(out, "    \"avx2\": false,\n");
+#endif
+#ifdef __AVX512F__
+		fprintf(out, "    \"avx512f\": true\n");
+#else
+		fprintf(out, "    \"avx512f\": false\n");
+#endif
+		fprintf(out, "  }\n");
+		fprintf(out, "}\n");
+		fclose(out);
+		return true;
+	}
+};
+
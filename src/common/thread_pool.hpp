@@ -0,0 +1,123 @@
+#pragma once
+
+// Threads that outlive the functions they run.
+//
+// The pthread programs start their reader, workers and writer (and FrameSink its
+// encoder) as PooledThread instead of std::thread. A PooledThread runs its function on
+// an idle thread of a process-wide pool, starting a new thread only when none is idle,
+// and join() waits for the function; the thread goes back to the pool. A program run
+// on its own starts as many threads as before, but in the processing server a job
+// reuses the threads of the jobs before it, so thread creation (and the first touch of
+// each thread's stack, arena and counters) is paid once.
+//
+// Every function gets a thread of its own for as long as it runs, so functions that
+// wait for each other (a worker on the reader's queue) cannot deadlock the pool. After
+// each function the thread's CPU mask is restored, so the --pin of one run does not
+// carry over to the next.
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "affinity.hpp"
+
+class ThreadPool {
+private:
+	std::mutex mtx;
+	std::condition_variable taskReady;
+	std::deque<std::function<void()>> tasks;
+	int idle = 0;  // threads waiting for a task
+
+	void threadLoop() {
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true) {
+			idle++;
+			taskReady.wait(lock, [this] { return !tasks.empty(); });
+			idle--;
+			std::function<void()> task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+
+			PlacementMask mask;
+			bool haveMask = currentThreadMask(mask);
+			task();
+			if (currentThreadNode() >= 0 && haveMask) setCurrentThreadMask(mask);
+			currentThreadNode() = -1;
+
+			lock.lock();
+		}
+	}
+
+public:
+	// Run 'task' on an idle thread, or on a new one when every thread is busy
+	void submit(std::function<void()> task) {
+		std::lock_guard<std::mutex> lock(mtx);
+		tasks.push_back(std::move(task));
+		if ((int)tasks.size() > idle) {
+			std::thread(&ThreadPool::threadLoop, this).detach();
+		}
+		taskReady.notify_one();
+	}
+};
+
+// The pool of the process, created when first needed. Its threads wait for tasks until
+// the process exits, so it is never deleted.
+inline ThreadPool &threadPool() {
+	static ThreadPool* pool = new ThreadPool();
+	return *pool;
+}
+
+// std::thread on a pooled thread: construct with a function and its arguments, then
+// join(). Destroying it also waits for the function.
+class PooledThread {
+private:
+	struct Completion {
+		std::mutex mtx;
+		std::condition_variable finished;
+		bool done = false;
+	};
+	std::shared_ptr<Completion> completion;
+
+public:
+	PooledThread() = default;
+
+	template <typename Function, typename... Args>
+	explicit PooledThread(Function &&function, Args &&... args) : completion(std::make_shared<Completion>()) {
+		std::function<void()> body = std::bind(std::forward<Function>(function), std::forward<Args>(args)...);
+		std::shared_ptr<Completion> state = completion;
+		threadPool().submit([body, state]() {
+			body();
+			std::lock_guard<std::mutex> lock(state->mtx);
+			state->done = true;
+			state->finished.notify_all();
+		});
+	}
+
+	PooledThread(PooledThread &&) = default;
+	PooledThread &operator=(PooledThread &&other) {
+		if (this != &other) {
+			join();
+			completion = std::move(other.completion);
+		}
+		return *this;
+	}
+
+	~PooledThread() {
+		join();
+	}
+
+	bool joinable() const {
+		return completion != nullptr;
+	}
+
+	void join() {
+		if (!completion) return;
+		std::unique_lock<std::mutex> lock(completion->mtx);
+		completion->finished.wait(lock, [this] { return completion->done; });
+		lock.unlock();
+		completion.reset();
+	}
+};
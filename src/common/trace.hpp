@@ -0,0 +1,271 @@
+#pragma once
+
+// Span tracing for the processing programs.
+//
+// With --trace <file.json> every thread records the spans it goes through (decode,
+// kernel, encode, waiting on a queue, ...) into its own ring buffer, and the run is
+// written out at the end in Chrome trace-event format: open the file in
+// chrome://tracing or ui.perfetto.dev to see, frame by frame, which thread was busy
+// and which one everybody else was waiting on. Without the option a span costs one
+// relaxed atomic load.
+//
+// A buffer holds the last TRACE_BUFFER_EVENTS spans of its thread; older ones are
+// overwritten, so long runs keep their end. Span names must be string literals (only
+// the pointer is stored). Buffers of threads that have exited are handed to new
+// threads when the next session starts, so a process that runs many traced jobs (the
+// processing server) does not keep growing.
+//
+// FrameSource and FrameSink trace decode, write and encode themselves, and every
+// ComputeTimer (run_metrics.hpp) is a "kernel" span; the programs name their threads
+// and trace their queue waits.
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "cli_options.hpp"
+
+#define TRACE_BUFFER_EVENTS (1 << 16)  // Spans kept per thread
+
+struct TraceEvent {
+	const char* name;
+	int64_t start;  // cv::getTickCount ticks
+	int64_t end;
+};
+
+// Spans of one thread. Only that thread writes to it; it is read after the run.
+struct TraceBuffer {
+	int tid;
+	std::string threadName;
+	std::vector<TraceEvent> events;
+	size_t next = 0;  // total spans recorded, the ring position is next % size
+	bool inUse = true;  // false once its thread has exited
+
+	explicit TraceBuffer(int id) : tid(id), events(TRACE_BUFFER_EVENTS) {}
+
+	void clear() {
+		threadName.clear();
+		next = 0;
+	}
+
+	void add(const char* name, int64_t start, int64_t end) {
+		TraceEvent &event = events[next % events.size()];
+		event.name = name;
+		event.start = start;
+		event.end = end;
+		next++;
+	}
+};
+
+struct TraceRegistry {
+	std::atomic<bool> enabled;
+	int64_t startTicks = 0;
+	std::mutex mtx;
+	std::vector<std::unique_ptr<TraceBuffer>> buffers;  // kept after their threads exit
+	std::vector<TraceBuffer*> spare;  // buffers free for new threads in this session
+
+	TraceRegistry() : enabled(false) {}
+};
+
+inline TraceRegistry &traceRegistry() {
+	static TraceRegistry registry;
+	return registry;
+}
+
+inline bool traceEnabled() {
+	return traceRegistry().enabled.load(std::memory_order_relaxed);
+}
+
+// Gives the thread's buffer up when the thread exits
+struct TraceBufferOwner {
+	TraceBuffer* buffer = nullptr;
+
+	~TraceBufferOwner() {
+		if (!buffer) return;
+		std::lock_guard<std::mutex> lock(traceRegistry().mtx);
+		buffer->inUse = false;
+	}
+};
+
+// The calling thread's buffer, taken on first use
+inline TraceBuffer &traceBuffer() {
+	static thread_local TraceBufferOwner owner;
+	if (!owner.buffer) {
+		TraceRegistry &registry = traceRegistry();
+		std::lock_guard<std::mutex> lock(registry.mtx);
+		if (!registry.spare.empty()) {
+			owner.buffer = registry.spare.back();
+			registry.spare.pop_back();
+			owner.buffer->inUse = true;
+		} else {
+			registry.buffers.emplace_back(new TraceBuffer((int)registry.buffers.size()));
+			owner.buffer = registry.buffers.back().get();
+		}
+	}
+	return *owner.buffer;
+}
+
+// Name the calling thread in the trace ("reader", "worker", ...)
+inline void traceThreadName(const std::string &name) {
+	if (traceEnabled()) traceBuffer().threadName = name;
+}
+
+// Records the time from construction to end() (or the end of the scope) as a span
+class TraceSpan {
+private:
+	const char* name;
+	int64_t start = 0;
+	bool running;
+
+public:
+	explicit TraceSpan(const char* spanName) : name(spanName), running(traceEnabled()) {
+		if (running) start = cv::getTickCount();
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan &operator=(const TraceSpan&) = delete;
+
+	~TraceSpan() {
+		end();
+	}
+
+	void end() {
+		if (!running) return;
+		traceBuffer().add(name, start, cv::getTickCount());
+		running = false;
+	}
+};
+
+// Turns tracing on for the run (with --trace) and writes the trace at the end
+class TraceSession {
+private:
+	std::string path;
+
+	static void writeString(FILE* out, const std::string &value) {
+		fputc('"', out);
+		for (char c : value) {
+			if (c == '"' || c == '\\') fputc('\\', out);
+			if ((unsigned char)c < 0x20) fputc(' ', out);
+			else fputc(c, out);
+		}
+		fputc('"', out);
+	}
+
+public:
+	explicit TraceSession(const CliOptions &options) {
+		path = options.getString("trace", "");
+		if (path.empty()) return;
+
+		// Start from empty buffers, those of exited threads become spares
+		TraceRegistry &registry = traceRegistry();
+		{
+			std::lock_guard<std::mutex> lock(registry.mtx);
+			registry.spare.clear();
+			for (auto &buffer : registry.buffers) {
+				buffer->clear();
+				if (!buffer->inUse) registry.spare.push_back(buffer.get());
+			}
+		}
+		registry.startTicks = cv::getTickCount();
+		registry.enabled = true;
+		traceThreadName("main");
+	}
+
+	TraceSession(const TraceSession&) = delete;
+	TraceSession &operator=(const TraceSession&) = delete;
+
+	bool enabled() const {
+		return !path.empty();
+	}
+
+	// Write the trace and print how each thread spent its time. Call once every
+	// traced thread has finished.
+	bool write() {
+		if (!enabled()) return true;
+
+		TraceRegistry &registry = traceRegistry();
+		registry.enabled = false;
+
+		FILE* out = fopen(path.c_str(), "w");
+		if (!out) {
+			printf("Error: Cannot create trace file: %s\n", path.c_str());
+			return false;
+		}
+
+		double usPerTick = 1e6 / cv::getTickFrequency();
+		std::lock_guard<std::mutex> lock(registry.mtx);
+		bool first = true;
+		size_t spans = 0;
+		int threads = 0;
+		fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		for (const auto &buffer : registry.buffers) {
+			if (buffer->next == 0 && buffer->threadName.empty()) continue;  // unused this session
+			threads++;
+			std::string threadName = buffer->threadName.empty() ? "thread " + std::to_string(buffer->tid) : buffer->threadName;
+			fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+			        first ? "" : ",\n", buffer->tid);
+			writeString(out, threadName);
+			fprintf(out, "}}");
+			first = false;
+
+			size_t count = std::min(buffer->next, buffer->events.size());
+			for (size_t i = buffer->next - count; i < buffer->next; ++i) {
+				const TraceEvent &event = buffer->events[i % buffer->events.size()];
+				fprintf(out, ",\n{\"name\": ");
+				writeString(out, event.name);
+				fprintf(out, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				        buffer->tid, (event.start - registry.startTicks) * usPerTick, (event.end - event.start) * usPerTick);
+			}
+			spans += count;
+		}
+		fprintf(out, "\n]}\n");
+		fclose(out);
+
+		printf("Trace: %d threads, %d spans written to %s\n", threads, (int)spans, path.c_str());
+		printTimeBreakdown(registry);
+		return true;
+	}
+
+	// Per thread: time in each kind of span over the thread's traced lifetime, the
+	// rest is idle (outermost spans only, nested ones are part of their parent)
+	static void printTimeBreakdown(TraceRegistry &registry) {
+		double msPerTick = 1e3 / cv::getTickFrequency();
+		for (const auto &buffer : registry.buffers) {
+			size_t count = std::min(buffer->next, buffer->events.size());
+			if (count == 0) continue;
+
+			std::vector<TraceEvent> events;
+			for (size_t i = buffer->next - count; i < buffer->next; ++i) {
+				events.push_back(buffer->events[i % buffer->events.size()]);
+			}
+			std::sort(events.begin(), events.end(), [](const TraceEvent &a, const TraceEvent &b) {
+				return a.start != b.start ? a.start < b.start : a.end > b.end;
+			});
+
+			std::map<std::string, double> busy;
+			int64_t coveredUntil = events.front().start;
+			int64_t first = events.front().start, last = events.front().end;
+			for (const TraceEvent &event : events) {
+				last = std::max(last, event.end);
+				if (event.end <= coveredUntil) continue;  // nested in the previous span
+				busy[event.name] += (double)(event.end - std::max(event.start, coveredUntil));
+				coveredUntil = event.end;
+			}
+
+			double lifetime = (double)(last - first);
+			double idle = lifetime;
+			std::string name = buffer->threadName.empty() ? "thread " + std::to_string(buffer->tid) : buffer->threadName;
+			printf("  %-10s %9.1f ms:", name.c_str(), lifetime * msPerTick);
+			for (const auto &entry : busy) {
+				printf(" %s %.0f%%", entry.first.c_str(), lifetime > 0 ? 100.0 * entry.second / lifetime : 0.0);
+				idle -= entry.second;
+			}
+			printf(" idle %.0f%%\n", lifetime > 0 ? 100.0 * std::max(0.0, idle) / lifetime : 0.0);
+		}
+	}
+};
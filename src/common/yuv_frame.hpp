@@ -0,0 +1,73 @@
+#pragma once
+
+// Frames kept in the decoder's planar YUV 4:2:0 layout instead of BGR.
+//
+// Decoders produce YUV 4:2:0, and converting every picture to BGR (and then, for
+// kernels that only look at luminance, back to gray or YCrCb) costs two color
+// conversions and twice the memory traffic per frame. Programs whose kernel works on
+// luminance call FrameSource::enableYuv() (with --yuv 1) and then get I420 frames:
+// one CV_8UC1 Mat of height * 3 / 2 rows holding the Y plane, then the U and V
+// planes of a quarter the size each - the layout of cv::COLOR_YUV2BGR_I420, in video
+// range (Y 16-235), as decoders and Y4M files deliver it. FrameSink and the raw
+// writer take such frames as they are, so a frame can stay in I420 from the decoder
+// to the encoder.
+//
+// Single-channel gray frames keep their full range (0-255), so lumaToGray() and
+// grayToLuma() convert between them and the Y plane with a lookup table.
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+// True for an I420 frame of a video of 'size' (single channel, 3/2 the height)
+inline bool isI420Frame(const cv::Mat &frame, cv::Size size) {
+	return frame.type() == CV_8UC1 && size.height > 0 && frame.cols == size.width && frame.rows == size.height * 3 / 2;
+}
+
+// The Y plane of an I420 frame (shares its data)
+inline cv::Mat i420Luma(const cv::Mat &frame) {
+	return frame.rowRange(0, frame.rows * 2 / 3);
+}
+
+// The U and V planes of an I420 frame, one after the other (shares its data)
+inline cv::Mat i420Chroma(const cv::Mat &frame) {
+	return frame.rowRange(frame.rows * 2 / 3, frame.rows);
+}
+
+// Plane pointers and strides for libav; the frame must be continuous
+inline void i420Planes(const cv::Mat &frame, uint8_t* data[3], int linesize[3]) {
+	int width = frame.cols, height = frame.rows * 2 / 3;
+	data[0] = frame.data;
+	data[1] = data[0] + (size_t)width * height;
+	data[2] = data[1] + (size_t)(width / 2) * (height / 2);
+	linesize[0] = width;
+	linesize[1] = linesize[2] = width / 2;
+}
+
+// Lookup tables between video range (Y 16-235) and full range (0-255)
+inline const cv::Mat &videoToFullRange() {
+	static cv::Mat table = [] {
+		cv::Mat t(1, 256, CV_8U);
+		for (int i = 0; i < 256; ++i) t.data[i] = cv::saturate_cast<uchar>((i - 16) * 255.0 / 219.0);
+		return t;
+	}();
+	return table;
+}
+
+inline const cv::Mat &fullToVideoRange() {
+	static cv::Mat table = [] {
+		cv::Mat t(1, 256, CV_8U);
+		for (int i = 0; i < 256; ++i) t.data[i] = cv::saturate_cast<uchar>(16 + i * 219.0 / 255.0);
+		return t;
+	}();
+	return table;
+}
+
+// Gray image of an I420 frame: its Y plane, stretched to full range
+inline void lumaToGray(const cv::Mat &frame, cv::Mat &gray) {
+	cv::LUT(i420Luma(frame), videoToFullRange(), gray);
+}
+
+// Write a full-range gray image into 'luma' (e.g. the Y plane of an output frame)
+inline void grayToLuma(const cv::Mat &gray, cv::Mat &luma) {
+	cv::LUT(gray, fullToVideoRange(), luma);
+}